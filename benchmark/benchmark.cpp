@@ -1,6 +1,65 @@
+#include <algorithm>
 #include <memory>
+#include <new>
+#include <string>
 #include <vector>
 #include <sajson.h>
+#include <sajson_writer.h>
+#include "compare.h"
+#include "corpus.h"
+#include "perf_counters.h"
+#include "timing.h"
+#include "workloads.h"
+
+// Times sajson::parse() on each input file with each allocator and
+// reports throughput and latency percentiles.  Usage:
+//
+//     bench [options] [files...]
+//
+//     --shape NAME      time synthetic documents of this shape instead of
+//                       files; repeatable, or "all" (see corpus.h)
+//     --size SIZE       synthetic document size, e.g. 64K or 2G;
+//                       repeatable (default: 1K, 16K, 256K, 4M, 64M)
+//     --seed N          synthetic document seed (1)
+//     --workload NAME   time parsing plus queries on a testdata/ file;
+//                       repeatable, or "all" (see workloads.h)
+//     --allocator NAME  default, mmap, or bump; repeatable (default: all)
+//     --samples N       time exactly N parses per file
+//     --time SECONDS    otherwise sample for at least this long (0.5)
+//     --warmup SECONDS  untimed parses before sampling (0.1)
+//     --cpu N           pin to CPU N; -1 to not pin (default: the
+//                       CPU the benchmark starts on)
+//     --label NAME      recorded in the JSON output, e.g. the build name
+//     --json PATH       also write the results as JSON to PATH; plot.py
+//                       charts the synthetic ones against size
+//     --counters        also read hardware counters around each parse
+//     --baseline PATH   compare against the --json output of an earlier run
+//     --threshold PCT   median slowdown that counts as a regression (5)
+//     --alpha P         significance level for regressions (0.01)
+//
+// With no files, shapes, or workloads, the files in testdata/ are timed.
+// Each workload is timed with every allocator as parse plus queries, and
+// once more as NAME/access, the queries alone on an already parsed
+// document.
+//
+// --counters reports cycles per input byte, instructions per cycle, and
+// branch, L1 data, and last-level cache misses and page faults per KB of
+// input, counted over separate, untimed parses.  Counters the system does
+// not allow are shown as "-".
+//
+// --json keeps up to 1000 samples per result, evenly spaced through the
+// sorted samples, so that a later run can be compared against it.  With
+// --baseline, each result is matched to the baseline's by file and
+// allocator.  It is flagged as a regression when its median is more than
+// the threshold slower and a Mann-Whitney U test rejects, at level alpha,
+// that both runs' samples come from the same distribution.  Any
+// regression makes bench exit with status 3.
+//
+// Every sample is one parse plus freeing the document, timed on its own,
+// so the percentiles are per-document latencies.  ndjson documents are
+// parsed one record at a time and a sample covers all of them.  Peak
+// memory is the most bytes the allocator had outstanding during any one
+// parse.
 
 const char* default_files[] = {
     "testdata/apache_builds.json",
@@ -17,76 +76,789 @@ const char* default_files[] = {
 };
 const size_t default_files_count = sizeof(default_files) / sizeof(*default_files);
 
-template<typename AllocationStrategy>
-void run_benchmark(size_t max_string_length, const char* filename) {
+struct options {
+    options()
+        : samples(0)
+        , min_time(0.5)
+        , warmup_time(0.1)
+        , cpu(-2)
+        , label("")
+        , json_path(0)
+        , baseline_path(0)
+        , threshold(5)
+        , alpha(0.01)
+        , seed(1)
+        , want_counters(false)
+        , counters(0)
+    {}
+
+    std::vector<std::string> allocators;
+    size_t samples;
+    double min_time;
+    double warmup_time;
+    int cpu; // -2: wherever the benchmark starts, -1: not pinned
+    const char* label;
+    const char* json_path;
+    const char* baseline_path;
+    double threshold; // percent
+    double alpha;
+    std::vector<const char*> files;
+    std::vector<corpus::shape> shapes;
+    std::vector<workload*> workloads;
+    std::vector<size_t> sizes;
+    uint64_t seed;
+    bool want_counters;
+    // Set when want_counters and any counter could be opened.
+    perf::counters* counters;
+};
+
+// Hands out a preallocated block and frees nothing, so parses measure the
+// parser alone.  reset() reclaims everything between parses.
+class bump_allocator : public sajson::allocator {
+public:
+    // If the block cannot be allocated, every allocation fails.
+    explicit bump_allocator(size_t capacity)
+        : block(new (std::nothrow) char[capacity])
+        , capacity(block ? capacity : 0)
+        , used(0)
+    {}
+
+    void* allocate(size_t size) override {
+        size = (size + 15) & ~size_t(15);
+        if (capacity - used < size) {
+            return 0;
+        }
+        void* result = block.get() + used;
+        used += size;
+        return result;
+    }
+
+    void deallocate(const void*) override {}
+
+    void reset() {
+        used = 0;
+    }
+
+private:
+    std::unique_ptr<char[]> block;
+    size_t capacity;
+    size_t used;
+};
+
+// Forwards to another allocator, or new[] if none, and records the most
+// bytes outstanding at once.
+class counting_allocator : public sajson::allocator {
+public:
+    explicit counting_allocator(sajson::allocator* target)
+        : target(target)
+        , outstanding(0)
+        , peak(0)
+    {}
+
+    void* allocate(size_t size) override {
+        char* block = static_cast<char*>(
+            target ? target->allocate(size + HEADER_SIZE) : new (std::nothrow) char[size + HEADER_SIZE]);
+        if (!block) {
+            return 0;
+        }
+        memcpy(block, &size, sizeof(size));
+        outstanding += size;
+        peak = std::max(peak, outstanding);
+        return block + HEADER_SIZE;
+    }
+
+    void deallocate(const void* ptr) override {
+        const char* block = static_cast<const char*>(ptr) - HEADER_SIZE;
+        size_t size;
+        memcpy(&size, block, sizeof(size));
+        outstanding -= size;
+        if (target) {
+            target->deallocate(block);
+        } else {
+            delete[] block;
+        }
+    }
+
+    void release_unused(void* begin, size_t size) override {
+        if (target) {
+            target->release_unused(begin, size);
+        }
+    }
+
+    size_t get_peak() const {
+        return peak;
+    }
+
+private:
+    // Keeps the returned blocks as aligned as the target's.
+    static const size_t HEADER_SIZE = 16;
+
+    sajson::allocator* target;
+    size_t outstanding;
+    size_t peak;
+};
+
+struct result {
+    std::string file;
+    std::string allocator;
+    size_t bytes;
+    size_t peak_bytes;
+    sample_stats stats;
+    // Per parse, or negative if not counted.
+    double counts[perf::counter_count];
+    // Sorted, thinned to at most max_kept_samples.
+    std::vector<double> samples_ns;
+
+    double get_mb_per_second() const {
+        return bytes / stats.median_ns * 1e3;
+    }
+
+    double get_documents_per_second() const {
+        return 1e9 / stats.median_ns;
+    }
+
+    double get_cycles_per_byte() const {
+        return ratio(perf::COUNTER_CYCLES, bytes);
+    }
+
+    double get_instructions_per_cycle() const {
+        return counts[perf::COUNTER_CYCLES] < 0 ? -1 : ratio(perf::COUNTER_INSTRUCTIONS, counts[perf::COUNTER_CYCLES]);
+    }
+
+    double get_per_kb(perf::counter c) const {
+        return ratio(c, bytes / 1024.0);
+    }
+
+private:
+    double ratio(perf::counter c, double denominator) const {
+        return counts[c] < 0 || denominator <= 0 ? -1 : counts[c] / denominator;
+    }
+};
+
+// Warms up, then times f once per sample into r.
+template<typename F>
+void measure(const options& opts, result& r, F f) {
+    const benchmark_clock::time_point warmup_start = benchmark_clock::now();
+    do {
+        f();
+    } while (elapsed_seconds(warmup_start) < opts.warmup_time);
+
+    // Enough samples for a meaningful 99th percentile, unless a
+    // single parse takes so long that gathering them would take minutes.
+    const size_t min_samples = 100;
+    const size_t min_slow_samples = 5;
+    std::vector<double> ns;
+    const benchmark_clock::time_point start = benchmark_clock::now();
+    for (;;) {
+        if (opts.samples) {
+            if (ns.size() == opts.samples) {
+                break;
+            }
+        } else {
+            const double elapsed = elapsed_seconds(start);
+            if (elapsed >= opts.min_time && ns.size() >= min_samples) {
+                break;
+            }
+            if (elapsed >= 10 * opts.min_time && ns.size() >= min_slow_samples) {
+                break;
+            }
+        }
+        const benchmark_clock::time_point before = benchmark_clock::now();
+        f();
+        const benchmark_clock::time_point after = benchmark_clock::now();
+        ns.push_back(std::chrono::duration<double, std::nano>(after - before).count());
+    }
+    r.stats = summarize(ns);
+    r.samples_ns = thin_sorted_samples(ns, max_kept_samples);
+}
+
+// Keeps parse and workload results alive so they are not optimized away.
+volatile double result_sink;
+
+// Fills r.counts by running f with the counters enabled, after timing so
+// the counter syscalls do not disturb the samples.
+template<typename F>
+void count_events(const options& opts, result& r, F f) {
+    for (size_t i = 0; i < perf::counter_count; ++i) {
+        r.counts[i] = -1;
+    }
+    perf::counters* counters = opts.counters;
+    if (!counters) {
+        return;
+    }
+
+    const size_t runs = std::max<size_t>(1, std::min<size_t>(r.stats.samples, 100));
+    counters->reset();
+    for (size_t i = 0; i < runs; ++i) {
+        counters->start();
+        f();
+        counters->stop();
+    }
+    for (size_t i = 0; i < perf::counter_count; ++i) {
+        const perf::counter c = static_cast<perf::counter>(i);
+        if (counters->is_available(c)) {
+            r.counts[i] = counters->get(c) / runs;
+        }
+    }
+}
+
+bool read_file(const char* filename, std::vector<char>& buffer) {
     FILE* file = fopen(filename, "rb");
     if (!file) {
         perror("fopen failed");
-        return;
+        return false;
     }
 
     std::unique_ptr<FILE, int(*)(FILE*)> deleter(file, fclose);
 
     if (fseek(file, 0, SEEK_END)) {
         perror("fseek failed");
-        return;
+        return false;
     }
     size_t length = ftell(file);
     if (fseek(file, 0, SEEK_SET)) {
         perror("fseek failed");
-        return;
+        return false;
     }
 
-    std::vector<char> buffer(length);
-    if (fread(buffer.data(), length, 1, file) != 1) {
+    buffer.resize(length);
+    if (length && fread(buffer.data(), length, 1, file) != 1) {
         perror("fread failed");
-        return;
+        return false;
+    }
+    return true;
+}
+
+// Parses input once with each allocator and then times it, followed by
+// the workload if there is one.  Returns false if the input does not
+// parse.
+bool run_benchmark(
+    const options& opts,
+    const std::string& name,
+    const sajson::string& input,
+    bool ndjson,
+    workload* w,
+    std::vector<result>& results
+) {
+    std::vector<sajson::string> records;
+    if (ndjson) {
+        const char* p = input.data();
+        const char* const end = p + input.length();
+        while (p != end) {
+            const char* newline = static_cast<const char*>(memchr(p, '\n', end - p));
+            const char* record_end = newline ? newline : end;
+            if (record_end != p) {
+                records.push_back(sajson::string(p, record_end - p));
+            }
+            p = newline ? newline + 1 : end;
+        }
+    } else {
+        records.push_back(input);
+    }
+    size_t largest_record = 0;
+    for (const sajson::string& record : records) {
+        largest_record = std::max(largest_record, record.length());
     }
 
-    deleter.reset();
+    for (const std::string& allocator_name : opts.allocators) {
+        result r;
+        r.file = name;
+        r.allocator = allocator_name;
+        r.bytes = input.length();
 
-    clock_t minimum_each = std::numeric_limits<clock_t>::max();
+        std::unique_ptr<bump_allocator> bump;
+#ifdef SAJSON_HAS_MMAP
+        sajson::mmap_allocator mmap;
+#endif
+        sajson::allocator* alloc = 0;
+        if (allocator_name == "bump") {
+            // The input copy, the AST, and room for a deep parse stack.
+            bump.reset(new bump_allocator(largest_record * (1 + sizeof(size_t)) + (1 << 20)));
+            alloc = bump.get();
+#ifdef SAJSON_HAS_MMAP
+        } else if (allocator_name == "mmap") {
+            alloc = &mmap;
+#endif
+        }
 
-    clock_t start = clock();
+        r.peak_bytes = 0;
+        for (const sajson::string& record : records) {
+            if (bump) {
+                bump->reset();
+            }
+            counting_allocator counter(alloc);
+            const sajson::document& document = sajson::parse(record, &counter);
+            if (!document.is_valid()) {
+                fprintf(stderr, "%s: %s\n", name.c_str(), document.get_error_message_as_cstring());
+                return false;
+            }
+            if (w && !w->prepare(document.get_root())) {
+                fprintf(stderr, "%s: unexpected document for %s\n", name.c_str(), w->get_name());
+                return false;
+            }
+            r.peak_bytes = std::max(r.peak_bytes, counter.get_peak());
+        }
 
-    const size_t N = 1000;
-    for (size_t i = 0; i < N; ++i) {
-        clock_t before_each = clock();
-        sajson::parse(AllocationStrategy(), sajson::string(buffer.data(), buffer.size()));
-        clock_t elapsed_each = clock() - before_each;
-        minimum_each = std::min(minimum_each, elapsed_each);
+        double checksum = 0;
+        auto parse_all = [&] {
+            for (const sajson::string& record : records) {
+                if (bump) {
+                    bump->reset();
+                }
+                const sajson::document& document = sajson::parse(record, alloc);
+                checksum += document.is_valid();
+                if (w) {
+                    checksum += w->run(document.get_root());
+                }
+            }
+        };
+        measure(opts, r, parse_all);
+        count_events(opts, r, parse_all);
+        results.push_back(r);
+        result_sink = checksum;
     }
 
-    clock_t elapsed = clock() - start;
+    if (w) {
+        // The workload alone, to separate its cost from parsing.
+        const sajson::document& document = sajson::parse(input);
+        result r;
+        r.file = name + "/access";
+        r.allocator = "-";
+        r.bytes = input.length();
+        r.peak_bytes = 0;
+        double checksum = 0;
+        auto run = [&] {
+            checksum += w->run(document.get_root());
+        };
+        measure(opts, r, run);
+        count_events(opts, r, run);
+        results.push_back(r);
+        result_sink = checksum;
+    }
+    return true;
+}
+
+bool run_file_benchmark(const options& opts, const char* filename, std::vector<result>& results) {
+    std::vector<char> buffer;
+    if (!read_file(filename, buffer)) {
+        return false;
+    }
+    return run_benchmark(opts, filename, sajson::string(buffer.data(), buffer.size()), false, 0, results);
+}
 
-    double average_elapsed_ms = 1000.0 * elapsed / CLOCKS_PER_SEC / N;
-    double minimum_elapsed_ms = 1000.0 * minimum_each / CLOCKS_PER_SEC;
-    printf("%*s - %0.3f ms - %0.3f ms\n", static_cast<int>(max_string_length), filename, average_elapsed_ms, minimum_elapsed_ms);
+bool run_workload_benchmark(const options& opts, workload* w, std::vector<result>& results) {
+    std::vector<char> buffer;
+    if (!read_file(w->get_file(), buffer)) {
+        return false;
+    }
+    return run_benchmark(opts, w->get_name(), sajson::string(buffer.data(), buffer.size()), false, w, results);
 }
 
-template<typename AllocationStrategy>
-void run_all(size_t files_count, const char** files) {
-    size_t max_string_length = 0;
-    for (size_t i = 0; i < files_count; ++i) {
-        max_string_length = std::max(max_string_length, strlen(files[i]));
+std::string get_synthetic_name(corpus::shape shape, size_t size) {
+    const char* const suffixes = "KMG";
+    int scale = -1;
+    while (scale < 2 && size % 1024 == 0) {
+        size /= 1024;
+        ++scale;
     }
-    printf("%*s - %8s - %8s\n", static_cast<int>(max_string_length), "file", "avg", "min");
-    printf("%*s - %8s - %8s\n", static_cast<int>(max_string_length), "----", "---", "---");
-    for (size_t i = 0; i < files_count; ++i) {
-        run_benchmark<AllocationStrategy>(max_string_length, files[i]);
+    std::string name = corpus::shape_names[shape];
+    name += '-';
+    name += std::to_string(size);
+    if (scale >= 0) {
+        name += suffixes[scale];
     }
+    return name;
 }
 
-int main(int argc, const char** argv) {
-    if (argc > 1) {
-        //printf("\n=== SINGLE ALLOCATION ===\n\n");
-        run_all<sajson::single_allocation>(argc - 1, argv + 1);
-        //printf("\n=== DYNAMIC ALLOCATION ===\n\n");
-        //run_all<sajson::dynamic_allocation>(argc - 1, argv + 1);
+bool run_synthetic_benchmark(
+    const options& opts,
+    corpus::shape shape,
+    size_t size,
+    std::vector<result>& results
+) {
+    const std::string document = corpus::generate(shape, size, opts.seed);
+    return run_benchmark(
+        opts,
+        get_synthetic_name(shape, size),
+        sajson::string(document.data(), document.size()),
+        shape == corpus::SHAPE_NDJSON,
+        0,
+        results);
+}
+
+struct counter_column {
+    const char* heading;
+    int width;
+};
+
+const counter_column counter_columns[] = {
+    {"cyc/B", 6},
+    {"IPC", 5},
+    {"br miss/KB", 10},
+    {"L1 miss/KB", 10},
+    {"LLC miss/KB", 11},
+    {"faults/KB", 9},
+};
+
+void print_header(const options& opts, size_t max_string_length) {
+    printf("%*s - %-7s - %9s - %10s - %9s - %9s - %7s - %10s", static_cast<int>(max_string_length),
+        "file", "alloc", "MB/s", "docs/s", "median us", "p99 us", "samples", "peak KB");
+    if (opts.counters) {
+        for (const counter_column& column : counter_columns) {
+            printf(" - %*s", column.width, column.heading);
+        }
+    }
+    printf("\n");
+    printf("%*s - %-7s - %9s - %10s - %9s - %9s - %7s - %10s", static_cast<int>(max_string_length),
+        "----", "-----", "----", "------", "---------", "------", "-------", "-------");
+    if (opts.counters) {
+        for (const counter_column& column : counter_columns) {
+            printf(" - %*s", column.width, std::string(strlen(column.heading), '-').c_str());
+        }
+    }
+    printf("\n");
+}
+
+void print_metric(const counter_column& column, double value) {
+    if (value < 0) {
+        printf(" - %*s", column.width, "-");
     } else {
-        //printf("\n=== SINGLE ALLOCATION ===\n\n");
-        run_all<sajson::single_allocation>(default_files_count, default_files);
-        //printf("\n=== DYNAMIC ALLOCATION ===\n\n");
-        //run_all<sajson::dynamic_allocation>(default_files_count, default_files);
+        printf(" - %*.2f", column.width, value);
+    }
+}
+
+void print_results(const options& opts, const std::vector<result>& results, size_t first, size_t max_string_length) {
+    for (size_t i = first; i < results.size(); ++i) {
+        const result& r = results[i];
+        printf("%*s - %-7s - %9.1f - %10.0f - %9.3f - %9.3f - %7zu - %10.1f",
+            static_cast<int>(max_string_length), r.file.c_str(), r.allocator.c_str(),
+            r.get_mb_per_second(), r.get_documents_per_second(),
+            r.stats.median_ns / 1e3, r.stats.p99_ns / 1e3, r.stats.samples,
+            r.peak_bytes / 1024.0);
+        if (opts.counters) {
+            print_metric(counter_columns[0], r.get_cycles_per_byte());
+            print_metric(counter_columns[1], r.get_instructions_per_cycle());
+            print_metric(counter_columns[2], r.get_per_kb(perf::COUNTER_BRANCH_MISSES));
+            print_metric(counter_columns[3], r.get_per_kb(perf::COUNTER_L1D_MISSES));
+            print_metric(counter_columns[4], r.get_per_kb(perf::COUNTER_LLC_MISSES));
+            print_metric(counter_columns[5], r.get_per_kb(perf::COUNTER_PAGE_FAULTS));
+        }
+        printf("\n");
+    }
+}
+
+bool write_json(const options& opts, int pinned_cpu, const std::vector<result>& results) {
+    sajson::writer w;
+    w.start_object();
+    w.key(sajson::literal("label"));
+    w.string_value(sajson::literal(opts.label));
+    w.key(sajson::literal("compiler"));
+#ifdef __VERSION__
+    w.string_value(sajson::literal(__VERSION__));
+#else
+    w.null_value();
+#endif
+    w.key(sajson::literal("word_bits"));
+    w.integer_value(static_cast<int>(8 * sizeof(void*)));
+    w.key(sajson::literal("cpu"));
+    w.integer_value(pinned_cpu);
+    w.key(sajson::literal("seed"));
+    w.double_value(static_cast<double>(opts.seed));
+    w.key(sajson::literal("results"));
+    w.start_array();
+    for (const result& r : results) {
+        w.start_object();
+        w.key(sajson::literal("file"));
+        w.string_value(sajson::string(r.file.data(), r.file.size()));
+        w.key(sajson::literal("allocator"));
+        w.string_value(sajson::string(r.allocator.data(), r.allocator.size()));
+        w.key(sajson::literal("bytes"));
+        w.double_value(static_cast<double>(r.bytes));
+        w.key(sajson::literal("peak_bytes"));
+        w.double_value(static_cast<double>(r.peak_bytes));
+        w.key(sajson::literal("samples"));
+        w.double_value(static_cast<double>(r.stats.samples));
+        w.key(sajson::literal("min_ns"));
+        w.double_value(r.stats.min_ns);
+        w.key(sajson::literal("median_ns"));
+        w.double_value(r.stats.median_ns);
+        w.key(sajson::literal("p99_ns"));
+        w.double_value(r.stats.p99_ns);
+        w.key(sajson::literal("mean_ns"));
+        w.double_value(r.stats.mean_ns);
+        w.key(sajson::literal("samples_ns"));
+        w.start_array();
+        for (double sample : r.samples_ns) {
+            w.double_value(sample);
+        }
+        w.end_array();
+        w.key(sajson::literal("mb_per_s"));
+        w.double_value(r.get_mb_per_second());
+        w.key(sajson::literal("documents_per_s"));
+        w.double_value(r.get_documents_per_second());
+        if (opts.counters) {
+            // Per parse; null where unavailable.
+            w.key(sajson::literal("counters"));
+            w.start_object();
+            for (size_t i = 0; i < perf::counter_count; ++i) {
+                w.key(sajson::literal(perf::counter_names[i]));
+                if (r.counts[i] < 0) {
+                    w.null_value();
+                } else {
+                    w.double_value(r.counts[i]);
+                }
+            }
+            w.end_object();
+        }
+        w.end_object();
+    }
+    w.end_array();
+    w.end_object();
+
+    FILE* file = fopen(opts.json_path, "wb");
+    if (!file) {
+        perror("fopen failed");
+        return false;
+    }
+    const sajson::string output = w.get_output();
+    bool ok = w.is_valid()
+        && fwrite(output.data(), 1, output.length(), file) == output.length()
+        && fputc('\n', file) != EOF;
+    ok = fclose(file) == 0 && ok;
+    if (!ok) {
+        perror("writing results failed");
+    }
+    return ok;
+}
+
+double get_median(const std::vector<double>& sorted) {
+    const size_t n = sorted.size();
+    return n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+}
+
+// Prints each result's change from the baseline.  Returns true if any
+// regressed.
+bool compare_to_baseline(
+    const options& opts,
+    const baseline& base,
+    const std::vector<result>& results,
+    size_t max_string_length
+) {
+    printf("\ncompared to %s:\n", opts.baseline_path);
+    printf("%*s - %-7s - %10s - %10s - %8s - %8s\n", static_cast<int>(max_string_length),
+        "file", "alloc", "base us", "now us", "change", "p");
+    printf("%*s - %-7s - %10s - %10s - %8s - %8s\n", static_cast<int>(max_string_length),
+        "----", "-----", "-------", "------", "------", "-");
+
+    bool regressed = false;
+    for (const result& r : results) {
+        printf("%*s - %-7s - ", static_cast<int>(max_string_length), r.file.c_str(), r.allocator.c_str());
+        const baseline::const_iterator i = base.find(std::make_pair(r.file, r.allocator));
+        if (i == base.end() || i->second.empty()) {
+            printf("%10s - %10.3f\n", "-", r.stats.median_ns / 1e3);
+            continue;
+        }
+
+        std::vector<double> base_samples = i->second;
+        std::sort(base_samples.begin(), base_samples.end());
+        const double base_median = get_median(base_samples);
+        const double now_median = get_median(r.samples_ns);
+        const double change = (now_median / base_median - 1) * 100;
+        const double p = mann_whitney_p(base_samples, r.samples_ns);
+        const bool significant = p < opts.alpha;
+        const char* verdict = "";
+        if (significant && change > opts.threshold) {
+            verdict = " - REGRESSION";
+            regressed = true;
+        } else if (significant && change < -opts.threshold) {
+            verdict = " - improved";
+        }
+        printf("%10.3f - %10.3f - %+7.1f%% - %8.2g%s\n",
+            base_median / 1e3, now_median / 1e3, change, p, verdict);
+    }
+    return regressed;
+}
+
+bool parse_options(
+    int argc,
+    const char** argv,
+    const std::vector<std::unique_ptr<workload>>& available_workloads,
+    options& opts
+) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg.size() < 2 || arg.compare(0, 2, "--") != 0) {
+            opts.files.push_back(argv[i]);
+            continue;
+        }
+        if (arg == "--counters") {
+            opts.want_counters = true;
+            continue;
+        }
+        if (i + 1 == argc) {
+            fprintf(stderr, "%s needs a value\n", argv[i]);
+            return false;
+        }
+        const char* value = argv[++i];
+        if (arg == "--allocator") {
+            const std::string name = value;
+            if (name != "default" && name != "bump"
+#ifdef SAJSON_HAS_MMAP
+                && name != "mmap"
+#endif
+            ) {
+                fprintf(stderr, "unknown allocator: %s\n", value);
+                return false;
+            }
+            opts.allocators.push_back(name);
+        } else if (arg == "--shape") {
+            corpus::shape shape;
+            if (0 == strcmp(value, "all")) {
+                for (size_t s = 0; s < corpus::shape_count; ++s) {
+                    opts.shapes.push_back(static_cast<corpus::shape>(s));
+                }
+            } else if (corpus::find_shape(value, shape)) {
+                opts.shapes.push_back(shape);
+            } else {
+                fprintf(stderr, "unknown shape: %s\n", value);
+                return false;
+            }
+        } else if (arg == "--size") {
+            size_t size;
+            if (!corpus::parse_size(value, size)) {
+                fprintf(stderr, "invalid size: %s\n", value);
+                return false;
+            }
+            opts.sizes.push_back(size);
+        } else if (arg == "--workload") {
+            const size_t count = opts.workloads.size();
+            for (const std::unique_ptr<workload>& w : available_workloads) {
+                if (0 == strcmp(value, "all") || 0 == strcmp(value, w->get_name())) {
+                    opts.workloads.push_back(w.get());
+                }
+            }
+            if (opts.workloads.size() == count) {
+                fprintf(stderr, "unknown workload: %s\n", value);
+                return false;
+            }
+        } else if (arg == "--seed") {
+            opts.seed = strtoull(value, 0, 10);
+        } else if (arg == "--samples") {
+            opts.samples = strtoul(value, 0, 10);
+        } else if (arg == "--time") {
+            opts.min_time = atof(value);
+        } else if (arg == "--warmup") {
+            opts.warmup_time = atof(value);
+        } else if (arg == "--cpu") {
+            opts.cpu = atoi(value);
+        } else if (arg == "--label") {
+            opts.label = value;
+        } else if (arg == "--json") {
+            opts.json_path = value;
+        } else if (arg == "--baseline") {
+            opts.baseline_path = value;
+        } else if (arg == "--threshold") {
+            opts.threshold = atof(value);
+        } else if (arg == "--alpha") {
+            opts.alpha = atof(value);
+        } else {
+            fprintf(stderr, "unknown option: %s\n", argv[i - 1]);
+            return false;
+        }
+    }
+
+    if (opts.allocators.empty()) {
+        opts.allocators.push_back("default");
+#ifdef SAJSON_HAS_MMAP
+        opts.allocators.push_back("mmap");
+#endif
+        opts.allocators.push_back("bump");
+    }
+    if (!opts.sizes.empty() && opts.shapes.empty()) {
+        fprintf(stderr, "--size needs --shape\n");
+        return false;
+    }
+    if (!opts.shapes.empty()) {
+        if (!opts.files.empty()) {
+            fprintf(stderr, "--shape and files are exclusive\n");
+            return false;
+        }
+        if (opts.sizes.empty()) {
+            for (size_t size = 1 << 10; size <= (64 << 20); size *= 16) {
+                opts.sizes.push_back(size);
+            }
+        }
+    } else if (opts.files.empty() && opts.workloads.empty()) {
+        opts.files.assign(default_files, default_files + default_files_count);
+    }
+    return true;
+}
+
+int main(int argc, const char** argv) {
+    const std::vector<std::unique_ptr<workload>> available_workloads = workloads::get_all();
+    options opts;
+    if (!parse_options(argc, argv, available_workloads, opts)) {
+        return 2;
+    }
+    const int pinned_cpu = pin_cpu(opts.cpu);
+
+    perf::counters counters;
+    if (opts.want_counters) {
+        if (counters.open()) {
+            opts.counters = &counters;
+        } else {
+            fprintf(stderr, "hardware counters unavailable: %s\n", strerror(counters.get_error()));
+        }
+    }
+
+    size_t max_string_length = 4;
+    for (const char* file : opts.files) {
+        max_string_length = std::max(max_string_length, strlen(file));
+    }
+    for (corpus::shape shape : opts.shapes) {
+        for (size_t size : opts.sizes) {
+            max_string_length = std::max(max_string_length, get_synthetic_name(shape, size).size());
+        }
+    }
+    for (workload* w : opts.workloads) {
+        max_string_length = std::max(max_string_length, strlen(w->get_name()) + strlen("/access"));
+    }
+    print_header(opts, max_string_length);
+
+    std::vector<result> results;
+    bool ok = true;
+    for (const char* file : opts.files) {
+        const size_t first = results.size();
+        ok = run_file_benchmark(opts, file, results) && ok;
+        print_results(opts, results, first, max_string_length);
+        fflush(stdout);
+    }
+    for (corpus::shape shape : opts.shapes) {
+        for (size_t size : opts.sizes) {
+            const size_t first = results.size();
+            ok = run_synthetic_benchmark(opts, shape, size, results) && ok;
+            print_results(opts, results, first, max_string_length);
+            fflush(stdout);
+        }
+    }
+    for (workload* w : opts.workloads) {
+        const size_t first = results.size();
+        ok = run_workload_benchmark(opts, w, results) && ok;
+        print_results(opts, results, first, max_string_length);
+        fflush(stdout);
+    }
+
+    if (opts.json_path && !write_json(opts, pinned_cpu, results)) {
+        ok = false;
+    }
+    bool regressed = false;
+    if (opts.baseline_path) {
+        baseline base;
+        if (load_baseline(opts.baseline_path, base)) {
+            regressed = compare_to_baseline(opts, base, results, max_string_length);
+        } else {
+            ok = false;
+        }
     }
+    return !ok ? 1 : regressed ? 3 : 0;
 }
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <sajson.h>
+
+// Comparison of benchmark samples against a baseline saved by
+// bench --json.
+
+// Samples kept per result in the JSON output: enough for the rank test
+// to resolve small shifts without bloating the file.
+const size_t max_kept_samples = 1000;
+
+// Evenly spaced order statistics of sorted, at most max_count of them, so
+// the kept samples have the same distribution as all of them.
+inline std::vector<double> thin_sorted_samples(const std::vector<double>& sorted, size_t max_count) {
+    if (sorted.size() <= max_count) {
+        return sorted;
+    }
+    std::vector<double> kept;
+    kept.reserve(max_count);
+    for (size_t i = 0; i < max_count; ++i) {
+        kept.push_back(sorted[(2 * i + 1) * sorted.size() / (2 * max_count)]);
+    }
+    return kept;
+}
+
+// The two-sided p-value of the Mann-Whitney U test that a and b come
+// from the same distribution, from the normal approximation with tie and
+// continuity corrections.  Needs a handful of samples on each side to be
+// meaningful.
+inline double mann_whitney_p(const std::vector<double>& a, const std::vector<double>& b) {
+    const double n1 = static_cast<double>(a.size());
+    const double n2 = static_cast<double>(b.size());
+    if (a.empty() || b.empty()) {
+        return 1;
+    }
+
+    std::vector<std::pair<double, bool>> all; // value, is from a
+    all.reserve(a.size() + b.size());
+    for (double v : a) {
+        all.push_back(std::make_pair(v, true));
+    }
+    for (double v : b) {
+        all.push_back(std::make_pair(v, false));
+    }
+    std::sort(all.begin(), all.end());
+
+    // Sum of a's ranks, with tied values sharing their average rank.
+    double rank_sum = 0;
+    double tie_term = 0;
+    for (size_t i = 0; i < all.size();) {
+        size_t j = i;
+        while (j < all.size() && all[j].first == all[i].first) {
+            ++j;
+        }
+        const double ties = static_cast<double>(j - i);
+        const double average_rank = (i + 1 + j) / 2.0;
+        for (size_t k = i; k < j; ++k) {
+            if (all[k].second) {
+                rank_sum += average_rank;
+            }
+        }
+        tie_term += ties * ties * ties - ties;
+        i = j;
+    }
+
+    const double n = n1 + n2;
+    const double u = rank_sum - n1 * (n1 + 1) / 2;
+    const double mean = n1 * n2 / 2;
+    const double variance = n1 * n2 / 12 * ((n + 1) - tie_term / (n * (n - 1)));
+    if (variance <= 0) {
+        return 1;
+    }
+    const double distance = std::max(0.0, fabs(u - mean) - 0.5);
+    return erfc(distance / sqrt(2 * variance));
+}
+
+// Baseline samples keyed by (file, allocator).
+typedef std::map<std::pair<std::string, std::string>, std::vector<double>> baseline;
+
+// Looks up key if object is an object that has it.
+inline bool find_member(const sajson::value& object, const char* key, sajson::type t, sajson::value& out) {
+    if (object.get_type() != sajson::TYPE_OBJECT) {
+        return false;
+    }
+    const size_t i = object.find_object_key(sajson::literal(key));
+    if (i == object.get_length() || object.get_object_value(i).get_type() != t) {
+        return false;
+    }
+    out = object.get_object_value(i);
+    return true;
+}
+
+// Reads the results from a bench --json file.  Returns false, with a
+// message on stderr, if the file cannot be read or is not bench output.
+inline bool load_baseline(const char* path, baseline& out) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        perror("fopen failed");
+        return false;
+    }
+    std::string text;
+    char chunk[65536];
+    size_t count;
+    while ((count = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        text.append(chunk, count);
+    }
+    fclose(file);
+
+    const sajson::document& document = sajson::parse(sajson::string(text.data(), text.size()));
+    if (!document.is_valid()) {
+        fprintf(stderr, "%s: %s\n", path, document.get_error_message_as_cstring());
+        return false;
+    }
+    sajson::value results = document.get_root();
+    if (!find_member(document.get_root(), "results", sajson::TYPE_ARRAY, results)) {
+        fprintf(stderr, "%s: not a bench --json file\n", path);
+        return false;
+    }
+
+    for (const sajson::value& result : results.get_array_elements()) {
+        sajson::value file_name = result;
+        sajson::value allocator = result;
+        sajson::value samples = result;
+        if (!find_member(result, "file", sajson::TYPE_STRING, file_name)
+            || !find_member(result, "allocator", sajson::TYPE_STRING, allocator)
+            || !find_member(result, "samples_ns", sajson::TYPE_ARRAY, samples)) {
+            continue;
+        }
+
+        std::vector<double>& samples_ns = out[std::make_pair(
+            std::string(file_name.as_cstring(), file_name.get_string_length()),
+            std::string(allocator.as_cstring(), allocator.get_string_length()))];
+        samples_ns.clear();
+        for (const sajson::value& sample : samples.get_array_elements()) {
+            const sajson::type t = sample.get_type();
+            if (t == sajson::TYPE_INTEGER || t == sajson::TYPE_DOUBLE) {
+                samples_ns.push_back(sample.get_number_value());
+            }
+        }
+    }
+    return true;
+}
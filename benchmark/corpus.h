@@ -0,0 +1,287 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+// Deterministic synthetic JSON documents for scaling benchmarks.  Each
+// shape stresses one part of the parser, and the same shape, size, and
+// seed always produce the same bytes.
+
+namespace corpus {
+    enum shape {
+        // Arrays of integers, decimals, and exponents.
+        SHAPE_NUMBERS,
+        // Objects of plain ASCII strings.
+        SHAPE_STRINGS,
+        // Strings dense with escapes, \u sequences, and UTF-8.
+        SHAPE_ESCAPES,
+        // Chains of objects and arrays hundreds of levels deep.
+        SHAPE_NESTED,
+        // One object with a key per value.
+        SHAPE_WIDE,
+        // Small records, one per line.  Not a single JSON document.
+        SHAPE_NDJSON,
+    };
+
+    const char* const shape_names[] = {
+        "numbers", "strings", "escapes", "nested", "wide", "ndjson",
+    };
+    const size_t shape_count = sizeof(shape_names) / sizeof(*shape_names);
+
+    inline bool find_shape(const char* name, shape& result) {
+        for (size_t i = 0; i < shape_count; ++i) {
+            if (0 == strcmp(name, shape_names[i])) {
+                result = static_cast<shape>(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Parses sizes like "4096", "64K", "16M", or "2G" (binary units).
+    inline bool parse_size(const char* text, size_t& result) {
+        // strtoull would accept leading whitespace and signs, and wrap
+        // "-1" around to a huge size.
+        if (*text < '0' || *text > '9') {
+            return false;
+        }
+        char* end;
+        const unsigned long long value = strtoull(text, &end, 10);
+        unsigned shift = 0;
+        switch (*end) {
+            case 'K': case 'k': shift = 10; ++end; break;
+            case 'M': case 'm': shift = 20; ++end; break;
+            case 'G': case 'g': shift = 30; ++end; break;
+        }
+        if (*end || value == 0) {
+            return false;
+        }
+        result = static_cast<size_t>(value << shift);
+        return (result >> shift) == value;
+    }
+
+    // xorshift64*: fast, and identical on every platform.
+    class random {
+    public:
+        explicit random(uint64_t seed)
+            : state(seed ? seed : 0x9e3779b97f4a7c15ULL)
+        {}
+
+        uint64_t next() {
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+            return state * 0x2545f4914f6cdd1dULL;
+        }
+
+        // Uniform enough in [0, n) for n far below 2^32.
+        uint32_t below(uint32_t n) {
+            return static_cast<uint32_t>((next() >> 32) % n);
+        }
+
+    private:
+        uint64_t state;
+    };
+
+    namespace internal {
+        inline void append_unsigned(std::string& out, uint64_t value) {
+            char digits[20];
+            size_t count = 0;
+            do {
+                digits[count++] = static_cast<char>('0' + value % 10);
+                value /= 10;
+            } while (value);
+            while (count) {
+                out += digits[--count];
+            }
+        }
+
+        inline void append_digits(std::string& out, random& r, size_t count) {
+            out += static_cast<char>('1' + r.below(9));
+            for (size_t i = 1; i < count; ++i) {
+                out += static_cast<char>('0' + r.below(10));
+            }
+        }
+
+        inline void append_number(std::string& out, random& r) {
+            if (r.below(4) == 0) {
+                out += '-';
+            }
+            switch (r.below(3)) {
+                case 0: // integer, some beyond int32
+                    append_digits(out, r, 1 + r.below(18));
+                    break;
+                case 1: // decimal
+                    append_digits(out, r, 1 + r.below(6));
+                    out += '.';
+                    append_digits(out, r, 1 + r.below(12));
+                    break;
+                default: // exponent
+                    append_digits(out, r, 1);
+                    out += '.';
+                    append_digits(out, r, 1 + r.below(16));
+                    out += r.below(2) ? "e-" : "e+";
+                    append_unsigned(out, r.below(300));
+                    break;
+            }
+        }
+
+        inline void append_word(std::string& out, random& r, size_t length) {
+            for (size_t i = 0; i < length; ++i) {
+                out += static_cast<char>('a' + r.below(26));
+            }
+        }
+
+        inline void append_text(std::string& out, random& r, size_t length) {
+            out += '"';
+            while (length) {
+                size_t word = 1 + r.below(10);
+                if (word > length) {
+                    word = length;
+                }
+                append_word(out, r, word);
+                length -= word;
+                if (length) {
+                    out += ' ';
+                    --length;
+                }
+            }
+            out += '"';
+        }
+
+        inline void append_escaped_text(std::string& out, random& r, size_t length) {
+            static const char* const pieces[] = {
+                "\\\"", "\\\\", "\\/", "\\b", "\\f", "\\n", "\\r", "\\t",
+                "\\u0001", "\\u00e9", "\\u20ac", "\\ud83d\\ude00",
+                "\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80",
+            };
+            const size_t piece_count = sizeof(pieces) / sizeof(*pieces);
+
+            out += '"';
+            for (size_t i = 0; i < length; ++i) {
+                if (r.below(3) == 0) {
+                    out += pieces[r.below(piece_count)];
+                } else {
+                    out += static_cast<char>('a' + r.below(26));
+                }
+            }
+            out += '"';
+        }
+
+        inline void append_element(std::string& out, shape s, random& r, uint64_t index) {
+            switch (s) {
+                case SHAPE_NUMBERS:
+                    out += '[';
+                    for (int i = 0; i < 16; ++i) {
+                        if (i) {
+                            out += ',';
+                        }
+                        append_number(out, r);
+                    }
+                    out += ']';
+                    break;
+
+                case SHAPE_STRINGS:
+                    out += "{\"id\":";
+                    append_text(out, r, 16);
+                    out += ",\"name\":";
+                    append_text(out, r, 4 + r.below(28));
+                    out += ",\"text\":";
+                    append_text(out, r, 20 + r.below(200));
+                    out += '}';
+                    break;
+
+                case SHAPE_ESCAPES:
+                    append_escaped_text(out, r, 8 + r.below(120));
+                    break;
+
+                case SHAPE_NESTED: {
+                    const uint32_t depth = 64 + r.below(448);
+                    for (uint32_t i = 0; i < depth; ++i) {
+                        out += i % 2 ? "{\"a\":" : "[";
+                    }
+                    append_unsigned(out, index);
+                    for (uint32_t i = depth; i--;) {
+                        out += i % 2 ? '}' : ']';
+                    }
+                    break;
+                }
+
+                case SHAPE_WIDE:
+                    out += "\"k";
+                    append_unsigned(out, index);
+                    out += "\":";
+                    append_unsigned(out, r.below(1000000));
+                    break;
+
+                case SHAPE_NDJSON:
+                    out += "{\"id\":";
+                    append_unsigned(out, index);
+                    out += ",\"ok\":";
+                    out += r.below(2) ? "true" : "false";
+                    out += ",\"user\":";
+                    append_text(out, r, 4 + r.below(12));
+                    out += ",\"tags\":[";
+                    append_text(out, r, 3 + r.below(5));
+                    out += ',';
+                    append_text(out, r, 3 + r.below(5));
+                    out += "],\"score\":";
+                    append_number(out, r);
+                    out += '}';
+                    break;
+            }
+        }
+    }
+
+    // Generates a document of the given shape, stopping at the first
+    // element boundary at or past target_bytes, and passes it to sink in
+    // chunks of roughly chunk_size bytes as sink(const std::string&), so
+    // documents larger than memory can be written out.
+    template<typename Sink>
+    void generate(shape s, size_t target_bytes, uint64_t seed, Sink sink, size_t chunk_size = 1 << 20) {
+        const char* open = "[";
+        const char* separator = ",";
+        const char* close = "]";
+        if (s == SHAPE_WIDE) {
+            open = "{";
+            close = "}";
+        } else if (s == SHAPE_NDJSON) {
+            open = "";
+            separator = "\n";
+            close = "\n";
+        }
+
+        random r(seed);
+        std::string chunk;
+        chunk.reserve(chunk_size + 4096);
+        chunk += open;
+        size_t total = 0;
+        const size_t close_length = strlen(close);
+        for (uint64_t index = 0;; ++index) {
+            if (index) {
+                chunk += separator;
+            }
+            internal::append_element(chunk, s, r, index);
+            if (total + chunk.size() + close_length >= target_bytes) {
+                break;
+            }
+            if (chunk.size() >= chunk_size) {
+                total += chunk.size();
+                sink(chunk);
+                chunk.clear();
+            }
+        }
+        chunk += close;
+        sink(chunk);
+    }
+
+    inline std::string generate(shape s, size_t target_bytes, uint64_t seed = 1) {
+        std::string document;
+        document.reserve(target_bytes + 4096);
+        generate(s, target_bytes, seed, [&](const std::string& chunk) {
+            document += chunk;
+        });
+        return document;
+    }
+}
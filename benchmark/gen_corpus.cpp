@@ -0,0 +1,41 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "corpus.h"
+
+// Writes a synthetic JSON document.  Usage:
+//
+//     gen_corpus SHAPE SIZE [SEED] > output.json
+//
+// SHAPE is one of numbers, strings, escapes, nested, wide, or ndjson.
+// SIZE accepts K, M, and G suffixes.  The output is the same on every
+// run and platform for a given shape, size, and seed.
+
+int main(int argc, const char** argv) {
+    corpus::shape shape;
+    size_t size;
+    if (argc < 3 || argc > 4
+        || !corpus::find_shape(argv[1], shape)
+        || !corpus::parse_size(argv[2], size)) {
+        fprintf(stderr, "usage: %s SHAPE SIZE [SEED]\n", argv[0]);
+        fprintf(stderr, "shapes:");
+        for (size_t i = 0; i < corpus::shape_count; ++i) {
+            fprintf(stderr, " %s", corpus::shape_names[i]);
+        }
+        fprintf(stderr, "\n");
+        return 2;
+    }
+    const uint64_t seed = argc == 4 ? strtoull(argv[3], 0, 10) : 1;
+
+    bool ok = true;
+    corpus::generate(shape, size, seed, [&](const std::string& chunk) {
+        if (ok && fwrite(chunk.data(), 1, chunk.size(), stdout) != chunk.size()) {
+            perror("fwrite failed");
+            ok = false;
+        }
+    });
+    if (fflush(stdout) != 0) {
+        perror("fflush failed");
+        ok = false;
+    }
+    return ok ? 0 : 1;
+}
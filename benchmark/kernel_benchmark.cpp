@@ -0,0 +1,424 @@
+#include <string.h>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sajson.h>
+#include "corpus.h"
+#include "timing.h"
+
+// Times the parser's inner loops one at a time on synthetic inputs, so a
+// regression in one is not hidden by the others in whole-document
+// numbers.  Usage:
+//
+//     kernel_bench [--time SECONDS] [--cpu N] [filter...]
+//
+// Only benchmarks whose name contains one of the filters are run.  Each
+// sample restores the input (the string kernels decode in place and
+// install_object sorts in place), then times one pass over many
+// operations; ns/op is that time divided by the operation count.
+
+// Exposes the lexical kernels, which are protected in parser_base.
+class kernels : public sajson::parser_base {
+public:
+    kernels(char* begin, char* end)
+        : parser_base(begin, end)
+    {}
+
+    using parser_base::skip_whitespace;
+    using parser_base::parse_string;
+    using parser_base::decode_number;
+};
+
+struct kernel_benchmark {
+    std::string name;
+    // Operations per pass, and input bytes per pass if the kernel scans
+    // text (else 0).
+    size_t ops;
+    size_t bytes;
+    std::function<void()> restore;
+    std::function<size_t()> run;
+};
+
+// Keeps results alive so passes are not optimized away.
+volatile size_t sink;
+
+// A text input that can be reset to its original bytes.
+class text_input {
+public:
+    explicit text_input(const std::string& text)
+        : original(text)
+        , buffer(text.begin(), text.end())
+    {}
+
+    void restore() {
+        memcpy(buffer.data(), original.data(), original.size());
+    }
+
+    char* begin() {
+        return buffer.data();
+    }
+
+    char* end() {
+        return buffer.data() + buffer.size();
+    }
+
+    size_t size() const {
+        return buffer.size();
+    }
+
+private:
+    std::string original;
+    std::vector<char> buffer;
+};
+
+std::string random_word(corpus::random& r, size_t min_length, size_t max_length) {
+    std::string word;
+    const size_t length = min_length + r.below(static_cast<uint32_t>(max_length - min_length + 1));
+    for (size_t i = 0; i < length; ++i) {
+        word += static_cast<char>('a' + r.below(26));
+    }
+    return word;
+}
+
+// Runs of `width` whitespace characters, each followed by one 'x'.
+void add_skip_whitespace(std::vector<kernel_benchmark>& benchmarks, size_t width) {
+    static const char whitespace[] = {' ', '\n', '\t', '\r'};
+    corpus::random r(width);
+    std::string text;
+    const size_t runs = 4096;
+    for (size_t i = 0; i < runs; ++i) {
+        for (size_t j = 0; j < width; ++j) {
+            text += j % 8 == 7 ? whitespace[r.below(4)] : ' ';
+        }
+        text += 'x';
+    }
+    auto input = std::make_shared<text_input>(text);
+
+    kernel_benchmark b;
+    b.name = "skip_whitespace/" + std::to_string(width);
+    b.ops = runs;
+    b.bytes = input->size();
+    b.restore = [] {};
+    b.run = [input, runs] {
+        kernels k(input->begin(), input->end());
+        char* p = input->begin();
+        for (size_t i = 0; i < runs; ++i) {
+            p = k.skip_whitespace(p) + 1;
+        }
+        return static_cast<size_t>(p - input->begin());
+    };
+    benchmarks.push_back(b);
+}
+
+// count back-to-back strings, each made by next_string.
+template<typename F>
+void add_parse_string(std::vector<kernel_benchmark>& benchmarks, const std::string& name, size_t count, F next_string) {
+    corpus::random r(count);
+    std::string text;
+    for (size_t i = 0; i < count; ++i) {
+        text += '"';
+        text += next_string(r);
+        text += '"';
+    }
+    auto input = std::make_shared<text_input>(text);
+
+    kernel_benchmark b;
+    b.name = "parse_string/" + name;
+    b.ops = count;
+    b.bytes = input->size();
+    b.restore = [input] { input->restore(); };
+    b.run = [input, count] {
+        kernels k(input->begin(), input->end());
+        char* p = input->begin();
+        size_t tag[2];
+        size_t total = 0;
+        for (size_t i = 0; i < count; ++i) {
+            p = k.parse_string(p, tag);
+            total += tag[1] - tag[0];
+        }
+        return total;
+    };
+    benchmarks.push_back(b);
+}
+
+std::string escaped_string(corpus::random& r) {
+    static const char* const escapes[] = {
+        "\\n", "\\t", "\\\"", "\\\\", "\\u00e9", "\\u20ac", "\\ud83d\\ude00",
+    };
+    std::string s;
+    for (int i = 0; i < 8; ++i) {
+        s += random_word(r, 4, 8);
+        s += escapes[r.below(sizeof(escapes) / sizeof(*escapes))];
+    }
+    return s;
+}
+
+std::string utf8_string(corpus::random& r) {
+    static const char* const characters[] = {
+        "\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80",
+    };
+    std::string s;
+    for (int i = 0; i < 8; ++i) {
+        s += random_word(r, 4, 8);
+        s += characters[r.below(3)];
+    }
+    return s;
+}
+
+// count comma-terminated numbers, each made by next_number.
+template<typename F>
+void add_decode_number(std::vector<kernel_benchmark>& benchmarks, const char* name, F next_number) {
+    const size_t count = 4096;
+    corpus::random r(count);
+    std::string text;
+    for (size_t i = 0; i < count; ++i) {
+        text += next_number(r);
+        text += ',';
+    }
+    auto input = std::make_shared<text_input>(text);
+
+    kernel_benchmark b;
+    b.name = std::string("decode_number/") + name;
+    b.ops = count;
+    b.bytes = input->size();
+    b.restore = [] {};
+    b.run = [input, count] {
+        kernels k(input->begin(), input->end());
+        char* p = input->begin();
+        size_t total = 0;
+        for (size_t i = 0; i < count; ++i) {
+            int integer;
+            double number;
+            std::pair<char*, sajson::type> result = k.decode_number(p, integer, number);
+            total += result.second == sajson::TYPE_INTEGER ? integer : static_cast<size_t>(number);
+            p = result.first + 1;
+        }
+        return total;
+    };
+    benchmarks.push_back(b);
+}
+
+std::string digits(corpus::random& r, size_t min_count, size_t max_count) {
+    std::string s(1, static_cast<char>('1' + r.below(9)));
+    const size_t count = min_count + r.below(static_cast<uint32_t>(max_count - min_count + 1));
+    while (s.size() < count) {
+        s += static_cast<char>('0' + r.below(10));
+    }
+    return s;
+}
+
+// Objects of key_count random keys, in random or sorted order, installed
+// the way the parser does when it reaches each closing brace.
+void add_install_object(std::vector<kernel_benchmark>& benchmarks, size_t key_count, bool presorted) {
+    const size_t object_count = std::max<size_t>(1, 16384 / key_count);
+    corpus::random r(key_count);
+
+    auto text = std::make_shared<std::string>();
+    std::vector<sajson::object_key_record> keys;
+    for (size_t i = 0; i < object_count * key_count; ++i) {
+        const std::string key = random_word(r, 3, 12);
+        sajson::object_key_record record;
+        record.key_start = text->size();
+        record.key_end = record.key_start + key.size();
+        record.value = sajson::make_element(sajson::TYPE_NULL, 0);
+        keys.push_back(record);
+        *text += key;
+    }
+    if (presorted) {
+        for (size_t i = 0; i < object_count; ++i) {
+            std::sort(
+                keys.begin() + i * key_count,
+                keys.begin() + (i + 1) * key_count,
+                sajson::object_key_comparator(text->data()));
+        }
+    }
+
+    auto original = std::make_shared<std::vector<sajson::object_key_record>>(keys);
+    auto work = std::make_shared<std::vector<sajson::object_key_record>>(keys);
+    auto ast = std::make_shared<std::vector<size_t>>(object_count * (3 * key_count + 1));
+
+    kernel_benchmark b;
+    b.name = "install_object/" + std::to_string(key_count) + (presorted ? "-sorted" : "-random");
+    b.ops = object_count;
+    b.bytes = 0;
+    b.restore = [original, work] { *work = *original; };
+    b.run = [text, work, ast, object_count, key_count] {
+        size_t* const structure_end = ast->data() + ast->size();
+        size_t* write_cursor = structure_end;
+        for (size_t i = 0; i < object_count; ++i) {
+            size_t* base = reinterpret_cast<size_t*>(work->data() + i * key_count);
+            sajson::internal::install_object(base, base + 3 * key_count, write_cursor, structure_end, text->data());
+        }
+        return *write_cursor;
+    };
+    benchmarks.push_back(b);
+}
+
+// Lookups of random present (or absent) keys in a parsed object.
+void add_find_object_key(std::vector<kernel_benchmark>& benchmarks, size_t key_count, bool present) {
+    corpus::random r(key_count);
+    std::string text = "{";
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < key_count; ++i) {
+        // Unique, and of varied lengths like real keys.
+        keys.push_back(random_word(r, 2, 10) + std::to_string(i));
+        if (i) {
+            text += ',';
+        }
+        text += '"' + keys.back() + "\":" + std::to_string(i);
+    }
+    text += '}';
+
+    auto document = std::make_shared<sajson::document>(
+        sajson::parse(sajson::string(text.data(), text.size())));
+    if (!document->is_valid()) {
+        fprintf(stderr, "find_object_key: %s\n", document->get_error_message_as_cstring());
+        exit(1);
+    }
+
+    const size_t lookup_count = 4096;
+    auto lookups = std::make_shared<std::vector<std::string>>();
+    for (size_t i = 0; i < lookup_count; ++i) {
+        std::string key = keys[r.below(static_cast<uint32_t>(key_count))];
+        if (!present) {
+            key[0] = static_cast<char>(toupper(key[0]));
+        }
+        lookups->push_back(key);
+    }
+
+    kernel_benchmark b;
+    b.name = "find_object_key/" + std::to_string(key_count) + (present ? "-hit" : "-miss");
+    b.ops = lookup_count;
+    b.bytes = 0;
+    b.restore = [] {};
+    b.run = [document, lookups] {
+        const sajson::value root = document->get_root();
+        size_t total = 0;
+        for (const std::string& key : *lookups) {
+            total += root.find_object_key(sajson::string(key.data(), key.size()));
+        }
+        return total;
+    };
+    benchmarks.push_back(b);
+}
+
+std::vector<kernel_benchmark> make_benchmarks() {
+    std::vector<kernel_benchmark> benchmarks;
+
+    add_skip_whitespace(benchmarks, 1);
+    add_skip_whitespace(benchmarks, 8);
+    add_skip_whitespace(benchmarks, 64);
+
+    // Plain ASCII stays on the fast path; escapes and bytes above 0x7f
+    // fall through to the slow path.
+    for (size_t length : {8, 64, 512}) {
+        add_parse_string(benchmarks, "ascii-" + std::to_string(length), 1024, [length](corpus::random& r) {
+            return random_word(r, length, length);
+        });
+    }
+    add_parse_string(benchmarks, "escaped", 1024, escaped_string);
+    add_parse_string(benchmarks, "utf8", 1024, utf8_string);
+
+    add_decode_number(benchmarks, "int-short", [](corpus::random& r) {
+        return digits(r, 1, 4);
+    });
+    add_decode_number(benchmarks, "int-long", [](corpus::random& r) {
+        return digits(r, 7, 9);
+    });
+    add_decode_number(benchmarks, "int-overflow", [](corpus::random& r) {
+        return digits(r, 11, 18);
+    });
+    add_decode_number(benchmarks, "double", [](corpus::random& r) {
+        return digits(r, 1, 6) + '.' + digits(r, 1, 10);
+    });
+    add_decode_number(benchmarks, "exponent", [](corpus::random& r) {
+        return digits(r, 1, 1) + '.' + digits(r, 1, 15) + (r.below(2) ? "e-" : "e+") + std::to_string(r.below(300));
+    });
+
+    for (size_t key_count : {4, 16, 256, 4096}) {
+        add_install_object(benchmarks, key_count, false);
+    }
+    add_install_object(benchmarks, 16, true);
+    add_install_object(benchmarks, 256, true);
+
+    for (size_t key_count : {4, 16, 256, 4096}) {
+        add_find_object_key(benchmarks, key_count, true);
+    }
+    add_find_object_key(benchmarks, 256, false);
+
+    return benchmarks;
+}
+
+sample_stats measure(kernel_benchmark& b, double min_time) {
+    const size_t min_samples = 100;
+    std::vector<double> ns;
+    const benchmark_clock::time_point start = benchmark_clock::now();
+    for (size_t warmup = 0; warmup < 10; ++warmup) {
+        b.restore();
+        sink = b.run();
+    }
+    while (ns.size() < min_samples || elapsed_seconds(start) < min_time) {
+        b.restore();
+        const benchmark_clock::time_point before = benchmark_clock::now();
+        sink = b.run();
+        const benchmark_clock::time_point after = benchmark_clock::now();
+        ns.push_back(std::chrono::duration<double, std::nano>(after - before).count() / b.ops);
+    }
+    return summarize(ns);
+}
+
+int main(int argc, const char** argv) {
+    double min_time = 0.2;
+    int cpu = -2;
+    std::vector<std::string> filters;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if ((arg == "--time" || arg == "--cpu") && i + 1 < argc) {
+            const char* value = argv[++i];
+            if (arg == "--time") {
+                min_time = atof(value);
+            } else {
+                cpu = atoi(value);
+            }
+        } else if (arg.compare(0, 2, "--") == 0) {
+            fprintf(stderr, "usage: %s [--time SECONDS] [--cpu N] [filter...]\n", argv[0]);
+            return 2;
+        } else {
+            filters.push_back(arg);
+        }
+    }
+    pin_cpu(cpu);
+
+    std::vector<kernel_benchmark> benchmarks = make_benchmarks();
+    size_t max_name_length = 6;
+    for (const kernel_benchmark& b : benchmarks) {
+        max_name_length = std::max(max_name_length, b.name.size());
+    }
+
+    printf("%-*s - %10s - %10s - %10s - %9s\n", static_cast<int>(max_name_length),
+        "kernel", "ns/op", "min", "p99", "MB/s");
+    printf("%-*s - %10s - %10s - %10s - %9s\n", static_cast<int>(max_name_length),
+        "------", "-----", "---", "---", "----");
+    for (kernel_benchmark& b : benchmarks) {
+        bool selected = filters.empty();
+        for (const std::string& filter : filters) {
+            selected = selected || b.name.find(filter) != std::string::npos;
+        }
+        if (!selected) {
+            continue;
+        }
+
+        const sample_stats stats = measure(b, min_time);
+        printf("%-*s - %10.2f - %10.2f - %10.2f - ", static_cast<int>(max_name_length),
+            b.name.c_str(), stats.median_ns, stats.min_ns, stats.p99_ns);
+        if (b.bytes) {
+            printf("%9.1f\n", b.bytes / (stats.median_ns * b.ops) * 1e3);
+        } else {
+            printf("%9s\n", "-");
+        }
+        fflush(stdout);
+    }
+    return 0;
+}
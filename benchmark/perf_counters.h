@@ -0,0 +1,173 @@
+#pragma once
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Hardware and software performance counters for the calling thread,
+// read through perf_event_open(2).  Only user-space work is counted.
+// Counters the kernel, hardware, or perf_event_paranoid setting does not
+// allow are left closed, and on other platforms none are available, so
+// check is_available() before reading.
+
+namespace perf {
+    enum counter {
+        COUNTER_CYCLES,
+        COUNTER_INSTRUCTIONS,
+        COUNTER_BRANCH_MISSES,
+        COUNTER_L1D_MISSES,
+        COUNTER_LLC_MISSES,
+        COUNTER_PAGE_FAULTS,
+    };
+
+    const char* const counter_names[] = {
+        "cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses", "page_faults",
+    };
+    const size_t counter_count = sizeof(counter_names) / sizeof(*counter_names);
+
+    class counters {
+    public:
+        counters()
+            : first_error(0)
+        {
+            for (size_t i = 0; i < counter_count; ++i) {
+                fds[i] = -1;
+            }
+        }
+
+        ~counters() {
+#ifdef __linux__
+            for (size_t i = 0; i < counter_count; ++i) {
+                if (fds[i] >= 0) {
+                    close(fds[i]);
+                }
+            }
+#endif
+        }
+
+        counters(const counters&) = delete;
+        void operator=(const counters&) = delete;
+
+        // Returns true if any counter could be opened.  Otherwise
+        // get_error() is the errno of the first failure.
+        bool open() {
+#ifdef __linux__
+            open_counter(COUNTER_CYCLES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+            open_counter(COUNTER_INSTRUCTIONS, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+            open_counter(COUNTER_BRANCH_MISSES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+            open_counter(
+                COUNTER_L1D_MISSES,
+                PERF_TYPE_HW_CACHE,
+                PERF_COUNT_HW_CACHE_L1D
+                    | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                    | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+            open_counter(COUNTER_LLC_MISSES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+            open_counter(COUNTER_PAGE_FAULTS, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS);
+#else
+            first_error = ENOSYS;
+#endif
+            for (size_t i = 0; i < counter_count; ++i) {
+                if (fds[i] >= 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        int get_error() const {
+            return first_error;
+        }
+
+        bool is_available(counter c) const {
+            return fds[c] >= 0;
+        }
+
+        // Counts accumulate across start()/stop() pairs until reset().
+        void reset() {
+            for_each_counter(PERF_IOC_RESET);
+        }
+
+        void start() {
+            for_each_counter(PERF_IOC_ENABLE);
+        }
+
+        void stop() {
+            for_each_counter(PERF_IOC_DISABLE);
+        }
+
+        // The count since reset(), scaled up if the kernel had to
+        // multiplex this counter with others.  Zero if unavailable.
+        double get(counter c) const {
+#ifdef __linux__
+            uint64_t values[3]; // value, time enabled, time running
+            if (fds[c] < 0 || read(fds[c], values, sizeof(values)) != sizeof(values)) {
+                return 0;
+            }
+            if (values[2] == 0) {
+                return 0;
+            }
+            return static_cast<double>(values[0]) * values[1] / values[2];
+#else
+            (void)c;
+            return 0;
+#endif
+        }
+
+    private:
+#ifdef __linux__
+        enum ioctl_request {
+            PERF_IOC_RESET = PERF_EVENT_IOC_RESET,
+            PERF_IOC_ENABLE = PERF_EVENT_IOC_ENABLE,
+            PERF_IOC_DISABLE = PERF_EVENT_IOC_DISABLE,
+        };
+
+        void open_counter(counter c, uint32_t type, uint64_t config) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = type;
+            attr.config = config;
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            const long fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+            if (fd < 0) {
+                if (!first_error) {
+                    first_error = errno;
+                }
+                return;
+            }
+            fds[c] = static_cast<int>(fd);
+        }
+#else
+        enum ioctl_request {
+            PERF_IOC_RESET,
+            PERF_IOC_ENABLE,
+            PERF_IOC_DISABLE,
+        };
+#endif
+
+        void for_each_counter(ioctl_request request) {
+#ifdef __linux__
+            for (size_t i = 0; i < counter_count; ++i) {
+                if (fds[i] >= 0) {
+                    ioctl(fds[i], request, 0);
+                }
+            }
+#else
+            (void)request;
+#endif
+        }
+
+        int fds[sizeof(counter_names) / sizeof(*counter_names)];
+        int first_error;
+    };
+}
@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+
+# Plots throughput and peak memory against document size for the
+# synthetic corpus results in one or more bench --json files:
+#
+#   build/gcc-64-opt/bench --shape all --size 1K --size 64K --size 4M \
+#       --json bench.json
+#   benchmark/plot.py bench.json > bench.svg
+#
+# Each line is one shape (and allocator, and label when several files
+# are given).  Writes a self-contained SVG to stdout; needs nothing
+# beyond the standard library.
+
+import json
+import math
+import re
+import sys
+from xml.sax.saxutils import escape
+
+SYNTHETIC_NAME = re.compile(r'^([a-z]+)-\d+[KMG]?$')
+
+COLORS = [
+    '#1f77b4', '#ff7f0e', '#2ca02c', '#d62728', '#9467bd',
+    '#8c564b', '#e377c2', '#7f7f7f', '#bcbd22', '#17becf',
+]
+
+PANEL_WIDTH = 480
+PANEL_HEIGHT = 320
+MARGIN_LEFT = 70
+MARGIN_TOP = 40
+MARGIN_BOTTOM = 50
+LEGEND_WIDTH = 220
+
+
+def load_series(paths):
+    series = {}
+    for path in paths:
+        with open(path) as f:
+            run = json.load(f)
+        label = run.get('label', '')
+        for r in run.get('results', []):
+            match = SYNTHETIC_NAME.match(r.get('file', ''))
+            if not match:
+                continue
+            name = '%s %s' % (match.group(1), r.get('allocator', ''))
+            if len(paths) > 1 and label:
+                name += ' (%s)' % label
+            series.setdefault(name, []).append(
+                (r['bytes'], r['mb_per_s'], r['peak_bytes']))
+    for points in series.values():
+        points.sort()
+    return series
+
+
+def format_bytes(n):
+    for suffix in ['', 'K', 'M', 'G']:
+        if n < 1024:
+            return '%g%s' % (n, suffix)
+        n /= 1024.0
+    return '%gT' % n
+
+
+def log_range(values):
+    low = math.floor(math.log2(min(values)))
+    high = math.ceil(math.log2(max(values)))
+    return low, max(high, low + 1)
+
+
+def panel(out, x0, title, series, column, y_label, y_format):
+    xs = [p[0] for points in series.values() for p in points]
+    ys = [max(p[column], 1) for points in series.values() for p in points]
+    x_low, x_high = log_range(xs)
+    y_low, y_high = log_range(ys)
+    left = x0 + MARGIN_LEFT
+    width = PANEL_WIDTH - MARGIN_LEFT - 20
+    bottom = PANEL_HEIGHT - MARGIN_BOTTOM
+    height = bottom - MARGIN_TOP
+
+    def px(x):
+        return left + width * (math.log2(x) - x_low) / (x_high - x_low)
+
+    def py(y):
+        return bottom - height * (math.log2(max(y, 1)) - y_low) / (y_high - y_low)
+
+    out.append('<text x="%d" y="%d" font-weight="bold">%s</text>'
+               % (left, MARGIN_TOP - 15, escape(title)))
+    x_step = max(1, (x_high - x_low) // 8)
+    for e in range(x_low, x_high + 1, x_step):
+        x = px(2 ** e)
+        out.append('<line x1="%.1f" y1="%d" x2="%.1f" y2="%d" stroke="#ddd"/>'
+                   % (x, MARGIN_TOP, x, bottom))
+        out.append('<text x="%.1f" y="%d" text-anchor="middle">%s</text>'
+                   % (x, bottom + 16, format_bytes(2 ** e)))
+    y_step = max(1, (y_high - y_low) // 6)
+    for e in range(y_low, y_high + 1, y_step):
+        y = py(2 ** e)
+        out.append('<line x1="%d" y1="%.1f" x2="%d" y2="%.1f" stroke="#ddd"/>'
+                   % (left, y, left + width, y))
+        out.append('<text x="%d" y="%.1f" text-anchor="end">%s</text>'
+                   % (left - 6, y + 4, y_format(2 ** e)))
+    out.append('<rect x="%d" y="%d" width="%d" height="%d" fill="none" stroke="#000"/>'
+               % (left, MARGIN_TOP, width, height))
+    out.append('<text x="%d" y="%d" text-anchor="middle">document size</text>'
+               % (left + width // 2, bottom + 36))
+    out.append('<text transform="translate(%d %d) rotate(-90)" text-anchor="middle">%s</text>'
+               % (x0 + 14, MARGIN_TOP + height // 2, escape(y_label)))
+
+    for i, name in enumerate(sorted(series)):
+        color = COLORS[i % len(COLORS)]
+        points = ' '.join('%.1f,%.1f' % (px(p[0]), py(p[column])) for p in series[name])
+        out.append('<polyline points="%s" fill="none" stroke="%s" stroke-width="2"/>'
+                   % (points, color))
+        for p in series[name]:
+            out.append('<circle cx="%.1f" cy="%.1f" r="3" fill="%s"/>'
+                       % (px(p[0]), py(p[column]), color))
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.stderr.write('usage: %s BENCH_JSON... > plot.svg\n' % sys.argv[0])
+        return 1
+    series = load_series(sys.argv[1:])
+    if not series:
+        sys.stderr.write('no synthetic results; run bench with --shape\n')
+        return 1
+
+    total_width = 2 * PANEL_WIDTH + LEGEND_WIDTH
+    out = ['<svg xmlns="http://www.w3.org/2000/svg" width="%d" height="%d" '
+           'font-family="sans-serif" font-size="11">'
+           % (total_width, max(PANEL_HEIGHT, 30 + 16 * len(series)))]
+    out.append('<rect width="100%" height="100%" fill="#fff"/>')
+    panel(out, 0, 'Throughput', series, 1, 'MB/s', lambda v: '%g' % v)
+    panel(out, PANEL_WIDTH, 'Peak allocation', series, 2, 'bytes', format_bytes)
+    for i, name in enumerate(sorted(series)):
+        y = MARGIN_TOP + 16 * i
+        x = 2 * PANEL_WIDTH
+        out.append('<line x1="%d" y1="%d" x2="%d" y2="%d" stroke="%s" stroke-width="2"/>'
+                   % (x, y - 4, x + 20, y - 4, COLORS[i % len(COLORS)]))
+        out.append('<text x="%d" y="%d">%s</text>' % (x + 26, y, escape(name)))
+    out.append('</svg>')
+    sys.stdout.write('\n'.join(out) + '\n')
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
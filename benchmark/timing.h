@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+// Clock, percentile, and CPU pinning helpers shared by the benchmarks.
+
+typedef std::chrono::steady_clock benchmark_clock;
+
+inline double elapsed_seconds(benchmark_clock::time_point since) {
+    return std::chrono::duration<double>(benchmark_clock::now() - since).count();
+}
+
+struct sample_stats {
+    size_t samples;
+    double min_ns;
+    double median_ns;
+    double p99_ns;
+    double mean_ns;
+};
+
+inline sample_stats summarize(std::vector<double>& ns) {
+    std::sort(ns.begin(), ns.end());
+    const size_t n = ns.size();
+    sample_stats stats;
+    stats.samples = n;
+    stats.min_ns = ns[0];
+    stats.median_ns = n % 2 ? ns[n / 2] : (ns[n / 2 - 1] + ns[n / 2]) / 2;
+    // The smallest sample at or above 99% of them.
+    stats.p99_ns = ns[(n * 99 + 99) / 100 - 1];
+    double total = 0;
+    for (double t : ns) {
+        total += t;
+    }
+    stats.mean_ns = total / n;
+    return stats;
+}
+
+// Pins the benchmark to one CPU so it is not migrated mid-sample.
+// -2 picks the CPU it is running on now and -1 does nothing.  Returns
+// the CPU, or -1 if not pinned.
+inline int pin_cpu(int cpu) {
+#ifdef __linux__
+    if (cpu == -2) {
+        cpu = sched_getcpu();
+    }
+    if (cpu < 0) {
+        return -1;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        perror("sched_setaffinity failed");
+        return -1;
+    }
+    return cpu;
+#else
+    (void)cpu;
+    return -1;
+#endif
+}
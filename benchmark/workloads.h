@@ -0,0 +1,260 @@
+#pragma once
+
+#include <assert.h>
+#include <string.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sajson.h>
+#include "corpus.h"
+
+// Queries run against a freshly parsed testdata/ document, so traversal,
+// lookup, and AST layout costs are measured along with parsing.  Each
+// returns a checksum that depends on everything it read.
+
+class workload {
+public:
+    virtual ~workload() {}
+
+    virtual const char* get_name() const = 0;
+    virtual const char* get_file() const = 0;
+
+    // Called once, untimed, with a parse of get_file().  Returns false if
+    // the document does not have the expected shape.
+    virtual bool prepare(const sajson::value& root) {
+        (void)root;
+        return true;
+    }
+
+    virtual double run(const sajson::value& root) = 0;
+};
+
+namespace workloads {
+    inline sajson::value get_key(const sajson::value& object, const char* key) {
+        return object.get_value_of_key(sajson::literal(key));
+    }
+
+    inline bool has_key(const sajson::value& object, const char* key) {
+        return object.get_type() == sajson::TYPE_OBJECT
+            && object.find_object_key(sajson::literal(key)) != object.get_length();
+    }
+
+    // statuses[*].user.screen_name
+    class screen_names : public workload {
+    public:
+        const char* get_name() const override {
+            return "screen_names";
+        }
+
+        const char* get_file() const override {
+            return "testdata/twitter.json";
+        }
+
+        bool prepare(const sajson::value& root) override {
+            return has_key(root, "statuses");
+        }
+
+        double run(const sajson::value& root) override {
+            size_t total = 0;
+            for (const sajson::value& status : get_key(root, "statuses").get_array_elements()) {
+                const sajson::value name = get_key(get_key(status, "user"), "screen_name");
+                total += name.get_string_length() + static_cast<unsigned char>(name.as_cstring()[0]);
+            }
+            return static_cast<double>(total);
+        }
+    };
+
+    // The sum of every vertex position, normal, and texture coordinate.
+    class mesh_sum : public workload {
+    public:
+        const char* get_name() const override {
+            return "mesh_sum";
+        }
+
+        const char* get_file() const override {
+            return "testdata/mesh.json";
+        }
+
+        bool prepare(const sajson::value& root) override {
+            return has_key(root, "positions") && has_key(root, "normals") && has_key(root, "tex0");
+        }
+
+        double run(const sajson::value& root) override {
+            static const char* const arrays[] = {"positions", "normals", "tex0"};
+            double total = 0;
+            for (const char* name : arrays) {
+                const sajson::value coordinates = get_key(root, name);
+                const size_t length = coordinates.get_length();
+                for (size_t i = 0; i < length; ++i) {
+                    total += coordinates.get_array_element(i).get_number_value();
+                }
+            }
+            return total;
+        }
+    };
+
+    // Looks up plugins by name in random order, a tenth of them absent,
+    // and reads each one's version.
+    class plugin_lookups : public workload {
+    public:
+        const char* get_name() const override {
+            return "plugin_lookups";
+        }
+
+        const char* get_file() const override {
+            return "testdata/update-center.json";
+        }
+
+        bool prepare(const sajson::value& root) override {
+            if (!has_key(root, "plugins")) {
+                return false;
+            }
+            const sajson::value plugins = get_key(root, "plugins");
+            std::vector<std::string> names;
+            for (const sajson::object_member& plugin : plugins.get_object_members()) {
+                names.push_back(std::string(plugin.get_key().data(), plugin.get_key().length()));
+            }
+            if (names.empty()) {
+                return false;
+            }
+
+            corpus::random r(names.size());
+            keys.clear();
+            for (size_t i = 0; i < lookup_count; ++i) {
+                std::string name = names[r.below(static_cast<uint32_t>(names.size()))];
+                if (r.below(10) == 0) {
+                    name += "-missing";
+                }
+                keys.push_back(name);
+            }
+            return true;
+        }
+
+        double run(const sajson::value& root) override {
+            const sajson::value plugins = get_key(root, "plugins");
+            size_t total = 0;
+            for (const std::string& key : keys) {
+                const size_t i = plugins.find_object_key(sajson::string(key.data(), key.size()));
+                if (i != plugins.get_length()) {
+                    const sajson::value plugin = plugins.get_object_value(i);
+                    total += get_key(plugin, "version").get_string_length();
+                } else {
+                    ++total;
+                }
+            }
+            return static_cast<double>(total);
+        }
+
+    private:
+        static const size_t lookup_count = 1000;
+        std::vector<std::string> keys;
+    };
+
+    // The full-document walk from example/main.cpp.
+    class traverse : public workload {
+    public:
+        const char* get_name() const override {
+            return "traverse";
+        }
+
+        const char* get_file() const override {
+            return "testdata/twitter.json";
+        }
+
+        double run(const sajson::value& root) override {
+            stats s;
+            walk(s, root);
+            return s.null_count + s.false_count + s.true_count + s.number_count
+                + s.object_count + s.array_count + s.string_count
+                + s.total_string_length + s.total_array_length + s.total_object_length
+                + s.total_number_value;
+        }
+
+    private:
+        struct stats {
+            stats()
+                : null_count(0)
+                , false_count(0)
+                , true_count(0)
+                , number_count(0)
+                , object_count(0)
+                , array_count(0)
+                , string_count(0)
+                , total_string_length(0)
+                , total_array_length(0)
+                , total_object_length(0)
+                , total_number_value(0)
+            {}
+
+            size_t null_count;
+            size_t false_count;
+            size_t true_count;
+            size_t number_count;
+            size_t object_count;
+            size_t array_count;
+            size_t string_count;
+
+            size_t total_string_length;
+            size_t total_array_length;
+            size_t total_object_length;
+            double total_number_value;
+        };
+
+        static void walk(stats& s, const sajson::value& node) {
+            using namespace sajson;
+
+            switch (node.get_type()) {
+                case TYPE_NULL:
+                    ++s.null_count;
+                    break;
+
+                case TYPE_FALSE:
+                    ++s.false_count;
+                    break;
+
+                case TYPE_TRUE:
+                    ++s.true_count;
+                    break;
+
+                case TYPE_ARRAY:
+                    ++s.array_count;
+                    s.total_array_length += node.get_length();
+                    for (const value& element : node.get_array_elements()) {
+                        walk(s, element);
+                    }
+                    break;
+
+                case TYPE_OBJECT:
+                    ++s.object_count;
+                    s.total_object_length += node.get_length();
+                    for (const object_member& member : node.get_object_members()) {
+                        walk(s, member.get_value());
+                    }
+                    break;
+
+                case TYPE_STRING:
+                    ++s.string_count;
+                    s.total_string_length += node.get_string_length();
+                    break;
+
+                case TYPE_DOUBLE:
+                case TYPE_INTEGER:
+                    ++s.number_count;
+                    s.total_number_value += node.get_number_value();
+                    break;
+
+                default:
+                    assert(false && "unknown node type");
+            }
+        }
+    };
+
+    inline std::vector<std::unique_ptr<workload>> get_all() {
+        std::vector<std::unique_ptr<workload>> all;
+        all.emplace_back(new screen_names);
+        all.emplace_back(new mesh_sum);
+        all.emplace_back(new plugin_lookups);
+        all.emplace_back(new traverse);
+        return all;
+    }
+}
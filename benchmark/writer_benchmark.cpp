@@ -0,0 +1,218 @@
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <sajson.h>
+#include <sajson_writer.h>
+
+// Compares sajson::writer with the obvious snprintf-based serializer,
+// both on whole documents and on numbers alone.
+
+const char* default_files[] = {
+    "testdata/apache_builds.json",
+    "testdata/github_events.json",
+    "testdata/instruments.json",
+    "testdata/mesh.json",
+    "testdata/mesh.pretty.json",
+    "testdata/nested.json",
+    "testdata/svg_menu.json",
+    "testdata/truenull.json",
+    "testdata/twitter.json",
+    "testdata/update-center.json",
+    "testdata/whitespace.json",
+};
+const size_t default_files_count = sizeof(default_files) / sizeof(*default_files);
+
+void snprintf_write_string(std::string& out, const char* s, size_t length) {
+    out += '"';
+    for (size_t i = 0; i < length; ++i) {
+        const unsigned char c = s[i];
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c < 0x20) {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            out += escape;
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+void snprintf_write(std::string& out, const sajson::value& v) {
+    char number[32];
+    switch (v.get_type()) {
+        case sajson::TYPE_ARRAY:
+            out += '[';
+            for (size_t i = 0; i < v.get_length(); ++i) {
+                if (i) {
+                    out += ',';
+                }
+                snprintf_write(out, v.get_array_element(i));
+            }
+            out += ']';
+            break;
+        case sajson::TYPE_OBJECT:
+            out += '{';
+            for (size_t i = 0; i < v.get_length(); ++i) {
+                if (i) {
+                    out += ',';
+                }
+                const sajson::string key = v.get_object_key(i);
+                snprintf_write_string(out, key.data(), key.length());
+                out += ':';
+                snprintf_write(out, v.get_object_value(i));
+            }
+            out += '}';
+            break;
+        case sajson::TYPE_INTEGER:
+            snprintf(number, sizeof(number), "%d", v.get_integer_value());
+            out += number;
+            break;
+        case sajson::TYPE_DOUBLE:
+            snprintf(number, sizeof(number), "%.17g", v.get_double_value());
+            out += number;
+            break;
+        case sajson::TYPE_NULL:
+            out += "null";
+            break;
+        case sajson::TYPE_FALSE:
+            out += "false";
+            break;
+        case sajson::TYPE_TRUE:
+            out += "true";
+            break;
+        case sajson::TYPE_STRING:
+            snprintf_write_string(out, v.as_cstring(), v.get_string_length());
+            break;
+    }
+}
+
+// Returns the minimum time of N runs of f, in milliseconds.
+template<typename F>
+double time_minimum(size_t N, F f) {
+    clock_t minimum_each = std::numeric_limits<clock_t>::max();
+    for (size_t i = 0; i < N; ++i) {
+        clock_t before_each = clock();
+        f();
+        minimum_each = std::min(minimum_each, clock() - before_each);
+    }
+    return 1000.0 * minimum_each / CLOCKS_PER_SEC;
+}
+
+void run_benchmark(size_t max_string_length, const char* filename) {
+    FILE* file = fopen(filename, "rb");
+    if (!file) {
+        perror("fopen failed");
+        return;
+    }
+
+    std::unique_ptr<FILE, int(*)(FILE*)> deleter(file, fclose);
+
+    if (fseek(file, 0, SEEK_END)) {
+        perror("fseek failed");
+        return;
+    }
+    size_t length = ftell(file);
+    if (fseek(file, 0, SEEK_SET)) {
+        perror("fseek failed");
+        return;
+    }
+
+    std::vector<char> buffer(length);
+    if (fread(buffer.data(), length, 1, file) != 1) {
+        perror("fread failed");
+        return;
+    }
+
+    deleter.reset();
+
+    const sajson::document& document = sajson::parse(sajson::string(buffer.data(), buffer.size()));
+    if (!document.is_valid()) {
+        fprintf(stderr, "%s: %s\n", filename, document.get_error_message_as_cstring());
+        return;
+    }
+    const sajson::value& root = document.get_root();
+
+    const size_t N = 200;
+    sajson::writer w;
+    double writer_ms = time_minimum(N, [&] {
+        w.clear();
+        w.write(root);
+    });
+    std::string out;
+    double snprintf_ms = time_minimum(N, [&] {
+        out.clear();
+        snprintf_write(out, root);
+    });
+
+    printf("%*s - %8.3f ms - %8.3f ms - %5.1fx\n",
+        static_cast<int>(max_string_length), filename,
+        writer_ms, snprintf_ms, writer_ms > 0 ? snprintf_ms / writer_ms : 0.0);
+}
+
+void run_numbers() {
+    std::mt19937_64 random(1);
+    std::uniform_real_distribution<double> distribution(-1e9, 1e9);
+    std::vector<double> doubles(100000);
+    std::vector<int> integers(doubles.size());
+    for (size_t i = 0; i < doubles.size(); ++i) {
+        doubles[i] = distribution(random);
+        integers[i] = static_cast<int>(random());
+    }
+
+    char buffer[32];
+    size_t sink = 0;
+    const size_t N = 20;
+    double format_double_ms = time_minimum(N, [&] {
+        for (double d : doubles) {
+            sink += sajson::internal::format_double(d, buffer) - buffer;
+        }
+    });
+    double snprintf_double_ms = time_minimum(N, [&] {
+        for (double d : doubles) {
+            sink += snprintf(buffer, sizeof(buffer), "%.17g", d);
+        }
+    });
+    double format_integer_ms = time_minimum(N, [&] {
+        for (int i : integers) {
+            sink += sajson::internal::format_integer(i, buffer) - buffer;
+        }
+    });
+    double snprintf_integer_ms = time_minimum(N, [&] {
+        for (int i : integers) {
+            sink += snprintf(buffer, sizeof(buffer), "%d", i);
+        }
+    });
+
+    printf("\n%zu numbers - %8s - %8s\n", doubles.size(), "sajson", "snprintf");
+    printf("doubles     - %5.3f ms - %5.3f ms\n", format_double_ms, snprintf_double_ms);
+    printf("integers    - %5.3f ms - %5.3f ms\n", format_integer_ms, snprintf_integer_ms);
+    if (!sink) {
+        printf("\n");
+    }
+}
+
+int main(int argc, const char** argv) {
+    const char** files = default_files;
+    size_t files_count = default_files_count;
+    if (argc > 1) {
+        files = argv + 1;
+        files_count = argc - 1;
+    }
+
+    size_t max_string_length = 0;
+    for (size_t i = 0; i < files_count; ++i) {
+        max_string_length = std::max(max_string_length, strlen(files[i]));
+    }
+    printf("%*s - %11s - %11s - %6s\n", static_cast<int>(max_string_length), "file", "writer", "snprintf", "ratio");
+    printf("%*s - %11s - %11s - %6s\n", static_cast<int>(max_string_length), "----", "------", "--------", "-----");
+    for (size_t i = 0; i < files_count; ++i) {
+        run_benchmark(max_string_length, files[i]);
+    }
+
+    run_numbers();
+}
@@ -58,20 +58,18 @@ void traverse(jsonstats& stats, const sajson::value& node) {
 
         case TYPE_ARRAY: {
             ++stats.array_count;
-            auto length = node.get_length();
-            stats.total_array_length += length;
-            for (size_t i = 0; i < length; ++i) {
-                traverse(stats, node.get_array_element(i));
+            stats.total_array_length += node.get_length();
+            for (const value& element : node.get_array_elements()) {
+                traverse(stats, element);
             }
             break;
         }
 
         case TYPE_OBJECT: {
             ++stats.object_count;
-            auto length = node.get_length();
-            stats.total_object_length += length;
-            for (auto i = 0u; i < length; ++i) {
-                traverse(stats,node.get_object_value(i));
+            stats.total_object_length += node.get_length();
+            for (const object_member& member : node.get_object_members()) {
+                traverse(stats, member.get_value());
             }
             break;
         }
@@ -110,7 +108,7 @@ int main(int argc, char** argv) {
     }
     fclose(file);
     
-    const sajson::document& document = sajson::parse(sajson::dynamic_allocation(), mutable_string_view(length, buffer));
+    const sajson::document& document = sajson::parse(sajson::string(buffer, length));
     if (!success(document)) {
         return 1;
     }
@@ -27,11 +27,13 @@
 #include <assert.h>
 #include <stdarg.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 #include <math.h>
 #include <limits.h>
 #include <algorithm>
 #include <cstdio>
+#include <iterator>
 #include <limits>
 
 #ifndef SAJSON_NO_STD_STRING
@@ -55,6 +57,17 @@
 #define SAJSON_UNREACHABLE() assert(!"unreachable")
 #endif
 
+#if !defined(SAJSON_NO_MMAP) && (defined(__unix__) || defined(__APPLE__))
+#define SAJSON_HAS_MMAP 1
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) && !defined(SAJSON_NO_SIMD)
+#define SAJSON_HAS_SSE2 1
+#include <emmintrin.h>
+#endif
+
 namespace sajson {
     namespace internal {
         // This template utilizes the One Definition Rule to create global arrays in a header.
@@ -67,18 +80,19 @@ namespace sajson {
 
         // bit 0 (1) - set if: plain ASCII string character
         // bit 1 (2) - set if: whitespace
+        // bit 2 (4) - set if: " [ ] { }
         // bit 4 (0x10) - set if: 0-9 e E .
         template<typename unused>
         const uint8_t globals_struct<unused>::parse_flags[256] = {
          // 0    1    2    3    4    5    6    7      8    9    A    B    C    D    E    F
             0,   0,   0,   0,   0,   0,   0,   0,     0,   2,   2,   0,   0,   2,   0,   0, // 0
             0,   0,   0,   0,   0,   0,   0,   0,     0,   0,   0,   0,   0,   0,   0,   0, // 1
-            3,   1,   0,   1,   1,   1,   1,   1,     1,   1,   1,   1,   1,   1,   0x11,1, // 2
+            3,   1,   4,   1,   1,   1,   1,   1,     1,   1,   1,   1,   1,   1,   0x11,1, // 2
             0x11,0x11,0x11,0x11,0x11,0x11,0x11,0x11,  0x11,0x11,1,   1,   1,   1,   1,   1, // 3
             1,   1,   1,   1,   1,   0x11,1,   1,     1,   1,   1,   1,   1,   1,   1,   1, // 4
-            1,   1,   1,   1,   1,   1,   1,   1,     1,   1,   1,   1,   0,   1,   1,   1, // 5
+            1,   1,   1,   1,   1,   1,   1,   1,     1,   1,   1,   5,   0,   5,   1,   1, // 5
             1,   1,   1,   1,   1,   0x11,1,   1,     1,   1,   1,   1,   1,   1,   1,   1, // 6
-            1,   1,   1,   1,   1,   1,   1,   1,     1,   1,   1,   1,   1,   1,   1,   1, // 7
+            1,   1,   1,   1,   1,   1,   1,   1,     1,   1,   1,   5,   1,   5,   1,   1, // 7
 
          // 128-255
             0,0,0,0,0,0,0,0,  0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0,  0,0,0,0,0,0,0,0,
@@ -96,6 +110,11 @@ namespace sajson {
             //return c == '\r' || c == '\n' || c == '\t' || c == ' ';
             return (globals::parse_flags[static_cast<unsigned char>(c)] & 2) != 0;
         }
+
+        inline bool is_bracket_or_quote(char c) {
+            //return c == '"' || c == '[' || c == ']' || c == '{' || c == '}';
+            return (globals::parse_flags[static_cast<unsigned char>(c)] & 4) != 0;
+        }
     }
 
     enum type: uint8_t {
@@ -213,7 +232,10 @@ namespace sajson {
         };
 
         static void store(size_t* location, int value) {
+            // Zero the rest of the word so equal documents have identical
+            // ASTs.
             integer_storage is;
+            is.u = 0;
             is.i = value;
             *location = is.u;
         }
@@ -260,6 +282,10 @@ namespace sajson {
     // TODO: reinstate with c++03 implementation
     //static_assert(sizeof(double_storage) == sizeof(double), "double_storage should have same size as double");
 
+    class array_iterator;
+    class object_iterator;
+    template<typename Iterator> class value_range;
+
     class value {
     public:
         explicit value(type value_type, const size_t* payload, const char* text)
@@ -299,6 +325,18 @@ namespace sajson {
             return value(get_element_type(element), payload + get_element_value(element), text);
         }
 
+        // valid iff get_type() is TYPE_ARRAY
+        //
+        //     for (const sajson::value& element : v.get_array_elements()) ...
+        //
+        // Cheaper than get_array_element() in a loop: the iterator steps
+        // through the element words and nothing else.
+        value_range<array_iterator> get_array_elements() const;
+
+        // valid iff get_type() is TYPE_OBJECT
+        // Yields object_members in the AST's sorted key order.
+        value_range<object_iterator> get_object_members() const;
+
         // valid iff get_type() is TYPE_OBJECT
         value get_value_of_key(const string& key) const {
             assert_type(TYPE_OBJECT);
@@ -415,11 +453,163 @@ namespace sajson {
             assert(i < get_length());
         }
 
-        const type value_type;
-        const size_t* const payload;
-        const char* const text;
+        type value_type;
+        const size_t* payload;
+        const char* text;
+    };
+
+    // Steps through an array's element words.  All of its state is three
+    // pointers, so loops over it stay in registers.
+    class array_iterator {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef sajson::value value_type;
+        typedef ptrdiff_t difference_type;
+        typedef void pointer;
+        typedef sajson::value reference;
+
+        array_iterator(const size_t* element, const size_t* payload, const char* text)
+            : element(element)
+            , payload(payload)
+            , text(text)
+        {}
+
+        value operator*() const {
+            const size_t e = *element;
+            return value(get_element_type(e), payload + get_element_value(e), text);
+        }
+
+        array_iterator& operator++() {
+            ++element;
+            return *this;
+        }
+
+        array_iterator operator++(int) {
+            array_iterator previous = *this;
+            ++element;
+            return previous;
+        }
+
+        bool operator==(const array_iterator& other) const {
+            return element == other.element;
+        }
+
+        bool operator!=(const array_iterator& other) const {
+            return element != other.element;
+        }
+
+    private:
+        const size_t* element;
+        const size_t* payload;
+        const char* text;
+    };
+
+    // One member of an object, decoded only as far as it is used.
+    class object_member {
+    public:
+        object_member(const size_t* record, const size_t* payload, const char* text)
+            : record(record)
+            , payload(payload)
+            , text(text)
+        {}
+
+        string get_key() const {
+            return string(text + record[0], record[1] - record[0]);
+        }
+
+        value get_value() const {
+            const size_t e = record[2];
+            return value(get_element_type(e), payload + get_element_value(e), text);
+        }
+
+    private:
+        const size_t* record;
+        const size_t* payload;
+        const char* text;
+    };
+
+    // Steps through an object's key records.
+    class object_iterator {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef object_member value_type;
+        typedef ptrdiff_t difference_type;
+        typedef void pointer;
+        typedef object_member reference;
+
+        object_iterator(const size_t* record, const size_t* payload, const char* text)
+            : record(record)
+            , payload(payload)
+            , text(text)
+        {}
+
+        object_member operator*() const {
+            return object_member(record, payload, text);
+        }
+
+        object_iterator& operator++() {
+            record += 3;
+            return *this;
+        }
+
+        object_iterator operator++(int) {
+            object_iterator previous = *this;
+            record += 3;
+            return previous;
+        }
+
+        bool operator==(const object_iterator& other) const {
+            return record == other.record;
+        }
+
+        bool operator!=(const object_iterator& other) const {
+            return record != other.record;
+        }
+
+    private:
+        const size_t* record;
+        const size_t* payload;
+        const char* text;
+    };
+
+    // A begin and end pair for range-based for loops.
+    template<typename Iterator>
+    class value_range {
+    public:
+        value_range(Iterator first, Iterator last)
+            : first(first)
+            , last(last)
+        {}
+
+        Iterator begin() const {
+            return first;
+        }
+
+        Iterator end() const {
+            return last;
+        }
+
+    private:
+        Iterator first;
+        Iterator last;
     };
 
+    inline value_range<array_iterator> value::get_array_elements() const {
+        assert_type(TYPE_ARRAY);
+        const size_t* const elements = payload + 1;
+        return value_range<array_iterator>(
+            array_iterator(elements, payload, text),
+            array_iterator(elements + payload[0], payload, text));
+    }
+
+    inline value_range<object_iterator> value::get_object_members() const {
+        assert_type(TYPE_OBJECT);
+        const size_t* const records = payload + 1;
+        return value_range<object_iterator>(
+            object_iterator(records, payload, text),
+            object_iterator(records + 3 * payload[0], payload, text));
+    }
+
     enum error {
         ERROR_SUCCESS,
         ERROR_OUT_OF_MEMORY,
@@ -443,20 +633,297 @@ namespace sajson {
         ERROR_INVALID_UTF16_TRAIL_SURROGATE,
         ERROR_UNKNOWN_ESCAPE,
         ERROR_INVALID_UTF8,
+        ERROR_INVALID_PROJECTION,
+        ERROR_INVALID_SNAPSHOT,
+        ERROR_IO,
+        ERROR_INVALID_PATCH,
+        ERROR_PATCH_FAILED,
+        ERROR_TYPE_MISMATCH,
+        ERROR_NESTING_TOO_DEEP,
     };
 
+    namespace internal {
+        inline const char* get_error_text(error error_code) {
+            switch (error_code) {
+                case ERROR_SUCCESS: return "no error";
+                case ERROR_OUT_OF_MEMORY: return  "out of memory";
+                case ERROR_UNEXPECTED_END: return  "unexpected end of input";
+                case ERROR_MISSING_ROOT_ELEMENT: return  "missing root element";
+                case ERROR_BAD_ROOT: return  "document root must be object or array";
+                case ERROR_EXPECTED_COMMA: return  "expected ,";
+                case ERROR_MISSING_OBJECT_KEY: return  "missing object key";
+                case ERROR_EXPECTED_COLON: return  "expected :";
+                case ERROR_EXPECTED_END_OF_INPUT: return  "expected end of input";
+                case ERROR_UNEXPECTED_COMMA: return  "unexpected comma";
+                case ERROR_EXPECTED_VALUE: return  "expected value";
+                case ERROR_EXPECTED_NULL: return  "expected 'null'";
+                case ERROR_EXPECTED_FALSE: return  "expected 'false'";
+                case ERROR_EXPECTED_TRUE: return  "expected 'true'";
+                case ERROR_MSSING_EXPONENT: return  "missing exponent";
+                case ERROR_ILLEGAL_CODEPOINT: return  "illegal unprintable codepoint in string";
+                case ERROR_INVALID_UNICODE_ESCAPE: return  "invalid character in unicode escape";
+                case ERROR_UNEXPECTED_END_OF_UTF16: return  "unexpected end of input during UTF-16 surrogate pair";
+                case ERROR_EXPECTED_U: return  "expected \\u";
+                case ERROR_INVALID_UTF16_TRAIL_SURROGATE: return  "invalid UTF-16 trail surrogate";
+                case ERROR_UNKNOWN_ESCAPE: return  "unknown escape";
+                case ERROR_INVALID_UTF8: return  "invalid UTF-8";
+                case ERROR_INVALID_PROJECTION: return  "invalid projection";
+                case ERROR_INVALID_SNAPSHOT: return  "invalid snapshot";
+                case ERROR_IO: return  "I/O error";
+                case ERROR_INVALID_PATCH: return  "invalid patch operation";
+                case ERROR_PATCH_FAILED: return  "patch operation failed";
+                case ERROR_TYPE_MISMATCH: return  "value does not match the bound type";
+                case ERROR_NESTING_TOO_DEEP: return  "nesting too deep";
+            }
+
+            SAJSON_UNREACHABLE();
+        }
+
+        // Formats the message for an error into buffer, which holds
+        // buffer_length bytes.
+        inline void format_error_message(char* buffer, size_t buffer_length, error error_code, int error_arg) {
+            buffer[buffer_length - 1] = 0;
+            // The argument is the code point for ERROR_ILLEGAL_CODEPOINT,
+            // the operation's index for patch errors, and the errno for
+            // ERROR_IO.
+            int written = error_code == ERROR_ILLEGAL_CODEPOINT
+                    || error_code == ERROR_INVALID_PATCH
+                    || error_code == ERROR_PATCH_FAILED
+                ? snprintf(buffer, buffer_length - 1, "%s: %d", get_error_text(error_code), error_arg)
+                : error_code == ERROR_IO
+                ? snprintf(buffer, buffer_length - 1, "%s: %s", get_error_text(error_code), strerror(error_arg))
+                : snprintf(buffer, buffer_length - 1, "%s", get_error_text(error_code));
+            (void)written;
+            assert(written >= 0 && static_cast<size_t>(written) < buffer_length);
+        }
+    }
+
     class allocator {
     public:
         virtual void* allocate(size_t) = 0;
         virtual void deallocate(const void*) = 0;
+
+        // Called with a range inside a live allocation whose contents
+        // will never be read again.  Allocators that can return memory
+        // to the operating system without freeing the whole buffer may
+        // do so.  The default does nothing.
+        virtual void release_unused(void* begin, size_t size) {
+            (void)begin;
+            (void)size;
+        }
     };
 
+    namespace internal {
+        // Records, one bit per nesting level, whether each open structure
+        // is an array or an object.  This is all the state the
+        // grammar needs when no AST is being built.  The first levels are
+        // stored inline; deeper documents spill into allocated memory.
+        class structure_stack {
+        public:
+            explicit structure_stack(allocator& alloc)
+                : alloc(alloc)
+                , words(inline_words)
+                , capacity(INLINE_WORDS * WORD_BITS)
+                , depth(0)
+            {}
+
+            ~structure_stack() {
+                if (words != inline_words) {
+                    alloc.deallocate(words);
+                }
+            }
+
+            structure_stack(const structure_stack&) = delete;
+            void operator=(const structure_stack&) = delete;
+
+            bool empty() const {
+                return depth == 0;
+            }
+
+            size_t get_depth() const {
+                return depth;
+            }
+
+            // Returns false if memory could not be allocated.
+            bool push(type structure_type) {
+                assert(structure_type == TYPE_ARRAY || structure_type == TYPE_OBJECT);
+                if (SAJSON_UNLIKELY(depth == capacity) && !grow()) {
+                    return false;
+                }
+                const size_t bit = size_t(1) << (depth % WORD_BITS);
+                if (structure_type == TYPE_OBJECT) {
+                    words[depth / WORD_BITS] |= bit;
+                } else {
+                    words[depth / WORD_BITS] &= ~bit;
+                }
+                ++depth;
+                return true;
+            }
+
+            type top() const {
+                assert(depth > 0);
+                const size_t index = depth - 1;
+                const size_t bit = size_t(1) << (index % WORD_BITS);
+                return (words[index / WORD_BITS] & bit) ? TYPE_OBJECT : TYPE_ARRAY;
+            }
+
+            type pop() {
+                type result = top();
+                --depth;
+                return result;
+            }
+
+        private:
+            bool grow() {
+                const size_t word_count = 2 * capacity / WORD_BITS;
+                size_t* new_words = static_cast<size_t*>(alloc.allocate(word_count * sizeof(size_t)));
+                if (!new_words) {
+                    return false;
+                }
+                memcpy(new_words, words, capacity / WORD_BITS * sizeof(size_t));
+                if (words != inline_words) {
+                    alloc.deallocate(words);
+                }
+                words = new_words;
+                capacity *= 2;
+                return true;
+            }
+
+            enum { INLINE_WORDS = 2 };
+            static const size_t WORD_BITS = sizeof(size_t) * CHAR_BIT;
+
+            allocator& alloc;
+            size_t* words;
+            size_t capacity;
+            size_t depth;
+            size_t inline_words[INLINE_WORDS];
+        };
+
+        // A stack of words, stored inline until it outgrows INLINE_WORDS.
+        class word_stack {
+        public:
+            explicit word_stack(allocator& alloc)
+                : alloc(alloc)
+                , words(inline_words)
+                , capacity(INLINE_WORDS)
+                , size(0)
+            {}
+
+            ~word_stack() {
+                if (words != inline_words) {
+                    alloc.deallocate(words);
+                }
+            }
+
+            word_stack(const word_stack&) = delete;
+            void operator=(const word_stack&) = delete;
+
+            // Returns false if memory could not be allocated.
+            bool push(size_t word) {
+                if (SAJSON_UNLIKELY(size == capacity) && !grow()) {
+                    return false;
+                }
+                words[size++] = word;
+                return true;
+            }
+
+            size_t pop() {
+                assert(size > 0);
+                return words[--size];
+            }
+
+            void reset(size_t new_size) {
+                assert(new_size <= size);
+                size = new_size;
+            }
+
+            size_t get_size() const {
+                return size;
+            }
+
+            size_t* get_top() {
+                return words + size;
+            }
+
+            size_t* get_pointer_from_offset(size_t offset) {
+                return words + offset;
+            }
+
+        private:
+            bool grow() {
+                size_t* new_words = static_cast<size_t*>(alloc.allocate(2 * capacity * sizeof(size_t)));
+                if (!new_words) {
+                    return false;
+                }
+                memcpy(new_words, words, capacity * sizeof(size_t));
+                if (words != inline_words) {
+                    alloc.deallocate(words);
+                }
+                words = new_words;
+                capacity *= 2;
+                return true;
+            }
+
+            enum { INLINE_WORDS = 8 };
+
+            allocator& alloc;
+            size_t* words;
+            size_t capacity;
+            size_t size;
+            size_t inline_words[INLINE_WORDS];
+        };
+
+        // The object key paths kept by a projection, as a trie.  Node 0
+        // is the root; the edges leaving node n are
+        // edges[first_edge[n]] through edges[first_edge[n + 1] - 1].  An
+        // edge leads either to another node or, where a path ends, to
+        // KEEP_ALL.
+        struct projection_trie {
+            static const size_t KEEP_ALL = static_cast<size_t>(-1);
+            static const size_t NOT_FOUND = static_cast<size_t>(-2);
+
+            struct edge {
+                size_t parent;
+                size_t key_offset;
+                size_t key_length;
+                size_t target;
+            };
+
+            // Returns the target of the edge from node named key, or
+            // NOT_FOUND.  Nodes rarely have more than a handful of edges,
+            // so a linear scan beats anything cleverer.
+            size_t find_child(size_t node, const string& key) const {
+                const edge* e = edges + first_edge[node];
+                const edge* const end = edges + first_edge[node + 1];
+                for (; e != end; ++e) {
+                    if (e->key_length == key.length()
+                        && memcmp(text + e->key_offset, key.data(), key.length()) == 0
+                    ) {
+                        return e->target;
+                    }
+                }
+                return NOT_FOUND;
+            }
+
+            const edge* edges;
+            const size_t* first_edge;
+            const char* text;
+            size_t root; // 0, or KEEP_ALL if everything is kept
+        };
+    }
+
     class data_storage {
     public:
         data_storage(char* input, bool owns_input, size_t* structure, size_t length, allocator& alloc)
+            : data_storage(input, owns_input, structure, length, length, alloc)
+        {
+        }
+
+        data_storage(char* input, bool owns_input, size_t* structure, size_t length, size_t structure_length, allocator& alloc)
             : input(input)
             , structure(structure)
             , length(length)
+            , structure_length(structure_length)
             , alloc(alloc)
             , owns_input(owns_input)
         {
@@ -466,12 +933,14 @@ namespace sajson {
             : input(rhs.input)
             , structure(rhs.structure)
             , length(rhs.length)
+            , structure_length(rhs.structure_length)
             , alloc(rhs.alloc)
             , owns_input(rhs.owns_input)
         {
             rhs.input = nullptr;
             rhs.structure = nullptr;
             rhs.length = 0;
+            rhs.structure_length = 0;
         }
         data_storage(const data_storage&) = delete;
         ~data_storage() {
@@ -487,12 +956,52 @@ namespace sajson {
         }
 
         size_t* structure_end() const {
-            return structure + length;
+            return structure + structure_length;
+        }
+
+        allocator& get_allocator() const {
+            return alloc;
+        }
+
+        // The parse stack grows up from structure and the AST grows down
+        // from structure_end(), so once parsing is done, everything below
+        // the AST is garbage.
+        void release_structure_below(size_t* ast_begin) {
+            if (structure && ast_begin > structure) {
+                alloc.release_unused(structure, (ast_begin - structure) * sizeof(size_t));
+            }
+        }
+
+        // Moves [ast_begin, structure_end()) into an allocation of exactly
+        // that size and frees the original buffer.  AST offsets are
+        // relative, so the copy remains valid as-is.  Returns the new
+        // location of ast_begin, or null if the allocation failed, in
+        // which case nothing changes.
+        size_t* shrink_structure(const size_t* ast_begin) {
+            const size_t ast_length = structure_end() - ast_begin;
+            size_t* compacted = static_cast<size_t*>(alloc.allocate(ast_length * sizeof(size_t)));
+            if (!compacted) {
+                return 0;
+            }
+            memcpy(compacted, ast_begin, ast_length * sizeof(size_t));
+            alloc.deallocate(structure);
+            structure = compacted;
+            structure_length = ast_length;
+            return compacted;
+        }
+
+        void free_structure() {
+            if (structure) {
+                alloc.deallocate(structure);
+                structure = nullptr;
+                structure_length = 0;
+            }
         }
 
         char* input;
         size_t* structure;
         size_t length;
+        size_t structure_length;
 
     private:        
         allocator& alloc;
@@ -522,12 +1031,7 @@ namespace sajson {
             , error_code(error_code)
             , error_arg(error_arg)
         {
-            formatted_error_message[ERROR_BUFFER_LENGTH - 1] = 0;
-            int written = has_significant_error_arg()
-                ? snprintf(formatted_error_message, ERROR_BUFFER_LENGTH - 1, "%s: %d", _internal_get_error_text(), error_arg)
-                : snprintf(formatted_error_message, ERROR_BUFFER_LENGTH - 1, "%s", _internal_get_error_text());
-            (void)written;
-            assert(written >= 0 && written < ERROR_BUFFER_LENGTH);
+            internal::format_error_message(formatted_error_message, ERROR_BUFFER_LENGTH, error_code, error_arg);
         }
 
         document(const document&) = delete;
@@ -559,6 +1063,35 @@ namespace sajson {
             return value(root_type, root, storage.input);
         }
 
+        // The structure buffer is allocated for the worst case, but the
+        // AST only occupies its tail.  compact() moves the AST into an
+        // allocation of exactly the right size and frees the original,
+        // which is worthwhile for documents that are kept around.  An
+        // invalid document simply drops its structure buffer.
+        //
+        // Invalidates any values previously obtained from this document.
+        // Returns false, leaving the document untouched, if the
+        // allocation fails.
+        bool compact() {
+            if (!is_valid()) {
+                storage.free_structure();
+                return true;
+            }
+            size_t* new_root = storage.shrink_structure(root);
+            if (!new_root) {
+                return false;
+            }
+            root = new_root;
+            return true;
+        }
+
+        // Number of bytes used by the structure buffer.  Before
+        // compact(), this is the worst-case size; after, it is the size
+        // of the AST.
+        size_t get_structure_size() const {
+            return storage.structure_length * sizeof(size_t);
+        }
+
         size_t get_error_line() const {
             return error_line;
         }
@@ -589,32 +1122,7 @@ namespace sajson {
 
         /// WARNING: Internal function which is subject to change
         const char* _internal_get_error_text() const {
-            switch (error_code) {
-                case ERROR_SUCCESS: return "no error";
-                case ERROR_OUT_OF_MEMORY: return  "out of memory";
-                case ERROR_UNEXPECTED_END: return  "unexpected end of input";
-                case ERROR_MISSING_ROOT_ELEMENT: return  "missing root element";
-                case ERROR_BAD_ROOT: return  "document root must be object or array";
-                case ERROR_EXPECTED_COMMA: return  "expected ,";
-                case ERROR_MISSING_OBJECT_KEY: return  "missing object key";
-                case ERROR_EXPECTED_COLON: return  "expected :";
-                case ERROR_EXPECTED_END_OF_INPUT: return  "expected end of input";
-                case ERROR_UNEXPECTED_COMMA: return  "unexpected comma";
-                case ERROR_EXPECTED_VALUE: return  "expected value";
-                case ERROR_EXPECTED_NULL: return  "expected 'null'";
-                case ERROR_EXPECTED_FALSE: return  "expected 'false'";
-                case ERROR_EXPECTED_TRUE: return  "expected 'true'";
-                case ERROR_MSSING_EXPONENT: return  "missing exponent";
-                case ERROR_ILLEGAL_CODEPOINT: return  "illegal unprintable codepoint in string";
-                case ERROR_INVALID_UNICODE_ESCAPE: return  "invalid character in unicode escape";
-                case ERROR_UNEXPECTED_END_OF_UTF16: return  "unexpected end of input during UTF-16 surrogate pair";
-                case ERROR_EXPECTED_U: return  "expected \\u";
-                case ERROR_INVALID_UTF16_TRAIL_SURROGATE: return  "invalid UTF-16 trail surrogate";
-                case ERROR_UNKNOWN_ESCAPE: return  "unknown escape";
-                case ERROR_INVALID_UTF8: return  "invalid UTF-8";
-            }
-
-            SAJSON_UNREACHABLE();
+            return internal::get_error_text(error_code);
         }
 
         /// WARNING: Internal function exposed only for high-performance language bindings.
@@ -631,14 +1139,21 @@ namespace sajson {
             return storage.input;
         }
 
-    private:
-        bool has_significant_error_arg() const {
-            return error_code == ERROR_ILLEGAL_CODEPOINT;
+        /// WARNING: Internal function which is subject to change
+        size_t _internal_get_input_length() const {
+            return storage.length;
+        }
+
+        /// WARNING: Internal function which is subject to change
+        // The AST runs from the root to the end of the structure buffer.
+        size_t _internal_get_ast_length() const {
+            return storage.structure_end() - root;
         }
 
+    private:
         data_storage storage;
         const type root_type;
-        const size_t* const root;
+        const size_t* root;
         const size_t error_line;
         const size_t error_column;
         const error error_code;
@@ -651,26 +1166,84 @@ namespace sajson {
         char formatted_error_message[ERROR_BUFFER_LENGTH];
     };
     
-    class parser {
+    // The outcome of a parse that does not produce a document, such as
+    // parse_events().  Carries the same error information as document.
+    class parse_result {
     public:
-        parser(data_storage&& storage)
-            : storage(std::move(storage))
-            , write_cursor(this->storage.structure + this->storage.length)
-            , root_type(TYPE_NULL)
-            , error_line(0)
+        parse_result()
+            : error_line(0)
             , error_column(0)
-        {}
+            , error_code(ERROR_SUCCESS)
+            , error_arg(0)
+        {
+            formatted_error_message[0] = 0;
+        }
 
-        document get_document() {
-            // transfering ownership of storage
-            if (parse()) {
-                return document(std::move(storage), root_type, write_cursor);
-            } else {
-                return document(std::move(storage), error_line, error_column, error_code, error_arg);
-            }
+        parse_result(size_t error_line, size_t error_column, error error_code, int error_arg)
+            : error_line(error_line)
+            , error_column(error_column)
+            , error_code(error_code)
+            , error_arg(error_arg)
+        {
+            internal::format_error_message(formatted_error_message, ERROR_BUFFER_LENGTH, error_code, error_arg);
+        }
+
+        bool is_valid() const {
+            return error_code == ERROR_SUCCESS;
+        }
+
+        size_t get_error_line() const {
+            return error_line;
+        }
+
+        size_t get_error_column() const {
+            return error_column;
+        }
+
+#ifndef SAJSON_NO_STD_STRING
+        std::string get_error_message_as_string() const {
+            return formatted_error_message;
+        }
+#endif
+
+        const char* get_error_message_as_cstring() const {
+            return formatted_error_message;
+        }
+
+        /// WARNING: Internal function which is subject to change
+        error _internal_get_error_code() const {
+            return error_code;
+        }
+
+        /// WARNING: Internal function which is subject to change
+        int _internal_get_error_argument() const {
+            return error_arg;
         }
 
     private:
+        size_t error_line;
+        size_t error_column;
+        error error_code;
+        int error_arg;
+
+        enum { ERROR_BUFFER_LENGTH = 128 };
+        char formatted_error_message[ERROR_BUFFER_LENGTH];
+    };
+
+    // The lexical half of the parser: whitespace, literals, numbers,
+    // strings, and error position reporting.  Shared by every parsing mode
+    // so they all agree on what is valid JSON.
+    class parser_base {
+    protected:
+        parser_base(char* input, char* input_end)
+            : input(input)
+            , input_end(input_end)
+            , error_line(0)
+            , error_column(0)
+            , error_code(ERROR_SUCCESS)
+            , error_arg(0)
+        {}
+
         struct error_result {
             operator bool() const {
                 return false;
@@ -681,7 +1254,7 @@ namespace sajson {
         };
 
         bool at_eof(const char* p) {
-            return p == storage.input_end();
+            return p == input_end;
         }
 
         char* skip_whitespace(char* p) {
@@ -691,7 +1264,7 @@ namespace sajson {
             // to optimize for code size here.
             // * https://github.com/chadaustin/Web-Benchmarks/blob/master/json/third-party/pjson/pjson.h#L1873
             for (;;) {
-                if (SAJSON_UNLIKELY(p == storage.input_end())) {
+                if (SAJSON_UNLIKELY(p == input_end)) {
                     return 0;
                 } else if (internal::is_whitespace(*p)) {
                     ++p;
@@ -715,13 +1288,13 @@ namespace sajson {
 
         error_result make_error(char* p, error code, int arg = 0) {
             if (!p) {
-                p = storage.input + (storage.input_end() - storage.input);
+                p = input_end;
             }
 
             error_line = 1;
             error_column = 1;
 
-            char* c = storage.input;
+            char* c = input;
             while (c < p) {
                 if (*c == '\r') {
                     if (c + 1 < p && c[1] == '\n') {
@@ -747,844 +1320,2586 @@ namespace sajson {
             return error_result();
         }
 
-        bool parse() {
-            // p points to the character currently being parsed
-            char* p = storage.input;
+        bool has_remaining_characters(char* p, ptrdiff_t remaining) {
+            return input_end - p >= remaining;
+        }
 
-            stack_head stack(storage.structure);
+        char* parse_null(char* p) {
+            if (SAJSON_UNLIKELY(!has_remaining_characters(p, 4))) {
+                make_error(p, ERROR_UNEXPECTED_END);
+                return 0;
+            }
+            char p1 = p[1];
+            char p2 = p[2];
+            char p3 = p[3];
+            if (SAJSON_UNLIKELY(p1 != 'u' || p2 != 'l' || p3 != 'l')) {
+                make_error(p, ERROR_EXPECTED_NULL);
+                return 0;
+            }
+            return p + 4;
+        }
 
-            p = skip_whitespace(p);
-            if (SAJSON_UNLIKELY(!p)) {
-                return make_error(p, ERROR_MISSING_ROOT_ELEMENT);
+        char* parse_false(char* p) {
+            if (SAJSON_UNLIKELY(!has_remaining_characters(p, 5))) {
+                return make_error(p, ERROR_UNEXPECTED_END);
+            }
+            char p1 = p[1];
+            char p2 = p[2];
+            char p3 = p[3];
+            char p4 = p[4];
+            if (SAJSON_UNLIKELY(p1 != 'a' || p2 != 'l' || p3 != 's' || p4 != 'e')) {
+                return make_error(p, ERROR_EXPECTED_FALSE);
             }
+            return p + 5;
+        }
 
-            // current_base is an offset to the first element of the current structure (object or array)
-            size_t current_base = stack.get_size();
-            type current_structure_type;
-            if (*p == '[') {
-                current_structure_type = TYPE_ARRAY;
-                stack.push(make_element(current_structure_type, ROOT_MARKER));
-                goto array_close_or_element;
-            } else if (*p == '{') {
-                current_structure_type = TYPE_OBJECT;
-                stack.push(make_element(current_structure_type, ROOT_MARKER));
-                goto object_close_or_element;
-            } else {
-                return make_error(p, ERROR_BAD_ROOT);
+        char* parse_true(char* p) {
+            if (SAJSON_UNLIKELY(!has_remaining_characters(p, 4))) {
+                return make_error(p, ERROR_UNEXPECTED_END);
+            }
+            char p1 = p[1];
+            char p2 = p[2];
+            char p3 = p[3];
+            if (SAJSON_UNLIKELY(p1 != 'r' || p2 != 'u' || p3 != 'e')) {
+                return make_error(p, ERROR_EXPECTED_TRUE);
             }
+            return p + 4;
+        }
 
-            // BEGIN STATE MACHINE
+        static double pow10(int exponent) {
+            if (exponent > 308) {
+                return std::numeric_limits<double>::infinity();
+            } else if (exponent < -323) {
+                return 0.0;
+            }
+            static const double constants[] = {
+                1e-323,1e-322,1e-321,1e-320,1e-319,1e-318,1e-317,1e-316,1e-315,1e-314,
+                1e-313,1e-312,1e-311,1e-310,1e-309,1e-308,1e-307,1e-306,1e-305,1e-304,
+                1e-303,1e-302,1e-301,1e-300,1e-299,1e-298,1e-297,1e-296,1e-295,1e-294,
+                1e-293,1e-292,1e-291,1e-290,1e-289,1e-288,1e-287,1e-286,1e-285,1e-284,
+                1e-283,1e-282,1e-281,1e-280,1e-279,1e-278,1e-277,1e-276,1e-275,1e-274,
+                1e-273,1e-272,1e-271,1e-270,1e-269,1e-268,1e-267,1e-266,1e-265,1e-264,
+                1e-263,1e-262,1e-261,1e-260,1e-259,1e-258,1e-257,1e-256,1e-255,1e-254,
+                1e-253,1e-252,1e-251,1e-250,1e-249,1e-248,1e-247,1e-246,1e-245,1e-244,
+                1e-243,1e-242,1e-241,1e-240,1e-239,1e-238,1e-237,1e-236,1e-235,1e-234,
+                1e-233,1e-232,1e-231,1e-230,1e-229,1e-228,1e-227,1e-226,1e-225,1e-224,
+                1e-223,1e-222,1e-221,1e-220,1e-219,1e-218,1e-217,1e-216,1e-215,1e-214,
+                1e-213,1e-212,1e-211,1e-210,1e-209,1e-208,1e-207,1e-206,1e-205,1e-204,
+                1e-203,1e-202,1e-201,1e-200,1e-199,1e-198,1e-197,1e-196,1e-195,1e-194,
+                1e-193,1e-192,1e-191,1e-190,1e-189,1e-188,1e-187,1e-186,1e-185,1e-184,
+                1e-183,1e-182,1e-181,1e-180,1e-179,1e-178,1e-177,1e-176,1e-175,1e-174,
+                1e-173,1e-172,1e-171,1e-170,1e-169,1e-168,1e-167,1e-166,1e-165,1e-164,
+                1e-163,1e-162,1e-161,1e-160,1e-159,1e-158,1e-157,1e-156,1e-155,1e-154,
+                1e-153,1e-152,1e-151,1e-150,1e-149,1e-148,1e-147,1e-146,1e-145,1e-144,
+                1e-143,1e-142,1e-141,1e-140,1e-139,1e-138,1e-137,1e-136,1e-135,1e-134,
+                1e-133,1e-132,1e-131,1e-130,1e-129,1e-128,1e-127,1e-126,1e-125,1e-124,
+                1e-123,1e-122,1e-121,1e-120,1e-119,1e-118,1e-117,1e-116,1e-115,1e-114,
+                1e-113,1e-112,1e-111,1e-110,1e-109,1e-108,1e-107,1e-106,1e-105,1e-104,
+                1e-103,1e-102,1e-101,1e-100,1e-99,1e-98,1e-97,1e-96,1e-95,1e-94,1e-93,
+                1e-92,1e-91,1e-90,1e-89,1e-88,1e-87,1e-86,1e-85,1e-84,1e-83,1e-82,1e-81,
+                1e-80,1e-79,1e-78,1e-77,1e-76,1e-75,1e-74,1e-73,1e-72,1e-71,1e-70,1e-69,
+                1e-68,1e-67,1e-66,1e-65,1e-64,1e-63,1e-62,1e-61,1e-60,1e-59,1e-58,1e-57,
+                1e-56,1e-55,1e-54,1e-53,1e-52,1e-51,1e-50,1e-49,1e-48,1e-47,1e-46,1e-45,
+                1e-44,1e-43,1e-42,1e-41,1e-40,1e-39,1e-38,1e-37,1e-36,1e-35,1e-34,1e-33,
+                1e-32,1e-31,1e-30,1e-29,1e-28,1e-27,1e-26,1e-25,1e-24,1e-23,1e-22,1e-21,
+                1e-20,1e-19,1e-18,1e-17,1e-16,1e-15,1e-14,1e-13,1e-12,1e-11,1e-10,1e-9,
+                1e-8,1e-7,1e-6,1e-5,1e-4,1e-3,1e-2,1e-1,1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,
+                1e8,1e9,1e10,1e11,1e12,1e13,1e14,1e15,1e16,1e17,1e18,1e19,1e20,1e21,
+                1e22,1e23,1e24,1e25,1e26,1e27,1e28,1e29,1e30,1e31,1e32,1e33,1e34,1e35,
+                1e36,1e37,1e38,1e39,1e40,1e41,1e42,1e43,1e44,1e45,1e46,1e47,1e48,1e49,
+                1e50,1e51,1e52,1e53,1e54,1e55,1e56,1e57,1e58,1e59,1e60,1e61,1e62,1e63,
+                1e64,1e65,1e66,1e67,1e68,1e69,1e70,1e71,1e72,1e73,1e74,1e75,1e76,1e77,
+                1e78,1e79,1e80,1e81,1e82,1e83,1e84,1e85,1e86,1e87,1e88,1e89,1e90,1e91,
+                1e92,1e93,1e94,1e95,1e96,1e97,1e98,1e99,1e100,1e101,1e102,1e103,1e104,
+                1e105,1e106,1e107,1e108,1e109,1e110,1e111,1e112,1e113,1e114,1e115,1e116,
+                1e117,1e118,1e119,1e120,1e121,1e122,1e123,1e124,1e125,1e126,1e127,1e128,
+                1e129,1e130,1e131,1e132,1e133,1e134,1e135,1e136,1e137,1e138,1e139,1e140,
+                1e141,1e142,1e143,1e144,1e145,1e146,1e147,1e148,1e149,1e150,1e151,1e152,
+                1e153,1e154,1e155,1e156,1e157,1e158,1e159,1e160,1e161,1e162,1e163,1e164,
+                1e165,1e166,1e167,1e168,1e169,1e170,1e171,1e172,1e173,1e174,1e175,1e176,
+                1e177,1e178,1e179,1e180,1e181,1e182,1e183,1e184,1e185,1e186,1e187,1e188,
+                1e189,1e190,1e191,1e192,1e193,1e194,1e195,1e196,1e197,1e198,1e199,1e200,
+                1e201,1e202,1e203,1e204,1e205,1e206,1e207,1e208,1e209,1e210,1e211,1e212,
+                1e213,1e214,1e215,1e216,1e217,1e218,1e219,1e220,1e221,1e222,1e223,1e224,
+                1e225,1e226,1e227,1e228,1e229,1e230,1e231,1e232,1e233,1e234,1e235,1e236,
+                1e237,1e238,1e239,1e240,1e241,1e242,1e243,1e244,1e245,1e246,1e247,1e248,
+                1e249,1e250,1e251,1e252,1e253,1e254,1e255,1e256,1e257,1e258,1e259,1e260,
+                1e261,1e262,1e263,1e264,1e265,1e266,1e267,1e268,1e269,1e270,1e271,1e272,
+                1e273,1e274,1e275,1e276,1e277,1e278,1e279,1e280,1e281,1e282,1e283,1e284,
+                1e285,1e286,1e287,1e288,1e289,1e290,1e291,1e292,1e293,1e294,1e295,1e296,
+                1e297,1e298,1e299,1e300,1e301,1e302,1e303,1e304,1e305,1e306,1e307,1e308
+            };
+            return constants[exponent + 323];
+        }
 
-            size_t pop_element; // used as an argument into the `pop` routine
+        // On success, the number is left in out_integer or out_double,
+        // depending on the returned type.
+        std::pair<char*, type> decode_number(char* p, int& out_integer, double& out_double) {
+            bool negative = false;
+            if ('-' == *p) {
+                ++p;
+                negative = true;
 
-            if (0) { // purely for structure
+                if (SAJSON_UNLIKELY(at_eof(p))) {
+                    return std::make_pair(make_error(p, ERROR_UNEXPECTED_END), TYPE_NULL);
+                }
+            }
 
-            // ASSUMES: byte at p SHOULD be skipped
-            array_close_or_element:
-                p = skip_whitespace(p + 1);
-                if (SAJSON_UNLIKELY(!p)) {
-                    return unexpected_end();
+            bool try_double = false;
+
+            int i = 0;
+            double d = 0.0; // gcc complains that d might be used uninitialized which isn't true. appease the warning anyway.
+            if (*p == '0') {
+                ++p;
+                if (SAJSON_UNLIKELY(at_eof(p))) {
+                    return std::make_pair(make_error(p, ERROR_UNEXPECTED_END), TYPE_NULL);
                 }
-                if (*p == ']') {
-                    goto pop_array;
-                } else {
-                    goto next_element;
+            } else for (;;) {
+                unsigned char c = *p;
+                if (c < '0' || c > '9') {
+                    break;
                 }
-                SAJSON_UNREACHABLE();
 
-            // ASSUMES: byte at p SHOULD be skipped
-            object_close_or_element:
-                p = skip_whitespace(p + 1);
-                if (SAJSON_UNLIKELY(!p)) {
-                    return unexpected_end();
+                ++p;
+                if (SAJSON_UNLIKELY(at_eof(p))) {
+                    return std::make_pair(make_error(p, ERROR_UNEXPECTED_END), TYPE_NULL);
                 }
-                if (*p == '}') {
-                    goto pop_object;
+
+                unsigned char digit = c - '0';
+
+                if (SAJSON_UNLIKELY(!try_double && i > INT_MAX / 10 - 9)) {
+                    // TODO: could split this into two loops
+                    try_double = true;
+                    d = i;
+                }
+                if (SAJSON_UNLIKELY(try_double)) {
+                    d = 10.0 * d + digit;
                 } else {
-                    goto object_key;
+                    i = 10 * i + digit;
                 }
-                SAJSON_UNREACHABLE();
+            }
 
-            // ASSUMES: byte at p SHOULD NOT be skipped
-            structure_close_or_comma:
-                p = skip_whitespace(p);
-                if (SAJSON_UNLIKELY(!p)) {
-                    return unexpected_end();
+            int exponent = 0;
+
+            if ('.' == *p) {
+                if (!try_double) {
+                    try_double = true;
+                    d = i;
+                }
+                ++p;
+                if (SAJSON_UNLIKELY(at_eof(p))) {
+                    return std::make_pair(make_error(p, ERROR_UNEXPECTED_END), TYPE_NULL);
                 }
+                for (;;) {
+                    char c = *p;
+                    if (c < '0' || c > '9') {
+                        break;
+                    }
 
-                if (current_structure_type == TYPE_ARRAY) {
-                    if (*p == ']') {
-                        goto pop_array;
-                    } else {
+                    ++p;
+                    if (SAJSON_UNLIKELY(at_eof(p))) {
+                        return std::make_pair(make_error(p, ERROR_UNEXPECTED_END), TYPE_NULL);
+                    }
+                    d = d * 10 + (c - '0');
+                    --exponent;
+                }
+            }
+
+            char e = *p;
+            if ('e' == e || 'E' == e) {
+                if (!try_double) {
+                    try_double = true;
+                    d = i;
+                }
+                ++p;
+                if (SAJSON_UNLIKELY(at_eof(p))) {
+                    return std::make_pair(make_error(p, ERROR_UNEXPECTED_END), TYPE_NULL);
+                }
+
+                bool negativeExponent = false;
+                if ('-' == *p) {
+                    negativeExponent = true;
+                    ++p;
+                    if (SAJSON_UNLIKELY(at_eof(p))) {
+                        return std::make_pair(make_error(p, ERROR_UNEXPECTED_END), TYPE_NULL);
+                    }
+                } else if ('+' == *p) {
+                    ++p;
+                    if (SAJSON_UNLIKELY(at_eof(p))) {
+                        return std::make_pair(make_error(p, ERROR_UNEXPECTED_END), TYPE_NULL);
+                    }
+                }
+
+                int exp = 0;
+
+                char c = *p;
+                if (SAJSON_UNLIKELY(c < '0' || c > '9')) {
+                    return std::make_pair(make_error(p, ERROR_MSSING_EXPONENT), TYPE_NULL);
+                }
+                for (;;) {
+                    exp = 10 * exp + (c - '0');
+
+                    ++p;
+                    if (SAJSON_UNLIKELY(at_eof(p))) {
+                        return std::make_pair(make_error(p, ERROR_UNEXPECTED_END), TYPE_NULL);
+                    }
+
+                    c = *p;
+                    if (c < '0' || c > '9') {
+                        break;
+                    }
+                }
+                exponent += (negativeExponent ? -exp : exp);
+            }
+
+            if (exponent) {
+                assert(try_double);
+                d *= pow10(exponent);
+            }
+
+            if (negative) {
+                if (try_double) {
+                    d = -d;
+                } else {
+                    i = -i;
+                }
+            }
+            if (try_double) {
+                out_double = d;
+                return std::make_pair(p, TYPE_DOUBLE);
+            } else {
+                out_integer = i;
+                return std::make_pair(p, TYPE_INTEGER);
+            }
+        }
+
+        // Reads the string at p, unescaping it in place and recording its
+        // bounds in tag.  With Decode false, the string is only checked:
+        // neither the input nor tag is written.
+        template<bool Decode = true>
+        char* parse_string(char* p, size_t* tag) {
+            ++p; // "
+            size_t start = p - input;
+            while (input_end - p >= 4) {
+                if (!internal::is_plain_string_character(p[0])) { goto found; }
+                if (!internal::is_plain_string_character(p[1])) { p += 1; goto found; }
+                if (!internal::is_plain_string_character(p[2])) { p += 2; goto found; }
+                if (!internal::is_plain_string_character(p[3])) { p += 3; goto found; }
+                p += 4;
+            }
+            for (;;) {
+                if (SAJSON_UNLIKELY(p >= input_end)) {
+                    return make_error(p, ERROR_UNEXPECTED_END);
+                }
+
+                if (!internal::is_plain_string_character(*p)) {
+                    break;
+                }
+
+                ++p;
+            }
+        found:
+            if (SAJSON_LIKELY(*p == '"')) {
+                if (Decode) {
+                    tag[0] = start;
+                    tag[1] = p - input;
+                    *p = '\0';
+                }
+                return p + 1;
+            }
+
+            if (*p >= 0 && *p < 0x20) {
+                return make_error(p, ERROR_ILLEGAL_CODEPOINT, static_cast<int>(*p));
+            } else {
+                // backslash or >0x7f
+                return parse_string_slow<Decode>(p, tag, start);
+            }
+        }
+
+        char* read_hex(char* p, unsigned& u) {
+            unsigned v = 0;
+            int i = 4;
+            while (i--) {
+                unsigned char c = *p++;
+                if (c >= '0' && c <= '9') {
+                    c -= '0';
+                } else if (c >= 'a' && c <= 'f') {
+                    c = c - 'a' + 10;
+                } else if (c >= 'A' && c <= 'F') {
+                    c = c - 'A' + 10;
+                } else {
+                    return make_error(p, ERROR_INVALID_UNICODE_ESCAPE);
+                }
+                v = (v << 4) + c;
+            }
+
+            u = v;
+            return p;
+        }
+
+        void write_utf8(unsigned codepoint, char*& end) {
+            if (codepoint < 0x80) {
+                *end++ = char(codepoint);
+            } else if (codepoint < 0x800) {
+                *end++ = 0xC0 | char(codepoint >> 6);
+                *end++ = 0x80 | char(codepoint & 0x3F);
+            } else if (codepoint < 0x10000) {
+                *end++ = 0xE0 | char(codepoint >> 12);
+                *end++ = 0x80 | char((codepoint >> 6) & 0x3F);
+                *end++ = 0x80 | char(codepoint & 0x3F);
+            } else {
+                assert(codepoint < 0x200000);
+                *end++ = 0xF0 | char(codepoint >> 18);
+                *end++ = 0x80 | char((codepoint >> 12) & 0x3F);
+                *end++ = 0x80 | char((codepoint >> 6) & 0x3F);
+                *end++ = 0x80 | char(codepoint & 0x3F);
+            }
+        }
+
+        template<bool Decode>
+        char* parse_string_slow(char* p, size_t* tag, size_t start) {
+            char* end = p;
+
+            for (;;) {
+                if (SAJSON_UNLIKELY(p >= input_end)) {
+                    return make_error(p, ERROR_UNEXPECTED_END);
+                }
+
+                if (SAJSON_UNLIKELY(*p >= 0 && *p < 0x20)) {
+                    return make_error(p, ERROR_ILLEGAL_CODEPOINT, static_cast<int>(*p));
+                }
+
+                switch (*p) {
+                    case '"':
+                        if (Decode) {
+                            tag[0] = start;
+                            tag[1] = end - input;
+                            *end = '\0';
+                        }
+                        return p + 1;
+
+                    case '\\':
+                        ++p;
+                        if (SAJSON_UNLIKELY(p >= input_end)) {
+                            return make_error(p, ERROR_UNEXPECTED_END);
+                        }
+
+                        char replacement;
+                        switch (*p) {
+                            case '"': replacement = '"'; goto replace;
+                            case '\\': replacement = '\\'; goto replace;
+                            case '/': replacement = '/'; goto replace;
+                            case 'b': replacement = '\b'; goto replace;
+                            case 'f': replacement = '\f'; goto replace;
+                            case 'n': replacement = '\n'; goto replace;
+                            case 'r': replacement = '\r'; goto replace;
+                            case 't': replacement = '\t'; goto replace;
+                            replace:
+                                if (Decode) {
+                                    *end++ = replacement;
+                                }
+                                ++p;
+                                break;
+                            case 'u': {
+                                ++p;
+                                if (SAJSON_UNLIKELY(!has_remaining_characters(p, 4))) {
+                                    return make_error(p, ERROR_UNEXPECTED_END);
+                                }
+                                unsigned u = 0; // gcc's complaining that this could be used uninitialized. wrong.
+                                p = read_hex(p, u);
+                                if (!p) {
+                                    return 0;
+                                }
+                                if (u >= 0xD800 && u <= 0xDBFF) {
+                                    if (SAJSON_UNLIKELY(!has_remaining_characters(p, 6))) {
+                                        return make_error(p, ERROR_UNEXPECTED_END_OF_UTF16);
+                                    }
+                                    char p0 = p[0];
+                                    char p1 = p[1];
+                                    if (p0 != '\\' || p1 != 'u') {
+                                        return make_error(p, ERROR_EXPECTED_U);
+                                    }
+                                    p += 2;
+                                    unsigned v = 0; // gcc's complaining that this could be used uninitialized. wrong.
+                                    p = read_hex(p, v);
+                                    if (!p) {
+                                        return p;
+                                    }
+
+                                    if (v < 0xDC00 || v > 0xDFFF) {
+                                        return make_error(p, ERROR_INVALID_UTF16_TRAIL_SURROGATE);
+                                    }
+                                    u = 0x10000 + (((u - 0xD800) << 10) | (v - 0xDC00));
+                                }
+                                if (Decode) {
+                                    write_utf8(u, end);
+                                }
+                                break;
+                            }
+                            default:
+                                return make_error(p, ERROR_UNKNOWN_ESCAPE);
+                        }
+                        break;
+
+                    default:
+                        // validate UTF-8
+                        unsigned char c0 = p[0];
+                        if (c0 < 128) {
+                            if (Decode) {
+                                *end++ = *p;
+                            }
+                            ++p;
+                        } else if (c0 < 224) {
+                            if (SAJSON_UNLIKELY(!has_remaining_characters(p, 2))) {
+                                return unexpected_end(p);
+                            }
+                            unsigned char c1 = p[1];
+                            if (c1 < 128 || c1 >= 192) {
+                                return make_error(p + 1, ERROR_INVALID_UTF8);
+                            }
+                            if (Decode) {
+                                end[0] = c0;
+                                end[1] = c1;
+                                end += 2;
+                            }
+                            p += 2;
+                        } else if (c0 < 240) {
+                            if (SAJSON_UNLIKELY(!has_remaining_characters(p, 3))) {
+                                return unexpected_end(p);
+                            }
+                            unsigned char c1 = p[1];
+                            if (c1 < 128 || c1 >= 192) {
+                                return make_error(p + 1, ERROR_INVALID_UTF8);
+                            }
+                            unsigned char c2 = p[2];
+                            if (c2 < 128 || c2 >= 192) {
+                                return make_error(p + 2, ERROR_INVALID_UTF8);
+                            }
+                            if (Decode) {
+                                end[0] = c0;
+                                end[1] = c1;
+                                end[2] = c2;
+                                end += 3;
+                            }
+                            p += 3;
+                        } else if (c0 < 248) {
+                            if (SAJSON_UNLIKELY(!has_remaining_characters(p, 4))) {
+                                return unexpected_end(p);
+                            }
+                            unsigned char c1 = p[1];
+                            if (c1 < 128 || c1 >= 192) {
+                                return make_error(p + 1, ERROR_INVALID_UTF8);
+                            }
+                            unsigned char c2 = p[2];
+                            if (c2 < 128 || c2 >= 192) {
+                                return make_error(p + 2, ERROR_INVALID_UTF8);
+                            }
+                            unsigned char c3 = p[3];
+                            if (c3 < 128 || c3 >= 192) {
+                                return make_error(p + 3, ERROR_INVALID_UTF8);
+                            }
+                            if (Decode) {
+                                end[0] = c0;
+                                end[1] = c1;
+                                end[2] = c2;
+                                end[3] = c3;
+                                end += 4;
+                            }
+                            p += 4;
+                        } else {
+                            return make_error(p, ERROR_INVALID_UTF8);
+                        }
+                        break;
+                }
+            }
+        }
+
+        char* const input;
+        char* const input_end;
+
+        size_t error_line;
+        size_t error_column;
+        error error_code;
+        int error_arg; // optional argument for the error
+    };
+
+    // Drives a handler through the same grammar as parser, but reports
+    // each value as it is read instead of building an AST.  See
+    // parse_events().
+    //
+    // With Decode false, the input is only checked and never written:
+    // the handler sees structure events but no keys, strings, or numbers.
+    // This is how validate() works.
+    template<typename Handler, bool Decode = true>
+    class event_parser : private parser_base {
+    public:
+        event_parser(char* input, size_t length, Handler& handler, allocator& alloc)
+            : parser_base(input, input + length)
+            , handler(handler)
+            , stack(alloc)
+        {}
+
+        parse_result get_result() {
+            parse();
+            return get_error();
+        }
+
+        parse_result get_error() const {
+            if (error_code == ERROR_SUCCESS) {
+                return parse_result();
+            } else {
+                return parse_result(error_line, error_column, error_code, error_arg);
+            }
+        }
+
+        // Parses the one value starting at p, which must not be
+        // whitespace, and returns a pointer just past it.  Returns null on
+        // error; get_error() then describes the error.
+        char* parse_value(char* p) {
+            // stack holds the types of all open structures, and
+            // current_structure_type caches its top.
+            type current_structure_type = TYPE_NULL;
+            goto next_element;
+
+            // BEGIN STATE MACHINE
+
+            if (0) { // purely for structure
+
+            // ASSUMES: byte at p SHOULD be skipped
+            array_close_or_element:
+                p = skip_whitespace(p + 1);
+                if (SAJSON_UNLIKELY(!p)) {
+                    return unexpected_end();
+                }
+                if (*p == ']') {
+                    goto pop_array;
+                } else {
+                    goto next_element;
+                }
+                SAJSON_UNREACHABLE();
+
+            // ASSUMES: byte at p SHOULD be skipped
+            object_close_or_element:
+                p = skip_whitespace(p + 1);
+                if (SAJSON_UNLIKELY(!p)) {
+                    return unexpected_end();
+                }
+                if (*p == '}') {
+                    goto pop_object;
+                } else {
+                    goto object_key;
+                }
+                SAJSON_UNREACHABLE();
+
+            // ASSUMES: byte at p SHOULD NOT be skipped
+            structure_close_or_comma:
+                p = skip_whitespace(p);
+                if (SAJSON_UNLIKELY(!p)) {
+                    return unexpected_end();
+                }
+
+                if (current_structure_type == TYPE_ARRAY) {
+                    if (*p == ']') {
+                        goto pop_array;
+                    } else {
+                        if (SAJSON_UNLIKELY(*p != ',')) {
+                            return make_error(p, ERROR_EXPECTED_COMMA);
+                        }
+                        ++p;
+                        goto next_element;
+                    }
+                } else {
+                    assert(current_structure_type == TYPE_OBJECT);
+                    if (*p == '}') {
+                        goto pop_object;
+                    } else {
+                        if (SAJSON_UNLIKELY(*p != ',')) {
+                            return make_error(p, ERROR_EXPECTED_COMMA);
+                        }
+                        ++p;
+                        goto object_key;
+                    }
+                }
+                SAJSON_UNREACHABLE();
+
+            // ASSUMES: *p == '}'
+            pop_object:
+                ++p;
+                handler.end_object();
+                goto pop;
+
+            // ASSUMES: *p == ']'
+            pop_array:
+                ++p;
+                handler.end_array();
+                goto pop;
+
+            pop:
+                stack.pop();
+                if (stack.empty()) {
+                    return p;
+                }
+                current_structure_type = stack.top();
+                goto structure_close_or_comma;
+
+            // ASSUMES: byte at p SHOULD NOT be skipped
+            object_key: {
+                p = skip_whitespace(p);
+                if (SAJSON_UNLIKELY(!p)) {
+                    return unexpected_end();
+                }
+                if (SAJSON_UNLIKELY(*p != '"')) {
+                    return make_error(p, ERROR_MISSING_OBJECT_KEY);
+                }
+                size_t tag[2];
+                p = parse_string<Decode>(p, tag);
+                if (SAJSON_UNLIKELY(!p)) {
+                    return 0;
+                }
+                if (Decode) {
+                    handler.key(string(input + tag[0], tag[1] - tag[0]));
+                }
+                p = skip_whitespace(p);
+                if (SAJSON_UNLIKELY(!p || *p != ':')) {
+                    return make_error(p, ERROR_EXPECTED_COLON);
+                }
+                ++p;
+                goto next_element;
+            }
+
+            // ASSUMES: byte at p SHOULD NOT be skipped
+            next_element:
+                p = skip_whitespace(p);
+                if (SAJSON_UNLIKELY(!p)) {
+                    return unexpected_end();
+                }
+
+                switch (*p) {
+                    case 0:
+                        return unexpected_end(p);
+                    case 'n':
+                        p = parse_null(p);
+                        if (!p) {
+                            return 0;
+                        }
+                        handler.null_value();
+                        break;
+                    case 'f':
+                        p = parse_false(p);
+                        if (!p) {
+                            return 0;
+                        }
+                        handler.bool_value(false);
+                        break;
+                    case 't':
+                        p = parse_true(p);
+                        if (!p) {
+                            return 0;
+                        }
+                        handler.bool_value(true);
+                        break;
+                    case '0':
+                    case '1':
+                    case '2':
+                    case '3':
+                    case '4':
+                    case '5':
+                    case '6':
+                    case '7':
+                    case '8':
+                    case '9':
+                    case '-': {
+                        int i = 0;
+                        double d = 0.0;
+                        auto result = decode_number(p, i, d);
+                        p = result.first;
+                        if (!p) {
+                            return 0;
+                        }
+                        if (Decode) {
+                            if (result.second == TYPE_DOUBLE) {
+                                handler.double_value(d);
+                            } else {
+                                handler.integer_value(i);
+                            }
+                        }
+                        break;
+                    }
+                    case '"': {
+                        size_t tag[2];
+                        p = parse_string<Decode>(p, tag);
+                        if (!p) {
+                            return 0;
+                        }
+                        if (Decode) {
+                            handler.string_value(string(input + tag[0], tag[1] - tag[0]));
+                        }
+                        break;
+                    }
+
+                    case '[':
+                        if (SAJSON_UNLIKELY(!stack.push(TYPE_ARRAY))) {
+                            return oom(p);
+                        }
+                        current_structure_type = TYPE_ARRAY;
+                        handler.start_array();
+                        goto array_close_or_element;
+                    case '{':
+                        if (SAJSON_UNLIKELY(!stack.push(TYPE_OBJECT))) {
+                            return oom(p);
+                        }
+                        current_structure_type = TYPE_OBJECT;
+                        handler.start_object();
+                        goto object_close_or_element;
+
+                    case ',':
+                        return make_error(p, ERROR_UNEXPECTED_COMMA);
+                    default:
+                        return make_error(p, ERROR_EXPECTED_VALUE);
+                }
+
+                if (stack.empty()) {
+                    return p;
+                }
+                goto structure_close_or_comma;
+            }
+
+            SAJSON_UNREACHABLE();
+        }
+
+    private:
+        bool parse() {
+            // p points to the character currently being parsed
+            char* p = skip_whitespace(input);
+            if (SAJSON_UNLIKELY(!p)) {
+                return make_error(p, ERROR_MISSING_ROOT_ELEMENT);
+            }
+            if (SAJSON_UNLIKELY(*p != '[' && *p != '{')) {
+                return make_error(p, ERROR_BAD_ROOT);
+            }
+
+            p = parse_value(p);
+            if (SAJSON_UNLIKELY(!p)) {
+                return false;
+            }
+
+            p = skip_whitespace(p);
+            if (SAJSON_UNLIKELY(p)) {
+                return make_error(p, ERROR_EXPECTED_END_OF_INPUT);
+            }
+            return true;
+        }
+
+        Handler& handler;
+        internal::structure_stack stack;
+    };
+
+    namespace internal {
+        class default_allocator : public allocator {
+            void* allocate(size_t size) override {
+                return new uint8_t[size];
+            }
+            void deallocate(const void* buf) override {
+                delete[] static_cast<const uint8_t*>(buf);
+            }
+        };
+
+        // Ignores every event.  Used when only the grammar matters.
+        struct null_handler {
+            void start_array() {}
+            void end_array() {}
+            void start_object() {}
+            void end_object() {}
+            void key(const string&) {}
+            void null_value() {}
+            void bool_value(bool) {}
+            void integer_value(int) {}
+            void double_value(double) {}
+            void string_value(const string&) {}
+        };
+
+        inline allocator& get_default_allocator() {
+            static default_allocator s_allocator;
+            return s_allocator;
+        }
+
+        // Sends v and everything under it to handler as events, in the
+        // AST's order.
+        template<typename Handler>
+        void replay_value(const value& v, Handler& handler) {
+            switch (v.get_type()) {
+                case TYPE_ARRAY:
+                    handler.start_array();
+                    for (const value& element : v.get_array_elements()) {
+                        replay_value(element, handler);
+                    }
+                    handler.end_array();
+                    break;
+                case TYPE_OBJECT:
+                    handler.start_object();
+                    for (const object_member& member : v.get_object_members()) {
+                        handler.key(member.get_key());
+                        replay_value(member.get_value(), handler);
+                    }
+                    handler.end_object();
+                    break;
+                case TYPE_INTEGER:
+                    handler.integer_value(v.get_integer_value());
+                    break;
+                case TYPE_DOUBLE:
+                    handler.double_value(v.get_double_value());
+                    break;
+                case TYPE_NULL:
+                    handler.null_value();
+                    break;
+                case TYPE_FALSE:
+                    handler.bool_value(false);
+                    break;
+                case TYPE_TRUE:
+                    handler.bool_value(true);
+                    break;
+                case TYPE_STRING:
+                    handler.string_value(string(v.as_cstring(), v.get_string_length()));
+                    break;
+            }
+        }
+
+        // Orders keys as object_key_comparator does: by length, then
+        // bytes.
+        inline int compare_keys(const string& a, const string& b) {
+            if (a.length() != b.length()) {
+                return a.length() < b.length() ? -1 : 1;
+            }
+            return memcmp(a.data(), b.data(), a.length());
+        }
+
+        // JSON equality: numbers by value, objects regardless of member
+        // order.  Works on value and overlay_value alike.  Object keys are
+        // sorted the same way in both, so members pair up by index.
+        template<typename A, typename B>
+        bool values_equal(const A& a, const B& b) {
+            const type a_type = a.get_type();
+            const type b_type = b.get_type();
+            const bool a_number = a_type == TYPE_INTEGER || a_type == TYPE_DOUBLE;
+            const bool b_number = b_type == TYPE_INTEGER || b_type == TYPE_DOUBLE;
+            if (a_number && b_number) {
+                return a.get_number_value() == b.get_number_value();
+            }
+            if (a_type != b_type) {
+                return false;
+            }
+            switch (a_type) {
+                case TYPE_ARRAY: {
+                    const size_t length = a.get_length();
+                    if (length != b.get_length()) {
+                        return false;
+                    }
+                    for (size_t i = 0; i < length; ++i) {
+                        if (!values_equal(a.get_array_element(i), b.get_array_element(i))) {
+                            return false;
+                        }
+                    }
+                    return true;
+                }
+                case TYPE_OBJECT: {
+                    const size_t length = a.get_length();
+                    if (length != b.get_length()) {
+                        return false;
+                    }
+                    for (size_t i = 0; i < length; ++i) {
+                        if (compare_keys(a.get_object_key(i), b.get_object_key(i)) != 0
+                            || !values_equal(a.get_object_value(i), b.get_object_value(i))
+                        ) {
+                            return false;
+                        }
+                    }
+                    return true;
+                }
+                case TYPE_STRING:
+                    return a.get_string_length() == b.get_string_length()
+                        && memcmp(a.as_cstring(), b.as_cstring(), a.get_string_length()) == 0;
+                default:
+                    return true;
+            }
+        }
+
+        // Pending elements are encoded as make_element(type, distance
+        // from structure_end).  These write the finished array or object
+        // below write_cursor, with offsets relative to its own payload,
+        // and move write_cursor down to it.
+        inline void install_array(const size_t* array_base, const size_t* array_end, size_t*& write_cursor, size_t* structure_end) {
+            const size_t length = array_end - array_base;
+            write_cursor -= length + 1;
+            size_t* const new_base = write_cursor;
+            size_t* out = new_base + length + 1;
+
+            while (array_end > array_base) {
+                size_t element = *--array_end;
+                type element_type = get_element_type(element);
+                size_t element_value = get_element_value(element);
+                size_t* element_ptr = structure_end - element_value;
+                *--out = make_element(element_type, element_ptr - new_base);
+            }
+            *--out = length;
+        }
+
+        // Object elements are preceded by their key's start and end
+        // offsets in text.  Sorts the keys in place first.
+        inline void install_object(size_t* object_base, size_t* object_end, size_t*& write_cursor, size_t* structure_end, const char* text) {
+            assert((object_end - object_base) % 3 == 0);
+            const size_t length_times_3 = object_end - object_base;
+            std::sort(
+                reinterpret_cast<object_key_record*>(object_base),
+                reinterpret_cast<object_key_record*>(object_end),
+                object_key_comparator(text));
+
+            write_cursor -= length_times_3 + 1;
+            size_t* const new_base = write_cursor;
+            size_t* out = new_base + length_times_3 + 1;
+
+            while (object_end > object_base) {
+                size_t element = *--object_end;
+                type element_type = get_element_type(element);
+                size_t element_value = get_element_value(element);
+                size_t* element_ptr = structure_end - element_value;
+
+                *--out = make_element(element_type, element_ptr - new_base);
+                *--out = *--object_end;
+                *--out = *--object_end;
+            }
+            *--out = length_times_3 / 3;
+        }
+    }
+
+    class parser : private parser_base {
+    public:
+        parser(data_storage&& storage, const internal::projection_trie* projection = 0)
+            : parser_base(storage.input, storage.input_end())
+            , storage(std::move(storage))
+            , write_cursor(this->storage.structure_end())
+            , root_type(TYPE_NULL)
+            , projection(projection)
+            , projection_node(projection ? projection->root : internal::projection_trie::KEEP_ALL)
+            , value_node(projection_node)
+            , projection_nodes(this->storage.get_allocator())
+        {}
+
+        document get_document() {
+            // transfering ownership of storage
+            if (parse()) {
+                storage.release_structure_below(write_cursor);
+                return document(std::move(storage), root_type, write_cursor);
+            } else {
+                storage.release_structure_below(storage.structure_end());
+                return document(std::move(storage), error_line, error_column, error_code, error_arg);
+            }
+        }
+
+    private:
+        bool parse() {
+            // p points to the character currently being parsed
+            char* p = storage.input;
+
+            stack_head stack(storage.structure);
+
+            p = skip_whitespace(p);
+            if (SAJSON_UNLIKELY(!p)) {
+                return make_error(p, ERROR_MISSING_ROOT_ELEMENT);
+            }
+
+            // current_base is an offset to the first element of the current structure (object or array)
+            size_t current_base = stack.get_size();
+            type current_structure_type;
+            if (*p == '[') {
+                current_structure_type = TYPE_ARRAY;
+                stack.push(make_element(current_structure_type, ROOT_MARKER));
+                goto array_close_or_element;
+            } else if (*p == '{') {
+                current_structure_type = TYPE_OBJECT;
+                stack.push(make_element(current_structure_type, ROOT_MARKER));
+                goto object_close_or_element;
+            } else {
+                return make_error(p, ERROR_BAD_ROOT);
+            }
+
+            // BEGIN STATE MACHINE
+
+            size_t pop_element; // used as an argument into the `pop` routine
+
+            if (0) { // purely for structure
+
+            // ASSUMES: byte at p SHOULD be skipped
+            array_close_or_element:
+                p = skip_whitespace(p + 1);
+                if (SAJSON_UNLIKELY(!p)) {
+                    return unexpected_end();
+                }
+                if (*p == ']') {
+                    goto pop_array;
+                } else {
+                    goto next_element;
+                }
+                SAJSON_UNREACHABLE();
+
+            // ASSUMES: byte at p SHOULD be skipped
+            object_close_or_element:
+                p = skip_whitespace(p + 1);
+                if (SAJSON_UNLIKELY(!p)) {
+                    return unexpected_end();
+                }
+                if (*p == '}') {
+                    goto pop_object;
+                } else {
+                    goto object_key;
+                }
+                SAJSON_UNREACHABLE();
+
+            // ASSUMES: byte at p SHOULD NOT be skipped
+            structure_close_or_comma:
+                p = skip_whitespace(p);
+                if (SAJSON_UNLIKELY(!p)) {
+                    return unexpected_end();
+                }
+
+                if (current_structure_type == TYPE_ARRAY) {
+                    if (*p == ']') {
+                        goto pop_array;
+                    } else {
+                        if (SAJSON_UNLIKELY(*p != ',')) {
+                            return make_error(p, ERROR_EXPECTED_COMMA);
+                        }
+                        ++p;
+                        goto next_element;
+                    }
+                } else {
+                    assert(current_structure_type == TYPE_OBJECT);
+                    if (*p == '}') {
+                        goto pop_object;
+                    } else {
                         if (SAJSON_UNLIKELY(*p != ',')) {
                             return make_error(p, ERROR_EXPECTED_COMMA);
                         }
-                        ++p;
-                        goto next_element;
+                        ++p;
+                        goto object_key;
+                    }
+                }
+                SAJSON_UNREACHABLE();
+
+            // ASSUMES: *p == '}'
+            pop_object: {
+                ++p;
+                size_t* base_ptr = stack.get_pointer_from_offset(current_base);
+                pop_element = *base_ptr;
+                if (SAJSON_UNLIKELY(!install_object(base_ptr + 1, stack.get_top()))) {
+                    return oom(p);
+                }
+                goto pop;
+            }
+
+            // ASSUMES: *p == ']'
+            pop_array: {
+                ++p;
+                size_t* base_ptr = stack.get_pointer_from_offset(current_base);
+                pop_element = *base_ptr;
+                if (SAJSON_UNLIKELY(!install_array(base_ptr + 1, stack.get_top()))) {
+                    return oom(p);
+                }
+                goto pop;
+            }
+
+            // ASSUMES: byte at p SHOULD NOT be skipped
+            object_key: {
+                p = skip_whitespace(p);
+                if (SAJSON_UNLIKELY(!p)) {
+                    return unexpected_end();
+                }
+                if (SAJSON_UNLIKELY(*p != '"')) {
+                    return make_error(p, ERROR_MISSING_OBJECT_KEY);
+                }
+                size_t* out = stack.reserve(2);
+                p = parse_string(p, out);
+                if (SAJSON_UNLIKELY(!p)) {
+                    return false;
+                }
+                p = skip_whitespace(p);
+                if (SAJSON_UNLIKELY(!p || *p != ':')) {
+                    return make_error(p, ERROR_EXPECTED_COLON);
+                }
+                ++p;
+                if (SAJSON_UNLIKELY(projection_node != internal::projection_trie::KEEP_ALL)) {
+                    value_node = projection->find_child(projection_node, string(input + out[0], out[1] - out[0]));
+                    if (value_node == internal::projection_trie::NOT_FOUND) {
+                        stack.reset(stack.get_size() - 2);
+                        p = skip_value(p);
+                        if (SAJSON_UNLIKELY(!p)) {
+                            return false;
+                        }
+                        goto structure_close_or_comma;
+                    }
+                }
+                goto next_element;
+            }
+
+            // ASSUMES: byte at p SHOULD NOT be skipped
+            next_element:
+                p = skip_whitespace(p);
+                if (SAJSON_UNLIKELY(!p)) {
+                    return unexpected_end();
+                }
+
+                type value_type_result;
+                switch (*p) {
+                    case 0:
+                        return unexpected_end(p);
+                    case 'n':
+                        p = parse_null(p);
+                        if (!p) {
+                            return false;
+                        }
+                        value_type_result = TYPE_NULL;
+                        break;
+                    case 'f':
+                        p = parse_false(p);
+                        if (!p) {
+                            return false;
+                        }
+                        value_type_result = TYPE_FALSE;
+                        break;
+                    case 't':
+                        p = parse_true(p);
+                        if (!p) {
+                            return false;
+                        }
+                        value_type_result = TYPE_TRUE;
+                        break;
+                    case '0':
+                    case '1':
+                    case '2':
+                    case '3':
+                    case '4':
+                    case '5':
+                    case '6':
+                    case '7':
+                    case '8':
+                    case '9':
+                    case '-': {
+                        auto result = parse_number(p);
+                        p = result.first;
+                        if (!p) {
+                            return false;
+                        }
+                        value_type_result = result.second;
+                        break;
+                    }
+                    case '"': {
+                        write_cursor -= 2;
+                        size_t* string_tag = write_cursor;
+                        p = parse_string(p, string_tag);
+                        if (!p) {
+                            return false;
+                        }
+                        value_type_result = TYPE_STRING;
+                        break;
                     }
-                } else {
-                    assert(current_structure_type == TYPE_OBJECT);
-                    if (*p == '}') {
-                        goto pop_object;
-                    } else {
-                        if (SAJSON_UNLIKELY(*p != ',')) {
-                            return make_error(p, ERROR_EXPECTED_COMMA);
+
+                    case '[': {
+                        if (SAJSON_UNLIKELY(projection) && !enter_projection_node()) {
+                            return oom(p);
                         }
-                        ++p;
-                        goto object_key;
+                        size_t previous_base = current_base;
+                        current_base = stack.get_size();
+                        stack.push(make_element(current_structure_type, previous_base));
+                        current_structure_type = TYPE_ARRAY;
+                        goto array_close_or_element;
+                    }
+                    case '{': {
+                        if (SAJSON_UNLIKELY(projection) && !enter_projection_node()) {
+                            return oom(p);
+                        }
+                        size_t previous_base = current_base;
+                        current_base = stack.get_size();
+                        stack.push(make_element(current_structure_type, previous_base));
+                        current_structure_type = TYPE_OBJECT;
+                        goto object_close_or_element;
+                    }
+                    pop: {
+                        size_t parent = get_element_value(pop_element);
+                        if (parent == ROOT_MARKER) {
+                            root_type = current_structure_type;
+                            p = skip_whitespace(p);
+                            if (SAJSON_UNLIKELY(p)) {
+                                return make_error(p, ERROR_EXPECTED_END_OF_INPUT);
+                            }
+                            return true;
+                        }
+                        if (SAJSON_UNLIKELY(projection)) {
+                            // Back in the parent, whose array elements
+                            // share its node.
+                            projection_node = value_node = projection_nodes.pop();
+                        }
+                        stack.reset(current_base);
+                        current_base = parent;
+                        value_type_result = current_structure_type;
+                        current_structure_type = get_element_type(pop_element);
+                        break;
                     }
+
+                    case ',':
+                        return make_error(p, ERROR_UNEXPECTED_COMMA);
+                    default:
+                        return make_error(p, ERROR_EXPECTED_VALUE);
                 }
-                SAJSON_UNREACHABLE();
 
-            // ASSUMES: *p == '}'
-            pop_object: {
-                ++p;
-                size_t* base_ptr = stack.get_pointer_from_offset(current_base);
-                pop_element = *base_ptr;
-                if (SAJSON_UNLIKELY(!install_object(base_ptr + 1, stack.get_top()))) {
-                    return oom(p);
+                stack.push(make_element(value_type_result, storage.structure_end() - write_cursor));
+
+                goto structure_close_or_comma;
+            }
+
+            SAJSON_UNREACHABLE();
+        }
+
+        std::pair<char*, type> parse_number(char* p) {
+            int i;
+            double d;
+            std::pair<char*, type> result = decode_number(p, i, d);
+            if (result.second == TYPE_DOUBLE) {
+                write_cursor -= double_storage::word_length;
+                double_storage::store(write_cursor, d);
+            } else if (result.second == TYPE_INTEGER) {
+                write_cursor -= integer_storage::word_length;
+                integer_storage::store(write_cursor, i);
+            }
+            return result;
+        }
+
+        // Called on entering a structure: it takes the node selected for
+        // it, and its elements, if an array, inherit that node.
+        bool enter_projection_node() {
+            if (SAJSON_UNLIKELY(!projection_nodes.push(projection_node))) {
+                return false;
+            }
+            projection_node = value_node;
+            return true;
+        }
+
+        // Checks and skips a value the projection excludes.  p points just
+        // past the colon.
+        char* skip_value(char* p) {
+            p = skip_whitespace(p);
+            if (SAJSON_UNLIKELY(!p)) {
+                return unexpected_end();
+            }
+            internal::null_handler handler;
+            event_parser<internal::null_handler, false> skipper(input, input_end - input, handler, storage.get_allocator());
+            p = skipper.parse_value(p);
+            if (SAJSON_UNLIKELY(!p)) {
+                parse_result error = skipper.get_error();
+                error_line = error.get_error_line();
+                error_column = error.get_error_column();
+                error_code = error._internal_get_error_code();
+                error_arg = error._internal_get_error_argument();
+            }
+            return p;
+        }
+
+        bool install_array(size_t* array_base, size_t* array_end) {
+            internal::install_array(array_base, array_end, write_cursor, storage.structure_end());
+            return true;
+        }
+
+        bool install_object(size_t* object_base, size_t* object_end) {
+            internal::install_object(object_base, object_end, write_cursor, storage.structure_end(), storage.input);
+            return true;
+        }
+
+        class stack_head {
+        public:
+            stack_head(stack_head&& other)
+                : stack_bottom(other.stack_bottom)
+                , stack_top(other.stack_top)
+            {}
+
+            void push(size_t element) {
+                *stack_top++ = element;
+            }
+
+            size_t* reserve(size_t amount) {
+                size_t* rv = stack_top;
+                stack_top += amount;
+                return rv;
+            }
+
+            void reset(size_t new_top) {
+                stack_top = stack_bottom + new_top;
+            }
+
+            size_t get_size() {
+                return stack_top - stack_bottom;
+            }
+
+            size_t* get_top() {
+                return stack_top;
+            }
+
+            size_t* get_pointer_from_offset(size_t offset) {
+                return stack_bottom + offset;
+            }
+
+            stack_head() = delete;
+            stack_head(const stack_head&) = delete;
+            void operator=(const stack_head&) = delete;
+
+            stack_head(size_t* base)
+                : stack_bottom(base)
+                , stack_top(base)
+            {}
+
+            size_t* const stack_bottom;
+            size_t* stack_top;
+
+            friend class single_allocation;
+        };
+
+        data_storage storage;
+        size_t* write_cursor;
+
+        type root_type;
+
+        // Null unless projecting.  projection_node belongs to the current
+        // structure and value_node to the value being parsed; both are
+        // KEEP_ALL when everything is kept.  projection_nodes holds the
+        // nodes of the enclosing structures.
+        const internal::projection_trie* const projection;
+        size_t projection_node;
+        size_t value_node;
+        internal::word_stack projection_nodes;
+    };
+
+#ifdef SAJSON_HAS_MMAP
+    // Backs every allocation with its own anonymous mapping.  The
+    // structure buffer is sized for the worst case, but the kernel only
+    // commits the pages the parser actually touches, and the parse stack
+    // is handed back with madvise once the AST is complete.  Resident
+    // memory then tracks the real AST size rather than the input length.
+    //
+    // Each allocation costs a pair of system calls, so this only pays off
+    // for large documents or long-lived ones.
+    class mmap_allocator : public allocator {
+    public:
+        void* allocate(size_t size) override {
+            int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+            flags |= MAP_NORESERVE;
+#endif
+            size_t mapping_size = size + HEADER_SIZE;
+            void* mapping = mmap(0, mapping_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+            if (mapping == MAP_FAILED) {
+                return 0;
+            }
+            *static_cast<size_t*>(mapping) = mapping_size;
+            return static_cast<char*>(mapping) + HEADER_SIZE;
+        }
+
+        void deallocate(const void* buf) override {
+            if (!buf) {
+                return;
+            }
+            char* mapping = const_cast<char*>(static_cast<const char*>(buf)) - HEADER_SIZE;
+            munmap(mapping, *reinterpret_cast<size_t*>(mapping));
+        }
+
+        void release_unused(void* begin, size_t size) override {
+            const uintptr_t page_mask = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE)) - 1;
+            // Only whole pages can be released; round inward so the
+            // partially-used pages at either end survive.
+            uintptr_t first = (reinterpret_cast<uintptr_t>(begin) + page_mask) & ~page_mask;
+            uintptr_t last = (reinterpret_cast<uintptr_t>(begin) + size) & ~page_mask;
+            if (first < last) {
+                madvise(reinterpret_cast<void*>(first), last - first, MADV_DONTNEED);
+            }
+        }
+
+    private:
+        // Room for the mapping size while keeping the returned pointer
+        // suitably aligned for any structure word.
+        enum { HEADER_SIZE = 16 };
+    };
+#endif
+
+    namespace internal {
+        inline document parse_copy(const sajson::string& string, allocator* alloc, const projection_trie* projection) {
+            if (!alloc) {
+                alloc = &internal::get_default_allocator();
+            }
+
+            size_t length = string.length();
+            char* input = static_cast<char*>(alloc->allocate(length));
+            size_t* structure = input
+                ? static_cast<size_t*>(alloc->allocate(length * sizeof(size_t)))
+                : 0;
+
+            data_storage storage(input, true, structure, length, *alloc);
+            if (SAJSON_UNLIKELY(!structure)) {
+                return document(std::move(storage), 0, 0, ERROR_OUT_OF_MEMORY, 0);
+            }
+            memcpy(input, string.data(), length);
+
+            return parser(std::move(storage), projection).get_document();
+        }
+    }
+
+    inline document parse(sajson::string string, allocator* alloc = nullptr) {
+        return internal::parse_copy(string, alloc, 0);
+    }
+
+    // Reports the input's contents to handler as a sequence of events
+    // instead of building an AST.  Strings are unescaped in place, so the
+    // input is first copied into a buffer from alloc, which is freed
+    // before returning.  The handler must provide:
+    //
+    //     void start_array();
+    //     void end_array();
+    //     void start_object();
+    //     void end_object();
+    //     void key(const sajson::string& key);
+    //     void null_value();
+    //     void bool_value(bool value);
+    //     void integer_value(int value);
+    //     void double_value(double value);
+    //     void string_value(const sajson::string& value);
+    //
+    // Keys and strings are unescaped and NUL-terminated, and are only valid
+    // for the duration of the call.  Events are delivered as the input is
+    // read, so if the input is invalid, the handler will already have seen
+    // everything before the error.
+    template<typename Handler>
+    parse_result parse_events(sajson::string string, Handler& handler, allocator* alloc = nullptr) {
+        if (!alloc) {
+            alloc = &internal::get_default_allocator();
+        }
+
+        size_t length = string.length();
+        char* input = static_cast<char*>(alloc->allocate(length));
+        if (SAJSON_UNLIKELY(!input)) {
+            return parse_result(0, 0, ERROR_OUT_OF_MEMORY, 0);
+        }
+        memcpy(input, string.data(), length);
+
+        parse_result result = event_parser<Handler>(input, length, handler, *alloc).get_result();
+        alloc->deallocate(input);
+        return result;
+    }
+
+    // Checks that input is a valid JSON document, applying exactly the same
+    // grammar, escape, and UTF-8 rules as parse() and reporting the same
+    // errors and positions.  The input is neither copied nor modified, and
+    // no AST is built: the only memory used is one bit per nesting level,
+    // which only needs allocating for very deeply nested documents.
+    inline parse_result validate(const char* input, size_t length, allocator* alloc = nullptr) {
+        if (!alloc) {
+            alloc = &internal::get_default_allocator();
+        }
+        internal::null_handler handler;
+        // Without Decode, event_parser never writes to the input.
+        return event_parser<internal::null_handler, false>(
+            const_cast<char*>(input), length, handler, *alloc).get_result();
+    }
+
+    inline parse_result validate(const sajson::string& input, allocator* alloc = nullptr) {
+        return validate(input.data(), input.length(), alloc);
+    }
+
+    namespace internal {
+        // For each mask of bytes to keep from a group of eight, the
+        // positions of the kept bytes and how many there are.
+        struct compress_table {
+            compress_table() {
+                for (unsigned mask = 0; mask < 256; ++mask) {
+                    uint8_t count = 0;
+                    for (uint8_t bit = 0; bit < 8; ++bit) {
+                        if (mask & (1u << bit)) {
+                            indices[mask][count++] = bit;
+                        }
+                    }
+                    counts[mask] = count;
+                    while (count < 8) {
+                        indices[mask][count++] = 0;
+                    }
                 }
-                goto pop;
             }
 
-            // ASSUMES: *p == ']'
-            pop_array: {
-                ++p;
-                size_t* base_ptr = stack.get_pointer_from_offset(current_base);
-                pop_element = *base_ptr;
-                if (SAJSON_UNLIKELY(!install_array(base_ptr + 1, stack.get_top()))) {
-                    return oom(p);
+            uint8_t indices[256][8];
+            uint8_t counts[256];
+        };
+
+        inline const compress_table& get_compress_table() {
+            static const compress_table table;
+            return table;
+        }
+
+        // Appends the bytes of group selected by keep to out, always
+        // storing eight bytes.  Returns the new end of the output.
+        inline char* compress_group(char* out, const char* group, unsigned keep, const compress_table& table) {
+            const uint8_t* const indices = table.indices[keep];
+            for (int i = 0; i < 8; ++i) {
+                out[i] = group[indices[i]];
+            }
+            return out + table.counts[keep];
+        }
+
+        // One step of minify(): copies c unless it is whitespace outside
+        // a string, tracking string boundaries.
+        inline char* minify_byte(char c, char* out, bool& in_string, bool& escaped) {
+            if (in_string) {
+                *out++ = c;
+                if (escaped) {
+                    escaped = false;
+                } else if (c == '\\') {
+                    escaped = true;
+                } else if (c == '"') {
+                    in_string = false;
+                }
+            } else if (!is_whitespace(c)) {
+                *out++ = c;
+                in_string = (c == '"');
+            }
+            return out;
+        }
+    }
+
+    // Removes the whitespace outside of strings from data, in place, and
+    // returns the new length.  String contents, escapes included, are
+    // kept byte for byte.  Nothing else is checked: invalid input comes
+    // out equally invalid, just shorter.
+    //
+    // Useful before storing a document, or before parse() when the input
+    // is heavily indented, since parse() copies the input and sizes its
+    // AST buffer by input length.
+    inline size_t minify(char* data, size_t length) {
+        char* in = data;
+        char* const end = data + length;
+        char* out = data;
+        bool in_string = false;
+        bool escaped = false;
+
+#ifdef SAJSON_HAS_SSE2
+        // Sixteen bytes at a time, falling back to the byte loop for any
+        // block with a quote or backslash in it.  Outside strings,
+        // whitespace is squeezed out using a table of positions per
+        // eight-byte group.  The output never passes the input, so a
+        // block is always fully read before it is written over.
+        const internal::compress_table& table = internal::get_compress_table();
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i space = _mm_set1_epi8(' ');
+        const __m128i tab = _mm_set1_epi8('\t');
+        const __m128i newline = _mm_set1_epi8('\n');
+        const __m128i carriage_return = _mm_set1_epi8('\r');
+        while (end - in >= 16) {
+            const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+            const int specials = _mm_movemask_epi8(
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)));
+            if (specials) {
+                for (char* const block_end = in + 16; in != block_end; ++in) {
+                    out = internal::minify_byte(*in, out, in_string, escaped);
+                }
+                continue;
+            }
+
+            if (!in_string) {
+                const int whitespace = _mm_movemask_epi8(_mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(chunk, space), _mm_cmpeq_epi8(chunk, tab)),
+                    _mm_or_si128(_mm_cmpeq_epi8(chunk, newline), _mm_cmpeq_epi8(chunk, carriage_return))));
+                if (whitespace) {
+                    if (whitespace != 0xffff) {
+                        char block[16];
+                        _mm_storeu_si128(reinterpret_cast<__m128i*>(block), chunk);
+                        const unsigned keep = ~static_cast<unsigned>(whitespace);
+                        out = internal::compress_group(out, block, keep & 0xff, table);
+                        out = internal::compress_group(out, block + 8, (keep >> 8) & 0xff, table);
+                    }
+                    in += 16;
+                    continue;
+                }
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), chunk);
+            out += 16;
+            in += 16;
+            escaped = false;
+        }
+#endif
+
+        for (; in != end; ++in) {
+            out = internal::minify_byte(*in, out, in_string, escaped);
+        }
+        return out - data;
+    }
+
+    namespace internal {
+        // Unescapes a string in place within a buffer of its own.
+        class string_decoder : private parser_base {
+        public:
+            string_decoder(char* buffer, size_t length)
+                : parser_base(buffer, buffer + length)
+            {}
+
+            char* decode(char* p, size_t* tag) {
+                return parse_string(p, tag);
+            }
+        };
+
+        // The engine behind lazy_document: finds values by scanning the
+        // raw text, never writing to it.
+        class lazy_reader : private parser_base {
+        public:
+            lazy_reader(const char* input, size_t length, allocator& alloc)
+                // Only the read-only parts of parser_base are used.
+                : parser_base(const_cast<char*>(input), const_cast<char*>(input) + length)
+                , alloc(alloc)
+                , scratch(0)
+            {}
+
+            ~lazy_reader() {
+                if (scratch) {
+                    alloc.deallocate(scratch);
+                }
+            }
+
+            lazy_reader(const lazy_reader&) = delete;
+            void operator=(const lazy_reader&) = delete;
+
+            const char* root() {
+                char* p = skip_whitespace(input);
+                if (SAJSON_UNLIKELY(!p)) {
+                    return fail(p, ERROR_MISSING_ROOT_ELEMENT);
+                }
+                if (SAJSON_UNLIKELY(*p != '[' && *p != '{')) {
+                    return fail(p, ERROR_BAD_ROOT);
+                }
+                return p;
+            }
+
+            type get_type(const char* p) {
+                switch (*p) {
+                    case '{': return TYPE_OBJECT;
+                    case '[': return TYPE_ARRAY;
+                    case '"': return TYPE_STRING;
+                    case 'n': return TYPE_NULL;
+                    case 't': return TYPE_TRUE;
+                    case 'f': return TYPE_FALSE;
+                    default: {
+                        int i;
+                        double d;
+                        return read_number(p, i, d);
+                    }
+                }
+            }
+
+            // Returns TYPE_NULL if the number is malformed.
+            type read_number(const char* p, int& i, double& d) {
+                i = 0;
+                d = 0.0;
+                const saved_error saved = save_error();
+                std::pair<char*, type> result = decode_number(const_cast<char*>(p), i, d);
+                keep_first_error(saved);
+                if (SAJSON_UNLIKELY(!result.first)) {
+                    return TYPE_NULL;
+                }
+                return result.second;
+            }
+
+            // Returns the decoded contents of the string at p, or null if
+            // it is malformed.  Strings without escapes point straight
+            // into the input; others are decoded into a scratch buffer
+            // that lives as long as the reader.
+            const char* read_string(const char* p, size_t* length) {
+                assert(*p == '"');
+                const saved_error saved = save_error();
+                char* end = parse_string<false>(const_cast<char*>(p), 0);
+                keep_first_error(saved);
+                if (SAJSON_UNLIKELY(!end)) {
+                    return 0;
+                }
+                const char* contents = p + 1;
+                const size_t raw_length = end - 1 - contents;
+                if (!memchr(contents, '\\', raw_length)) {
+                    *length = raw_length;
+                    return contents;
+                }
+
+                const size_t input_length = input_end - input;
+                if (!scratch) {
+                    scratch = static_cast<char*>(alloc.allocate(input_length));
+                    if (SAJSON_UNLIKELY(!scratch)) {
+                        return fail(p, ERROR_OUT_OF_MEMORY);
+                    }
                 }
-                goto pop;
+                // Decoded strings never grow, so decoding each one at its
+                // own offset keeps earlier results intact.
+                const size_t offset = p - input;
+                memcpy(scratch + offset, p, end - p);
+                size_t tag[2];
+                string_decoder(scratch, input_length).decode(scratch + offset, tag);
+                *length = tag[1] - tag[0];
+                return scratch + tag[0];
             }
 
-            // ASSUMES: byte at p SHOULD NOT be skipped
-            object_key: {
-                p = skip_whitespace(p);
+            // Returns the value of the first member named key, or null if
+            // there is none.
+            const char* find_key(const char* object, const string& key) {
+                assert(*object == '{');
+                const char* p = skip_whitespace(const_cast<char*>(object) + 1);
                 if (SAJSON_UNLIKELY(!p)) {
-                    return unexpected_end();
+                    return fail(p, ERROR_UNEXPECTED_END);
                 }
-                if (SAJSON_UNLIKELY(*p != '"')) {
-                    return make_error(p, ERROR_MISSING_OBJECT_KEY);
+                if (*p == '}') {
+                    return 0;
                 }
-                size_t* out = stack.reserve(2);
-                p = parse_string(p, out);
+                for (;;) {
+                    if (SAJSON_UNLIKELY(*p != '"')) {
+                        return fail(p, ERROR_MISSING_OBJECT_KEY);
+                    }
+                    const char* key_start = p;
+                    p = skip_string(p);
+                    if (SAJSON_UNLIKELY(!p)) {
+                        return 0;
+                    }
+                    const bool match = key_equals(key_start, p, key);
+                    p = skip_whitespace(const_cast<char*>(p));
+                    if (SAJSON_UNLIKELY(!p || *p != ':')) {
+                        return fail(p, ERROR_EXPECTED_COLON);
+                    }
+                    p = skip_whitespace(const_cast<char*>(p) + 1);
+                    if (SAJSON_UNLIKELY(!p)) {
+                        return fail(p, ERROR_UNEXPECTED_END);
+                    }
+                    if (match) {
+                        return check_value(p);
+                    }
+                    p = next_member(p, '}');
+                    if (!p) {
+                        return 0;
+                    }
+                }
+            }
+
+            // Returns the element at index, or null if there is none.
+            const char* find_element(const char* array, size_t index) {
+                assert(*array == '[');
+                const char* p = skip_whitespace(const_cast<char*>(array) + 1);
                 if (SAJSON_UNLIKELY(!p)) {
-                    return false;
+                    return fail(p, ERROR_UNEXPECTED_END);
                 }
-                p = skip_whitespace(p);
-                if (SAJSON_UNLIKELY(!p || *p != ':')) {
-                    return make_error(p, ERROR_EXPECTED_COLON);
+                if (*p == ']') {
+                    return 0;
                 }
-                ++p;
-                goto next_element;
+                for (; index; --index) {
+                    p = next_member(p, ']');
+                    if (!p) {
+                        return 0;
+                    }
+                }
+                return check_value(p);
             }
 
-            // ASSUMES: byte at p SHOULD NOT be skipped
-            next_element:
-                p = skip_whitespace(p);
+            size_t count_elements(const char* structure) {
+                const char close = (*structure == '[') ? ']' : '}';
+                const char* p = skip_whitespace(const_cast<char*>(structure) + 1);
                 if (SAJSON_UNLIKELY(!p)) {
-                    return unexpected_end();
+                    fail(p, ERROR_UNEXPECTED_END);
+                    return 0;
                 }
-
-                type value_type_result;
-                switch (*p) {
-                    case 0:
-                        return unexpected_end(p);
-                    case 'n':
-                        p = parse_null(p);
-                        if (!p) {
-                            return false;
-                        }
-                        value_type_result = TYPE_NULL;
-                        break;
-                    case 'f':
-                        p = parse_false(p);
-                        if (!p) {
-                            return false;
-                        }
-                        value_type_result = TYPE_FALSE;
-                        break;
-                    case 't':
-                        p = parse_true(p);
-                        if (!p) {
-                            return false;
-                        }
-                        value_type_result = TYPE_TRUE;
-                        break;
-                    case '0':
-                    case '1':
-                    case '2':
-                    case '3':
-                    case '4':
-                    case '5':
-                    case '6':
-                    case '7':
-                    case '8':
-                    case '9':
-                    case '-': {
-                        auto result = parse_number(p);
-                        p = result.first;
-                        if (!p) {
-                            return false;
-                        }
-                        value_type_result = result.second;
-                        break;
-                    }
-                    case '"': {
-                        write_cursor -= 2;
-                        size_t* string_tag = write_cursor;
-                        p = parse_string(p, string_tag);
+                size_t count = 0;
+                while (*p != close) {
+                    if (close == '}') {
+                        p = skip_key(p);
                         if (!p) {
-                            return false;
+                            break;
                         }
-                        value_type_result = TYPE_STRING;
-                        break;
-                    }
-
-                    case '[': {
-                        size_t previous_base = current_base;
-                        current_base = stack.get_size();
-                        stack.push(make_element(current_structure_type, previous_base));
-                        current_structure_type = TYPE_ARRAY;
-                        goto array_close_or_element;
-                    }
-                    case '{': {
-                        size_t previous_base = current_base;
-                        current_base = stack.get_size();
-                        stack.push(make_element(current_structure_type, previous_base));
-                        current_structure_type = TYPE_OBJECT;
-                        goto object_close_or_element;
                     }
-                    pop: {
-                        size_t parent = get_element_value(pop_element);
-                        if (parent == ROOT_MARKER) {
-                            root_type = current_structure_type;
-                            p = skip_whitespace(p);
-                            if (SAJSON_UNLIKELY(p)) {
-                                return make_error(p, ERROR_EXPECTED_END_OF_INPUT);
-                            }
-                            return true;
-                        }
-                        stack.reset(current_base);
-                        current_base = parent;
-                        value_type_result = current_structure_type;
-                        current_structure_type = get_element_type(pop_element);
+                    ++count;
+                    p = next_member(p, close);
+                    if (!p) {
                         break;
                     }
-
-                    case ',':
-                        return make_error(p, ERROR_UNEXPECTED_COMMA);
-                    default:
-                        return make_error(p, ERROR_EXPECTED_VALUE);
                 }
-
-                stack.push(make_element(value_type_result, storage.structure_end() - write_cursor));
-
-                goto structure_close_or_comma;
+                return count;
             }
 
-            SAJSON_UNREACHABLE();
-        }
-
-        bool has_remaining_characters(char* p, ptrdiff_t remaining) {
-            return storage.input_end() - p >= remaining;
-        }
-
-        char* parse_null(char* p) {
-            if (SAJSON_UNLIKELY(!has_remaining_characters(p, 4))) {
-                make_error(p, ERROR_UNEXPECTED_END);
-                return 0;
-            }
-            char p1 = p[1];
-            char p2 = p[2];
-            char p3 = p[3];
-            if (SAJSON_UNLIKELY(p1 != 'u' || p2 != 'l' || p3 != 'l')) {
-                make_error(p, ERROR_EXPECTED_NULL);
-                return 0;
+            parse_result get_error() const {
+                if (error_code == ERROR_SUCCESS) {
+                    return parse_result();
+                }
+                return parse_result(error_line, error_column, error_code, error_arg);
             }
-            return p + 4;
-        }
 
-        char* parse_false(char* p) {
-            if (SAJSON_UNLIKELY(!has_remaining_characters(p, 5))) {
-                return make_error(p, ERROR_UNEXPECTED_END);
-            }
-            char p1 = p[1];
-            char p2 = p[2];
-            char p3 = p[3];
-            char p4 = p[4];
-            if (SAJSON_UNLIKELY(p1 != 'a' || p2 != 'l' || p3 != 's' || p4 != 'e')) {
-                return make_error(p, ERROR_EXPECTED_FALSE);
+        private:
+            // Records the first error; later ones are usually fallout.
+            error_result fail(const char* p, error code) {
+                if (error_code == ERROR_SUCCESS) {
+                    make_error(const_cast<char*>(p), code);
+                }
+                return error_result();
             }
-            return p + 5;
-        }
 
-        char* parse_true(char* p) {
-            if (SAJSON_UNLIKELY(!has_remaining_characters(p, 4))) {
-                return make_error(p, ERROR_UNEXPECTED_END);
-            }
-            char p1 = p[1];
-            char p2 = p[2];
-            char p3 = p[3];
-            if (SAJSON_UNLIKELY(p1 != 'r' || p2 != 'u' || p3 != 'e')) {
-                return make_error(p, ERROR_EXPECTED_TRUE);
+            // parser_base's own checks report through make_error
+            // directly, so each call into one saves the error state and
+            // puts back any earlier error it overwrote.
+            struct saved_error {
+                size_t line;
+                size_t column;
+                error code;
+                int arg;
+            };
+
+            saved_error save_error() const {
+                saved_error saved = {error_line, error_column, error_code, error_arg};
+                return saved;
             }
-            return p + 4;
-        }
 
-        static double pow10(int exponent) {
-            if (exponent > 308) {
-                return std::numeric_limits<double>::infinity();
-            } else if (exponent < -323) {
-                return 0.0;
+            void keep_first_error(const saved_error& saved) {
+                if (saved.code != ERROR_SUCCESS) {
+                    error_line = saved.line;
+                    error_column = saved.column;
+                    error_code = saved.code;
+                    error_arg = saved.arg;
+                }
             }
-            static const double constants[] = {
-                1e-323,1e-322,1e-321,1e-320,1e-319,1e-318,1e-317,1e-316,1e-315,1e-314,
-                1e-313,1e-312,1e-311,1e-310,1e-309,1e-308,1e-307,1e-306,1e-305,1e-304,
-                1e-303,1e-302,1e-301,1e-300,1e-299,1e-298,1e-297,1e-296,1e-295,1e-294,
-                1e-293,1e-292,1e-291,1e-290,1e-289,1e-288,1e-287,1e-286,1e-285,1e-284,
-                1e-283,1e-282,1e-281,1e-280,1e-279,1e-278,1e-277,1e-276,1e-275,1e-274,
-                1e-273,1e-272,1e-271,1e-270,1e-269,1e-268,1e-267,1e-266,1e-265,1e-264,
-                1e-263,1e-262,1e-261,1e-260,1e-259,1e-258,1e-257,1e-256,1e-255,1e-254,
-                1e-253,1e-252,1e-251,1e-250,1e-249,1e-248,1e-247,1e-246,1e-245,1e-244,
-                1e-243,1e-242,1e-241,1e-240,1e-239,1e-238,1e-237,1e-236,1e-235,1e-234,
-                1e-233,1e-232,1e-231,1e-230,1e-229,1e-228,1e-227,1e-226,1e-225,1e-224,
-                1e-223,1e-222,1e-221,1e-220,1e-219,1e-218,1e-217,1e-216,1e-215,1e-214,
-                1e-213,1e-212,1e-211,1e-210,1e-209,1e-208,1e-207,1e-206,1e-205,1e-204,
-                1e-203,1e-202,1e-201,1e-200,1e-199,1e-198,1e-197,1e-196,1e-195,1e-194,
-                1e-193,1e-192,1e-191,1e-190,1e-189,1e-188,1e-187,1e-186,1e-185,1e-184,
-                1e-183,1e-182,1e-181,1e-180,1e-179,1e-178,1e-177,1e-176,1e-175,1e-174,
-                1e-173,1e-172,1e-171,1e-170,1e-169,1e-168,1e-167,1e-166,1e-165,1e-164,
-                1e-163,1e-162,1e-161,1e-160,1e-159,1e-158,1e-157,1e-156,1e-155,1e-154,
-                1e-153,1e-152,1e-151,1e-150,1e-149,1e-148,1e-147,1e-146,1e-145,1e-144,
-                1e-143,1e-142,1e-141,1e-140,1e-139,1e-138,1e-137,1e-136,1e-135,1e-134,
-                1e-133,1e-132,1e-131,1e-130,1e-129,1e-128,1e-127,1e-126,1e-125,1e-124,
-                1e-123,1e-122,1e-121,1e-120,1e-119,1e-118,1e-117,1e-116,1e-115,1e-114,
-                1e-113,1e-112,1e-111,1e-110,1e-109,1e-108,1e-107,1e-106,1e-105,1e-104,
-                1e-103,1e-102,1e-101,1e-100,1e-99,1e-98,1e-97,1e-96,1e-95,1e-94,1e-93,
-                1e-92,1e-91,1e-90,1e-89,1e-88,1e-87,1e-86,1e-85,1e-84,1e-83,1e-82,1e-81,
-                1e-80,1e-79,1e-78,1e-77,1e-76,1e-75,1e-74,1e-73,1e-72,1e-71,1e-70,1e-69,
-                1e-68,1e-67,1e-66,1e-65,1e-64,1e-63,1e-62,1e-61,1e-60,1e-59,1e-58,1e-57,
-                1e-56,1e-55,1e-54,1e-53,1e-52,1e-51,1e-50,1e-49,1e-48,1e-47,1e-46,1e-45,
-                1e-44,1e-43,1e-42,1e-41,1e-40,1e-39,1e-38,1e-37,1e-36,1e-35,1e-34,1e-33,
-                1e-32,1e-31,1e-30,1e-29,1e-28,1e-27,1e-26,1e-25,1e-24,1e-23,1e-22,1e-21,
-                1e-20,1e-19,1e-18,1e-17,1e-16,1e-15,1e-14,1e-13,1e-12,1e-11,1e-10,1e-9,
-                1e-8,1e-7,1e-6,1e-5,1e-4,1e-3,1e-2,1e-1,1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,
-                1e8,1e9,1e10,1e11,1e12,1e13,1e14,1e15,1e16,1e17,1e18,1e19,1e20,1e21,
-                1e22,1e23,1e24,1e25,1e26,1e27,1e28,1e29,1e30,1e31,1e32,1e33,1e34,1e35,
-                1e36,1e37,1e38,1e39,1e40,1e41,1e42,1e43,1e44,1e45,1e46,1e47,1e48,1e49,
-                1e50,1e51,1e52,1e53,1e54,1e55,1e56,1e57,1e58,1e59,1e60,1e61,1e62,1e63,
-                1e64,1e65,1e66,1e67,1e68,1e69,1e70,1e71,1e72,1e73,1e74,1e75,1e76,1e77,
-                1e78,1e79,1e80,1e81,1e82,1e83,1e84,1e85,1e86,1e87,1e88,1e89,1e90,1e91,
-                1e92,1e93,1e94,1e95,1e96,1e97,1e98,1e99,1e100,1e101,1e102,1e103,1e104,
-                1e105,1e106,1e107,1e108,1e109,1e110,1e111,1e112,1e113,1e114,1e115,1e116,
-                1e117,1e118,1e119,1e120,1e121,1e122,1e123,1e124,1e125,1e126,1e127,1e128,
-                1e129,1e130,1e131,1e132,1e133,1e134,1e135,1e136,1e137,1e138,1e139,1e140,
-                1e141,1e142,1e143,1e144,1e145,1e146,1e147,1e148,1e149,1e150,1e151,1e152,
-                1e153,1e154,1e155,1e156,1e157,1e158,1e159,1e160,1e161,1e162,1e163,1e164,
-                1e165,1e166,1e167,1e168,1e169,1e170,1e171,1e172,1e173,1e174,1e175,1e176,
-                1e177,1e178,1e179,1e180,1e181,1e182,1e183,1e184,1e185,1e186,1e187,1e188,
-                1e189,1e190,1e191,1e192,1e193,1e194,1e195,1e196,1e197,1e198,1e199,1e200,
-                1e201,1e202,1e203,1e204,1e205,1e206,1e207,1e208,1e209,1e210,1e211,1e212,
-                1e213,1e214,1e215,1e216,1e217,1e218,1e219,1e220,1e221,1e222,1e223,1e224,
-                1e225,1e226,1e227,1e228,1e229,1e230,1e231,1e232,1e233,1e234,1e235,1e236,
-                1e237,1e238,1e239,1e240,1e241,1e242,1e243,1e244,1e245,1e246,1e247,1e248,
-                1e249,1e250,1e251,1e252,1e253,1e254,1e255,1e256,1e257,1e258,1e259,1e260,
-                1e261,1e262,1e263,1e264,1e265,1e266,1e267,1e268,1e269,1e270,1e271,1e272,
-                1e273,1e274,1e275,1e276,1e277,1e278,1e279,1e280,1e281,1e282,1e283,1e284,
-                1e285,1e286,1e287,1e288,1e289,1e290,1e291,1e292,1e293,1e294,1e295,1e296,
-                1e297,1e298,1e299,1e300,1e301,1e302,1e303,1e304,1e305,1e306,1e307,1e308
-            };
-            return constants[exponent + 323];
-        }
 
-        std::pair<char*, type> parse_number(char* p) {
-            bool negative = false;
-            if ('-' == *p) {
-                ++p;
-                negative = true;
+            // Checks that p begins a value, leaving numbers and strings
+            // to be decoded when they are read.
+            const char* check_value(const char* p) {
+                char* q = const_cast<char*>(p);
+                const saved_error saved = save_error();
+                switch (*p) {
+                    case 'n':
+                        q = parse_null(q);
+                        break;
+                    case 't':
+                        q = parse_true(q);
+                        break;
+                    case 'f':
+                        q = parse_false(q);
+                        break;
+                    case '"': case '[': case '{': case '-':
+                    case '0': case '1': case '2': case '3': case '4':
+                    case '5': case '6': case '7': case '8': case '9':
+                        return p;
+                    default:
+                        return fail(p, ERROR_EXPECTED_VALUE);
+                }
+                keep_first_error(saved);
+                return q ? p : 0;
+            }
 
-                if (SAJSON_UNLIKELY(at_eof(p))) {
-                    return std::make_pair(make_error(p, ERROR_UNEXPECTED_END), TYPE_NULL);
+            // Given the start of a member's key, returns the start of its
+            // value.
+            const char* skip_key(const char* p) {
+                if (SAJSON_UNLIKELY(*p != '"')) {
+                    return fail(p, ERROR_MISSING_OBJECT_KEY);
+                }
+                p = skip_string(p);
+                if (SAJSON_UNLIKELY(!p)) {
+                    return 0;
+                }
+                p = skip_whitespace(const_cast<char*>(p));
+                if (SAJSON_UNLIKELY(!p || *p != ':')) {
+                    return fail(p, ERROR_EXPECTED_COLON);
+                }
+                p = skip_whitespace(const_cast<char*>(p) + 1);
+                if (SAJSON_UNLIKELY(!p)) {
+                    return fail(p, ERROR_UNEXPECTED_END);
                 }
+                return p;
             }
 
-            bool try_double = false;
-
-            int i = 0;
-            double d = 0.0; // gcc complains that d might be used uninitialized which isn't true. appease the warning anyway.
-            if (*p == '0') {
-                ++p;
-                if (SAJSON_UNLIKELY(at_eof(p))) {
-                    return std::make_pair(make_error(p, ERROR_UNEXPECTED_END), TYPE_NULL);
+            // Skips the array element or object member value at p and
+            // the comma after it.  Returns the start of the next element
+            // or key, or null at the end of the structure or on error.
+            const char* next_member(const char* p, char close) {
+                p = skip_value(p);
+                if (SAJSON_UNLIKELY(!p)) {
+                    return 0;
                 }
-            } else for (;;) {
-                unsigned char c = *p;
-                if (c < '0' || c > '9') {
-                    break;
+                p = skip_whitespace(const_cast<char*>(p));
+                if (SAJSON_UNLIKELY(!p)) {
+                    return fail(p, ERROR_UNEXPECTED_END);
                 }
-
-                ++p;
-                if (SAJSON_UNLIKELY(at_eof(p))) {
-                    return std::make_pair(make_error(p, ERROR_UNEXPECTED_END), TYPE_NULL);
+                if (*p == close) {
+                    return 0;
                 }
-
-                unsigned char digit = c - '0';
-
-                if (SAJSON_UNLIKELY(!try_double && i > INT_MAX / 10 - 9)) {
-                    // TODO: could split this into two loops
-                    try_double = true;
-                    d = i;
+                if (SAJSON_UNLIKELY(*p != ',')) {
+                    return fail(p, ERROR_EXPECTED_COMMA);
                 }
-                if (SAJSON_UNLIKELY(try_double)) {
-                    d = 10.0 * d + digit;
-                } else {
-                    i = 10 * i + digit;
+                p = skip_whitespace(const_cast<char*>(p) + 1);
+                if (SAJSON_UNLIKELY(!p)) {
+                    return fail(p, ERROR_UNEXPECTED_END);
                 }
+                return p;
             }
 
-            int exponent = 0;
-
-            if ('.' == *p) {
-                if (!try_double) {
-                    try_double = true;
-                    d = i;
-                }
+            // Given an opening quote, returns a pointer past the closing
+            // quote.  Only escapes are interpreted; the contents are not
+            // checked.
+            const char* skip_string(const char* p) {
                 ++p;
-                if (SAJSON_UNLIKELY(at_eof(p))) {
-                    return std::make_pair(make_error(p, ERROR_UNEXPECTED_END), TYPE_NULL);
-                }
                 for (;;) {
-                    char c = *p;
-                    if (c < '0' || c > '9') {
-                        break;
+                    while (input_end - p >= 4
+                        && internal::is_plain_string_character(p[0])
+                        && internal::is_plain_string_character(p[1])
+                        && internal::is_plain_string_character(p[2])
+                        && internal::is_plain_string_character(p[3])
+                    ) {
+                        p += 4;
                     }
-
-                    ++p;
-                    if (SAJSON_UNLIKELY(at_eof(p))) {
-                        return std::make_pair(make_error(p, ERROR_UNEXPECTED_END), TYPE_NULL);
+                    if (SAJSON_UNLIKELY(p == input_end)) {
+                        return fail(p, ERROR_UNEXPECTED_END);
+                    }
+                    const char c = *p++;
+                    if (c == '"') {
+                        return p;
+                    } else if (c == '\\') {
+                        if (SAJSON_UNLIKELY(p == input_end)) {
+                            return fail(p, ERROR_UNEXPECTED_END);
+                        }
+                        ++p;
                     }
-                    d = d * 10 + (c - '0');
-                    --exponent;
                 }
             }
 
-            char e = *p;
-            if ('e' == e || 'E' == e) {
-                if (!try_double) {
-                    try_double = true;
-                    d = i;
-                }
-                ++p;
-                if (SAJSON_UNLIKELY(at_eof(p))) {
-                    return std::make_pair(make_error(p, ERROR_UNEXPECTED_END), TYPE_NULL);
+            // Skips the value at p by tracking only quotes and bracket
+            // depth.  Skipped text is not validated.
+            const char* skip_value(const char* p) {
+                switch (*p) {
+                    case '"':
+                        return skip_string(p);
+                    case '[':
+                    case '{': {
+                        size_t depth = 0;
+                        for (;;) {
+                            while (p != input_end && !internal::is_bracket_or_quote(*p)) {
+                                ++p;
+                            }
+                            if (SAJSON_UNLIKELY(p == input_end)) {
+                                return fail(p, ERROR_UNEXPECTED_END);
+                            }
+                            const char c = *p;
+                            if (c == '"') {
+                                p = skip_string(p);
+                                if (SAJSON_UNLIKELY(!p)) {
+                                    return 0;
+                                }
+                                continue;
+                            }
+                            ++p;
+                            if (c == '[' || c == '{') {
+                                ++depth;
+                            } else if (--depth == 0) {
+                                return p;
+                            }
+                        }
+                    }
+                    default:
+                        while (p != input_end
+                            && !internal::is_whitespace(*p)
+                            && *p != ',' && *p != ']' && *p != '}'
+                        ) {
+                            ++p;
+                        }
+                        return p;
                 }
+            }
 
-                bool negativeExponent = false;
-                if ('-' == *p) {
-                    negativeExponent = true;
-                    ++p;
-                    if (SAJSON_UNLIKELY(at_eof(p))) {
-                        return std::make_pair(make_error(p, ERROR_UNEXPECTED_END), TYPE_NULL);
-                    }
-                } else if ('+' == *p) {
-                    ++p;
-                    if (SAJSON_UNLIKELY(at_eof(p))) {
-                        return std::make_pair(make_error(p, ERROR_UNEXPECTED_END), TYPE_NULL);
-                    }
+            // start and end delimit a raw key, including its quotes.
+            bool key_equals(const char* start, const char* end, const string& key) {
+                const char* contents = start + 1;
+                const size_t raw_length = end - 1 - contents;
+                if (SAJSON_LIKELY(!memchr(contents, '\\', raw_length))) {
+                    return raw_length == key.length() && memcmp(contents, key.data(), raw_length) == 0;
                 }
+                size_t length;
+                const char* decoded = read_string(start, &length);
+                return decoded && length == key.length() && memcmp(decoded, key.data(), length) == 0;
+            }
 
-                int exp = 0;
+            allocator& alloc;
+            char* scratch;
+        };
+    }
 
-                char c = *p;
-                if (SAJSON_UNLIKELY(c < '0' || c > '9')) {
-                    return std::make_pair(make_error(p, ERROR_MSSING_EXPONENT), TYPE_NULL);
-                }
-                for (;;) {
-                    exp = 10 * exp + (c - '0');
+    // A value inside a lazy_document, represented only by its position in
+    // the text.  Navigating scans forward from that position, and scalars
+    // are decoded each time they are read, so cache what is used often.
+    //
+    // Navigation never fails loudly: a missing key, an out-of-range index,
+    // navigating into a scalar, or malformed text all produce a value for
+    // which exists() is false, and navigating from such a value produces
+    // another.  Chains like root.get_value_of_key(a).get_value_of_key(b)
+    // therefore only need checking at the end.  When exists() is false
+    // because of malformed text, lazy_document::get_error() says why.
+    class lazy_value {
+    public:
+        bool exists() const {
+            return p != 0;
+        }
 
-                    ++p;
-                    if (SAJSON_UNLIKELY(at_eof(p))) {
-                        return std::make_pair(make_error(p, ERROR_UNEXPECTED_END), TYPE_NULL);
-                    }
+        // valid iff exists()
+        type get_type() const {
+            assert(exists());
+            return reader->get_type(p);
+        }
 
-                    c = *p;
-                    if (c < '0' || c > '9') {
-                        break;
-                    }
-                }
-                exponent += (negativeExponent ? -exp : exp);
-            }
+        // valid iff get_type() is TYPE_ARRAY or TYPE_OBJECT
+        // Scans the whole structure.
+        size_t get_length() const {
+            assert(p && (*p == '[' || *p == '{'));
+            return reader->count_elements(p);
+        }
 
-            if (exponent) {
-                assert(try_double);
-                d *= pow10(exponent);
+        lazy_value get_array_element(size_t index) const {
+            if (!p || *p != '[') {
+                return lazy_value(reader, 0);
             }
+            return lazy_value(reader, reader->find_element(p, index));
+        }
 
-            if (negative) {
-                if (try_double) {
-                    d = -d;
-                } else {
-                    i = -i;
-                }
-            }
-            if (try_double) {
-                write_cursor -= (double_storage::word_length);
-                double_storage::store(write_cursor, d);
-                return std::make_pair(p, TYPE_DOUBLE);
-            } else {
-                write_cursor -= integer_storage::word_length;
-                integer_storage::store(write_cursor, i);
-                return std::make_pair(p, TYPE_INTEGER);
+        // Returns the first member named key.
+        lazy_value get_value_of_key(const string& key) const {
+            if (!p || *p != '{') {
+                return lazy_value(reader, 0);
             }
+            return lazy_value(reader, reader->find_key(p, key));
         }
 
-        bool install_array(size_t* array_base, size_t* array_end) {
-            const size_t length = array_end - array_base;
-            write_cursor -= length + 1;
-            size_t* const new_base = write_cursor;
-            size_t* out = new_base + length + 1;
+        // valid iff get_type() is TYPE_INTEGER
+        int get_integer_value() const {
+            int i;
+            double d;
+            type t = read_number(i, d);
+            (void)t;
+            assert(t == TYPE_INTEGER);
+            return i;
+        }
 
-            while (array_end > array_base) {
-                size_t element = *--array_end;
-                type element_type = get_element_type(element);
-                size_t element_value = get_element_value(element);
-                size_t* element_ptr = storage.structure_end() - element_value;
-                *--out = make_element(element_type, element_ptr - new_base);
-            }
-            *--out = length;
-            return true;
+        // valid iff get_type() is TYPE_DOUBLE
+        double get_double_value() const {
+            int i;
+            double d;
+            type t = read_number(i, d);
+            (void)t;
+            assert(t == TYPE_DOUBLE);
+            return d;
         }
 
-        bool install_object(size_t* object_base, size_t* object_end) {
-            assert((object_end - object_base) % 3 == 0);
-            const size_t length_times_3 = object_end - object_base;
-            std::sort(
-                reinterpret_cast<object_key_record*>(object_base),
-                reinterpret_cast<object_key_record*>(object_end),
-                object_key_comparator(storage.input));
+        // valid iff get_type() is TYPE_INTEGER or TYPE_DOUBLE
+        double get_number_value() const {
+            int i;
+            double d;
+            return read_number(i, d) == TYPE_INTEGER ? i : d;
+        }
 
-            write_cursor -= length_times_3 + 1;
-            size_t* const new_base = write_cursor;
-            size_t* out = new_base + length_times_3 + 1;
+        // valid iff get_type() is TYPE_STRING
+        // Returns an empty string if the string is malformed.  Strings with
+        // escapes are decoded into memory owned by the document; the result
+        // stays valid as long as the document does.
+        string get_string_value() const {
+            assert(p && *p == '"');
+            size_t length = 0;
+            const char* data = reader->read_string(p, &length);
+            return data ? string(data, length) : string("", 0);
+        }
 
-            while (object_end > object_base) {
-                size_t element = *--object_end;
-                type element_type = get_element_type(element);
-                size_t element_value = get_element_value(element);
-                size_t* element_ptr = storage.structure_end() - element_value;
+#ifndef SAJSON_NO_STD_STRING
+        // valid iff get_type() is TYPE_STRING
+        std::string as_string() const {
+            return get_string_value().as_string();
+        }
+#endif
 
-                *--out = make_element(element_type, element_ptr - new_base);
-                *--out = *--object_end;
-                *--out = *--object_end;
-            }
-            *--out = length_times_3 / 3;
-            return true;
+    private:
+        friend class lazy_document;
+
+        lazy_value(internal::lazy_reader* reader, const char* p)
+            : reader(reader)
+            , p(p)
+        {}
+
+        type read_number(int& i, double& d) const {
+            assert(p);
+            return reader->read_number(p, i, d);
         }
 
-        char* parse_string(char* p, size_t* tag) {
-            ++p; // "
-            size_t start = p - storage.input;
-            while (storage.input_end() - p >= 4) {
-                if (!internal::is_plain_string_character(p[0])) { goto found; }
-                if (!internal::is_plain_string_character(p[1])) { p += 1; goto found; }
-                if (!internal::is_plain_string_character(p[2])) { p += 2; goto found; }
-                if (!internal::is_plain_string_character(p[3])) { p += 3; goto found; }
-                p += 4;
-            }
-            for (;;) {
-                if (SAJSON_UNLIKELY(p >= storage.input_end())) {
-                    return make_error(p, ERROR_UNEXPECTED_END);
-                }
+        internal::lazy_reader* reader;
+        const char* p;
+    };
 
-                if (!internal::is_plain_string_character(*p)) {
-                    break;
-                }
+    // Reads a document on demand instead of parsing it up front.  Only the
+    // text between the root and the values actually requested is scanned;
+    // subtrees that are passed over are skipped by tracking brackets and
+    // quotes, without validating or decoding them.  This is much cheaper
+    // than parse() when a few fields are read from a large document, but
+    // also means malformed text is only detected where it is traversed;
+    // use validate() first if that matters.
+    //
+    // The input is neither copied nor modified, so it must outlive the
+    // lazy_document and its values.
+    class lazy_document {
+    public:
+        explicit lazy_document(const sajson::string& input, allocator* alloc = nullptr)
+            : reader(input.data(), input.length(), alloc ? *alloc : internal::get_default_allocator())
+        {}
 
-                ++p;
-            }
-        found:
-            if (SAJSON_LIKELY(*p == '"')) {
-                tag[0] = start;
-                tag[1] = p - storage.input;
-                *p = '\0';
-                return p + 1;
-            }
+        lazy_document(const lazy_document&) = delete;
+        void operator=(const lazy_document&) = delete;
 
-            if (*p >= 0 && *p < 0x20) {
-                return make_error(p, ERROR_ILLEGAL_CODEPOINT, static_cast<int>(*p));
-            } else {
-                // backslash or >0x7f
-                return parse_string_slow(p, tag, start);
-            }
+        lazy_value get_root() {
+            return lazy_value(&reader, reader.root());
         }
 
-        char* read_hex(char* p, unsigned& u) {
-            unsigned v = 0;
-            int i = 4;
-            while (i--) {
-                unsigned char c = *p++;
-                if (c >= '0' && c <= '9') {
-                    c -= '0';
-                } else if (c >= 'a' && c <= 'f') {
-                    c = c - 'a' + 10;
-                } else if (c >= 'A' && c <= 'F') {
-                    c = c - 'A' + 10;
-                } else {
-                    return make_error(p, ERROR_INVALID_UNICODE_ESCAPE);
-                }
-                v = (v << 4) + c;
+        // The first error encountered while navigating, if any.
+        parse_result get_error() const {
+            return reader.get_error();
+        }
+
+    private:
+        internal::lazy_reader reader;
+    };
+
+    // A JSON Pointer (RFC 6901), such as "/statuses/17/user/screen_name",
+    // split once into its reference tokens.  ~0 and ~1 escapes are decoded,
+    // token lengths are measured, and tokens that could be array indices
+    // are converted up front, so evaluating the pointer is nothing but
+    // object key binary searches and array indexing.  Evaluation does not
+    // allocate.
+    //
+    // The URI fragment form ("#/a/b") is not supported; percent-decode and
+    // strip the '#' first.
+    class json_pointer {
+    public:
+        explicit json_pointer(const sajson::string& path, allocator* alloc = nullptr)
+            : alloc(alloc ? alloc : &internal::get_default_allocator())
+            , tokens(0)
+            , token_count(0)
+            , valid(false)
+            , out_of_memory(false)
+        {
+            compile(path);
+        }
+
+        json_pointer(json_pointer&& rhs)
+            : alloc(rhs.alloc)
+            , tokens(rhs.tokens)
+            , token_count(rhs.token_count)
+            , valid(rhs.valid)
+            , out_of_memory(rhs.out_of_memory)
+        {
+            rhs.tokens = 0;
+            rhs.token_count = 0;
+            rhs.valid = false;
+        }
+
+        json_pointer(const json_pointer&) = delete;
+        void operator=(const json_pointer&) = delete;
+
+        ~json_pointer() {
+            if (tokens) {
+                alloc->deallocate(tokens);
             }
+        }
+
+        // False if the path is malformed (it must be empty or begin with
+        // '/', and '~' must be followed by '0' or '1') or if memory could
+        // not be allocated.  An invalid pointer never resolves.
+        bool is_valid() const {
+            return valid;
+        }
+
+        // Whether the pointer is invalid for want of memory rather than
+        // because the path is malformed.
+        bool is_out_of_memory() const {
+            return out_of_memory;
+        }
 
-            u = v;
-            return p;
+        size_t get_token_count() const {
+            return token_count;
         }
 
-        void write_utf8(unsigned codepoint, char*& end) {
-            if (codepoint < 0x80) {
-                *end++ = char(codepoint);
-            } else if (codepoint < 0x800) {
-                *end++ = 0xC0 | char(codepoint >> 6);
-                *end++ = 0x80 | char(codepoint & 0x3F);
-            } else if (codepoint < 0x10000) {
-                *end++ = 0xE0 | char(codepoint >> 12);
-                *end++ = 0x80 | char((codepoint >> 6) & 0x3F);
-                *end++ = 0x80 | char(codepoint & 0x3F);
-            } else {
-                assert(codepoint < 0x200000);
-                *end++ = 0xF0 | char(codepoint >> 18);
-                *end++ = 0x80 | char((codepoint >> 12) & 0x3F);
-                *end++ = 0x80 | char((codepoint >> 6) & 0x3F);
-                *end++ = 0x80 | char(codepoint & 0x3F);
-            }
+        // valid iff index < get_token_count()
+        string get_token(size_t index) const {
+            assert(index < token_count);
+            return string(get_token_text() + tokens[index].offset, tokens[index].length);
         }
 
-        char* parse_string_slow(char* p, size_t* tag, size_t start) {
-            char* end = p;
+        static const size_t NOT_AN_INDEX = static_cast<size_t>(-1);
 
-            for (;;) {
-                if (SAJSON_UNLIKELY(p >= storage.input_end())) {
-                    return make_error(p, ERROR_UNEXPECTED_END);
-                }
+        // valid iff index < get_token_count()
+        // The token as an array index, or NOT_AN_INDEX if it cannot be one.
+        size_t get_token_index(size_t index) const {
+            assert(index < token_count);
+            return tokens[index].index;
+        }
 
-                if (SAJSON_UNLIKELY(*p >= 0 && *p < 0x20)) {
-                    return make_error(p, ERROR_ILLEGAL_CODEPOINT, static_cast<int>(*p));
+        // Resolves the pointer against root.  Returns true and stores the
+        // referenced value in *out if every token names an existing object
+        // member or array element; otherwise returns false and leaves *out
+        // unchanged.
+        bool evaluate(const value& root, value* out) const {
+            if (!valid) {
+                return false;
+            }
+            value current = root;
+            for (size_t i = 0; i < token_count; ++i) {
+                if (!step(i, &current)) {
+                    return false;
                 }
+            }
+            *out = current;
+            return true;
+        }
 
-                switch (*p) {
-                    case '"':
-                        tag[0] = start;
-                        tag[1] = end - storage.input;
-                        *end = '\0';
-                        return p + 1;
-
-                    case '\\':
-                        ++p;
-                        if (SAJSON_UNLIKELY(p >= storage.input_end())) {
-                            return make_error(p, ERROR_UNEXPECTED_END);
-                        }
+        // Evaluates count pointers against the same root.  results[i] and
+        // found[i] receive the outcome of pointers[i]; results must point
+        // to count initialized values.  When a pointer names a sibling of
+        // the one before it, as with "/user/id" followed by "/user/name",
+        // the walk resumes from their shared parent, so grouping pointers
+        // by parent helps.  Returns the number of pointers that resolved.
+        static size_t evaluate_all(
+            const value& root,
+            const json_pointer* pointers,
+            size_t count,
+            value* results,
+            bool* found
+        ) {
+            // The value reached by all but the last token of the previous
+            // pointer, if that walk got that far.
+            const json_pointer* previous = 0;
+            value parent = root;
+            size_t parent_depth = 0;
+            size_t found_count = 0;
+
+            for (size_t i = 0; i < count; ++i) {
+                const json_pointer& pointer = pointers[i];
+                found[i] = false;
+                if (!pointer.valid) {
+                    previous = 0;
+                    continue;
+                }
 
-                        char replacement;
-                        switch (*p) {
-                            case '"': replacement = '"'; goto replace;
-                            case '\\': replacement = '\\'; goto replace;
-                            case '/': replacement = '/'; goto replace;
-                            case 'b': replacement = '\b'; goto replace;
-                            case 'f': replacement = '\f'; goto replace;
-                            case 'n': replacement = '\n'; goto replace;
-                            case 'r': replacement = '\r'; goto replace;
-                            case 't': replacement = '\t'; goto replace;
-                            replace:
-                                *end++ = replacement;
-                                ++p;
-                                break;
-                            case 'u': {
-                                ++p;
-                                if (SAJSON_UNLIKELY(!has_remaining_characters(p, 4))) {
-                                    return make_error(p, ERROR_UNEXPECTED_END);
-                                }
-                                unsigned u = 0; // gcc's complaining that this could be used uninitialized. wrong.
-                                p = read_hex(p, u);
-                                if (!p) {
-                                    return 0;
-                                }
-                                if (u >= 0xD800 && u <= 0xDBFF) {
-                                    if (SAJSON_UNLIKELY(!has_remaining_characters(p, 6))) {
-                                        return make_error(p, ERROR_UNEXPECTED_END_OF_UTF16);
-                                    }
-                                    char p0 = p[0];
-                                    char p1 = p[1];
-                                    if (p0 != '\\' || p1 != 'u') {
-                                        return make_error(p, ERROR_EXPECTED_U);
-                                    }
-                                    p += 2;
-                                    unsigned v = 0; // gcc's complaining that this could be used uninitialized. wrong.
-                                    p = read_hex(p, v);
-                                    if (!p) {
-                                        return p;
-                                    }
+                value current = root;
+                size_t depth = 0;
+                if (previous
+                    && parent_depth <= pointer.token_count
+                    && pointer.shares_prefix(*previous, parent_depth)
+                ) {
+                    current = parent;
+                    depth = parent_depth;
+                }
 
-                                    if (v < 0xDC00 || v > 0xDFFF) {
-                                        return make_error(p, ERROR_INVALID_UTF16_TRAIL_SURROGATE);
-                                    }
-                                    u = 0x10000 + (((u - 0xD800) << 10) | (v - 0xDC00));
-                                }
-                                write_utf8(u, end);
-                                break;
-                            }
-                            default:
-                                return make_error(p, ERROR_UNKNOWN_ESCAPE);
-                        }
+                previous = 0;
+                for (; depth < pointer.token_count; ++depth) {
+                    if (depth + 1 == pointer.token_count) {
+                        previous = &pointer;
+                        parent = current;
+                        parent_depth = depth;
+                    }
+                    if (!pointer.step(depth, &current)) {
                         break;
+                    }
+                }
 
-                    default:
-                        // validate UTF-8
-                        unsigned char c0 = p[0];
-                        if (c0 < 128) {
-                            *end++ = *p++;
-                        } else if (c0 < 224) {
-                            if (SAJSON_UNLIKELY(!has_remaining_characters(p, 2))) {
-                                return unexpected_end(p);
-                            }
-                            unsigned char c1 = p[1];
-                            if (c1 < 128 || c1 >= 192) {
-                                return make_error(p + 1, ERROR_INVALID_UTF8);
-                            }
-                            end[0] = c0;
-                            end[1] = c1;
-                            end += 2;
-                            p += 2;
-                        } else if (c0 < 240) {
-                            if (SAJSON_UNLIKELY(!has_remaining_characters(p, 3))) {
-                                return unexpected_end(p);
-                            }
-                            unsigned char c1 = p[1];
-                            if (c1 < 128 || c1 >= 192) {
-                                return make_error(p + 1, ERROR_INVALID_UTF8);
-                            }
-                            unsigned char c2 = p[2];
-                            if (c2 < 128 || c2 >= 192) {
-                                return make_error(p + 2, ERROR_INVALID_UTF8);
-                            }
-                            end[0] = c0;
-                            end[1] = c1;
-                            end[2] = c2;
-                            end += 3;
-                            p += 3;
-                        } else if (c0 < 248) {
-                            if (SAJSON_UNLIKELY(!has_remaining_characters(p, 4))) {
-                                return unexpected_end(p);
-                            }
-                            unsigned char c1 = p[1];
-                            if (c1 < 128 || c1 >= 192) {
-                                return make_error(p + 1, ERROR_INVALID_UTF8);
-                            }
-                            unsigned char c2 = p[2];
-                            if (c2 < 128 || c2 >= 192) {
-                                return make_error(p + 2, ERROR_INVALID_UTF8);
-                            }
-                            unsigned char c3 = p[3];
-                            if (c3 < 128 || c3 >= 192) {
-                                return make_error(p + 3, ERROR_INVALID_UTF8);
-                            }
-                            end[0] = c0;
-                            end[1] = c1;
-                            end[2] = c2;
-                            end[3] = c3;
-                            end += 4;
-                            p += 4;
-                        } else {
-                            return make_error(p, ERROR_INVALID_UTF8);
-                        }
-                        break;
+                if (depth == pointer.token_count) {
+                    results[i] = current;
+                    found[i] = true;
+                    ++found_count;
                 }
             }
+            return found_count;
         }
 
-        class stack_head {
-        public:
-            stack_head(stack_head&& other)
-                : stack_bottom(other.stack_bottom)
-                , stack_top(other.stack_top)
-            {}
+    private:
+        struct token {
+            size_t offset;
+            size_t length;
+            size_t index; // NOT_AN_INDEX unless the token is a valid array index
+        };
 
-            void push(size_t element) {
-                *stack_top++ = element;
+        void compile(const sajson::string& path) {
+            const char* p = path.data();
+            const char* const end = p + path.length();
+            if (p == end) {
+                valid = true;
+                return;
+            }
+            if (*p != '/') {
+                return;
             }
 
-            size_t* reserve(size_t amount) {
-                size_t* rv = stack_top;
-                stack_top += amount;
-                return rv;
+            size_t count = 0;
+            for (const char* c = p; c != end; ++c) {
+                count += (*c == '/');
             }
 
-            void reset(size_t new_top) {
-                stack_top = stack_bottom + new_top;
+            // The tokens and their decoded text share one allocation.
+            // Decoding never makes text longer, so path.length() bytes
+            // are enough.
+            tokens = static_cast<token*>(alloc->allocate(count * sizeof(token) + path.length()));
+            if (!tokens) {
+                out_of_memory = true;
+                return;
+            }
+            token_count = count;
+            char* const text = const_cast<char*>(get_token_text());
+            char* out = text;
+
+            for (size_t i = 0; i < count; ++i) {
+                ++p; // '/'
+                token& t = tokens[i];
+                t.offset = out - text;
+                while (p != end && *p != '/') {
+                    if (*p == '~') {
+                        ++p;
+                        if (p == end || (*p != '0' && *p != '1')) {
+                            return;
+                        }
+                        *out++ = (*p == '0') ? '~' : '/';
+                        ++p;
+                    } else {
+                        *out++ = *p++;
+                    }
+                }
+                t.length = (out - text) - t.offset;
+                t.index = parse_index(text + t.offset, t.length);
             }
+            valid = true;
+        }
 
-            size_t get_size() {
-                return stack_top - stack_bottom;
+        // RFC 6901 array indices are 0 or a decimal number without leading
+        // zeroes.  "-" names the element past the end, which never exists.
+        static size_t parse_index(const char* s, size_t length) {
+            if (length == 0 || (length > 1 && s[0] == '0')) {
+                return NOT_AN_INDEX;
+            }
+            size_t index = 0;
+            for (size_t i = 0; i < length; ++i) {
+                if (s[i] < '0' || s[i] > '9') {
+                    return NOT_AN_INDEX;
+                }
+                const size_t digit = s[i] - '0';
+                if (index > (NOT_AN_INDEX - 1 - digit) / 10) {
+                    return NOT_AN_INDEX;
+                }
+                index = index * 10 + digit;
             }
+            return index;
+        }
 
-            size_t* get_top() {
-                return stack_top;
+        const char* get_token_text() const {
+            return reinterpret_cast<const char*>(tokens + token_count);
+        }
+
+        // Whether the first count tokens of this pointer and other match.
+        bool shares_prefix(const json_pointer& other, size_t count) const {
+            for (size_t i = 0; i < count; ++i) {
+                const token& a = tokens[i];
+                const token& b = other.tokens[i];
+                if (a.length != b.length
+                    || memcmp(get_token_text() + a.offset, other.get_token_text() + b.offset, a.length) != 0
+                ) {
+                    return false;
+                }
             }
+            return true;
+        }
 
-            size_t* get_pointer_from_offset(size_t offset) {
-                return stack_bottom + offset;
+        // Applies token i to *current.
+        bool step(size_t i, value* current) const {
+            const token& t = tokens[i];
+            if (current->get_type() == TYPE_OBJECT) {
+                const size_t index = current->find_object_key(string(get_token_text() + t.offset, t.length));
+                if (index == current->get_length()) {
+                    return false;
+                }
+                *current = current->get_object_value(index);
+                return true;
+            } else if (current->get_type() == TYPE_ARRAY) {
+                if (t.index >= current->get_length()) {
+                    return false;
+                }
+                *current = current->get_array_element(t.index);
+                return true;
+            } else {
+                return false;
+            }
+        }
+
+        allocator* alloc;
+        token* tokens;
+        size_t token_count;
+        bool valid;
+        bool out_of_memory;
+    };
+
+    // The members of a document that parse() should keep.  Each path is a
+    // JSON Pointer whose tokens all name object members: arrays on the
+    // way are passed through, so "/events/id" keeps the id of every
+    // element of events.  A member at the end of a path is kept whole.
+    //
+    // Members on no path are syntax-checked and skipped as they are read,
+    // never reaching the parse stack or the AST, so both the AST and the
+    // key sorting shrink to what is kept.  The structure buffer is still
+    // sized for the whole input; document::compact() returns the rest.
+    class projection {
+    public:
+        projection(const json_pointer* paths, size_t count, allocator* alloc = nullptr)
+            : alloc(alloc ? alloc : &internal::get_default_allocator())
+            , buffer(0)
+            , valid(false)
+        {
+            trie.edges = 0;
+            trie.first_edge = 0;
+            trie.text = 0;
+            trie.root = 0;
+            compile(paths, count);
+        }
+
+        projection(projection&& rhs)
+            : alloc(rhs.alloc)
+            , buffer(rhs.buffer)
+            , trie(rhs.trie)
+            , valid(rhs.valid)
+        {
+            rhs.buffer = 0;
+            rhs.valid = false;
+        }
+
+        projection(const projection&) = delete;
+        void operator=(const projection&) = delete;
+
+        ~projection() {
+            if (buffer) {
+                alloc->deallocate(buffer);
             }
+        }
 
-            stack_head() = delete;
-            stack_head(const stack_head&) = delete;
-            void operator=(const stack_head&) = delete;
+        // False if any path is invalid or if memory could not be
+        // allocated.  Parsing with an invalid projection fails with
+        // ERROR_INVALID_PROJECTION.
+        bool is_valid() const {
+            return valid;
+        }
 
-            stack_head(size_t* base)
-                : stack_bottom(base)
-                , stack_top(base)
-            {}
+        const internal::projection_trie& _internal_get_trie() const {
+            return trie;
+        }
 
-            size_t* const stack_bottom;
-            size_t* stack_top;
+    private:
+        typedef internal::projection_trie::edge edge;
 
-            friend class single_allocation;
+        struct edge_parent_less {
+            bool operator()(const edge& a, const edge& b) const {
+                return a.parent < b.parent;
+            }
         };
 
-        data_storage storage;
-        size_t* write_cursor;
-
-        type root_type;
-        size_t error_line;
-        size_t error_column;
-        error error_code;
-        int error_arg; // optional argument for the error
-    };
+        void compile(const json_pointer* paths, size_t count) {
+            size_t token_count = 0;
+            size_t text_length = 0;
+            for (size_t i = 0; i < count; ++i) {
+                if (!paths[i].is_valid()) {
+                    return;
+                }
+                token_count += paths[i].get_token_count();
+                for (size_t j = 0; j < paths[i].get_token_count(); ++j) {
+                    text_length += paths[i].get_token(j).length();
+                }
+            }
 
-    namespace internal {
-        class default_allocator : public allocator {
-            void* allocate(size_t size) override {
-                return new uint8_t[size];
+            // Every token adds at most one edge and one node to the root.
+            const size_t max_nodes = token_count + 1;
+            buffer = alloc->allocate(
+                token_count * sizeof(edge)
+                + (max_nodes + 1) * sizeof(size_t)
+                + max_nodes
+                + text_length);
+            if (!buffer) {
+                return;
             }
-            void deallocate(const void* buf) override {
-                delete[] static_cast<const uint8_t*>(buf);
+            edge* const edges = static_cast<edge*>(buffer);
+            size_t* const first_edge = reinterpret_cast<size_t*>(edges + token_count);
+            bool* const ends_path = reinterpret_cast<bool*>(first_edge + max_nodes + 1);
+            char* const text = reinterpret_cast<char*>(ends_path + max_nodes);
+
+            size_t edge_count = 0;
+            size_t node_count = 1;
+            size_t text_used = 0;
+            ends_path[0] = false;
+            for (size_t i = 0; i < count; ++i) {
+                size_t node = 0;
+                for (size_t j = 0; j < paths[i].get_token_count() && !ends_path[node]; ++j) {
+                    const string key = paths[i].get_token(j);
+                    size_t k = 0;
+                    for (; k < edge_count; ++k) {
+                        const edge& e = edges[k];
+                        if (e.parent == node
+                            && e.key_length == key.length()
+                            && memcmp(text + e.key_offset, key.data(), key.length()) == 0
+                        ) {
+                            break;
+                        }
+                    }
+                    if (k == edge_count) {
+                        edge& e = edges[edge_count++];
+                        e.parent = node;
+                        e.key_offset = text_used;
+                        e.key_length = key.length();
+                        e.target = node_count;
+                        ends_path[node_count++] = false;
+                        memcpy(text + text_used, key.data(), key.length());
+                        text_used += key.length();
+                    }
+                    node = edges[k].target;
+                }
+                ends_path[node] = true;
             }
-        };
-    }
 
-    inline document parse(sajson::string string, allocator* alloc = nullptr) {
+            // Group the edges by the node they leave.  Subtrees under
+            // a path that ends early are unreachable and harmless.
+            std::sort(edges, edges + edge_count, edge_parent_less());
+            size_t k = 0;
+            for (size_t node = 0; node <= node_count; ++node) {
+                first_edge[node] = k;
+                while (k < edge_count && edges[k].parent == node) {
+                    ++k;
+                }
+            }
+            for (k = 0; k < edge_count; ++k) {
+                if (ends_path[edges[k].target]) {
+                    edges[k].target = internal::projection_trie::KEEP_ALL;
+                }
+            }
 
-        if (!alloc) {
-            static internal::default_allocator s_allocator;
-            alloc = &s_allocator;
+            trie.edges = edges;
+            trie.first_edge = first_edge;
+            trie.text = text;
+            trie.root = ends_path[0] ? internal::projection_trie::KEEP_ALL : 0;
+            valid = true;
         }
 
-        size_t length = string.length();
-        char* input = static_cast<char*>(alloc->allocate(length));
-        memcpy(input, string.data(), length);
-        size_t* structure = static_cast<size_t*>(alloc->allocate(length * sizeof(size_t)));
+        allocator* alloc;
+        void* buffer;
+        internal::projection_trie trie;
+        bool valid;
+    };
 
-        data_storage storage(input, true, structure, length, *alloc);
-        
-        return parser(std::move(storage)).get_document();
+    // Like parse(), but the resulting document holds only the members
+    // named by keep.  See projection.
+    inline document parse(sajson::string string, const projection& keep, allocator* alloc = nullptr) {
+        if (SAJSON_UNLIKELY(!keep.is_valid())) {
+            if (!alloc) {
+                alloc = &internal::get_default_allocator();
+            }
+            return document(data_storage(0, false, 0, 0, *alloc), 0, 0, ERROR_INVALID_PROJECTION, 0);
+        }
+        return internal::parse_copy(string, alloc, &keep._internal_get_trie());
     }
 }
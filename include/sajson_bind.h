@@ -0,0 +1,490 @@
+#pragma once
+
+#include "sajson.h"
+#include "sajson_writer.h"
+
+#include <string>
+#include <vector>
+
+// Reads JSON straight into C++ structs, with no document in between, and
+// writes them back out.  A struct is bound by listing its fields, at
+// namespace scope:
+//
+//     struct point {
+//         int x;
+//         int y;
+//         std::string label;
+//     };
+//
+//     SAJSON_BIND_BEGIN(point)
+//         SAJSON_BIND_FIELD(x)
+//         SAJSON_BIND_FIELD(y)
+//         SAJSON_BIND_FIELD(label)
+//     SAJSON_BIND_END()
+//
+//     point pt;
+//     sajson::parse_result result = sajson::parse_into(text, pt);
+//
+//     sajson::writer w;
+//     sajson::write_bound(w, pt);
+//
+// Fields may be bool, int, double, std::string, bound structs, and
+// std::vectors of any of these.  Each field's key is hashed at compile
+// time, so a key in the input costs one hash and usually one comparison.
+// Unknown keys are skipped, checked but not decoded; fields missing from
+// the input keep their values.  A value of the wrong type, including
+// null, fails with ERROR_TYPE_MISMATCH.  Reading recurses once per array
+// or object, so a type that contains itself, as trees do, fails with
+// ERROR_NESTING_TOO_DEEP past bind_reader::MAX_DEPTH levels rather than
+// overflowing the stack.
+//
+// Writing uses the same field list: each key is written from a string
+// literal, quotes and colon included, made by SAJSON_BIND_FIELD.
+
+namespace sajson {
+    // Specialized by SAJSON_BIND_BEGIN for each bound struct.
+    template<typename T>
+    struct binding;
+
+    namespace internal {
+        class bind_reader;
+
+        // 32-bit FNV-1a, usable in constant expressions.
+        constexpr uint32_t hash_key(const char* key, size_t length, uint32_t hash = 2166136261u) {
+            return length == 0
+                ? hash
+                : hash_key(key + 1, length - 1, (hash ^ static_cast<unsigned char>(*key)) * 16777619u);
+        }
+
+        // The same hash, for keys read at runtime.
+        inline uint32_t hash_runtime_key(const char* key, size_t length) {
+            uint32_t hash = 2166136261u;
+            for (size_t i = 0; i < length; ++i) {
+                hash = (hash ^ static_cast<unsigned char>(key[i])) * 16777619u;
+            }
+            return hash;
+        }
+
+        // What a field table is instantiated for: bind_reader to read
+        // fields, or a writer type to write them.  apply<>() is the
+        // operation on one member.
+        template<typename Operation>
+        struct field_operation;
+
+        template<typename T, typename Operation>
+        struct bound_field {
+            typedef typename field_operation<Operation>::template function<T> function_type;
+
+            constexpr bound_field(const char* name, size_t name_length, const char* quoted_key, function_type function)
+                : name(name)
+                , name_length(name_length)
+                , hash(hash_key(name, name_length))
+                , quoted_key(quoted_key)
+                , quoted_key_length(name_length + 3)
+                , function(function)
+            {}
+
+            const char* name;
+            size_t name_length;
+            uint32_t hash;
+            const char* quoted_key; // "\"name\":"
+            size_t quoted_key_length;
+            function_type function;
+        };
+    }
+}
+
+// Field names are identifiers, so the quoted keys need no escaping.
+#define SAJSON_BIND_BEGIN(type_name) \
+    namespace sajson { \
+        template<> \
+        struct binding<type_name> { \
+            typedef type_name bound_type; \
+            template<typename Operation> \
+            static const ::sajson::internal::bound_field<bound_type, Operation>* get_fields(size_t& count) { \
+                typedef ::sajson::internal::bound_field<bound_type, Operation> field; \
+                typedef ::sajson::internal::field_operation<Operation> operation; \
+                static const field fields[] = {
+
+#define SAJSON_BIND_FIELD(member) \
+                    field( \
+                        #member, \
+                        sizeof(#member) - 1, \
+                        "\"" #member "\":", \
+                        &operation::template apply<bound_type, decltype(bound_type::member), &bound_type::member>),
+
+#define SAJSON_BIND_END() \
+                }; \
+                count = sizeof(fields) / sizeof(fields[0]); \
+                return fields; \
+            } \
+        }; \
+    }
+
+namespace sajson {
+    namespace internal {
+        // A recursive-descent parser specialized by the bound types: each
+        // read() accepts exactly the JSON its type can hold.  Skipped
+        // values are not recursed into, but bound arrays and objects are,
+        // up to MAX_DEPTH of them.
+        class bind_reader : private parser_base {
+        public:
+            enum : size_t { MAX_DEPTH = 1024 };
+
+            bind_reader(char* input, size_t length, allocator& alloc)
+                : parser_base(input, input + length)
+                , alloc(alloc)
+                , depth(0)
+            {}
+
+            template<typename T>
+            parse_result read_document(T& out) {
+                char* p = skip_whitespace(input);
+                if (SAJSON_UNLIKELY(!p)) {
+                    make_error(p, ERROR_MISSING_ROOT_ELEMENT);
+                } else if (SAJSON_UNLIKELY(*p != '[' && *p != '{')) {
+                    make_error(p, ERROR_BAD_ROOT);
+                } else if ((p = read(p, out))) {
+                    p = skip_whitespace(p);
+                    if (SAJSON_UNLIKELY(p)) {
+                        make_error(p, ERROR_EXPECTED_END_OF_INPUT);
+                    }
+                }
+                if (error_code != ERROR_SUCCESS) {
+                    return parse_result(error_line, error_column, error_code, error_arg);
+                }
+                return parse_result();
+            }
+
+            // Each read() takes p at the first byte of a value and returns
+            // a pointer just past it, or null on error.
+
+            char* read(char* p, bool& out) {
+                if (*p == 't') {
+                    out = true;
+                    return parse_true(p);
+                } else if (*p == 'f') {
+                    out = false;
+                    return parse_false(p);
+                }
+                return mismatch(p);
+            }
+
+            // Elements of std::vector<bool>.
+            char* read(char* p, std::vector<bool>::reference out) {
+                bool b = false;
+                p = read(p, b);
+                out = b;
+                return p;
+            }
+
+            char* read(char* p, int& out) {
+                double d = 0.0;
+                std::pair<char*, type> result = read_number(p, out, d);
+                if (SAJSON_UNLIKELY(result.second != TYPE_INTEGER)) {
+                    return result.first ? mismatch(p) : 0;
+                }
+                return result.first;
+            }
+
+            char* read(char* p, double& out) {
+                int i = 0;
+                std::pair<char*, type> result = read_number(p, i, out);
+                if (result.second == TYPE_INTEGER) {
+                    out = i;
+                }
+                return result.first;
+            }
+
+            char* read(char* p, std::string& out) {
+                if (SAJSON_UNLIKELY(*p != '"')) {
+                    return mismatch(p);
+                }
+                size_t tag[2];
+                p = parse_string(p, tag);
+                if (SAJSON_LIKELY(p)) {
+                    out.assign(input + tag[0], tag[1] - tag[0]);
+                }
+                return p;
+            }
+
+            template<typename T, typename A>
+            char* read(char* p, std::vector<T, A>& out) {
+                if (SAJSON_UNLIKELY(*p != '[')) {
+                    return mismatch(p);
+                }
+                const nesting level(depth);
+                if (SAJSON_UNLIKELY(depth > MAX_DEPTH)) {
+                    return make_error(p, ERROR_NESTING_TOO_DEEP);
+                }
+                out.clear();
+                p = skip_whitespace(p + 1);
+                if (SAJSON_UNLIKELY(!p)) {
+                    return unexpected_end();
+                }
+                if (*p == ']') {
+                    return p + 1;
+                }
+                for (;;) {
+                    out.emplace_back();
+                    p = read(p, out.back());
+                    if (SAJSON_UNLIKELY(!p)) {
+                        return 0;
+                    }
+                    p = next_element(p, ']');
+                    if (!p || *p == ']') {
+                        return p ? p + 1 : 0;
+                    }
+                }
+            }
+
+            // Any other type must be bound.
+            template<typename T>
+            char* read(char* p, T& out) {
+                if (SAJSON_UNLIKELY(*p != '{')) {
+                    return mismatch(p);
+                }
+                const nesting level(depth);
+                if (SAJSON_UNLIKELY(depth > MAX_DEPTH)) {
+                    return make_error(p, ERROR_NESTING_TOO_DEEP);
+                }
+                size_t field_count;
+                const bound_field<T, bind_reader>* const fields = binding<T>::template get_fields<bind_reader>(field_count);
+                // Keys usually arrive in declaration order, so the field
+                // after the last one matched is tried first.
+                size_t expected = 0;
+
+                p = skip_whitespace(p + 1);
+                if (SAJSON_UNLIKELY(!p)) {
+                    return unexpected_end();
+                }
+                if (*p == '}') {
+                    return p + 1;
+                }
+                for (;;) {
+                    if (SAJSON_UNLIKELY(*p != '"')) {
+                        return make_error(p, ERROR_MISSING_OBJECT_KEY);
+                    }
+                    size_t tag[2];
+                    p = parse_string(p, tag);
+                    if (SAJSON_UNLIKELY(!p)) {
+                        return 0;
+                    }
+                    p = skip_whitespace(p);
+                    if (SAJSON_UNLIKELY(!p || *p != ':')) {
+                        return make_error(p, ERROR_EXPECTED_COLON);
+                    }
+                    p = skip_whitespace(p + 1);
+                    if (SAJSON_UNLIKELY(!p)) {
+                        return unexpected_end();
+                    }
+
+                    const size_t index = find_field(fields, field_count, expected, input + tag[0], tag[1] - tag[0]);
+                    if (index < field_count) {
+                        p = fields[index].function(*this, p, out);
+                        expected = index + 1;
+                    } else {
+                        p = skip_value(p);
+                    }
+                    if (SAJSON_UNLIKELY(!p)) {
+                        return 0;
+                    }
+
+                    p = next_element(p, '}');
+                    if (!p || *p == '}') {
+                        return p ? p + 1 : 0;
+                    }
+                }
+            }
+
+        private:
+            // Counts one array or object being read for as long as it
+            // lives.
+            struct nesting {
+                explicit nesting(size_t& depth)
+                    : depth(depth)
+                {
+                    ++depth;
+                }
+
+                ~nesting() {
+                    --depth;
+                }
+
+                size_t& depth;
+            };
+
+            template<typename T>
+            static size_t find_field(const bound_field<T, bind_reader>* fields, size_t count, size_t expected, const char* key, size_t length) {
+                const uint32_t hash = hash_runtime_key(key, length);
+                if (expected < count && matches(fields[expected], hash, key, length)) {
+                    return expected;
+                }
+                for (size_t i = 0; i < count; ++i) {
+                    if (matches(fields[i], hash, key, length)) {
+                        return i;
+                    }
+                }
+                return count;
+            }
+
+            template<typename T>
+            static bool matches(const bound_field<T, bind_reader>& field, uint32_t hash, const char* key, size_t length) {
+                return field.hash == hash
+                    && field.name_length == length
+                    && memcmp(field.name, key, length) == 0;
+            }
+
+            std::pair<char*, type> read_number(char* p, int& i, double& d) {
+                if (SAJSON_UNLIKELY(*p != '-' && (*p < '0' || *p > '9'))) {
+                    return std::make_pair(mismatch(p), TYPE_NULL);
+                }
+                return decode_number(p, i, d);
+            }
+
+            // After an element, skips to the next one.  Returns the start
+            // of the next element, the closing bracket, or null on error.
+            char* next_element(char* p, char close) {
+                p = skip_whitespace(p);
+                if (SAJSON_UNLIKELY(!p)) {
+                    return unexpected_end();
+                }
+                if (*p == close) {
+                    return p;
+                }
+                if (SAJSON_UNLIKELY(*p != ',')) {
+                    return make_error(p, ERROR_EXPECTED_COMMA);
+                }
+                p = skip_whitespace(p + 1);
+                if (SAJSON_UNLIKELY(!p)) {
+                    return unexpected_end();
+                }
+                if (SAJSON_UNLIKELY(*p == close)) {
+                    return make_error(p, close == '}' ? ERROR_MISSING_OBJECT_KEY : ERROR_EXPECTED_VALUE);
+                }
+                return p;
+            }
+
+            // Checks and skips the value at p.
+            char* skip_value(char* p) {
+                null_handler handler;
+                event_parser<null_handler, false> skipper(input, input_end - input, handler, alloc);
+                char* const end = skipper.parse_value(p);
+                if (SAJSON_UNLIKELY(!end)) {
+                    parse_result error = skipper.get_error();
+                    error_line = error.get_error_line();
+                    error_column = error.get_error_column();
+                    error_code = error._internal_get_error_code();
+                    error_arg = error._internal_get_error_argument();
+                }
+                return end;
+            }
+
+            // The value at p is not of the bound type.  If it is not valid
+            // JSON either, that is reported instead.
+            char* mismatch(char* p) {
+                if (skip_value(p)) {
+                    make_error(p, ERROR_TYPE_MISMATCH);
+                }
+                return 0;
+            }
+
+            allocator& alloc;
+            size_t depth;
+        };
+
+        template<>
+        struct field_operation<bind_reader> {
+            template<typename T>
+            using function = char* (*)(bind_reader& r, char* p, T& out);
+
+            template<typename T, typename M, M T::* member>
+            static char* apply(bind_reader& r, char* p, T& out) {
+                return r.read(p, out.*member);
+            }
+        };
+
+        // Writes bound types through any writer_base.
+        template<typename Writer>
+        struct bind_writer {
+            static void write(Writer& w, bool value) {
+                w.bool_value(value);
+            }
+
+            static void write(Writer& w, int value) {
+                w.integer_value(value);
+            }
+
+            static void write(Writer& w, double value) {
+                w.double_value(value);
+            }
+
+            static void write(Writer& w, const std::string& value) {
+                w.string_value(string(value.data(), value.size()));
+            }
+
+            template<typename T, typename A>
+            static void write(Writer& w, const std::vector<T, A>& values) {
+                w.start_array();
+                for (const auto& element : values) {
+                    write(w, element);
+                }
+                w.end_array();
+            }
+
+            // Any other type must be bound.  Members come out in the order
+            // they were bound.
+            template<typename T>
+            static void write(Writer& w, const T& value) {
+                size_t field_count;
+                const bound_field<T, Writer>* const fields = binding<T>::template get_fields<Writer>(field_count);
+                w.start_object();
+                for (size_t i = 0; i < field_count; ++i) {
+                    w.quoted_key(fields[i].quoted_key, fields[i].quoted_key_length);
+                    fields[i].function(w, value);
+                }
+                w.end_object();
+            }
+        };
+
+        template<typename Writer>
+        struct field_operation {
+            template<typename T>
+            using function = void (*)(Writer& w, const T& value);
+
+            template<typename T, typename M, M T::* member>
+            static void apply(Writer& w, const T& value) {
+                bind_writer<Writer>::write(w, value.*member);
+            }
+        };
+    }
+
+    // Parses a copy of input into out, whose type must be bound with
+    // SAJSON_BIND_BEGIN or be a std::vector of bound types.  On error, out
+    // holds whatever was read before the error.
+    template<typename T>
+    parse_result parse_into(const sajson::string& input, T& out, allocator* alloc = nullptr) {
+        if (!alloc) {
+            alloc = &internal::get_default_allocator();
+        }
+
+        const size_t length = input.length();
+        char* copy = static_cast<char*>(alloc->allocate(length));
+        if (SAJSON_UNLIKELY(!copy)) {
+            return parse_result(0, 0, ERROR_OUT_OF_MEMORY, 0);
+        }
+        memcpy(copy, input.data(), length);
+
+        parse_result result = internal::bind_reader(copy, length, *alloc).read_document(out);
+        alloc->deallocate(copy);
+        return result;
+    }
+
+    // Writes value, of a type parse_into() accepts, to w, a writer or
+    // stream_writer.  Keys are copied from strings made when the type was
+    // bound, and numbers are formatted as writer formats them.
+    template<typename Writer, typename T>
+    void write_bound(Writer& w, const T& value) {
+        internal::bind_writer<Writer>::write(w, value);
+    }
+}
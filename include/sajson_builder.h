@@ -0,0 +1,332 @@
+#pragma once
+
+#include "sajson.h"
+
+namespace sajson {
+    // Builds a document in code, writing the same AST the parser would
+    // produce for the equivalent text, so the result can be queried,
+    // written, or snapshotted without going through text.  The methods
+    // are the events an event_parser handler receives:
+    //
+    //     sajson::document_builder builder;
+    //     builder.start_object();
+    //     builder.key(sajson::literal("id"));
+    //     builder.integer_value(7);
+    //     builder.end_object();
+    //     sajson::document doc = builder.get_document();
+    //
+    // Keys and strings are copied.  Object keys are sorted when the
+    // object ends, just as in parsed documents.  Events must nest
+    // properly, with a key before each object member; this is asserted.
+    // A root that is not an array or object, or more than one root, is
+    // reported by get_document().
+    class document_builder {
+    public:
+        explicit document_builder(allocator* alloc = nullptr)
+            : alloc(alloc ? *alloc : internal::get_default_allocator())
+            , text(0)
+            , text_length(0)
+            , text_capacity(0)
+            , structure(0)
+            , structure_length(0)
+            , write_cursor(0)
+            , stack(this->alloc)
+            , current_base(0)
+            , current_structure_type(TYPE_NULL)
+            , depth(0)
+            , has_root(false)
+            , root_type(TYPE_NULL)
+            , error_code(ERROR_SUCCESS)
+        {}
+
+        document_builder(const document_builder&) = delete;
+        void operator=(const document_builder&) = delete;
+
+        ~document_builder() {
+            if (text) {
+                alloc.deallocate(text);
+            }
+            if (structure) {
+                alloc.deallocate(structure);
+            }
+        }
+
+        void start_array() {
+            start_structure(TYPE_ARRAY);
+        }
+
+        void end_array() {
+            end_structure(TYPE_ARRAY);
+        }
+
+        void start_object() {
+            start_structure(TYPE_OBJECT);
+        }
+
+        void end_object() {
+            end_structure(TYPE_OBJECT);
+        }
+
+        void key(const string& key) {
+            if (!is_valid()) {
+                return;
+            }
+            assert(depth > 0 && current_structure_type == TYPE_OBJECT);
+            assert((stack.get_size() - current_base) % 3 == 0);
+            size_t key_start;
+            if (!append_text(key, key_start)) {
+                return;
+            }
+            if (!stack.push(key_start) || !stack.push(key_start + key.length())) {
+                fail(ERROR_OUT_OF_MEMORY);
+            }
+        }
+
+        void null_value() {
+            add_element(TYPE_NULL, 0);
+        }
+
+        void bool_value(bool value) {
+            add_element(value ? TYPE_TRUE : TYPE_FALSE, 0);
+        }
+
+        void integer_value(int value) {
+            size_t* payload = add_element(TYPE_INTEGER, integer_storage::word_length);
+            if (payload) {
+                integer_storage::store(payload, value);
+            }
+        }
+
+        void double_value(double value) {
+            size_t* payload = add_element(TYPE_DOUBLE, double_storage::word_length);
+            if (payload) {
+                double_storage::store(payload, value);
+            }
+        }
+
+        void string_value(const string& value) {
+            if (!is_valid()) {
+                return;
+            }
+            size_t start;
+            if (!append_text(value, start)) {
+                return;
+            }
+            size_t* payload = add_element(TYPE_STRING, 2);
+            if (payload) {
+                payload[0] = start;
+                payload[1] = start + value.length();
+            }
+        }
+
+        // Adds a copy of v and everything under it, which may come from
+        // any document.
+        void write(const value& v) {
+            internal::replay_value(v, *this);
+        }
+
+        // False once memory could not be allocated or the root was
+        // misplaced, after which every event is ignored.
+        bool is_valid() const {
+            return error_code == ERROR_SUCCESS;
+        }
+
+        // Hands everything built so far to a document and starts over.
+        // The document is invalid if building failed or the root is
+        // missing or unfinished.
+        document get_document() {
+            if (depth > 0) {
+                fail(ERROR_UNEXPECTED_END);
+            } else if (!has_root) {
+                fail(ERROR_MISSING_ROOT_ELEMENT);
+            }
+            data_storage storage(text, true, structure, text_length, structure_length, alloc);
+            const error code = error_code;
+            const type finished_type = root_type;
+            size_t* const root = write_cursor;
+            text = 0;
+            text_length = 0;
+            text_capacity = 0;
+            structure = 0;
+            structure_length = 0;
+            write_cursor = 0;
+            stack.reset(0);
+            depth = 0;
+            has_root = false;
+            error_code = ERROR_SUCCESS;
+            if (code != ERROR_SUCCESS) {
+                return document(std::move(storage), 0, 0, code, 0);
+            }
+            storage.release_structure_below(root);
+            return document(std::move(storage), finished_type, root);
+        }
+
+    private:
+        enum {
+            INITIAL_TEXT_CAPACITY = 256,
+            INITIAL_STRUCTURE_LENGTH = 64,
+        };
+
+        void fail(error code) {
+            if (is_valid()) {
+                error_code = code;
+            }
+        }
+
+        // Checks that a value may go here.  Returns false if it is a
+        // misplaced root.
+        bool check_value_position() {
+            if (depth == 0) {
+                fail(has_root ? ERROR_EXPECTED_END_OF_INPUT : ERROR_BAD_ROOT);
+                return false;
+            }
+            assert(current_structure_type == TYPE_ARRAY
+                || (stack.get_size() - current_base) % 3 == 2);
+            return true;
+        }
+
+        // Writes words of payload below the AST and records the element.
+        // Returns the payload, or null on failure.
+        size_t* add_element(type element_type, size_t words) {
+            if (!is_valid() || !check_value_position()) {
+                return 0;
+            }
+            if (!reserve_structure(words)) {
+                return 0;
+            }
+            write_cursor -= words;
+            if (!stack.push(make_element(element_type, structure_end() - write_cursor))) {
+                fail(ERROR_OUT_OF_MEMORY);
+                return 0;
+            }
+            return write_cursor;
+        }
+
+        void start_structure(type structure_type) {
+            if (!is_valid()) {
+                return;
+            }
+            if (depth > 0) {
+                check_value_position();
+            } else if (has_root) {
+                fail(ERROR_EXPECTED_END_OF_INPUT);
+                return;
+            }
+            const size_t parent = depth > 0 ? current_base : ROOT_MARKER;
+            if (!stack.push(make_element(current_structure_type, parent))) {
+                fail(ERROR_OUT_OF_MEMORY);
+                return;
+            }
+            current_base = stack.get_size();
+            current_structure_type = structure_type;
+            ++depth;
+        }
+
+        void end_structure(type structure_type) {
+            if (!is_valid()) {
+                return;
+            }
+            assert(depth > 0 && current_structure_type == structure_type);
+            size_t* const base = stack.get_pointer_from_offset(current_base);
+            size_t* const top = stack.get_top();
+            if (!reserve_structure(top - base + 1)) {
+                return;
+            }
+            const size_t pop_element = base[-1];
+            if (structure_type == TYPE_ARRAY) {
+                internal::install_array(base, top, write_cursor, structure_end());
+            } else {
+                assert((top - base) % 3 == 0);
+                internal::install_object(base, top, write_cursor, structure_end(), text);
+            }
+            stack.reset(current_base - 1);
+            --depth;
+
+            const size_t parent = get_element_value(pop_element);
+            if (parent == ROOT_MARKER) {
+                has_root = true;
+                root_type = structure_type;
+                return;
+            }
+            current_base = parent;
+            current_structure_type = get_element_type(pop_element);
+            // Cannot fail: the stack just shrank.
+            stack.push(make_element(structure_type, structure_end() - write_cursor));
+        }
+
+        size_t* structure_end() const {
+            return structure + structure_length;
+        }
+
+        // Makes room for words more below write_cursor.  The AST grows
+        // down from the end of the buffer, and pending elements are
+        // offsets from that end, so it moves to the end of any new buffer.
+        bool reserve_structure(size_t words) {
+            if (SAJSON_LIKELY(static_cast<size_t>(write_cursor - structure) >= words)) {
+                return true;
+            }
+            const size_t used = structure_end() - write_cursor;
+            size_t new_length = structure_length ? structure_length * 2 : INITIAL_STRUCTURE_LENGTH;
+            while (new_length - used < words) {
+                new_length *= 2;
+            }
+            size_t* new_structure = static_cast<size_t*>(alloc.allocate(new_length * sizeof(size_t)));
+            if (!new_structure) {
+                fail(ERROR_OUT_OF_MEMORY);
+                return false;
+            }
+            size_t* const new_write_cursor = new_structure + new_length - used;
+            if (structure) {
+                memcpy(new_write_cursor, write_cursor, used * sizeof(size_t));
+                alloc.deallocate(structure);
+            }
+            structure = new_structure;
+            structure_length = new_length;
+            write_cursor = new_write_cursor;
+            return true;
+        }
+
+        // Copies s into the text, NUL-terminated like parsed strings, and
+        // sets start to its offset.
+        bool append_text(const string& s, size_t& start) {
+            const size_t needed = text_length + s.length() + 1;
+            if (needed > text_capacity) {
+                size_t new_capacity = text_capacity ? text_capacity * 2 : INITIAL_TEXT_CAPACITY;
+                while (new_capacity < needed) {
+                    new_capacity *= 2;
+                }
+                char* new_text = static_cast<char*>(alloc.allocate(new_capacity));
+                if (!new_text) {
+                    fail(ERROR_OUT_OF_MEMORY);
+                    return false;
+                }
+                if (text) {
+                    memcpy(new_text, text, text_length);
+                    alloc.deallocate(text);
+                }
+                text = new_text;
+                text_capacity = new_capacity;
+            }
+            start = text_length;
+            memcpy(text + text_length, s.data(), s.length());
+            text[text_length + s.length()] = 0;
+            text_length = needed;
+            return true;
+        }
+
+        allocator& alloc;
+        char* text;
+        size_t text_length;
+        size_t text_capacity;
+        size_t* structure;
+        size_t structure_length;
+        size_t* write_cursor;
+        internal::word_stack stack;
+        size_t current_base;
+        type current_structure_type;
+        size_t depth;
+        bool has_root;
+        type root_type;
+        error error_code;
+    };
+}
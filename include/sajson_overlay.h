@@ -0,0 +1,517 @@
+#pragma once
+
+#include "sajson_builder.h"
+
+#include <new>
+
+// Edits layered over an immutable document.  An overlay shares everything
+// in the base document except the arrays and objects on the paths to its
+// edits.  Each of those is copied one level deep when first edited, so an
+// edit costs the size of the containers along its path plus the size of
+// the new value, however large the document.
+
+namespace sajson {
+    class overlay;
+
+    namespace internal {
+        // Memory that is only freed all at once.
+        class arena {
+        public:
+            explicit arena(allocator& alloc)
+                : alloc(alloc)
+                , chunks(0)
+                , next(0)
+                , remaining(0)
+            {}
+
+            arena(const arena&) = delete;
+            void operator=(const arena&) = delete;
+
+            ~arena() {
+                while (chunks) {
+                    chunk* const previous = chunks->previous;
+                    alloc.deallocate(chunks);
+                    chunks = previous;
+                }
+            }
+
+            // Word-aligned; null if memory could not be allocated.
+            void* allocate(size_t size) {
+                size = (size + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+                if (SAJSON_UNLIKELY(size > remaining)) {
+                    const size_t chunk_size = std::max(size_t(CHUNK_SIZE), sizeof(chunk) + size);
+                    chunk* const c = static_cast<chunk*>(alloc.allocate(chunk_size));
+                    if (!c) {
+                        return 0;
+                    }
+                    c->previous = chunks;
+                    chunks = c;
+                    next = reinterpret_cast<char*>(c + 1);
+                    remaining = chunk_size - sizeof(chunk);
+                }
+                void* const result = next;
+                next += size;
+                remaining -= size;
+                return result;
+            }
+
+            allocator& get_allocator() const {
+                return alloc;
+            }
+
+        private:
+            enum { CHUNK_SIZE = 4096 };
+
+            struct chunk {
+                chunk* previous;
+            };
+
+            allocator& alloc;
+            chunk* chunks;
+            char* next;
+            size_t remaining;
+        };
+
+        struct overlay_node;
+
+        // One member or element of an edited container.  Its value is
+        // either node, if it has been edited below, or v.
+        struct overlay_slot {
+            overlay_slot(const char* key, size_t key_length, const value& v)
+                : key(key)
+                , key_length(key_length)
+                , v(v)
+                , node(0)
+            {}
+
+            const char* key; // objects only
+            size_t key_length;
+            value v;
+            overlay_node* node;
+        };
+
+        // An edited array or object.  Object slots are sorted like the
+        // AST's object key records.
+        struct overlay_node {
+            type node_type;
+            size_t length;
+            size_t capacity;
+            overlay_slot* slots;
+        };
+
+        inline bool overlay_key_less(const overlay_slot& slot, const string& key) {
+            if (slot.key_length != key.length()) {
+                return slot.key_length < key.length();
+            }
+            return memcmp(slot.key, key.data(), key.length()) < 0;
+        }
+    }
+
+    // A value as seen through an overlay.  Has the same accessors as
+    // value; arrays and objects return overlay_values for their elements.
+    // Valid until the overlay is next edited or destroyed.
+    class overlay_value {
+    public:
+        type get_type() const {
+            return node ? node->node_type : v.get_type();
+        }
+
+        // valid iff get_type() is TYPE_ARRAY or TYPE_OBJECT
+        size_t get_length() const {
+            return node ? node->length : v.get_length();
+        }
+
+        // valid iff get_type() is TYPE_ARRAY
+        overlay_value get_array_element(size_t index) const {
+            if (node) {
+                assert(node->node_type == TYPE_ARRAY && index < node->length);
+                return overlay_value(node->slots[index]);
+            }
+            return overlay_value(v.get_array_element(index));
+        }
+
+        // valid iff get_type() is TYPE_OBJECT
+        string get_object_key(size_t index) const {
+            if (node) {
+                assert(node->node_type == TYPE_OBJECT && index < node->length);
+                return string(node->slots[index].key, node->slots[index].key_length);
+            }
+            return v.get_object_key(index);
+        }
+
+        // valid iff get_type() is TYPE_OBJECT
+        overlay_value get_object_value(size_t index) const {
+            if (node) {
+                assert(node->node_type == TYPE_OBJECT && index < node->length);
+                return overlay_value(node->slots[index]);
+            }
+            return overlay_value(v.get_object_value(index));
+        }
+
+        // valid iff get_type() is TYPE_OBJECT
+        overlay_value get_value_of_key(const string& key) const {
+            const size_t index = find_object_key(key);
+            assert(index < get_length());
+            return get_object_value(index);
+        }
+
+        // valid iff get_type() is TYPE_OBJECT
+        // return get_length() if there is no such key
+        size_t find_object_key(const string& key) const {
+            if (node) {
+                assert(node->node_type == TYPE_OBJECT);
+                const internal::overlay_slot* const end = node->slots + node->length;
+                const internal::overlay_slot* const begin = node->slots;
+                const internal::overlay_slot* const i = std::lower_bound(begin, end, key, internal::overlay_key_less);
+                return (i != end
+                        && i->key_length == key.length()
+                        && memcmp(i->key, key.data(), key.length()) == 0) ? i - node->slots : node->length;
+            }
+            return v.find_object_key(key);
+        }
+
+        // valid iff get_type() is TYPE_INTEGER
+        int get_integer_value() const {
+            return v.get_integer_value();
+        }
+
+        // valid iff get_type() is TYPE_DOUBLE
+        double get_double_value() const {
+            return v.get_double_value();
+        }
+
+        // valid iff get_type() is TYPE_INTEGER or TYPE_DOUBLE
+        double get_number_value() const {
+            return v.get_number_value();
+        }
+
+        // valid iff get_type() is TYPE_STRING
+        size_t get_string_length() const {
+            return v.get_string_length();
+        }
+
+        // valid iff get_type() is TYPE_STRING
+        const char* as_cstring() const {
+            return v.as_cstring();
+        }
+
+#ifndef SAJSON_NO_STD_STRING
+        // valid iff get_type() is TYPE_STRING
+        std::string as_string() const {
+            return v.as_string();
+        }
+#endif
+
+        // Sends this value and everything under it to handler as events,
+        // in the same form as internal::replay_value.  Unedited subtrees
+        // are replayed straight from their documents.  A writer gives the
+        // edited JSON and a document_builder gives the edited document.
+        template<typename Handler>
+        void replay(Handler& handler) const {
+            if (!node) {
+                internal::replay_value(v, handler);
+                return;
+            }
+            if (node->node_type == TYPE_ARRAY) {
+                handler.start_array();
+                for (size_t i = 0; i < node->length; ++i) {
+                    overlay_value(node->slots[i]).replay(handler);
+                }
+                handler.end_array();
+            } else {
+                handler.start_object();
+                for (size_t i = 0; i < node->length; ++i) {
+                    handler.key(string(node->slots[i].key, node->slots[i].key_length));
+                    overlay_value(node->slots[i]).replay(handler);
+                }
+                handler.end_object();
+            }
+        }
+
+    private:
+        friend class overlay;
+
+        explicit overlay_value(const value& v)
+            : v(v)
+            , node(0)
+        {}
+
+        explicit overlay_value(const internal::overlay_slot& slot)
+            : v(slot.v)
+            , node(slot.node)
+        {}
+
+        value v; // the value itself, or the unedited original of node
+        const internal::overlay_node* node;
+    };
+
+    // Records edits to base, addressed by JSON Pointer, without changing
+    // it.  base must outlive the overlay.  New values are copied, so they
+    // need not outlive the edit.
+    //
+    //     sajson::overlay edits(doc);
+    //     edits.set(sajson::json_pointer(sajson::literal("/user/name")), name);
+    //     edits.remove(sajson::json_pointer(sajson::literal("/tags/0")));
+    //     edits.get_root().replay(writer);
+    //
+    // Edits fail, returning false and changing nothing, if the path does
+    // not lead where the edit requires or memory could not be allocated.
+    class overlay {
+    public:
+        explicit overlay(const document& base, allocator* alloc = nullptr)
+            : memory(alloc ? *alloc : internal::get_default_allocator())
+            , root(0, 0, base.get_root())
+            , values(0)
+            , valid(true)
+        {}
+
+        // Overlays the array or object base, whose document must outlive
+        // the overlay.
+        explicit overlay(const value& base, allocator* alloc = nullptr)
+            : memory(alloc ? *alloc : internal::get_default_allocator())
+            , root(0, 0, base)
+            , values(0)
+            , valid(true)
+        {
+            assert(base.get_type() == TYPE_ARRAY || base.get_type() == TYPE_OBJECT);
+        }
+
+        overlay(const overlay&) = delete;
+        void operator=(const overlay&) = delete;
+
+        ~overlay() {
+            for (owned_value* i = values; i; i = i->next) {
+                i->~owned_value();
+            }
+        }
+
+        overlay_value get_root() const {
+            return overlay_value(root);
+        }
+
+        // False once memory could not be allocated.  Earlier edits are
+        // kept.
+        bool is_valid() const {
+            return valid;
+        }
+
+        // Replaces the value at path, or adds a new object member.  The
+        // empty path replaces the root, which must stay an array or
+        // object.  "-" as the last token appends to an array.
+        bool set(const json_pointer& path, const value& v) {
+            return edit(path, v, SET);
+        }
+
+        // Inserts v into an array before the element at path, shifting
+        // later elements up; an index of the array's length or "-"
+        // appends.  For objects, the same as set().
+        bool insert(const json_pointer& path, const value& v) {
+            return edit(path, v, INSERT);
+        }
+
+        // Removes the object member or array element at path, shifting
+        // later elements down.
+        bool remove(const json_pointer& path) {
+            return edit(path, root.v, REMOVE);
+        }
+
+    private:
+        enum operation { SET, INSERT, REMOVE };
+
+        // A copy of a new value, as the only element of an array, since
+        // a document's root cannot be a scalar.
+        struct owned_value {
+            owned_value(document&& doc, owned_value* next)
+                : doc(std::move(doc))
+                , next(next)
+            {}
+
+            document doc;
+            owned_value* next;
+        };
+
+        bool edit(const json_pointer& path, const value& v, operation op) {
+            if (!path.is_valid()) {
+                return false;
+            }
+            const size_t count = path.get_token_count();
+            if (count == 0) {
+                if (op != SET || (v.get_type() != TYPE_ARRAY && v.get_type() != TYPE_OBJECT)) {
+                    return false;
+                }
+                return copy_value(v, &root);
+            }
+
+            // Check the whole path before changing anything.
+            overlay_value current = get_root();
+            for (size_t i = 0; i + 1 < count; ++i) {
+                size_t index;
+                if (!find_child(current, path, i, &index)) {
+                    return false;
+                }
+                current = current.get_type() == TYPE_ARRAY
+                    ? current.get_array_element(index)
+                    : current.get_object_value(index);
+            }
+            const string key = path.get_token(count - 1);
+            const type parent_type = current.get_type();
+            size_t index = 0;
+            bool adding;
+            if (parent_type == TYPE_ARRAY) {
+                const size_t length = current.get_length();
+                const bool append = key.length() == 1 && key.data()[0] == '-';
+                index = append ? length : path.get_token_index(count - 1);
+                if (index > length || (index == length && (op == REMOVE || (op == SET && !append)))) {
+                    return false;
+                }
+                adding = index == length || op == INSERT;
+            } else if (parent_type == TYPE_OBJECT) {
+                adding = !find_child(current, path, count - 1, &index);
+                if (adding && op == REMOVE) {
+                    return false;
+                }
+            } else {
+                return false;
+            }
+
+            // Copy the containers along the path.
+            internal::overlay_slot* slot = &root;
+            for (size_t i = 0; i + 1 < count; ++i) {
+                internal::overlay_node* node = get_node(slot);
+                if (!node) {
+                    return false;
+                }
+                size_t child = 0;
+                find_child(overlay_value(*slot), path, i, &child);
+                slot = &node->slots[child];
+            }
+            internal::overlay_node* const parent = get_node(slot);
+            if (!parent) {
+                return false;
+            }
+
+            if (op == REMOVE) {
+                memmove(parent->slots + index, parent->slots + index + 1, (parent->length - index - 1) * sizeof(internal::overlay_slot));
+                --parent->length;
+                return true;
+            }
+            if (!adding) {
+                return copy_value(v, &parent->slots[index]);
+            }
+
+            // The key and value are copied first, so a failure leaves the
+            // parent as it was.
+            const char* new_key = 0;
+            if (parent_type == TYPE_OBJECT) {
+                index = std::lower_bound(parent->slots, parent->slots + parent->length, key, internal::overlay_key_less) - parent->slots;
+                char* const key_copy = static_cast<char*>(allocate(key.length() + 1));
+                if (!key_copy) {
+                    return false;
+                }
+                memcpy(key_copy, key.data(), key.length());
+                key_copy[key.length()] = 0;
+                new_key = key_copy;
+            }
+            internal::overlay_slot new_slot(new_key, key.length(), root.v);
+            if (!copy_value(v, &new_slot) || !reserve_slot(parent)) {
+                return false;
+            }
+            memmove(parent->slots + index + 1, parent->slots + index, (parent->length - index) * sizeof(internal::overlay_slot));
+            new (&parent->slots[index]) internal::overlay_slot(new_slot);
+            ++parent->length;
+            return true;
+        }
+
+        // Finds the existing child named by token i of path.
+        static bool find_child(const overlay_value& parent, const json_pointer& path, size_t i, size_t* index) {
+            if (parent.get_type() == TYPE_OBJECT) {
+                *index = parent.find_object_key(path.get_token(i));
+            } else if (parent.get_type() == TYPE_ARRAY) {
+                *index = path.get_token_index(i);
+            } else {
+                return false;
+            }
+            return *index < parent.get_length();
+        }
+
+        // The node for slot, copying its container one level deep if it
+        // has not been edited before.
+        internal::overlay_node* get_node(internal::overlay_slot* slot) {
+            if (slot->node) {
+                return slot->node;
+            }
+            const value& v = slot->v;
+            const size_t length = v.get_length();
+            internal::overlay_node* const node = static_cast<internal::overlay_node*>(allocate(sizeof(internal::overlay_node)));
+            internal::overlay_slot* const slots = static_cast<internal::overlay_slot*>(allocate((length + 1) * sizeof(internal::overlay_slot)));
+            if (!node || !slots) {
+                return 0;
+            }
+            node->node_type = v.get_type();
+            node->length = length;
+            node->capacity = length + 1;
+            node->slots = slots;
+            if (v.get_type() == TYPE_ARRAY) {
+                for (size_t i = 0; i < length; ++i) {
+                    new (&slots[i]) internal::overlay_slot(0, 0, v.get_array_element(i));
+                }
+            } else {
+                for (size_t i = 0; i < length; ++i) {
+                    const string key = v.get_object_key(i);
+                    new (&slots[i]) internal::overlay_slot(key.data(), key.length(), v.get_object_value(i));
+                }
+            }
+            slot->node = node;
+            return node;
+        }
+
+        bool reserve_slot(internal::overlay_node* node) {
+            if (node->length < node->capacity) {
+                return true;
+            }
+            const size_t new_capacity = node->capacity * 2;
+            internal::overlay_slot* const slots = static_cast<internal::overlay_slot*>(allocate(new_capacity * sizeof(internal::overlay_slot)));
+            if (!slots) {
+                return false;
+            }
+            memcpy(static_cast<void*>(slots), node->slots, node->length * sizeof(internal::overlay_slot));
+            node->slots = slots;
+            node->capacity = new_capacity;
+            return true;
+        }
+
+        // Points slot at a copy of v.
+        bool copy_value(const value& v, internal::overlay_slot* slot) {
+            document_builder builder(&memory.get_allocator());
+            builder.start_array();
+            builder.write(v);
+            builder.end_array();
+            document doc = builder.get_document();
+            if (!doc.is_valid()) {
+                valid = false;
+                return false;
+            }
+            owned_value* const owned = static_cast<owned_value*>(allocate(sizeof(owned_value)));
+            if (!owned) {
+                return false;
+            }
+            values = new (owned) owned_value(std::move(doc), values);
+            slot->v = values->doc.get_root().get_array_element(0);
+            slot->node = 0;
+            return true;
+        }
+
+        void* allocate(size_t size) {
+            void* const result = memory.allocate(size);
+            if (!result) {
+                valid = false;
+            }
+            return result;
+        }
+
+        internal::arena memory;
+        internal::overlay_slot root;
+        owned_value* values;
+        bool valid;
+    };
+}
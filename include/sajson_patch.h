@@ -0,0 +1,237 @@
+#pragma once
+
+#include "sajson_overlay.h"
+
+// JSON Merge Patch (RFC 7386) and JSON Patch (RFC 6902).  Both leave
+// their inputs alone and produce a new, compacted document.  A merge
+// patch is merged with the target in a single pass over both, pairing
+// object members by walking their sorted keys side by side.  A JSON
+// Patch is applied to an overlay, so each operation only copies the
+// containers along its path, and the result is built once at the end.
+//
+// Documents cannot have scalar roots, so a patch that would make the
+// root a scalar fails.
+
+namespace sajson {
+    namespace internal {
+        // Writes the result of merging patch into target, which is null
+        // if there is no target.
+        inline void write_merge_patch(document_builder& out, const value* target, const value& patch) {
+            if (patch.get_type() != TYPE_OBJECT) {
+                out.write(patch);
+                return;
+            }
+            if (target && target->get_type() != TYPE_OBJECT) {
+                target = 0;
+            }
+
+            out.start_object();
+            const size_t target_length = target ? target->get_length() : 0;
+            const size_t patch_length = patch.get_length();
+            size_t i = 0;
+            size_t j = 0;
+            while (i < target_length || j < patch_length) {
+                const int order = i == target_length ? 1
+                    : j == patch_length ? -1
+                    : compare_keys(target->get_object_key(i), patch.get_object_key(j));
+                if (order < 0) {
+                    // Not mentioned by the patch.
+                    out.key(target->get_object_key(i));
+                    out.write(target->get_object_value(i));
+                    ++i;
+                    continue;
+                }
+                const value patch_value = patch.get_object_value(j);
+                if (patch_value.get_type() != TYPE_NULL) {
+                    out.key(patch.get_object_key(j));
+                    if (order == 0) {
+                        const value target_value = target->get_object_value(i);
+                        write_merge_patch(out, &target_value, patch_value);
+                    } else {
+                        write_merge_patch(out, 0, patch_value);
+                    }
+                }
+                if (order == 0) {
+                    ++i;
+                }
+                ++j;
+            }
+            out.end_object();
+        }
+
+        inline document finish_patch(document_builder& out) {
+            document result = out.get_document();
+            if (result.is_valid()) {
+                // Nothing is lost if this fails; the buffer just stays
+                // larger than needed.
+                result.compact();
+            }
+            return result;
+        }
+
+        inline document make_patch_error(allocator& alloc, error code, size_t operation) {
+            return document(data_storage(0, false, 0, 0, alloc), 0, 0, code, static_cast<int>(operation));
+        }
+
+        inline bool get_patch_member(const value& operation, const char* name, value* out) {
+            const size_t index = operation.find_object_key(literal(name));
+            if (index == operation.get_length()) {
+                return false;
+            }
+            *out = operation.get_object_value(index);
+            return true;
+        }
+
+        inline bool get_patch_string(const value& operation, const char* name, value* out) {
+            return get_patch_member(operation, name, out) && out->get_type() == TYPE_STRING;
+        }
+
+        inline bool is_patch_op(const value& op, const char* name) {
+            return compare_keys(string(op.as_cstring(), op.get_string_length()), literal(name)) == 0;
+        }
+
+        inline bool resolve_pointer(const overlay_value& root, const json_pointer& path, overlay_value* out) {
+            overlay_value current = root;
+            for (size_t i = 0; i < path.get_token_count(); ++i) {
+                size_t index;
+                if (current.get_type() == TYPE_OBJECT) {
+                    index = current.find_object_key(path.get_token(i));
+                } else if (current.get_type() == TYPE_ARRAY) {
+                    index = path.get_token_index(i);
+                } else {
+                    return false;
+                }
+                if (index >= current.get_length()) {
+                    return false;
+                }
+                current = current.get_type() == TYPE_OBJECT
+                    ? current.get_object_value(index)
+                    : current.get_array_element(index);
+            }
+            *out = current;
+            return true;
+        }
+
+        // Copies v, as the only element of the result's root array.
+        inline document copy_overlay_value(const overlay_value& v, allocator& alloc) {
+            document_builder builder(&alloc);
+            builder.start_array();
+            v.replay(builder);
+            builder.end_array();
+            return builder.get_document();
+        }
+
+        // RFC 6902 "add": the root is replaced, array elements are
+        // inserted, and object members are added or replaced.
+        inline bool add_patch_value(overlay& edits, const json_pointer& path, const value& v) {
+            return path.get_token_count() == 0
+                ? edits.set(path, v)
+                : edits.insert(path, v);
+        }
+
+        inline error apply_patch_operation(overlay& edits, const value& operation, allocator& alloc) {
+            value op(TYPE_NULL, 0, 0);
+            value path_text(TYPE_NULL, 0, 0);
+            if (operation.get_type() != TYPE_OBJECT
+                || !get_patch_string(operation, "op", &op)
+                || !get_patch_string(operation, "path", &path_text)
+            ) {
+                return ERROR_INVALID_PATCH;
+            }
+            const json_pointer path(string(path_text.as_cstring(), path_text.get_string_length()), &alloc);
+            if (!path.is_valid()) {
+                return path.is_out_of_memory() ? ERROR_OUT_OF_MEMORY : ERROR_INVALID_PATCH;
+            }
+            value v(TYPE_NULL, 0, 0);
+            overlay_value found = edits.get_root();
+            bool ok;
+
+            if (is_patch_op(op, "add")) {
+                if (!get_patch_member(operation, "value", &v)) {
+                    return ERROR_INVALID_PATCH;
+                }
+                ok = add_patch_value(edits, path, v);
+            } else if (is_patch_op(op, "remove")) {
+                ok = edits.remove(path);
+            } else if (is_patch_op(op, "replace")) {
+                if (!get_patch_member(operation, "value", &v)) {
+                    return ERROR_INVALID_PATCH;
+                }
+                ok = resolve_pointer(edits.get_root(), path, &found) && edits.set(path, v);
+            } else if (is_patch_op(op, "test")) {
+                if (!get_patch_member(operation, "value", &v)) {
+                    return ERROR_INVALID_PATCH;
+                }
+                ok = resolve_pointer(edits.get_root(), path, &found) && values_equal(found, v);
+            } else if (is_patch_op(op, "move") || is_patch_op(op, "copy")) {
+                const bool move = is_patch_op(op, "move");
+                value from_text(TYPE_NULL, 0, 0);
+                if (!get_patch_string(operation, "from", &from_text)) {
+                    return ERROR_INVALID_PATCH;
+                }
+                const json_pointer from(string(from_text.as_cstring(), from_text.get_string_length()), &alloc);
+                if (!from.is_valid()) {
+                    return from.is_out_of_memory() ? ERROR_OUT_OF_MEMORY : ERROR_INVALID_PATCH;
+                }
+                if (!resolve_pointer(edits.get_root(), from, &found)) {
+                    return ERROR_PATCH_FAILED;
+                }
+                if (move) {
+                    // A value cannot be moved into itself.
+                    bool is_prefix = from.get_token_count() < path.get_token_count();
+                    for (size_t i = 0; is_prefix && i < from.get_token_count(); ++i) {
+                        is_prefix = compare_keys(from.get_token(i), path.get_token(i)) == 0;
+                    }
+                    if (is_prefix) {
+                        return ERROR_PATCH_FAILED;
+                    }
+                }
+                const document copy = copy_overlay_value(found, alloc);
+                if (!copy.is_valid()) {
+                    return ERROR_OUT_OF_MEMORY;
+                }
+                ok = (!move || edits.remove(from))
+                    && add_patch_value(edits, path, copy.get_root().get_array_element(0));
+            } else {
+                return ERROR_INVALID_PATCH;
+            }
+
+            if (!edits.is_valid()) {
+                return ERROR_OUT_OF_MEMORY;
+            }
+            return ok ? ERROR_SUCCESS : ERROR_PATCH_FAILED;
+        }
+    }
+
+    // Applies the RFC 7386 merge patch to target.  Members of target that
+    // the patch does not mention are copied unchanged.  The result must
+    // be an array or object, so patch must be an object, or an array to
+    // replace the target.
+    inline document apply_merge_patch(const value& target, const value& patch, allocator* alloc = nullptr) {
+        document_builder out(alloc);
+        internal::write_merge_patch(out, &target, patch);
+        return internal::finish_patch(out);
+    }
+
+    // Applies the RFC 6902 patch, an array of operations, to target, an
+    // array or object.  If an operation is malformed or fails, so does
+    // the whole patch, with ERROR_INVALID_PATCH or ERROR_PATCH_FAILED and
+    // the operation's index as the error argument.
+    inline document apply_patch(const value& target, const value& patch, allocator* alloc = nullptr) {
+        allocator& a = alloc ? *alloc : internal::get_default_allocator();
+        if (patch.get_type() != TYPE_ARRAY) {
+            return internal::make_patch_error(a, ERROR_INVALID_PATCH, 0);
+        }
+        overlay edits(target, &a);
+        const size_t length = patch.get_length();
+        for (size_t i = 0; i < length; ++i) {
+            const error result = internal::apply_patch_operation(edits, patch.get_array_element(i), a);
+            if (result != ERROR_SUCCESS) {
+                return internal::make_patch_error(a, result, i);
+            }
+        }
+        document_builder out(&a);
+        edits.get_root().replay(out);
+        return internal::finish_patch(out);
+    }
+}
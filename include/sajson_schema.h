@@ -0,0 +1,1070 @@
+#pragma once
+
+#include "sajson.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <string>
+#include <vector>
+
+// JSON Schema validation over parsed documents.  compile_schema() turns a
+// schema, itself a parsed document, into a flat table of nodes, one per
+// subschema, so validating only dispatches on precomputed fields rather
+// than looking up keywords.  Object members are checked by merging the
+// instance's sorted keys with the node's property table, which is sorted
+// the same way, so properties, required, and additionalProperties cost a
+// single pass over each object.
+//
+// Supported keywords, with draft-07 meanings: type, enum, const,
+// minimum, maximum, exclusiveMinimum, exclusiveMaximum (numbers, or
+// draft-04 booleans), multipleOf, minLength, maxLength, minItems,
+// maxItems, uniqueItems, items (a schema or an array of them),
+// additionalItems, contains, properties, required, additionalProperties,
+// minProperties, maxProperties, allOf, anyOf, oneOf, not, if, then,
+// else, and $ref to "#" followed by a JSON pointer into the same schema.
+// As in draft-07, keywords next to $ref are ignored.  Annotations and
+// unknown keywords are ignored; pattern and the other keywords that
+// cannot be honored fail compilation rather than being skipped.
+
+namespace sajson {
+    class schema;
+
+    namespace internal {
+        // Appends '/' and token, escaped for a JSON pointer.
+        inline void append_pointer_token(std::string& path, const std::string& token) {
+            path += '/';
+            for (char c : token) {
+                if (c == '~') {
+                    path += "~0";
+                } else if (c == '/') {
+                    path += "~1";
+                } else {
+                    path += c;
+                }
+            }
+        }
+    }
+
+    // The outcome of validating one value.
+    class schema_result {
+    public:
+        schema_result()
+            : keyword(0)
+        {}
+
+        bool is_valid() const {
+            return !keyword;
+        }
+
+        // The keyword that rejected the value, such as "required", or
+        // null if the value is valid.
+        const char* get_keyword() const {
+            return keyword;
+        }
+
+        // Where in the value the failure was found, as a JSON pointer.
+        std::string get_instance_path() const {
+            std::string path;
+            for (size_t i = reversed_path.size(); i--;) {
+                internal::append_pointer_token(path, reversed_path[i]);
+            }
+            return path;
+        }
+
+    private:
+        friend class schema;
+
+        const char* keyword;
+        std::vector<std::string> reversed_path;
+    };
+
+    namespace internal {
+        struct schema_property {
+            const char* key;
+            size_t key_length;
+            size_t node; // schema::NO_NODE if only required
+            bool required;
+        };
+
+        struct schema_node {
+            enum type_bit {
+                TYPE_BIT_NULL = 1,
+                TYPE_BIT_BOOLEAN = 2,
+                TYPE_BIT_OBJECT = 4,
+                TYPE_BIT_ARRAY = 8,
+                TYPE_BIT_NUMBER = 16,
+                TYPE_BIT_STRING = 32,
+                // Numbers with no fractional part; implied by NUMBER.
+                TYPE_BIT_INTEGER = 64,
+                TYPE_BIT_ALL = 63,
+            };
+
+            enum flag {
+                HAS_MINIMUM = 1,
+                HAS_EXCLUSIVE_MINIMUM = 2,
+                HAS_MAXIMUM = 4,
+                HAS_EXCLUSIVE_MAXIMUM = 8,
+                HAS_MULTIPLE_OF = 16,
+                HAS_CONST = 32,
+                HAS_ENUM = 64,
+                HAS_TUPLE = 128,
+                UNIQUE_ITEMS = 256,
+            };
+
+            enum : size_t {
+                UNLIMITED = static_cast<size_t>(-1),
+            };
+
+            schema_node();
+
+            unsigned types;
+            unsigned flags;
+            double minimum;
+            double exclusive_minimum;
+            double maximum;
+            double exclusive_maximum;
+            double multiple_of;
+            size_t min_length;
+            size_t max_length;
+            size_t min_items;
+            size_t max_items;
+            size_t min_properties;
+            size_t max_properties;
+
+            // Index and range of schema::constants.
+            size_t const_index;
+            size_t enum_begin;
+            size_t enum_end;
+            // Range of schema::properties.
+            size_t properties_begin;
+            size_t properties_end;
+            size_t additional_properties;
+            size_t items;
+            // Ranges of schema::subschemas.
+            size_t tuple_begin;
+            size_t tuple_end;
+            size_t additional_items;
+            size_t contains;
+            size_t all_of_begin;
+            size_t all_of_end;
+            size_t any_of_begin;
+            size_t any_of_end;
+            size_t one_of_begin;
+            size_t one_of_end;
+            size_t not_node;
+            size_t if_node;
+            size_t then_node;
+            size_t else_node;
+        };
+
+        class schema_compiler;
+    }
+
+    // A compiled schema.  It refers to the schema document, which must
+    // outlive it.
+    class schema {
+    public:
+        enum : size_t {
+            // The nodes for the schemas true and false.
+            ACCEPT_NODE = 0,
+            REJECT_NODE = 1,
+            NO_NODE = static_cast<size_t>(-1),
+        };
+
+        // False if the schema could not be compiled.
+        bool is_valid() const {
+            return !error_message;
+        }
+
+        // Why compilation failed, or null.
+        const char* get_error_message() const {
+            return error_message;
+        }
+
+        // Where in the schema compilation failed, as a JSON pointer.
+        const std::string& get_error_path() const {
+            return error_path;
+        }
+
+        // Checks v, stopping at the first failure.  The schema must be
+        // valid.
+        schema_result validate(const value& v) const {
+            assert(is_valid());
+            schema_result result;
+            check(root, v, &result);
+            return result;
+        }
+
+        // Like validate(), but only says whether v is valid, which is
+        // cheaper when it is not.
+        bool accepts(const value& v) const {
+            assert(is_valid());
+            return check(root, v, 0);
+        }
+
+    private:
+        friend class internal::schema_compiler;
+
+        schema()
+            : root(ACCEPT_NODE)
+            , error_message(0)
+        {}
+
+        static bool fail(schema_result* result, const char* keyword) {
+            if (result) {
+                result->keyword = keyword;
+            }
+            return false;
+        }
+
+        static bool fail_at(schema_result* result, const string& segment) {
+            if (result) {
+                result->reversed_path.push_back(segment.as_string());
+            }
+            return false;
+        }
+
+        static bool fail_at(schema_result* result, size_t index) {
+            if (result) {
+                result->reversed_path.push_back(std::to_string(index));
+            }
+            return false;
+        }
+
+        static bool is_integral(const value& v) {
+            if (v.get_type() == TYPE_INTEGER) {
+                return true;
+            }
+            const double d = v.get_double_value();
+            return std::floor(d) == d;
+        }
+
+        static bool is_multiple(double d, double divisor) {
+            if (std::floor(d) == d && std::floor(divisor) == divisor) {
+                return std::fmod(d, divisor) == 0;
+            }
+            // Decimal divisors like 0.1 are inexact in binary, so 0.3 is
+            // not quite 3 * 0.1: allow a few ulps of d.
+            const double quotient = std::round(d / divisor);
+            const double ulp = std::nextafter(std::fabs(d), HUGE_VAL) - std::fabs(d);
+            return std::isfinite(quotient) && std::fabs(d - quotient * divisor) <= 4 * ulp;
+        }
+
+        static size_t count_code_points(const value& v) {
+            const char* s = v.as_cstring();
+            const size_t length = v.get_string_length();
+            size_t count = 0;
+            for (size_t i = 0; i < length; ++i) {
+                count += (static_cast<unsigned char>(s[i]) & 0xC0) != 0x80;
+            }
+            return count;
+        }
+
+        bool check_type(const internal::schema_node& node, const value& v) const {
+            typedef internal::schema_node n;
+            switch (v.get_type()) {
+                case TYPE_NULL:
+                    return node.types & n::TYPE_BIT_NULL;
+                case TYPE_FALSE:
+                case TYPE_TRUE:
+                    return node.types & n::TYPE_BIT_BOOLEAN;
+                case TYPE_OBJECT:
+                    return node.types & n::TYPE_BIT_OBJECT;
+                case TYPE_ARRAY:
+                    return node.types & n::TYPE_BIT_ARRAY;
+                case TYPE_STRING:
+                    return node.types & n::TYPE_BIT_STRING;
+                case TYPE_INTEGER:
+                case TYPE_DOUBLE:
+                    return (node.types & n::TYPE_BIT_NUMBER)
+                        || ((node.types & n::TYPE_BIT_INTEGER) && is_integral(v));
+            }
+            SAJSON_UNREACHABLE();
+        }
+
+        bool check_number(const internal::schema_node& node, const value& v, schema_result* result) const {
+            typedef internal::schema_node n;
+            const double d = v.get_number_value();
+            if ((node.flags & n::HAS_MINIMUM) && !(d >= node.minimum)) {
+                return fail(result, "minimum");
+            }
+            if ((node.flags & n::HAS_EXCLUSIVE_MINIMUM) && !(d > node.exclusive_minimum)) {
+                return fail(result, "exclusiveMinimum");
+            }
+            if ((node.flags & n::HAS_MAXIMUM) && !(d <= node.maximum)) {
+                return fail(result, "maximum");
+            }
+            if ((node.flags & n::HAS_EXCLUSIVE_MAXIMUM) && !(d < node.exclusive_maximum)) {
+                return fail(result, "exclusiveMaximum");
+            }
+            if ((node.flags & n::HAS_MULTIPLE_OF) && !is_multiple(d, node.multiple_of)) {
+                return fail(result, "multipleOf");
+            }
+            return true;
+        }
+
+        bool check_string(const internal::schema_node& node, const value& v, schema_result* result) const {
+            // A code point takes one to four bytes, so the byte length
+            // often settles it.
+            const size_t bytes = v.get_string_length();
+            if (bytes <= node.max_length && (bytes + 3) / 4 >= node.min_length) {
+                return true;
+            }
+            const size_t length = count_code_points(v);
+            if (length < node.min_length) {
+                return fail(result, "minLength");
+            }
+            if (length > node.max_length) {
+                return fail(result, "maxLength");
+            }
+            return true;
+        }
+
+        bool check_array(const internal::schema_node& node, const value& v, schema_result* result) const {
+            typedef internal::schema_node n;
+            const size_t length = v.get_length();
+            if (length < node.min_items) {
+                return fail(result, "minItems");
+            }
+            if (length > node.max_items) {
+                return fail(result, "maxItems");
+            }
+            const size_t tuple_length = node.tuple_end - node.tuple_begin;
+            for (size_t i = 0; i < length; ++i) {
+                size_t element_node = node.items;
+                bool additional = false;
+                if (node.flags & n::HAS_TUPLE) {
+                    additional = i >= tuple_length;
+                    element_node = additional ? node.additional_items : subschemas[node.tuple_begin + i];
+                }
+                if (element_node != ACCEPT_NODE && !check(element_node, v.get_array_element(i), result)) {
+                    if (element_node == REJECT_NODE) {
+                        fail(result, additional ? "additionalItems" : "items");
+                    }
+                    return fail_at(result, i);
+                }
+            }
+            if (node.flags & n::UNIQUE_ITEMS) {
+                for (size_t i = 1; i < length; ++i) {
+                    for (size_t j = 0; j < i; ++j) {
+                        if (internal::values_equal(v.get_array_element(i), v.get_array_element(j))) {
+                            return fail(result, "uniqueItems");
+                        }
+                    }
+                }
+            }
+            if (node.contains != NO_NODE) {
+                bool found = false;
+                for (size_t i = 0; i < length && !found; ++i) {
+                    found = check(node.contains, v.get_array_element(i), 0);
+                }
+                if (!found) {
+                    return fail(result, "contains");
+                }
+            }
+            return true;
+        }
+
+        // Merges the object's sorted keys with the sorted property table.
+        bool check_object(const internal::schema_node& node, const value& v, schema_result* result) const {
+            const size_t length = v.get_length();
+            if (length < node.min_properties) {
+                return fail(result, "minProperties");
+            }
+            if (length > node.max_properties) {
+                return fail(result, "maxProperties");
+            }
+            if (node.properties_begin == node.properties_end && node.additional_properties == ACCEPT_NODE) {
+                return true;
+            }
+            size_t i = 0;
+            size_t j = node.properties_begin;
+            while (i < length || j < node.properties_end) {
+                const internal::schema_property* const property = j < node.properties_end ? &properties[j] : 0;
+                const int order = i == length ? 1
+                    : !property ? -1
+                    : internal::compare_keys(v.get_object_key(i), string(property->key, property->key_length));
+                if (order > 0) {
+                    if (property->required) {
+                        return fail(result, "required");
+                    }
+                    ++j;
+                    continue;
+                }
+
+                const size_t member_node = order == 0 && property->node != NO_NODE
+                    ? property->node
+                    : node.additional_properties;
+                if (member_node != ACCEPT_NODE && !check(member_node, v.get_object_value(i), result)) {
+                    if (member_node == REJECT_NODE && (order != 0 || property->node == NO_NODE)) {
+                        fail(result, "additionalProperties");
+                    }
+                    return fail_at(result, v.get_object_key(i));
+                }
+                ++i;
+                // Duplicate keys are adjacent; each is checked against
+                // the same property.
+                if (order == 0 && (i == length
+                    || internal::compare_keys(v.get_object_key(i), string(property->key, property->key_length)) != 0)
+                ) {
+                    ++j;
+                }
+            }
+            return true;
+        }
+
+        bool check_constants(const internal::schema_node& node, const value& v, schema_result* result) const {
+            typedef internal::schema_node n;
+            if ((node.flags & n::HAS_CONST) && !internal::values_equal(v, constants[node.const_index])) {
+                return fail(result, "const");
+            }
+            if (node.flags & n::HAS_ENUM) {
+                for (size_t i = node.enum_begin; i < node.enum_end; ++i) {
+                    if (internal::values_equal(v, constants[i])) {
+                        return true;
+                    }
+                }
+                return fail(result, "enum");
+            }
+            return true;
+        }
+
+        bool check(size_t index, const value& v, schema_result* result) const {
+            typedef internal::schema_node n;
+            if (index == ACCEPT_NODE) {
+                return true;
+            }
+            if (index == REJECT_NODE) {
+                return fail(result, "false");
+            }
+            const n& node = nodes[index];
+            if (node.types != n::TYPE_BIT_ALL && !check_type(node, v)) {
+                return fail(result, "type");
+            }
+            if ((node.flags & (n::HAS_CONST | n::HAS_ENUM)) && !check_constants(node, v, result)) {
+                return false;
+            }
+            switch (v.get_type()) {
+                case TYPE_INTEGER:
+                case TYPE_DOUBLE:
+                    if (!check_number(node, v, result)) {
+                        return false;
+                    }
+                    break;
+                case TYPE_STRING:
+                    if (!check_string(node, v, result)) {
+                        return false;
+                    }
+                    break;
+                case TYPE_ARRAY:
+                    if (!check_array(node, v, result)) {
+                        return false;
+                    }
+                    break;
+                case TYPE_OBJECT:
+                    if (!check_object(node, v, result)) {
+                        return false;
+                    }
+                    break;
+                default:
+                    break;
+            }
+
+            for (size_t i = node.all_of_begin; i < node.all_of_end; ++i) {
+                if (!check(subschemas[i], v, result)) {
+                    return false;
+                }
+            }
+            if (node.any_of_begin != node.any_of_end) {
+                bool any = false;
+                for (size_t i = node.any_of_begin; i < node.any_of_end && !any; ++i) {
+                    any = check(subschemas[i], v, 0);
+                }
+                if (!any) {
+                    return fail(result, "anyOf");
+                }
+            }
+            if (node.one_of_begin != node.one_of_end) {
+                size_t matches = 0;
+                for (size_t i = node.one_of_begin; i < node.one_of_end && matches < 2; ++i) {
+                    matches += check(subschemas[i], v, 0);
+                }
+                if (matches != 1) {
+                    return fail(result, "oneOf");
+                }
+            }
+            if (node.not_node != NO_NODE && check(node.not_node, v, 0)) {
+                return fail(result, "not");
+            }
+            if (node.if_node != NO_NODE) {
+                const size_t branch = check(node.if_node, v, 0) ? node.then_node : node.else_node;
+                if (branch != NO_NODE && !check(branch, v, result)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        size_t root;
+        std::vector<internal::schema_node> nodes;
+        std::vector<internal::schema_property> properties;
+        std::vector<size_t> subschemas;
+        std::vector<value> constants;
+        const char* error_message;
+        std::string error_path;
+    };
+
+    namespace internal {
+        inline schema_node::schema_node()
+            : types(TYPE_BIT_ALL)
+            , flags(0)
+            , minimum(0)
+            , exclusive_minimum(0)
+            , maximum(0)
+            , exclusive_maximum(0)
+            , multiple_of(0)
+            , min_length(0)
+            , max_length(UNLIMITED)
+            , min_items(0)
+            , max_items(UNLIMITED)
+            , min_properties(0)
+            , max_properties(UNLIMITED)
+            , const_index(0)
+            , enum_begin(0)
+            , enum_end(0)
+            , properties_begin(0)
+            , properties_end(0)
+            , additional_properties(schema::ACCEPT_NODE)
+            , items(schema::ACCEPT_NODE)
+            , tuple_begin(0)
+            , tuple_end(0)
+            , additional_items(schema::ACCEPT_NODE)
+            , contains(schema::NO_NODE)
+            , all_of_begin(0)
+            , all_of_end(0)
+            , any_of_begin(0)
+            , any_of_end(0)
+            , one_of_begin(0)
+            , one_of_end(0)
+            , not_node(schema::NO_NODE)
+            , if_node(schema::NO_NODE)
+            , then_node(schema::NO_NODE)
+            , else_node(schema::NO_NODE)
+        {}
+
+        inline bool is_schema_key(const string& key, const char* name) {
+            return compare_keys(key, literal(name)) == 0;
+        }
+
+        class schema_compiler {
+        public:
+            static schema compile(const value& root) {
+                schema result;
+                schema_compiler(root, result).run();
+                return result;
+            }
+
+        private:
+            schema_compiler(const value& root, schema& out)
+                : root(root)
+                , out(out)
+            {}
+
+            void run() {
+                // The true and false schemas.
+                out.nodes.resize(2);
+                if (!compile_child(root, out.root) || !check_cycles()) {
+                    out.root = schema::ACCEPT_NODE;
+                }
+                if (out.error_message) {
+                    for (const std::string& token : path) {
+                        append_pointer_token(out.error_path, token);
+                    }
+                }
+            }
+
+            size_t fail(const char* message) {
+                if (!out.error_message) {
+                    out.error_message = message;
+                }
+                return schema::NO_NODE;
+            }
+
+            bool get_count(const value& v, size_t& count) {
+                if ((v.get_type() != TYPE_INTEGER && v.get_type() != TYPE_DOUBLE)
+                    || v.get_number_value() < 0
+                    || std::floor(v.get_number_value()) != v.get_number_value()
+                ) {
+                    fail("expected a non-negative integer");
+                    return false;
+                }
+                const double d = v.get_number_value();
+                count = d < static_cast<double>(schema_node::UNLIMITED)
+                    ? static_cast<size_t>(d)
+                    : size_t(schema_node::UNLIMITED);
+                return true;
+            }
+
+            bool get_number(const value& v, double& number) {
+                if (v.get_type() != TYPE_INTEGER && v.get_type() != TYPE_DOUBLE) {
+                    fail("expected a number");
+                    return false;
+                }
+                number = v.get_number_value();
+                return true;
+            }
+
+            bool compile_child(const value& v, size_t& index) {
+                index = compile_node(v);
+                if (index == schema::NO_NODE) {
+                    // Every failure should have said why already.
+                    fail("invalid schema");
+                    return false;
+                }
+                return true;
+            }
+
+            // Compiles each schema in the array v, appending their indices
+            // to subschemas as the range [begin, end).
+            bool compile_list(const value& v, size_t& begin, size_t& end) {
+                if (v.get_type() != TYPE_ARRAY || v.get_length() == 0) {
+                    fail("expected a non-empty array of schemas");
+                    return false;
+                }
+                std::vector<size_t> indices(v.get_length());
+                for (size_t i = 0; i < indices.size(); ++i) {
+                    path.push_back(std::to_string(i));
+                    if (!compile_child(v.get_array_element(i), indices[i])) {
+                        return false;
+                    }
+                    path.pop_back();
+                }
+                begin = out.subschemas.size();
+                out.subschemas.insert(out.subschemas.end(), indices.begin(), indices.end());
+                end = out.subschemas.size();
+                return true;
+            }
+
+            bool compile_types(const value& v, unsigned& types) {
+                if (v.get_type() == TYPE_STRING) {
+                    return add_type(v, types);
+                }
+                if (v.get_type() != TYPE_ARRAY) {
+                    fail("expected a type name or array of them");
+                    return false;
+                }
+                for (const value& name : v.get_array_elements()) {
+                    if (name.get_type() != TYPE_STRING || !add_type(name, types)) {
+                        fail("unknown type");
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            bool add_type(const value& name, unsigned& types) {
+                static const struct {
+                    const char* name;
+                    unsigned bit;
+                } type_names[] = {
+                    {"null", schema_node::TYPE_BIT_NULL},
+                    {"boolean", schema_node::TYPE_BIT_BOOLEAN},
+                    {"object", schema_node::TYPE_BIT_OBJECT},
+                    {"array", schema_node::TYPE_BIT_ARRAY},
+                    {"number", schema_node::TYPE_BIT_NUMBER},
+                    {"string", schema_node::TYPE_BIT_STRING},
+                    {"integer", schema_node::TYPE_BIT_INTEGER},
+                };
+                const string key(name.as_cstring(), name.get_string_length());
+                for (const auto& type_name : type_names) {
+                    if (is_schema_key(key, type_name.name)) {
+                        types |= type_name.bit;
+                        return true;
+                    }
+                }
+                fail("unknown type");
+                return false;
+            }
+
+            // Appends the property table for properties and required,
+            // sorted like object keys.
+            bool compile_properties(const value* properties, const value* required, schema_node& node) {
+                std::vector<schema_property> table;
+                if (properties) {
+                    path.push_back("properties");
+                    if (properties->get_type() != TYPE_OBJECT) {
+                        fail("expected an object of schemas");
+                        return false;
+                    }
+                    // Already sorted and, if keys repeat, adjacent; the
+                    // last one wins, as with any other keyword.
+                    for (const object_member& member : properties->get_object_members()) {
+                        const string key = member.get_key();
+                        path.push_back(key.as_string());
+                        schema_property property = {key.data(), key.length(), schema::NO_NODE, false};
+                        if (!compile_child(member.get_value(), property.node)) {
+                            return false;
+                        }
+                        path.pop_back();
+                        if (!table.empty() && compare_keys(key, string(table.back().key, table.back().key_length)) == 0) {
+                            table.back() = property;
+                        } else {
+                            table.push_back(property);
+                        }
+                    }
+                    path.pop_back();
+                }
+
+                if (required) {
+                    path.push_back("required");
+                    if (required->get_type() != TYPE_ARRAY) {
+                        fail("expected an array of strings");
+                        return false;
+                    }
+                    for (const value& name : required->get_array_elements()) {
+                        if (name.get_type() != TYPE_STRING) {
+                            fail("expected an array of strings");
+                            return false;
+                        }
+                        const string key(name.as_cstring(), name.get_string_length());
+                        std::vector<schema_property>::iterator it = table.begin();
+                        while (it != table.end() && compare_keys(string(it->key, it->key_length), key) < 0) {
+                            ++it;
+                        }
+                        if (it != table.end() && compare_keys(string(it->key, it->key_length), key) == 0) {
+                            it->required = true;
+                        } else {
+                            schema_property property = {key.data(), key.length(), schema::NO_NODE, true};
+                            table.insert(it, property);
+                        }
+                    }
+                    path.pop_back();
+                }
+
+                node.properties_begin = out.properties.size();
+                out.properties.insert(out.properties.end(), table.begin(), table.end());
+                node.properties_end = out.properties.size();
+                return true;
+            }
+
+            // Resolves a "#/..." reference against the root schema.
+            bool resolve_reference(const value& reference, value& target) {
+                if (reference.get_type() != TYPE_STRING) {
+                    fail("expected a reference");
+                    return false;
+                }
+                const char* const text = reference.as_cstring();
+                const size_t length = reference.get_string_length();
+                if (length == 0 || text[0] != '#' || memchr(text, '%', length)) {
+                    fail("only references within the schema are supported");
+                    return false;
+                }
+                const json_pointer pointer(string(text + 1, length - 1));
+                if (!pointer.is_valid()) {
+                    fail("invalid reference");
+                    return false;
+                }
+                target = root;
+                for (size_t i = 0; i < pointer.get_token_count(); ++i) {
+                    size_t index;
+                    if (target.get_type() == TYPE_OBJECT) {
+                        index = target.find_object_key(pointer.get_token(i));
+                    } else if (target.get_type() == TYPE_ARRAY) {
+                        index = pointer.get_token_index(i);
+                    } else {
+                        index = json_pointer::NOT_AN_INDEX;
+                    }
+                    if (index >= target.get_length()) {
+                        fail("unresolved reference");
+                        return false;
+                    }
+                    target = target.get_type() == TYPE_OBJECT
+                        ? target.get_object_value(index)
+                        : target.get_array_element(index);
+                }
+                return true;
+            }
+
+            size_t compile_node(const value& s) {
+                if (s.get_type() == TYPE_TRUE) {
+                    return schema::ACCEPT_NODE;
+                } else if (s.get_type() == TYPE_FALSE) {
+                    return schema::REJECT_NODE;
+                } else if (s.get_type() != TYPE_OBJECT) {
+                    return fail("expected a schema");
+                }
+
+                // Each subschema is compiled once, however many
+                // references reach it.  Its node is allocated first, so
+                // references back to it while it is still being compiled,
+                // as recursive schemas make, have an index to use.
+                const size_t* const key = s._internal_get_payload();
+                std::map<const size_t*, size_t>::iterator existing = states.find(key);
+                if (existing != states.end()) {
+                    return existing->second;
+                }
+
+                const size_t index = out.nodes.size();
+                out.nodes.push_back(schema_node());
+                states[key] = index;
+
+                const size_t reference = s.find_object_key(literal("$ref"));
+                if (reference != s.get_length()) {
+                    // The node is allOf the target.
+                    path.push_back("$ref");
+                    reference_paths[index] = path;
+                    value target(TYPE_NULL, 0, 0);
+                    size_t target_index;
+                    if (!resolve_reference(s.get_object_value(reference), target)
+                        || !compile_child(target, target_index)) {
+                        return schema::NO_NODE;
+                    }
+                    path.pop_back();
+                    schema_node node;
+                    node.all_of_begin = out.subschemas.size();
+                    out.subschemas.push_back(target_index);
+                    node.all_of_end = out.subschemas.size();
+                    out.nodes[index] = node;
+                    return index;
+                }
+
+                schema_node node;
+                if (!compile_keywords(s, node)) {
+                    return schema::NO_NODE;
+                }
+                out.nodes[index] = node;
+                return index;
+            }
+
+            enum visit_state : unsigned char {
+                NOT_VISITED,
+                ON_STACK,
+                DONE,
+            };
+
+            // Validation follows allOf, anyOf, oneOf, not, if, then, and
+            // else, and so $ref, without moving into the instance, so a
+            // cycle of them would recurse forever.  Every such cycle
+            // passes through a $ref, which is where it is reported.
+            bool check_cycles() {
+                std::vector<unsigned char> visited(out.nodes.size(), NOT_VISITED);
+                std::vector<size_t> stack;
+                for (size_t i = 0; i < out.nodes.size(); ++i) {
+                    if (!visit(i, visited, stack)) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            bool visit(size_t index, std::vector<unsigned char>& visited, std::vector<size_t>& stack) {
+                if (index == schema::NO_NODE || visited[index] == DONE) {
+                    return true;
+                }
+                if (visited[index] == ON_STACK) {
+                    for (size_t i = std::find(stack.begin(), stack.end(), index) - stack.begin(); i < stack.size(); ++i) {
+                        std::map<size_t, std::vector<std::string>>::const_iterator reference = reference_paths.find(stack[i]);
+                        if (reference != reference_paths.end()) {
+                            path = reference->second;
+                            break;
+                        }
+                    }
+                    fail("circular reference");
+                    return false;
+                }
+
+                visited[index] = ON_STACK;
+                stack.push_back(index);
+                const schema_node& node = out.nodes[index];
+                const size_t ranges[][2] = {
+                    {node.all_of_begin, node.all_of_end},
+                    {node.any_of_begin, node.any_of_end},
+                    {node.one_of_begin, node.one_of_end},
+                };
+                for (const auto& range : ranges) {
+                    for (size_t i = range[0]; i < range[1]; ++i) {
+                        if (!visit(out.subschemas[i], visited, stack)) {
+                            return false;
+                        }
+                    }
+                }
+                if (!visit(node.not_node, visited, stack)
+                    || !visit(node.if_node, visited, stack)
+                    || !visit(node.then_node, visited, stack)
+                    || !visit(node.else_node, visited, stack)
+                ) {
+                    return false;
+                }
+                stack.pop_back();
+                visited[index] = DONE;
+                return true;
+            }
+
+            bool compile_keywords(const value& s, schema_node& node) {
+                const value* properties = 0;
+                const value* required = 0;
+                // Keep the values alive for the pointers above.
+                value properties_value(TYPE_NULL, 0, 0);
+                value required_value(TYPE_NULL, 0, 0);
+                bool exclusive_minimum_flag = false;
+                bool exclusive_maximum_flag = false;
+
+                for (const object_member& member : s.get_object_members()) {
+                    const string k = member.get_key();
+                    const value v = member.get_value();
+                    path.push_back(k.as_string());
+                    bool ok = true;
+                    if (is_schema_key(k, "type")) {
+                        node.types = 0;
+                        ok = compile_types(v, node.types);
+                        if (node.types & schema_node::TYPE_BIT_NUMBER) {
+                            node.types &= ~unsigned(schema_node::TYPE_BIT_INTEGER);
+                        }
+                    } else if (is_schema_key(k, "const")) {
+                        node.flags |= schema_node::HAS_CONST;
+                        node.const_index = out.constants.size();
+                        out.constants.push_back(v);
+                    } else if (is_schema_key(k, "enum")) {
+                        if (v.get_type() != TYPE_ARRAY) {
+                            fail("expected an array");
+                            return false;
+                        }
+                        node.flags |= schema_node::HAS_ENUM;
+                        node.enum_begin = out.constants.size();
+                        for (const value& element : v.get_array_elements()) {
+                            out.constants.push_back(element);
+                        }
+                        node.enum_end = out.constants.size();
+                    } else if (is_schema_key(k, "minimum")) {
+                        node.flags |= schema_node::HAS_MINIMUM;
+                        ok = get_number(v, node.minimum);
+                    } else if (is_schema_key(k, "maximum")) {
+                        node.flags |= schema_node::HAS_MAXIMUM;
+                        ok = get_number(v, node.maximum);
+                    } else if (is_schema_key(k, "exclusiveMinimum")) {
+                        if (v.get_type() == TYPE_TRUE || v.get_type() == TYPE_FALSE) {
+                            exclusive_minimum_flag = v.get_type() == TYPE_TRUE;
+                        } else {
+                            node.flags |= schema_node::HAS_EXCLUSIVE_MINIMUM;
+                            ok = get_number(v, node.exclusive_minimum);
+                        }
+                    } else if (is_schema_key(k, "exclusiveMaximum")) {
+                        if (v.get_type() == TYPE_TRUE || v.get_type() == TYPE_FALSE) {
+                            exclusive_maximum_flag = v.get_type() == TYPE_TRUE;
+                        } else {
+                            node.flags |= schema_node::HAS_EXCLUSIVE_MAXIMUM;
+                            ok = get_number(v, node.exclusive_maximum);
+                        }
+                    } else if (is_schema_key(k, "multipleOf")) {
+                        node.flags |= schema_node::HAS_MULTIPLE_OF;
+                        ok = get_number(v, node.multiple_of);
+                        if (ok && !(node.multiple_of > 0)) {
+                            fail("expected a positive number");
+                            ok = false;
+                        }
+                    } else if (is_schema_key(k, "minLength")) {
+                        ok = get_count(v, node.min_length);
+                    } else if (is_schema_key(k, "maxLength")) {
+                        ok = get_count(v, node.max_length);
+                    } else if (is_schema_key(k, "minItems")) {
+                        ok = get_count(v, node.min_items);
+                    } else if (is_schema_key(k, "maxItems")) {
+                        ok = get_count(v, node.max_items);
+                    } else if (is_schema_key(k, "minProperties")) {
+                        ok = get_count(v, node.min_properties);
+                    } else if (is_schema_key(k, "maxProperties")) {
+                        ok = get_count(v, node.max_properties);
+                    } else if (is_schema_key(k, "uniqueItems")) {
+                        if (v.get_type() == TYPE_TRUE) {
+                            node.flags |= schema_node::UNIQUE_ITEMS;
+                        } else if (v.get_type() != TYPE_FALSE) {
+                            fail("expected a boolean");
+                            ok = false;
+                        }
+                    } else if (is_schema_key(k, "items")) {
+                        if (v.get_type() == TYPE_ARRAY) {
+                            node.flags |= schema_node::HAS_TUPLE;
+                            ok = v.get_length() == 0
+                                || compile_list(v, node.tuple_begin, node.tuple_end);
+                        } else {
+                            ok = compile_child(v, node.items);
+                        }
+                    } else if (is_schema_key(k, "additionalItems")) {
+                        ok = compile_child(v, node.additional_items);
+                    } else if (is_schema_key(k, "contains")) {
+                        ok = compile_child(v, node.contains);
+                    } else if (is_schema_key(k, "properties")) {
+                        properties_value = v;
+                        properties = &properties_value;
+                    } else if (is_schema_key(k, "required")) {
+                        required_value = v;
+                        required = &required_value;
+                    } else if (is_schema_key(k, "additionalProperties")) {
+                        ok = compile_child(v, node.additional_properties);
+                    } else if (is_schema_key(k, "allOf")) {
+                        ok = compile_list(v, node.all_of_begin, node.all_of_end);
+                    } else if (is_schema_key(k, "anyOf")) {
+                        ok = compile_list(v, node.any_of_begin, node.any_of_end);
+                    } else if (is_schema_key(k, "oneOf")) {
+                        ok = compile_list(v, node.one_of_begin, node.one_of_end);
+                    } else if (is_schema_key(k, "not")) {
+                        ok = compile_child(v, node.not_node);
+                    } else if (is_schema_key(k, "if")) {
+                        ok = compile_child(v, node.if_node);
+                    } else if (is_schema_key(k, "then")) {
+                        ok = compile_child(v, node.then_node);
+                    } else if (is_schema_key(k, "else")) {
+                        ok = compile_child(v, node.else_node);
+                    } else if (is_schema_key(k, "pattern")
+                        || is_schema_key(k, "patternProperties")
+                        || is_schema_key(k, "propertyNames")
+                        || is_schema_key(k, "dependencies")
+                        || is_schema_key(k, "dependentRequired")
+                        || is_schema_key(k, "dependentSchemas")
+                        || is_schema_key(k, "unevaluatedItems")
+                        || is_schema_key(k, "unevaluatedProperties")
+                    ) {
+                        fail("unsupported keyword");
+                        ok = false;
+                    }
+                    if (!ok) {
+                        return false;
+                    }
+                    path.pop_back();
+                }
+
+                if (properties || required) {
+                    if (!compile_properties(properties, required, node)) {
+                        return false;
+                    }
+                }
+                if (exclusive_minimum_flag && (node.flags & schema_node::HAS_MINIMUM)) {
+                    node.flags = (node.flags & ~unsigned(schema_node::HAS_MINIMUM)) | schema_node::HAS_EXCLUSIVE_MINIMUM;
+                    node.exclusive_minimum = node.minimum;
+                }
+                if (exclusive_maximum_flag && (node.flags & schema_node::HAS_MAXIMUM)) {
+                    node.flags = (node.flags & ~unsigned(schema_node::HAS_MAXIMUM)) | schema_node::HAS_EXCLUSIVE_MAXIMUM;
+                    node.exclusive_maximum = node.maximum;
+                }
+                return true;
+            }
+
+            const value& root;
+            schema& out;
+            // Compiled nodes by the payload of their schema object.
+            std::map<const size_t*, size_t> states;
+            // Where each $ref node's reference is, for reporting cycles.
+            std::map<size_t, std::vector<std::string>> reference_paths;
+            std::vector<std::string> path;
+        };
+    }
+
+    // Compiles the schema rooted at root, which may be any value in a
+    // document that outlives the result.  If the schema is not valid, or
+    // uses keywords that are not supported, the result says why and
+    // where.
+    inline schema compile_schema(const value& root) {
+        return internal::schema_compiler::compile(root);
+    }
+}
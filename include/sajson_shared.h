@@ -0,0 +1,59 @@
+#pragma once
+
+#include "sajson_snapshot.h"
+
+// Sharing parsed documents between processes.  One process parses a
+// document and publishes it as a snapshot (see sajson_snapshot.h) in a
+// named POSIX shared memory object; any number of others attach it
+// read-only.  Attaching maps the snapshot without parsing or copying, so
+// every process uses the same physical pages for the input and the AST.
+//
+// For unnamed sharing, write_snapshot_fd() a descriptor from
+// memfd_create() and hand it to other processes by fork() or over a
+// Unix socket, where load_snapshot_fd() attaches it.
+//
+// On older glibc, link with -lrt for shm_open().
+
+#ifdef SAJSON_HAS_MMAP
+namespace sajson {
+    // Creates the shared memory object name, which must begin with a
+    // slash, holding a snapshot of doc, which must be valid.  Fails if
+    // the name is already taken; to replace a document, unpublish it
+    // first.  Processes already attached keep the old one.  Returns
+    // false, with errno set, on failure.
+    inline bool publish_shared_document(const document& doc, const char* name, mode_t mode = 0644) {
+        const int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, mode);
+        if (fd < 0) {
+            return false;
+        }
+        const bool ok = write_snapshot_fd(doc, fd);
+        const int saved_errno = errno;
+        if (!ok) {
+            shm_unlink(name);
+        }
+        close(fd);
+        errno = saved_errno;
+        return ok;
+    }
+
+    // Removes the name.  The memory is freed once every attached
+    // document is gone.  Returns false, with errno set, on failure.
+    inline bool unpublish_shared_document(const char* name) {
+        return shm_unlink(name) == 0;
+    }
+
+    // Maps the document published under name read-only.  Fails with
+    // ERROR_IO, and the errno as the error argument, if there is no such
+    // document, or with ERROR_INVALID_SNAPSHOT if it is still being
+    // published.
+    inline document attach_shared_document(const char* name) {
+        const int fd = shm_open(name, O_RDONLY, 0);
+        if (fd < 0) {
+            return internal::make_snapshot_error(ERROR_IO, errno);
+        }
+        document result = load_snapshot_fd(fd);
+        close(fd);
+        return result;
+    }
+}
+#endif
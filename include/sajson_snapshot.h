@@ -0,0 +1,298 @@
+#pragma once
+
+#include <errno.h>
+#include "sajson.h"
+
+#include <atomic>
+
+#ifdef SAJSON_HAS_MMAP
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+// Binary snapshots of parsed documents.  A document is its input, as
+// left by parsing, plus an AST whose offsets are all relative, so both
+// can be written out as-is and used again without parsing.  A snapshot
+// file is laid out as:
+//
+//     snapshot_header
+//     input bytes
+//     padding to a word boundary
+//     one word: the byte offset of the AST from the start of the file
+//     AST words
+//
+// Snapshots are only readable by builds with the same word size and byte
+// order.  Loading checks the header but not the AST, so only load
+// snapshots this library wrote.
+
+namespace sajson {
+    struct snapshot_header {
+        enum { VERSION = 1 };
+
+        char magic[8];          // "sajson\x1a\x01"
+        uint32_t version;
+        uint32_t word_size;     // sizeof(size_t)
+        uint32_t byte_order;    // 0x01020304, in the writer's byte order
+        uint32_t root_type;
+        uint64_t input_length;  // bytes, starting right after the header
+        uint64_t ast_offset;    // bytes from the start of the snapshot
+        uint64_t ast_length;    // words
+        uint64_t snapshot_size; // bytes
+    };
+
+    namespace internal {
+        inline const char* get_snapshot_magic() {
+            return "sajson\x1a\x01";
+        }
+
+        // The first four bytes of the magic number, as an atomic word.
+        // write_snapshot() stores it last, with release order, and
+        // load_snapshot_fd() loads it first, with acquire order, so a
+        // reader that sees it also sees the rest of the snapshot.  Four
+        // bytes because every target can load them atomically from a
+        // read-only mapping.
+        inline std::atomic<uint32_t>& get_snapshot_publish_word(const void* snapshot) {
+            static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "atomic word must match the header");
+            return *static_cast<std::atomic<uint32_t>*>(const_cast<void*>(snapshot));
+        }
+
+        inline uint32_t get_snapshot_publish_value() {
+            uint32_t value;
+            memcpy(&value, get_snapshot_magic(), sizeof(value));
+            return value;
+        }
+
+        // Fills in the header for doc.
+        inline snapshot_header make_snapshot_header(const document& doc) {
+            snapshot_header header;
+            memcpy(header.magic, get_snapshot_magic(), sizeof(header.magic));
+            header.version = snapshot_header::VERSION;
+            header.word_size = sizeof(size_t);
+            header.byte_order = 0x01020304;
+            header.root_type = doc._internal_get_root_type();
+            header.input_length = doc._internal_get_input_length();
+            const uint64_t input_end = sizeof(snapshot_header) + header.input_length;
+            const uint64_t word_mask = sizeof(size_t) - 1;
+            // Leave room for the AST offset word before the AST.
+            header.ast_offset = ((input_end + word_mask) & ~word_mask) + sizeof(size_t);
+            header.ast_length = doc._internal_get_ast_length();
+            header.snapshot_size = header.ast_offset + header.ast_length * sizeof(size_t);
+            return header;
+        }
+
+        // Checks everything a loader relies on.
+        inline bool is_valid_snapshot_header(const snapshot_header& header, size_t available) {
+            if (memcmp(header.magic, get_snapshot_magic(), sizeof(header.magic)) != 0
+                || header.version != snapshot_header::VERSION
+                || header.word_size != sizeof(size_t)
+                || header.byte_order != 0x01020304
+                || (header.root_type != TYPE_ARRAY && header.root_type != TYPE_OBJECT)
+                || header.snapshot_size > available
+                || header.ast_offset % sizeof(size_t) != 0
+                || header.ast_length == 0
+                || header.input_length > header.snapshot_size
+            ) {
+                return false;
+            }
+            return header.ast_offset >= sizeof(snapshot_header) + header.input_length + sizeof(size_t)
+                && header.ast_offset <= header.snapshot_size
+                && (header.snapshot_size - header.ast_offset) / sizeof(size_t) == header.ast_length
+                && (header.snapshot_size - header.ast_offset) % sizeof(size_t) == 0;
+        }
+
+        inline document make_snapshot_error(error code, int arg = 0) {
+            return document(data_storage(0, false, 0, 0, get_default_allocator()), 0, 0, code, arg);
+        }
+
+#ifdef SAJSON_HAS_MMAP
+        // Owns the structure buffer of documents loaded by
+        // load_snapshot_file(), which is the tail of a read-only mapping.
+        // The mapping is found from the AST: the word before it gives the
+        // AST's offset into the mapping, and the header at the start of
+        // the mapping gives its size.
+        class snapshot_mapping_allocator : public allocator {
+        public:
+            // Mapped documents are already compact and never grow.
+            void* allocate(size_t) override {
+                return 0;
+            }
+
+            void deallocate(const void* ast) override {
+                const char* const ast_bytes = static_cast<const char*>(ast);
+                size_t offset;
+                memcpy(&offset, ast_bytes - sizeof(size_t), sizeof(offset));
+                const char* const mapping = ast_bytes - offset;
+                snapshot_header header;
+                memcpy(&header, mapping, sizeof(header));
+                munmap(const_cast<char*>(mapping), static_cast<size_t>(header.snapshot_size));
+            }
+        };
+
+        inline allocator& get_snapshot_mapping_allocator() {
+            static snapshot_mapping_allocator s_allocator;
+            return s_allocator;
+        }
+#endif
+    }
+
+    // The number of bytes write_snapshot() needs for doc, which must be
+    // valid.
+    inline size_t get_snapshot_size(const document& doc) {
+        assert(doc.is_valid());
+        return static_cast<size_t>(internal::make_snapshot_header(doc).snapshot_size);
+    }
+
+    // Writes a snapshot of doc, which must be valid, to out, which must
+    // hold get_snapshot_size(doc) bytes and be word-aligned.  The start
+    // of the magic number is stored last, atomically, so a reader of
+    // shared memory never accepts a half-written snapshot.
+    inline void write_snapshot(const document& doc, void* out) {
+        assert(doc.is_valid());
+        snapshot_header header = internal::make_snapshot_header(doc);
+        char* const bytes = static_cast<char*>(out);
+        std::atomic<uint32_t>& publish_word = internal::get_snapshot_publish_word(bytes);
+        publish_word.store(0, std::memory_order_relaxed);
+        memcpy(bytes + sizeof(uint32_t), reinterpret_cast<const char*>(&header) + sizeof(uint32_t), sizeof(header) - sizeof(uint32_t));
+        memcpy(bytes + sizeof(header), doc._internal_get_input(), doc._internal_get_input_length());
+        const size_t input_end = sizeof(header) + doc._internal_get_input_length();
+        const size_t ast_offset = static_cast<size_t>(header.ast_offset);
+        memset(bytes + input_end, 0, ast_offset - input_end);
+        memcpy(bytes + ast_offset - sizeof(size_t), &ast_offset, sizeof(size_t));
+        memcpy(bytes + ast_offset, doc._internal_get_root(), doc._internal_get_ast_length() * sizeof(size_t));
+        publish_word.store(internal::get_snapshot_publish_value(), std::memory_order_release);
+    }
+
+    // Writes a snapshot of doc, which must be valid, to a new file at
+    // path.  Returns false, with errno set, if the file could not be
+    // written.
+    inline bool save_snapshot(const document& doc, const char* path) {
+        assert(doc.is_valid());
+        const snapshot_header header = internal::make_snapshot_header(doc);
+        FILE* file = fopen(path, "wb");
+        if (!file) {
+            return false;
+        }
+        const size_t input_end = sizeof(header) + doc._internal_get_input_length();
+        const size_t ast_offset = static_cast<size_t>(header.ast_offset);
+        char padding[2 * sizeof(size_t)] = {0};
+        memcpy(padding + (ast_offset - input_end) - sizeof(size_t), &ast_offset, sizeof(size_t));
+        const size_t ast_bytes = doc._internal_get_ast_length() * sizeof(size_t);
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+            && fwrite(doc._internal_get_input(), 1, doc._internal_get_input_length(), file) == doc._internal_get_input_length()
+            && fwrite(padding, 1, ast_offset - input_end, file) == ast_offset - input_end
+            && fwrite(doc._internal_get_root(), 1, ast_bytes, file) == ast_bytes;
+        const int saved_errno = errno;
+        if (fclose(file) != 0) {
+            ok = false;
+        } else if (!ok) {
+            errno = saved_errno;
+        }
+        return ok;
+    }
+
+    // Loads a snapshot from memory, copying it into memory from alloc, so
+    // data need not outlive the result.  data need not be aligned.
+    inline document load_snapshot(const void* data, size_t length, allocator* alloc = nullptr) {
+        if (!alloc) {
+            alloc = &internal::get_default_allocator();
+        }
+        snapshot_header header;
+        if (length < sizeof(header)) {
+            return internal::make_snapshot_error(ERROR_INVALID_SNAPSHOT);
+        }
+        memcpy(&header, data, sizeof(header));
+        if (!internal::is_valid_snapshot_header(header, length)) {
+            return internal::make_snapshot_error(ERROR_INVALID_SNAPSHOT);
+        }
+
+        const size_t input_length = static_cast<size_t>(header.input_length);
+        const size_t ast_length = static_cast<size_t>(header.ast_length);
+        char* input = static_cast<char*>(alloc->allocate(input_length));
+        size_t* ast = input
+            ? static_cast<size_t*>(alloc->allocate(ast_length * sizeof(size_t)))
+            : 0;
+        data_storage storage(input, true, ast, input_length, ast_length, *alloc);
+        if (!ast) {
+            return document(std::move(storage), 0, 0, ERROR_OUT_OF_MEMORY, 0);
+        }
+        const char* const bytes = static_cast<const char*>(data);
+        memcpy(input, bytes + sizeof(header), input_length);
+        memcpy(ast, bytes + header.ast_offset, ast_length * sizeof(size_t));
+        return document(std::move(storage), static_cast<type>(header.root_type), ast);
+    }
+
+#ifdef SAJSON_HAS_MMAP
+    // Loads the snapshot in the file referred to by fd, which may be a
+    // regular file or shared memory, by mapping it read-only: there is no
+    // parsing and no copying, and pages are read in as the document is
+    // used.  The mapping lives as long as the document; fd does not need
+    // to.  Fails with ERROR_IO, and the errno as the error argument, if
+    // the file cannot be mapped.
+    inline document load_snapshot_fd(int fd) {
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            return internal::make_snapshot_error(ERROR_IO, errno);
+        }
+        const size_t size = static_cast<size_t>(st.st_size);
+        if (size < sizeof(snapshot_header)) {
+            return internal::make_snapshot_error(ERROR_INVALID_SNAPSHOT);
+        }
+        void* mapping = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            return internal::make_snapshot_error(ERROR_IO, errno);
+        }
+
+        // Pairs with the release store in write_snapshot(), for
+        // snapshots written to shared memory: nothing else is read
+        // until this says the snapshot is complete.
+        const uint32_t published = internal::get_snapshot_publish_word(mapping).load(std::memory_order_acquire);
+        const snapshot_header& header = *static_cast<const snapshot_header*>(mapping);
+        if (published != internal::get_snapshot_publish_value()
+            || !internal::is_valid_snapshot_header(header, size)
+            || header.snapshot_size != size) {
+            munmap(mapping, size);
+            return internal::make_snapshot_error(ERROR_INVALID_SNAPSHOT);
+        }
+
+        char* const bytes = static_cast<char*>(mapping);
+        size_t* const ast = reinterpret_cast<size_t*>(bytes + header.ast_offset);
+        data_storage storage(
+            bytes + sizeof(snapshot_header),
+            false,
+            ast,
+            static_cast<size_t>(header.input_length),
+            static_cast<size_t>(header.ast_length),
+            internal::get_snapshot_mapping_allocator());
+        return document(std::move(storage), static_cast<type>(header.root_type), ast);
+    }
+
+    // Replaces the contents of fd, which must be open for reading and
+    // writing, with a snapshot of doc, which must be valid.  Suits
+    // descriptors from shm_open() and memfd_create() as well as files.
+    // Returns false, with errno set, on failure.
+    inline bool write_snapshot_fd(const document& doc, int fd) {
+        const size_t size = get_snapshot_size(doc);
+        if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+            return false;
+        }
+        void* mapping = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            return false;
+        }
+        write_snapshot(doc, mapping);
+        munmap(mapping, size);
+        return true;
+    }
+
+    // Loads a snapshot file with load_snapshot_fd().
+    inline document load_snapshot_file(const char* path) {
+        const int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            return internal::make_snapshot_error(ERROR_IO, errno);
+        }
+        document result = load_snapshot_fd(fd);
+        close(fd);
+        return result;
+    }
+#endif
+}
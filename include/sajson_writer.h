@@ -0,0 +1,937 @@
+#pragma once
+
+#include <cmath>
+#include "sajson.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <errno.h>
+#include <poll.h>
+#include <sys/uio.h>
+#define SAJSON_HAS_WRITEV
+#endif
+
+namespace sajson {
+    namespace internal {
+        // "00" through "99", two characters each.
+        inline const char* get_digit_pairs() {
+            static const char pairs[] =
+                "00010203040506070809" "10111213141516171819"
+                "20212223242526272829" "30313233343536373839"
+                "40414243444546474849" "50515253545556575859"
+                "60616263646566676869" "70717273747576777879"
+                "80818283848586878889" "90919293949596979899";
+            return pairs;
+        }
+
+        // Writes at most 11 characters.
+        inline char* format_integer(int value, char* out) {
+            uint32_t u = static_cast<uint32_t>(value);
+            if (value < 0) {
+                *out++ = '-';
+                u = 0 - u;
+            }
+            const char* const pairs = get_digit_pairs();
+            char digits[10];
+            char* p = digits + sizeof(digits);
+            while (u >= 100) {
+                const uint32_t pair = (u % 100) * 2;
+                u /= 100;
+                *--p = pairs[pair + 1];
+                *--p = pairs[pair];
+            }
+            if (u >= 10) {
+                *--p = pairs[u * 2 + 1];
+                *--p = pairs[u * 2];
+            } else {
+                *--p = static_cast<char>('0' + u);
+            }
+            const size_t length = digits + sizeof(digits) - p;
+            memcpy(out, p, length);
+            return out + length;
+        }
+
+        // Double formatting follows Florian Loitsch's Grisu2 ("Printing
+        // Floating-Point Numbers Quickly and Accurately with Integers",
+        // PLDI 2010).  The digits it produces always read back as the
+        // same double and are the shortest such digits for all but a
+        // tiny fraction of inputs.
+
+        // A floating-point number f * 2^e with a 64-bit significand.
+        struct diy_fp {
+            diy_fp() {}
+
+            diy_fp(uint64_t f, int e)
+                : f(f)
+                , e(e)
+            {}
+
+            explicit diy_fp(double d) {
+                uint64_t bits;
+                memcpy(&bits, &d, sizeof(bits));
+                const int biased_exponent = static_cast<int>((bits >> 52) & 0x7ff);
+                const uint64_t significand = bits & (HIDDEN_BIT - 1);
+                if (biased_exponent) {
+                    f = significand + HIDDEN_BIT;
+                    e = biased_exponent - EXPONENT_BIAS;
+                } else {
+                    f = significand;
+                    e = 1 - EXPONENT_BIAS;
+                }
+            }
+
+            diy_fp operator-(const diy_fp& rhs) const {
+                return diy_fp(f - rhs.f, e);
+            }
+
+            // The high 64 bits of the product, rounded.
+            diy_fp operator*(const diy_fp& rhs) const {
+                const uint64_t mask = 0xffffffff;
+                const uint64_t a = f >> 32;
+                const uint64_t b = f & mask;
+                const uint64_t c = rhs.f >> 32;
+                const uint64_t d = rhs.f & mask;
+                const uint64_t ac = a * c;
+                const uint64_t bc = b * c;
+                const uint64_t ad = a * d;
+                const uint64_t bd = b * d;
+                uint64_t middle = (bd >> 32) + (ad & mask) + (bc & mask);
+                middle += uint64_t(1) << 31;
+                return diy_fp(ac + (ad >> 32) + (bc >> 32) + (middle >> 32), e + rhs.e + 64);
+            }
+
+            diy_fp normalize() const {
+                diy_fp result = *this;
+                while (!(result.f & (uint64_t(1) << 63))) {
+                    result.f <<= 1;
+                    result.e--;
+                }
+                return result;
+            }
+
+            // The boundaries m- and m+ halfway to the neighboring doubles,
+            // normalized to a common exponent.
+            void get_boundaries(diy_fp* minus, diy_fp* plus) const {
+                diy_fp p((f << 1) + 1, e - 1);
+                while (!(p.f & (HIDDEN_BIT << 1))) {
+                    p.f <<= 1;
+                    p.e--;
+                }
+                p.f <<= 64 - 52 - 2;
+                p.e -= 64 - 52 - 2;
+
+                // The gap below a power of two is half the gap above.
+                diy_fp m = (f == HIDDEN_BIT)
+                    ? diy_fp((f << 2) - 1, e - 2)
+                    : diy_fp((f << 1) - 1, e - 1);
+                m.f <<= m.e - p.e;
+                m.e = p.e;
+
+                *minus = m;
+                *plus = p;
+            }
+
+            static const uint64_t HIDDEN_BIT = uint64_t(1) << 52;
+            static const int EXPONENT_BIAS = 0x3ff + 52;
+
+            uint64_t f;
+            int e;
+        };
+
+        // Returns a power of ten c = 10^-k such that c * 2^e has a binary
+        // exponent in [-60, -32], storing k.
+        inline diy_fp get_cached_power(int e, int* k) {
+            // Generated by tools/gencachedpowers.js
+            static const uint64_t significands[] = {
+                0xfa8fd5a0081c0288, 0xbaaee17fa23ebf76, 0x8b16fb203055ac76,
+                0xcf42894a5dce35ea, 0x9a6bb0aa55653b2d, 0xe61acf033d1a45df,
+                0xab70fe17c79ac6ca, 0xff77b1fcbebcdc4f, 0xbe5691ef416bd60c,
+                0x8dd01fad907ffc3c, 0xd3515c2831559a83, 0x9d71ac8fada6c9b5,
+                0xea9c227723ee8bcb, 0xaecc49914078536d, 0x823c12795db6ce57,
+                0xc21094364dfb5637, 0x9096ea6f3848984f, 0xd77485cb25823ac7,
+                0xa086cfcd97bf97f4, 0xef340a98172aace5, 0xb23867fb2a35b28e,
+                0x84c8d4dfd2c63f3b, 0xc5dd44271ad3cdba, 0x936b9fcebb25c996,
+                0xdbac6c247d62a584, 0xa3ab66580d5fdaf6, 0xf3e2f893dec3f126,
+                0xb5b5ada8aaff80b8, 0x87625f056c7c4a8b, 0xc9bcff6034c13053,
+                0x964e858c91ba2655, 0xdff9772470297ebd, 0xa6dfbd9fb8e5b88f,
+                0xf8a95fcf88747d94, 0xb94470938fa89bcf, 0x8a08f0f8bf0f156b,
+                0xcdb02555653131b6, 0x993fe2c6d07b7fac, 0xe45c10c42a2b3b06,
+                0xaa242499697392d3, 0xfd87b5f28300ca0e, 0xbce5086492111aeb,
+                0x8cbccc096f5088cc, 0xd1b71758e219652c, 0x9c40000000000000,
+                0xe8d4a51000000000, 0xad78ebc5ac620000, 0x813f3978f8940984,
+                0xc097ce7bc90715b3, 0x8f7e32ce7bea5c70, 0xd5d238a4abe98068,
+                0x9f4f2726179a2245, 0xed63a231d4c4fb27, 0xb0de65388cc8ada8,
+                0x83c7088e1aab65db, 0xc45d1df942711d9a, 0x924d692ca61be758,
+                0xda01ee641a708dea, 0xa26da3999aef774a, 0xf209787bb47d6b85,
+                0xb454e4a179dd1877, 0x865b86925b9bc5c2, 0xc83553c5c8965d3d,
+                0x952ab45cfa97a0b3, 0xde469fbd99a05fe3, 0xa59bc234db398c25,
+                0xf6c69a72a3989f5c, 0xb7dcbf5354e9bece, 0x88fcf317f22241e2,
+                0xcc20ce9bd35c78a5, 0x98165af37b2153df, 0xe2a0b5dc971f303a,
+                0xa8d9d1535ce3b396, 0xfb9b7cd9a4a7443c, 0xbb764c4ca7a44410,
+                0x8bab8eefb6409c1a, 0xd01fef10a657842c, 0x9b10a4e5e9913129,
+                0xe7109bfba19c0c9d, 0xac2820d9623bf429, 0x80444b5e7aa7cf85,
+                0xbf21e44003acdd2d, 0x8e679c2f5e44ff8f, 0xd433179d9c8cb841,
+                0x9e19db92b4e31ba9, 0xeb96bf6ebadf77d9, 0xaf87023b9bf0ee6b
+            };
+            static const int16_t exponents[] = {
+                -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+                -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+                -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+                -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+                -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+                109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+                375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+                641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+                907, 933, 960, 986, 1013, 1039, 1066
+            };
+
+            // ceil((-61 - e) * log10(2)), offset to stay positive
+            const double dk = (-61 - e) * 0.30102999566398114 + 347;
+            int rounded = static_cast<int>(dk);
+            if (dk - rounded > 0.0) {
+                ++rounded;
+            }
+            const unsigned index = static_cast<unsigned>((rounded >> 3) + 1);
+            *k = -(-348 + static_cast<int>(index << 3));
+            return diy_fp(significands[index], exponents[index]);
+        }
+
+        inline const uint64_t* get_powers_of_ten() {
+            static const uint64_t powers[] = {
+                1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+                10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+                100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+                100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+                100000000000000000ULL, 1000000000000000000ULL,
+                10000000000000000000ULL,
+            };
+            return powers;
+        }
+
+        // Nudges the last digit toward w while staying inside the interval.
+        inline void grisu_round(char* buffer, int length, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w) {
+            while (rest < wp_w
+                && delta - rest >= ten_kappa
+                && (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)
+            ) {
+                buffer[length - 1]--;
+                rest += ten_kappa;
+            }
+        }
+
+        inline int count_decimal_digits(uint32_t n) {
+            if (n < 10) return 1;
+            if (n < 100) return 2;
+            if (n < 1000) return 3;
+            if (n < 10000) return 4;
+            if (n < 100000) return 5;
+            if (n < 1000000) return 6;
+            if (n < 10000000) return 7;
+            if (n < 100000000) return 8;
+            // The integral part never reaches ten digits here.
+            return 9;
+        }
+
+        inline void generate_digits(const diy_fp& w, const diy_fp& mp, uint64_t delta, char* buffer, int* length, int* k) {
+            const uint64_t* const powers = get_powers_of_ten();
+            const diy_fp one(uint64_t(1) << -mp.e, mp.e);
+            const diy_fp wp_w = mp - w;
+            uint32_t p1 = static_cast<uint32_t>(mp.f >> -one.e);
+            uint64_t p2 = mp.f & (one.f - 1);
+            int kappa = count_decimal_digits(p1);
+            *length = 0;
+
+            while (kappa > 0) {
+                const uint32_t divisor = static_cast<uint32_t>(powers[kappa - 1]);
+                const uint32_t digit = p1 / divisor;
+                p1 %= divisor;
+                if (digit || *length) {
+                    buffer[(*length)++] = static_cast<char>('0' + digit);
+                }
+                --kappa;
+                const uint64_t rest = (static_cast<uint64_t>(p1) << -one.e) + p2;
+                if (rest <= delta) {
+                    *k += kappa;
+                    grisu_round(buffer, *length, delta, rest, powers[kappa] << -one.e, wp_w.f);
+                    return;
+                }
+            }
+
+            for (;;) {
+                p2 *= 10;
+                delta *= 10;
+                const char digit = static_cast<char>(p2 >> -one.e);
+                if (digit || *length) {
+                    buffer[(*length)++] = static_cast<char>('0' + digit);
+                }
+                p2 &= one.f - 1;
+                --kappa;
+                if (p2 < delta) {
+                    *k += kappa;
+                    const int index = -kappa;
+                    grisu_round(buffer, *length, delta, p2, one.f, wp_w.f * (index < 20 ? powers[index] : 0));
+                    return;
+                }
+            }
+        }
+
+        // Writes the digits of a positive, finite value such that it
+        // equals buffer[0, length) * 10^k.
+        inline void grisu2(double value, char* buffer, int* length, int* k) {
+            const diy_fp v(value);
+            diy_fp minus;
+            diy_fp plus;
+            v.get_boundaries(&minus, &plus);
+
+            const diy_fp c = get_cached_power(plus.e, k);
+            const diy_fp w = v.normalize() * c;
+            diy_fp wp = plus * c;
+            diy_fp wm = minus * c;
+            // Stay strictly inside the interval to absorb the rounding
+            // error of the multiplications.
+            wm.f++;
+            wp.f--;
+            generate_digits(w, wp, wp.f - wm.f, buffer, length, k);
+        }
+
+        inline char* write_exponent(int k, char* out) {
+            if (k < 0) {
+                *out++ = '-';
+                k = -k;
+            }
+            if (k >= 100) {
+                *out++ = static_cast<char>('0' + k / 100);
+                k %= 100;
+                memcpy(out, get_digit_pairs() + k * 2, 2);
+                out += 2;
+            } else if (k >= 10) {
+                memcpy(out, get_digit_pairs() + k * 2, 2);
+                out += 2;
+            } else {
+                *out++ = static_cast<char>('0' + k);
+            }
+            return out;
+        }
+
+        // Lays out digits * 10^k as a JSON number that still reads back as
+        // a double: integral values keep a ".0".
+        inline char* layout_decimal(char* buffer, int length, int k) {
+            // 10^(kk - 1) <= value < 10^kk
+            const int kk = length + k;
+            if (k >= 0 && kk <= 21) {
+                // 1234e7 -> 12340000000.0
+                for (int i = length; i < kk; ++i) {
+                    buffer[i] = '0';
+                }
+                buffer[kk] = '.';
+                buffer[kk + 1] = '0';
+                return buffer + kk + 2;
+            } else if (kk > 0 && kk <= 21) {
+                // 1234e-2 -> 12.34
+                memmove(buffer + kk + 1, buffer + kk, length - kk);
+                buffer[kk] = '.';
+                return buffer + length + 1;
+            } else if (kk > -6 && kk <= 0) {
+                // 1234e-6 -> 0.001234
+                const int offset = 2 - kk;
+                memmove(buffer + offset, buffer, length);
+                buffer[0] = '0';
+                buffer[1] = '.';
+                for (int i = 2; i < offset; ++i) {
+                    buffer[i] = '0';
+                }
+                return buffer + length + offset;
+            } else if (length == 1) {
+                // 1e30
+                buffer[1] = 'e';
+                return write_exponent(kk - 1, buffer + 2);
+            } else {
+                // 1234e30 -> 1.234e33
+                memmove(buffer + 2, buffer + 1, length - 1);
+                buffer[1] = '.';
+                buffer[length + 1] = 'e';
+                return write_exponent(kk - 1, buffer + length + 2);
+            }
+        }
+
+        // Writes the shortest digits that read back as value, in at most
+        // 25 characters.  value must be finite.
+        inline char* format_double(double value, char* out) {
+            if (value == 0.0) {
+                if (std::signbit(value)) {
+                    *out++ = '-';
+                }
+                memcpy(out, "0.0", 3);
+                return out + 3;
+            }
+            if (value < 0) {
+                *out++ = '-';
+                value = -value;
+            }
+            int length;
+            int k;
+            grisu2(value, out, &length, &k);
+            return layout_decimal(out, length, k);
+        }
+
+        // For each byte, 0 if it can appear in a JSON string as-is,
+        // otherwise the character that follows the backslash in its
+        // escape.  'u' means \u00XX.
+        inline const char* get_escapes() {
+            static const char escapes[256] = {
+                'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+                'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+                0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\', 0, 0, 0,
+                // remaining bytes are zero
+            };
+            return escapes;
+        }
+
+        // Returns the length of the prefix of s that needs no escaping.
+        inline size_t count_unescaped(const char* s, size_t length) {
+            size_t i = 0;
+#ifdef SAJSON_HAS_SSE2
+            const __m128i quote = _mm_set1_epi8('"');
+            const __m128i backslash = _mm_set1_epi8('\\');
+            const __m128i control_max = _mm_set1_epi8(0x1f);
+            for (; i + 16 <= length; i += 16) {
+                const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+                const __m128i is_control = _mm_cmpeq_epi8(_mm_max_epu8(chunk, control_max), control_max);
+                const __m128i special = _mm_or_si128(
+                    is_control,
+                    _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)));
+                const int mask = _mm_movemask_epi8(special);
+                if (mask) {
+                    return i + __builtin_ctz(mask);
+                }
+            }
+#else
+            // Eight bytes at a time: a zero byte in (x ^ c) marks c, and
+            // the subtraction borrows out of any byte below 0x20.  False
+            // positives only send us to the byte loop early.
+            const uint64_t ones = 0x0101010101010101ULL;
+            const uint64_t high_bits = 0x8080808080808080ULL;
+            for (; i + 8 <= length; i += 8) {
+                uint64_t word;
+                memcpy(&word, s + i, sizeof(word));
+                const uint64_t quotes = word ^ (ones * '"');
+                const uint64_t backslashes = word ^ (ones * '\\');
+                const uint64_t special =
+                    ((word - ones * 0x20) & ~word)
+                    | ((quotes - ones) & ~quotes)
+                    | ((backslashes - ones) & ~backslashes);
+                if (special & high_bits) {
+                    break;
+                }
+            }
+#endif
+            const char* const escapes = get_escapes();
+            for (; i < length; ++i) {
+                if (escapes[static_cast<unsigned char>(s[i])]) {
+                    break;
+                }
+            }
+            return i;
+        }
+    }
+
+    namespace internal {
+        // The formatting shared by writer and stream_writer.  Derived
+        // supplies the output space through two members:
+        //
+        //     char* reserve(size_t n);  // room for n bytes, or null on failure
+        //     void commit(char* end);   // the bytes up to end were written
+        //
+        // n never exceeds MAX_RESERVE.
+        template<typename Derived>
+        class writer_base {
+        public:
+            // False once output has failed, after which nothing more is
+            // written.
+            bool is_valid() const {
+                return !failed;
+            }
+
+            void start_array() {
+                begin_value();
+                put('[');
+                first = true;
+            }
+
+            void end_array() {
+                put(']');
+                first = false;
+            }
+
+            void start_object() {
+                begin_value();
+                put('{');
+                first = true;
+            }
+
+            void end_object() {
+                put('}');
+                first = false;
+            }
+
+            void key(const string& key) {
+                begin_value();
+                write_string(key.data(), key.length(), ':');
+                after_key = true;
+            }
+
+            // Like key(), but key is written as-is: it must already be
+            // quoted, escaped, and followed by its colon, such as
+            // "\"id\":".
+            void quoted_key(const char* key, size_t length) {
+                assert(length <= size_t(MAX_RESERVE));
+                begin_value();
+                write_literal(key, length);
+                after_key = true;
+            }
+
+            void null_value() {
+                begin_value();
+                write_literal("null", 4);
+            }
+
+            void bool_value(bool value) {
+                begin_value();
+                if (value) {
+                    write_literal("true", 4);
+                } else {
+                    write_literal("false", 5);
+                }
+            }
+
+            void integer_value(int value) {
+                begin_value();
+                char* out = derived().reserve(11);
+                if (out) {
+                    derived().commit(format_integer(value, out));
+                }
+            }
+
+            void double_value(double value) {
+                begin_value();
+                if (SAJSON_UNLIKELY(!std::isfinite(value))) {
+                    write_literal("null", 4);
+                    return;
+                }
+                char* out = derived().reserve(25);
+                if (out) {
+                    derived().commit(format_double(value, out));
+                }
+            }
+
+            void string_value(const string& value) {
+                begin_value();
+                write_string(value.data(), value.length(), 0);
+            }
+
+            // Writes v and everything under it.  Object members come out in
+            // the AST's order, which is sorted, not the order of the
+            // original text.
+            void write(const value& v) {
+                replay_value(v, *this);
+            }
+
+        protected:
+            // Strings are escaped this many input bytes at a time, so no
+            // reservation exceeds MAX_RESERVE.
+            enum { STRING_SEGMENT = 256 };
+            enum { MAX_RESERVE = 6 * STRING_SEGMENT + 3 };
+
+            writer_base()
+                : first(true)
+                , after_key(false)
+                , failed(false)
+            {}
+
+            void reset() {
+                first = true;
+                after_key = false;
+                failed = false;
+            }
+
+            bool first;     // nothing written yet at this nesting level
+            bool after_key; // the next value belongs to a key
+            bool failed;
+
+        private:
+            Derived& derived() {
+                return static_cast<Derived&>(*this);
+            }
+
+            void begin_value() {
+                if (!first && !after_key) {
+                    put(',');
+                }
+                first = false;
+                after_key = false;
+            }
+
+            void put(char c) {
+                char* out = derived().reserve(1);
+                if (out) {
+                    *out = c;
+                    derived().commit(out + 1);
+                }
+            }
+
+            void write_literal(const char* s, size_t length) {
+                char* out = derived().reserve(length);
+                if (out) {
+                    memcpy(out, s, length);
+                    derived().commit(out + length);
+                }
+            }
+
+            // Writes s quoted and escaped, followed by suffix if nonzero.
+            void write_string(const char* s, size_t length, char suffix) {
+                static const char hex[] = "0123456789abcdef";
+                const char* const escapes = get_escapes();
+                bool opening = true;
+                do {
+                    size_t segment = length < STRING_SEGMENT ? length : size_t(STRING_SEGMENT);
+                    char* out = derived().reserve(6 * segment + 3);
+                    if (!out) {
+                        return;
+                    }
+                    if (opening) {
+                        *out++ = '"';
+                        opening = false;
+                    }
+                    length -= segment;
+                    for (;;) {
+                        const size_t plain = count_unescaped(s, segment);
+                        memcpy(out, s, plain);
+                        out += plain;
+                        s += plain;
+                        segment -= plain;
+                        if (!segment) {
+                            break;
+                        }
+                        const unsigned char c = static_cast<unsigned char>(*s++);
+                        --segment;
+                        const char escape = escapes[c];
+                        *out++ = '\\';
+                        *out++ = escape;
+                        if (escape == 'u') {
+                            *out++ = '0';
+                            *out++ = '0';
+                            *out++ = hex[c >> 4];
+                            *out++ = hex[c & 15];
+                        }
+                    }
+                    if (!length) {
+                        *out++ = '"';
+                        if (suffix) {
+                            *out++ = suffix;
+                        }
+                    }
+                    derived().commit(out);
+                } while (length);
+            }
+        };
+    }
+
+    // Serializes JSON into a growable buffer.  A writer accepts the same
+    // calls as a parse_events() handler, so it can be driven by hand, fed
+    // straight from parse_events(), or given a whole value with write().
+    // Commas and colons are inserted automatically; nothing checks that
+    // the calls nest properly.
+    //
+    // Integers and strings are formatted without going through printf.
+    // Doubles are written with the shortest digits that read back as the
+    // same value, and always with a '.' or exponent so they parse as
+    // doubles again.  JSON cannot represent NaN or infinity; they are
+    // written as null.
+    //
+    // is_valid() turns false if memory could not be allocated, in which
+    // case the output stops at the failed write.
+    class writer : public internal::writer_base<writer> {
+    public:
+        explicit writer(allocator* alloc = nullptr)
+            : alloc(alloc ? alloc : &internal::get_default_allocator())
+            , buffer(0)
+            , size(0)
+            , capacity(0)
+        {}
+
+        writer(writer&& rhs)
+            : internal::writer_base<writer>(rhs)
+            , alloc(rhs.alloc)
+            , buffer(rhs.buffer)
+            , size(rhs.size)
+            , capacity(rhs.capacity)
+        {
+            rhs.buffer = 0;
+            rhs.size = 0;
+            rhs.capacity = 0;
+        }
+
+        writer(const writer&) = delete;
+        void operator=(const writer&) = delete;
+
+        ~writer() {
+            if (buffer) {
+                alloc->deallocate(buffer);
+            }
+        }
+
+        // The output so far.  Valid until the next write.
+        string get_output() const {
+            return string(buffer ? buffer : "", size);
+        }
+
+        // Discards the output but keeps the buffer for reuse.
+        void clear() {
+            size = 0;
+            reset();
+        }
+
+    private:
+        friend class internal::writer_base<writer>;
+
+        char* reserve(size_t n) {
+            if (SAJSON_LIKELY(capacity - size >= n)) {
+                return buffer + size;
+            }
+            if (failed) {
+                return 0;
+            }
+            size_t new_capacity = capacity ? capacity * 2 : 256;
+            while (new_capacity - size < n) {
+                new_capacity *= 2;
+            }
+            char* new_buffer = static_cast<char*>(alloc->allocate(new_capacity));
+            if (!new_buffer) {
+                failed = true;
+                // Make every later reserve() fail too.
+                capacity = size;
+                return 0;
+            }
+            if (buffer) {
+                memcpy(new_buffer, buffer, size);
+                alloc->deallocate(buffer);
+            }
+            buffer = new_buffer;
+            capacity = new_capacity;
+            return buffer + size;
+        }
+
+        void commit(char* end) {
+            size = end - buffer;
+        }
+
+        allocator* alloc;
+        char* buffer;
+        size_t size;
+        size_t capacity;
+    };
+
+    // A contiguous piece of output handed to an output_sink.
+    struct output_chunk {
+        const char* data;
+        size_t length;
+    };
+
+    // Where a stream_writer sends its output.
+    class output_sink {
+    public:
+        virtual ~output_sink() {}
+
+        // Consumes count chunks, in order.  Returning only once they have
+        // been fully consumed is what applies backpressure: the writer
+        // produces nothing more until this returns.  Returns false on
+        // failure, which stops the writer.
+        virtual bool write(const output_chunk* chunks, size_t count) = 0;
+    };
+
+#ifdef SAJSON_HAS_WRITEV
+    // Writes to a file descriptor with one writev() per flush.  Partial
+    // writes are resumed, and if the descriptor is non-blocking, poll()
+    // waits for it to drain.
+    class fd_sink : public output_sink {
+    public:
+        explicit fd_sink(int fd)
+            : fd(fd)
+            , error_number(0)
+        {}
+
+        bool write(const output_chunk* chunks, size_t count) override {
+            enum { MAX_CHUNKS = 16 };
+            while (count) {
+                struct iovec iov[MAX_CHUNKS];
+                const size_t batch = count < MAX_CHUNKS ? count : size_t(MAX_CHUNKS);
+                for (size_t i = 0; i < batch; ++i) {
+                    iov[i].iov_base = const_cast<char*>(chunks[i].data);
+                    iov[i].iov_len = chunks[i].length;
+                }
+                if (!write_all(iov, batch)) {
+                    return false;
+                }
+                chunks += batch;
+                count -= batch;
+            }
+            return true;
+        }
+
+        // The errno of the failed write, if any.
+        int get_error_number() const {
+            return error_number;
+        }
+
+    private:
+        bool write_all(struct iovec* iov, size_t count) {
+            while (count) {
+                const ssize_t written = writev(fd, iov, static_cast<int>(count));
+                if (written < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                        struct pollfd p;
+                        p.fd = fd;
+                        p.events = POLLOUT;
+                        p.revents = 0;
+                        if (poll(&p, 1, -1) >= 0 || errno == EINTR) {
+                            continue;
+                        }
+                    }
+                    error_number = errno;
+                    return false;
+                }
+                size_t remaining = static_cast<size_t>(written);
+                while (count && remaining >= iov->iov_len) {
+                    remaining -= iov->iov_len;
+                    ++iov;
+                    --count;
+                }
+                if (count) {
+                    iov->iov_base = static_cast<char*>(iov->iov_base) + remaining;
+                    iov->iov_len -= remaining;
+                }
+            }
+            return true;
+        }
+
+        int fd;
+        int error_number;
+    };
+#endif
+
+    // Serializes JSON like writer, but into a fixed set of buffers that
+    // are handed to an output_sink as they fill, so output of any size
+    // streams through constant memory.  All full buffers go to the sink
+    // in one call, which lets fd_sink batch them into a single writev().
+    //
+    // Call flush() after the last value; the destructor discards whatever
+    // has not been flushed.  is_valid() turns false if the sink fails or
+    // the buffers could not be allocated.
+    class stream_writer : public internal::writer_base<stream_writer> {
+    public:
+        enum { MAX_BUFFERS = 16 };
+
+        // buffer_size is raised to the minimum the writer needs and
+        // buffer_count is clamped to [1, MAX_BUFFERS].
+        explicit stream_writer(
+            output_sink& sink,
+            size_t buffer_size = 64 * 1024,
+            size_t buffer_count = 4,
+            allocator* alloc = nullptr
+        )
+            : sink(sink)
+            , alloc(alloc ? alloc : &internal::get_default_allocator())
+            , buffer_size(buffer_size < size_t(MAX_RESERVE) ? size_t(MAX_RESERVE) : buffer_size)
+            , buffer_count(buffer_count < 1 ? 1 : buffer_count > MAX_BUFFERS ? size_t(MAX_BUFFERS) : buffer_count)
+            , storage(static_cast<char*>(this->alloc->allocate(this->buffer_size * this->buffer_count)))
+            , current(0)
+            , cursor(storage)
+            , bytes_flushed(0)
+        {
+            if (!storage) {
+                failed = true;
+            }
+        }
+
+        stream_writer(const stream_writer&) = delete;
+        void operator=(const stream_writer&) = delete;
+
+        ~stream_writer() {
+            if (storage) {
+                alloc->deallocate(storage);
+            }
+        }
+
+        // Sends everything buffered to the sink.  Returns is_valid().
+        bool flush() {
+            if (failed) {
+                return false;
+            }
+            chunks[current].data = get_buffer(current);
+            chunks[current].length = cursor - get_buffer(current);
+            const size_t count = current + (chunks[current].length ? 1 : 0);
+            if (count) {
+                if (!sink.write(chunks, count)) {
+                    failed = true;
+                    return false;
+                }
+                for (size_t i = 0; i < count; ++i) {
+                    bytes_flushed += chunks[i].length;
+                }
+            }
+            current = 0;
+            cursor = storage;
+            return true;
+        }
+
+        // Bytes accepted by the sink so far.
+        size_t get_bytes_flushed() const {
+            return bytes_flushed;
+        }
+
+    private:
+        friend class internal::writer_base<stream_writer>;
+
+        char* get_buffer(size_t index) const {
+            return storage + index * buffer_size;
+        }
+
+        char* reserve(size_t n) {
+            if (SAJSON_LIKELY(static_cast<size_t>(get_buffer(current) + buffer_size - cursor) >= n)) {
+                return cursor;
+            }
+            if (failed) {
+                return 0;
+            }
+            // Seal the current buffer and move to the next, flushing them
+            // all once none are left.
+            if (current + 1 < buffer_count) {
+                chunks[current].data = get_buffer(current);
+                chunks[current].length = cursor - get_buffer(current);
+                ++current;
+                cursor = get_buffer(current);
+                return cursor;
+            }
+            return flush() ? cursor : 0;
+        }
+
+        void commit(char* end) {
+            cursor = end;
+        }
+
+        output_sink& sink;
+        allocator* const alloc;
+        const size_t buffer_size;
+        const size_t buffer_count;
+        char* const storage;
+        size_t current;   // index of the buffer being filled
+        char* cursor;     // end of the output in that buffer
+        size_t bytes_flushed;
+        output_chunk chunks[MAX_BUFFERS];
+    };
+}
@@ -1,8 +1,22 @@
 // included first to verify sajson includes.
 #include <sajson.h>
+#include <sajson_bind.h>
+#include <sajson_builder.h>
 #include <sajson_ostream.h>
+#include <sajson_overlay.h>
+#include <sajson_patch.h>
+#include <sajson_schema.h>
+#include <sajson_shared.h>
+#include <sajson_snapshot.h>
+#include <sajson_writer.h>
 
 #include <functional>
+#include <random>
+#include <vector>
+
+#ifdef SAJSON_HAS_MMAP
+#include <sys/wait.h>
+#endif
 
 #include <UnitTest++.h>
 
@@ -46,6 +60,27 @@ public:
     int deallocs = 0;
 };
 
+// Fails every allocation after the first `remaining`.
+class failing_allocator : public count_allocator {
+public:
+    void* allocate(size_t size) override {
+        return allocs < remaining ? count_allocator::allocate(size) : 0;
+    }
+    int remaining = 0;
+};
+
+#ifdef SAJSON_HAS_MMAP
+#define MMAP_ALLOCATION_TEST(name) \
+    TEST(mmap_allocation_##name) { \
+        sajson::mmap_allocator alloc; \
+        name##internal([&alloc](const sajson::literal& literal) { \
+            return sajson::parse(literal, &alloc); \
+        }); \
+    }
+#else
+#define MMAP_ALLOCATION_TEST(name)
+#endif
+
 #define ABSTRACT_TEST(name) \
     static void name##internal(std::function<sajson::document(const sajson::literal&)> parse); \
     TEST(default_allocation_##name) { \
@@ -60,6 +95,7 @@ public:
         }); \
         CHECK_EQUAL(alloc.allocs, alloc.deallocs); \
     } \
+    MMAP_ALLOCATION_TEST(name) \
     static void name##internal(std::function<sajson::document(const sajson::literal&)> parse)
 
 ABSTRACT_TEST(empty_array) {
@@ -998,6 +1034,2359 @@ ABSTRACT_TEST(object_array_with_integers) {
 }
 
 
+SUITE(allocation) {
+    class release_recording_allocator : public count_allocator {
+    public:
+        void release_unused(void* begin, size_t size) override {
+            released_begin = static_cast<char*>(begin);
+            released_size = size;
+        }
+        char* released_begin = 0;
+        size_t released_size = 0;
+    };
+
+    TEST(parse_stack_is_released_after_parse) {
+        release_recording_allocator alloc;
+        {
+            const sajson::document& document = sajson::parse(literal("[{\"a\": [1, 2]}, \"b\"]"), &alloc);
+            assert(success(document));
+            // Everything below the root is scratch space.
+            const char* root = reinterpret_cast<const char*>(document._internal_get_root());
+            CHECK(alloc.released_begin != 0);
+            CHECK(alloc.released_begin + alloc.released_size == root);
+            CHECK_EQUAL(2u, document.get_root().get_length());
+        }
+        CHECK_EQUAL(alloc.allocs, alloc.deallocs);
+    }
+
+    TEST(failed_parse_releases_whole_structure) {
+        release_recording_allocator alloc;
+        const sajson::document& document = sajson::parse(literal("[1, 2"), &alloc);
+        CHECK_EQUAL(false, document.is_valid());
+        CHECK_EQUAL(5 * sizeof(size_t), alloc.released_size);
+    }
+
+    ABSTRACT_TEST(compact_preserves_ast) {
+        sajson::document document = parse(literal("{\"b\": [1, 2.5, \"x\"], \"a\": {\"c\": null}}"));
+        assert(success(document));
+        const size_t before = document.get_structure_size();
+        CHECK(document.compact());
+        CHECK(document.get_structure_size() < before);
+
+        const value& root = document.get_root();
+        CHECK_EQUAL(TYPE_OBJECT, root.get_type());
+        CHECK_EQUAL(2u, root.get_length());
+        const value& b = root.get_value_of_key(literal("b"));
+        CHECK_EQUAL(TYPE_ARRAY, b.get_type());
+        CHECK_EQUAL(1, b.get_array_element(0).get_integer_value());
+        CHECK_EQUAL(2.5, b.get_array_element(1).get_double_value());
+        CHECK_EQUAL("x", b.get_array_element(2).as_string());
+        const value& a = root.get_value_of_key(literal("a"));
+        CHECK_EQUAL(TYPE_NULL, a.get_value_of_key(literal("c")).get_type());
+    }
+
+    ABSTRACT_TEST(compact_invalid_document) {
+        sajson::document document = parse(literal("[1,"));
+        CHECK_EQUAL(false, document.is_valid());
+        CHECK(document.compact());
+        CHECK_EQUAL(0u, document.get_structure_size());
+    }
+
+    TEST(compact_exact_size) {
+        count_allocator alloc;
+        {
+            sajson::document document = sajson::parse(literal("[1, [2]]"), &alloc);
+            assert(success(document));
+            CHECK(document.compact());
+            CHECK_EQUAL(3, alloc.allocs);
+            CHECK_EQUAL(1, alloc.deallocs);
+            // [1, [2]]: 1+2 words for the root array, 1+1 for the inner
+            // array, and 1 for each integer.
+            CHECK_EQUAL(7 * sizeof(size_t), document.get_structure_size());
+        }
+        CHECK_EQUAL(alloc.allocs, alloc.deallocs);
+    }
+
+    TEST(allocation_failure_is_reported) {
+        for (int i = 0; i < 2; ++i) {
+            failing_allocator alloc;
+            alloc.remaining = i;
+            {
+                const sajson::document& document = sajson::parse(literal("[]"), &alloc);
+                CHECK_EQUAL(false, document.is_valid());
+                CHECK_EQUAL(sajson::ERROR_OUT_OF_MEMORY, document._internal_get_error_code());
+            }
+            CHECK_EQUAL(alloc.allocs, alloc.deallocs);
+        }
+    }
+}
+
+SUITE(events) {
+    // Records events in a compact textual form.
+    struct recording_handler {
+        void start_array() { log += "["; }
+        void end_array() { log += "]"; }
+        void start_object() { log += "{"; }
+        void end_object() { log += "}"; }
+        void key(const sajson::string& key) { log += "k:" + key.as_string() + " "; }
+        void null_value() { log += "n "; }
+        void bool_value(bool value) { log += value ? "t " : "f "; }
+        void integer_value(int value) { log += "i:" + std::to_string(value) + " "; }
+        void double_value(double value) { log += "d:" + std::to_string(value) + " "; }
+        void string_value(const sajson::string& value) { log += "s:" + value.as_string() + " "; }
+
+        std::string log;
+    };
+
+    TEST(events_in_document_order) {
+        recording_handler handler;
+        auto result = sajson::parse_events(
+            literal(" [ {\"b\": null, \"a\": [true, false]}, -12, 2.5, \"x\\ny\" ] "),
+            handler);
+        CHECK(result.is_valid());
+        // Object members are reported in input order, not sorted.
+        CHECK_EQUAL("[{k:b n k:a [t f ]}i:-12 d:2.500000 s:x\ny ]", handler.log);
+    }
+
+    TEST(empty_structures) {
+        recording_handler handler;
+        CHECK(sajson::parse_events(literal("[[], {}, [{}]]"), handler).is_valid());
+        CHECK_EQUAL("[[]{}[{}]]", handler.log);
+    }
+
+    TEST(deep_nesting_spills_stack) {
+        const size_t depth = 1000;
+        std::string text(depth, '[');
+        text += std::string(depth, ']');
+        count_allocator alloc;
+        recording_handler handler;
+        CHECK(sajson::parse_events(string(text.data(), text.size()), handler, &alloc).is_valid());
+        CHECK_EQUAL(text, handler.log);
+        CHECK(alloc.allocs > 1);
+        CHECK_EQUAL(alloc.allocs, alloc.deallocs);
+    }
+
+    TEST(errors_match_parse) {
+        const char* inputs[] = {
+            "",
+            "1",
+            "[1 2]",
+            "{\"a\" 1}",
+            "{\"a\": 1,}",
+            "[1,]",
+            "[nul]",
+            "[\"\\x\"]",
+            "[\"\x01\"]",
+            "[1e]",
+            "[[]]]",
+            "{\"a\": [}",
+            "\n\n  [\n  tru]",
+        };
+        for (size_t i = 0; i < sizeof(inputs) / sizeof(*inputs); ++i) {
+            const sajson::document& document = sajson::parse(literal(inputs[i]));
+            recording_handler handler;
+            auto result = sajson::parse_events(literal(inputs[i]), handler);
+            CHECK_EQUAL(false, document.is_valid());
+            CHECK_EQUAL(false, result.is_valid());
+            CHECK_EQUAL(document._internal_get_error_code(), result._internal_get_error_code());
+            CHECK_EQUAL(document.get_error_line(), result.get_error_line());
+            CHECK_EQUAL(document.get_error_column(), result.get_error_column());
+            CHECK_EQUAL(document.get_error_message_as_string(), result.get_error_message_as_string());
+        }
+    }
+}
+
+SUITE(validate) {
+    TEST(valid_documents) {
+        const char* inputs[] = {
+            "[]",
+            " { } ",
+            "[0, -1, 2.5e3, true, false, null, \"s\\u00e9\\n\", {\"a\": [[]]}]",
+            "{\"\\ud83d\\ude00\": \"\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\"}",
+        };
+        for (size_t i = 0; i < sizeof(inputs) / sizeof(*inputs); ++i) {
+            CHECK(sajson::validate(inputs[i], strlen(inputs[i])).is_valid());
+        }
+    }
+
+    TEST(input_is_not_modified) {
+        const std::string text = "{\"a\\tb\": [\"c\\u0041\", 1]}";
+        std::string copy = text;
+        CHECK(sajson::validate(copy.data(), copy.size()).is_valid());
+        CHECK_EQUAL(text, copy);
+    }
+
+    TEST(errors_match_parse) {
+        const char* inputs[] = {
+            "",
+            "  ",
+            "1",
+            "[1 2]",
+            "[01]",
+            "{\"a\" 1}",
+            "{1: 2}",
+            "{\"a\": 1,}",
+            "[1,]",
+            "[,1]",
+            "[nul]",
+            "[fals]",
+            "[\"\\x\"]",
+            "[\"\\u12x4\"]",
+            "[\"\\ud800\"]",
+            "[\"\\ud800\\u0041\"]",
+            "[\"\x01\"]",
+            "[\"\xc3\"]",
+            "[\"\xc3\x41\"]",
+            "[\"\xff\"]",
+            "[\"abc",
+            "[1e]",
+            "[-]",
+            "[[]]]",
+            "[] x",
+            "{\"a\": [}",
+            "\n\r\n  [\n  tru]",
+        };
+        for (size_t i = 0; i < sizeof(inputs) / sizeof(*inputs); ++i) {
+            const sajson::document& document = sajson::parse(literal(inputs[i]));
+            auto result = sajson::validate(literal(inputs[i]));
+            CHECK_EQUAL(document.is_valid(), result.is_valid());
+            CHECK_EQUAL(document._internal_get_error_code(), result._internal_get_error_code());
+            CHECK_EQUAL(document._internal_get_error_argument(), result._internal_get_error_argument());
+            CHECK_EQUAL(document.get_error_line(), result.get_error_line());
+            CHECK_EQUAL(document.get_error_column(), result.get_error_column());
+        }
+    }
+
+    TEST(shallow_documents_do_not_allocate) {
+        count_allocator alloc;
+        CHECK(sajson::validate(literal("[[[[{\"a\": [[[]]]}]]]]"), &alloc).is_valid());
+        CHECK_EQUAL(0, alloc.allocs);
+    }
+
+    TEST(deep_nesting) {
+        const size_t depth = 100000;
+        std::string text(depth, '[');
+        text += std::string(depth, ']');
+        count_allocator alloc;
+        CHECK(sajson::validate(text.data(), text.size(), &alloc).is_valid());
+        CHECK_EQUAL(alloc.allocs, alloc.deallocs);
+
+        text.pop_back();
+        auto result = sajson::validate(text.data(), text.size(), &alloc);
+        CHECK_EQUAL(sajson::ERROR_UNEXPECTED_END, result._internal_get_error_code());
+    }
+}
+
+SUITE(json_pointer) {
+    // The example document from RFC 6901 section 5.
+    const char* const rfc_document =
+        "{\"foo\": [\"bar\", \"baz\"], \"\": 0, \"a/b\": 1, \"c%d\": 2, \"e^f\": 3,"
+        " \"g|h\": 4, \"i\\\\j\": 5, \"k\\\"l\": 6, \" \": 7, \"m~n\": 8}";
+
+    TEST(rfc_examples) {
+        const sajson::document& document = sajson::parse(literal(rfc_document));
+        assert(success(document));
+        const value& root = document.get_root();
+
+        value result = root;
+        CHECK(sajson::json_pointer(literal("")).evaluate(root, &result));
+        CHECK_EQUAL(TYPE_OBJECT, result.get_type());
+
+        CHECK(sajson::json_pointer(literal("/foo")).evaluate(root, &result));
+        CHECK_EQUAL(TYPE_ARRAY, result.get_type());
+        CHECK(sajson::json_pointer(literal("/foo/0")).evaluate(root, &result));
+        CHECK_EQUAL("bar", result.as_string());
+
+        const char* int_paths[] = {
+            "/", "/a~1b", "/c%d", "/e^f", "/g|h", "/i\\j", "/k\"l", "/ ", "/m~0n",
+        };
+        for (int i = 0; i < 9; ++i) {
+            sajson::json_pointer pointer{literal(int_paths[i])};
+            CHECK(pointer.is_valid());
+            CHECK(pointer.evaluate(root, &result));
+            CHECK_EQUAL(i, result.get_integer_value());
+        }
+    }
+
+    TEST(compiled_tokens) {
+        sajson::json_pointer pointer(literal("/a~1b/m~0n/17/"));
+        CHECK(pointer.is_valid());
+        CHECK_EQUAL(4u, pointer.get_token_count());
+        CHECK_EQUAL("a/b", pointer.get_token(0).as_string());
+        CHECK_EQUAL("m~n", pointer.get_token(1).as_string());
+        CHECK_EQUAL("17", pointer.get_token(2).as_string());
+        CHECK_EQUAL("", pointer.get_token(3).as_string());
+    }
+
+    TEST(malformed_pointers) {
+        CHECK(!sajson::json_pointer(literal("foo")).is_valid());
+        CHECK(!sajson::json_pointer(literal("/a~")).is_valid());
+        CHECK(!sajson::json_pointer(literal("/a~2")).is_valid());
+
+        const sajson::document& document = sajson::parse(literal("[1]"));
+        assert(success(document));
+        value result = document.get_root();
+        CHECK(!sajson::json_pointer(literal("0")).evaluate(document.get_root(), &result));
+        CHECK_EQUAL(TYPE_ARRAY, result.get_type());
+    }
+
+    TEST(missing_values) {
+        const sajson::document& document = sajson::parse(literal("{\"a\": [10, 20], \"b\": \"s\"}"));
+        assert(success(document));
+        const value& root = document.get_root();
+        value result = root;
+        const char* paths[] = {
+            "/c", "/a/2", "/a/-", "/a/01", "/a/x", "/a/18446744073709551616", "/b/0", "/a/0/0",
+        };
+        for (size_t i = 0; i < sizeof(paths) / sizeof(*paths); ++i) {
+            CHECK(!sajson::json_pointer(literal(paths[i])).evaluate(root, &result));
+        }
+        CHECK(sajson::json_pointer(literal("/a/1")).evaluate(root, &result));
+        CHECK_EQUAL(20, result.get_integer_value());
+    }
+
+    TEST(batch_evaluation) {
+        const sajson::document& document = sajson::parse(literal(
+            "{\"user\": {\"id\": 7, \"name\": \"x\", \"tags\": [\"p\", \"q\"]}, \"n\": 1}"));
+        assert(success(document));
+        const value& root = document.get_root();
+
+        sajson::json_pointer pointers[] = {
+            sajson::json_pointer(literal("/user/id")),
+            sajson::json_pointer(literal("/user/name")),
+            sajson::json_pointer(literal("/user/missing")),
+            sajson::json_pointer(literal("/user/tags/1")),
+            sajson::json_pointer(literal("/user")),
+            sajson::json_pointer(literal("bad")),
+            sajson::json_pointer(literal("/n")),
+            sajson::json_pointer(literal("")),
+        };
+        const size_t count = sizeof(pointers) / sizeof(*pointers);
+        std::vector<value> results(count, root);
+        bool found[count];
+        CHECK_EQUAL(6u, sajson::json_pointer::evaluate_all(root, pointers, count, results.data(), found));
+
+        CHECK(found[0]);
+        CHECK_EQUAL(7, results[0].get_integer_value());
+        CHECK(found[1]);
+        CHECK_EQUAL("x", results[1].as_string());
+        CHECK(!found[2]);
+        CHECK(found[3]);
+        CHECK_EQUAL("q", results[3].as_string());
+        CHECK(found[4]);
+        CHECK_EQUAL(TYPE_OBJECT, results[4].get_type());
+        CHECK(!found[5]);
+        CHECK(found[6]);
+        CHECK_EQUAL(1, results[6].get_integer_value());
+        CHECK(found[7]);
+        CHECK_EQUAL(2u, results[7].get_length());
+    }
+
+    TEST(evaluation_does_not_allocate) {
+        count_allocator alloc;
+        sajson::json_pointer pointer(literal("/a/0"), &alloc);
+        CHECK_EQUAL(1, alloc.allocs);
+        const sajson::document& document = sajson::parse(literal("{\"a\": [true]}"));
+        assert(success(document));
+        value result = document.get_root();
+        for (int i = 0; i < 3; ++i) {
+            CHECK(pointer.evaluate(document.get_root(), &result));
+        }
+        CHECK_EQUAL(TYPE_TRUE, result.get_type());
+        CHECK_EQUAL(1, alloc.allocs);
+    }
+}
+
+SUITE(iteration) {
+    TEST(range_for_over_array) {
+        const sajson::document& document = sajson::parse(literal("[1, \"two\", [3], {\"four\": 4}, null]"));
+        assert(success(document));
+        const value& root = document.get_root();
+        size_t i = 0;
+        for (const value& element : root.get_array_elements()) {
+            const value& expected = root.get_array_element(i);
+            CHECK_EQUAL(expected.get_type(), element.get_type());
+            CHECK_EQUAL(expected._internal_get_payload(), element._internal_get_payload());
+            ++i;
+        }
+        CHECK_EQUAL(5u, i);
+        CHECK_EQUAL("two", (*++root.get_array_elements().begin()).as_string());
+    }
+
+    TEST(range_for_over_object) {
+        const sajson::document& document = sajson::parse(literal("{\"b\": 2, \"a\": \"x\", \"cc\": [], \"\": null}"));
+        assert(success(document));
+        const value& root = document.get_root();
+        size_t i = 0;
+        for (const sajson::object_member& member : root.get_object_members()) {
+            CHECK_EQUAL(root.get_object_key(i).as_string(), member.get_key().as_string());
+            CHECK_EQUAL(root.get_object_value(i).get_type(), member.get_value().get_type());
+            CHECK_EQUAL(root.get_object_value(i)._internal_get_payload(), member.get_value()._internal_get_payload());
+            ++i;
+        }
+        CHECK_EQUAL(4u, i);
+    }
+
+    TEST(empty_containers) {
+        const sajson::document& document = sajson::parse(literal("[[], {}]"));
+        assert(success(document));
+        const value& empty_array = document.get_root().get_array_element(0);
+        const value& empty_object = document.get_root().get_array_element(1);
+        CHECK(empty_array.get_array_elements().begin() == empty_array.get_array_elements().end());
+        CHECK(empty_object.get_object_members().begin() == empty_object.get_object_members().end());
+    }
+
+    TEST(works_with_algorithms) {
+        const sajson::document& document = sajson::parse(literal("[5, 6, \"seven\", 8]"));
+        assert(success(document));
+        const auto elements = document.get_root().get_array_elements();
+        CHECK_EQUAL(4, std::distance(elements.begin(), elements.end()));
+        const auto found = std::find_if(elements.begin(), elements.end(), [](const value& v) {
+            return v.get_type() == TYPE_STRING;
+        });
+        CHECK_EQUAL("seven", (*found).as_string());
+        CHECK_EQUAL(2, std::count_if(elements.begin(), elements.end(), [](const value& v) {
+            return v.get_type() == TYPE_INTEGER && v.get_integer_value() % 2 == 0;
+        }));
+
+        sajson::array_iterator i = elements.begin();
+        sajson::array_iterator previous = i++;
+        CHECK_EQUAL(5, (*previous).get_integer_value());
+        CHECK_EQUAL(6, (*i).get_integer_value());
+    }
+}
+
+SUITE(lazy) {
+    TEST(reads_only_requested_values) {
+        const char* text =
+            "{\"skip\": [1, {\"x\": \"]}\\\"\"}, [[]]], \"n\": -12, \"d\": 2.5,"
+            " \"s\": \"plain\", \"e\": \"a\\u00e9\\n\", \"t\": true, \"z\": null}";
+        sajson::lazy_document document{literal(text)};
+        sajson::lazy_value root = document.get_root();
+        CHECK(root.exists());
+        CHECK_EQUAL(TYPE_OBJECT, root.get_type());
+        CHECK_EQUAL(7u, root.get_length());
+
+        sajson::lazy_value n = root.get_value_of_key(literal("n"));
+        CHECK_EQUAL(TYPE_INTEGER, n.get_type());
+        CHECK_EQUAL(-12, n.get_integer_value());
+        sajson::lazy_value d = root.get_value_of_key(literal("d"));
+        CHECK_EQUAL(TYPE_DOUBLE, d.get_type());
+        CHECK_EQUAL(2.5, d.get_double_value());
+        CHECK_EQUAL(-12.0, n.get_number_value());
+
+        sajson::lazy_value s = root.get_value_of_key(literal("s"));
+        CHECK_EQUAL(TYPE_STRING, s.get_type());
+        CHECK_EQUAL("plain", s.as_string());
+        // Unescaped strings point into the input.
+        CHECK(s.get_string_value().data() > text);
+        CHECK(s.get_string_value().data() < text + strlen(text));
+        CHECK_EQUAL("a\xc3\xa9\n", root.get_value_of_key(literal("e")).as_string());
+
+        CHECK_EQUAL(TYPE_TRUE, root.get_value_of_key(literal("t")).get_type());
+        CHECK_EQUAL(TYPE_NULL, root.get_value_of_key(literal("z")).get_type());
+
+        sajson::lazy_value skip = root.get_value_of_key(literal("skip"));
+        CHECK_EQUAL(3u, skip.get_length());
+        CHECK_EQUAL("]}\"", skip.get_array_element(1).get_value_of_key(literal("x")).as_string());
+        CHECK_EQUAL(0u, skip.get_array_element(2).get_array_element(0).get_length());
+        CHECK(document.get_error().is_valid());
+    }
+
+    TEST(missing_values_chain) {
+        sajson::lazy_document document(literal("[0, {\"a\": 1}]"));
+        sajson::lazy_value root = document.get_root();
+        CHECK(!root.get_array_element(2).exists());
+        CHECK(!root.get_value_of_key(literal("a")).exists());
+        CHECK(!root.get_array_element(0).get_array_element(0).exists());
+        CHECK(!root.get_array_element(1).get_value_of_key(literal("b")).get_value_of_key(literal("c")).exists());
+        CHECK_EQUAL(1, root.get_array_element(1).get_value_of_key(literal("a")).get_integer_value());
+        CHECK(document.get_error().is_valid());
+    }
+
+    TEST(escaped_keys) {
+        sajson::lazy_document document(literal("{\"a\\u0062\": 1, \"ab\\\"\": 2, \"ab\": 3}"));
+        sajson::lazy_value root = document.get_root();
+        CHECK_EQUAL(1, root.get_value_of_key(literal("ab")).get_integer_value());
+        CHECK_EQUAL(2, root.get_value_of_key(literal("ab\"")).get_integer_value());
+    }
+
+    TEST(bad_roots) {
+        {
+            sajson::lazy_document document(literal("  "));
+            CHECK(!document.get_root().exists());
+            CHECK_EQUAL(sajson::ERROR_MISSING_ROOT_ELEMENT, document.get_error()._internal_get_error_code());
+        }
+        {
+            sajson::lazy_document document(literal("7"));
+            CHECK(!document.get_root().exists());
+            CHECK_EQUAL(sajson::ERROR_BAD_ROOT, document.get_error()._internal_get_error_code());
+        }
+    }
+
+    TEST(errors_are_found_only_when_traversed) {
+        sajson::lazy_document document(literal("[1, [nope], 2 3, tru]"));
+        sajson::lazy_value root = document.get_root();
+        CHECK_EQUAL(1, root.get_array_element(0).get_integer_value());
+        CHECK(document.get_error().is_valid());
+        CHECK_EQUAL(2, root.get_array_element(2).get_integer_value());
+        CHECK(document.get_error().is_valid());
+
+        CHECK(!root.get_array_element(3).exists());
+        const sajson::parse_result& error = document.get_error();
+        CHECK(!error.is_valid());
+        CHECK_EQUAL(sajson::ERROR_EXPECTED_COMMA, error._internal_get_error_code());
+        CHECK_EQUAL(15u, error.get_error_column());
+    }
+
+    TEST(first_error_is_kept) {
+        sajson::lazy_document document(literal("[1e, \"\\q\", 3e-, nul]"));
+        sajson::lazy_value root = document.get_root();
+        CHECK_EQUAL(sajson::TYPE_NULL, root.get_array_element(0).get_type());
+        const sajson::parse_result& first = document.get_error();
+        CHECK(!first.is_valid());
+        CHECK_EQUAL(sajson::ERROR_MSSING_EXPONENT, first._internal_get_error_code());
+        CHECK_EQUAL(4u, first.get_error_column());
+
+        CHECK_EQUAL(sajson::TYPE_NULL, root.get_array_element(2).get_type());
+        CHECK(!root.get_array_element(3).exists());
+        CHECK_EQUAL("", root.get_array_element(1).as_string());
+        const sajson::parse_result& error = document.get_error();
+        CHECK_EQUAL(sajson::ERROR_MSSING_EXPONENT, error._internal_get_error_code());
+        CHECK_EQUAL(4u, error.get_error_column());
+    }
+
+    TEST(unterminated) {
+        sajson::lazy_document document(literal("{\"a\": [1, \"]"));
+        sajson::lazy_value root = document.get_root();
+        CHECK(!root.get_value_of_key(literal("b")).exists());
+        CHECK_EQUAL(sajson::ERROR_UNEXPECTED_END, document.get_error()._internal_get_error_code());
+    }
+
+    TEST(scratch_is_allocated_once_for_escapes) {
+        count_allocator alloc;
+        {
+            sajson::lazy_document document(literal("[\"plain\", \"a\\tb\", \"c\\td\"]"), &alloc);
+            sajson::lazy_value root = document.get_root();
+            CHECK_EQUAL("plain", root.get_array_element(0).as_string());
+            CHECK_EQUAL(0, alloc.allocs);
+            sajson::string first = root.get_array_element(1).get_string_value();
+            CHECK_EQUAL("c\td", root.get_array_element(2).as_string());
+            CHECK_EQUAL("a\tb", std::string(first.data(), first.length()));
+            CHECK_EQUAL(1, alloc.allocs);
+        }
+        CHECK_EQUAL(0, alloc.allocs - alloc.deallocs);
+    }
+}
+
+SUITE(projection) {
+    TEST(keeps_only_projected_members) {
+        const sajson::json_pointer paths[] = {
+            sajson::json_pointer(literal("/id")),
+            sajson::json_pointer(literal("/user/name")),
+            sajson::json_pointer(literal("/tags")),
+        };
+        sajson::projection keep(paths, 3);
+        CHECK(keep.is_valid());
+
+        const sajson::document& document = sajson::parse(literal(
+            "{\"skip\": {\"deep\": [{\"x\": 1}, \"]}\"]}, \"id\": 1, \"name\": \"x\","
+            " \"user\": {\"id\": 7, \"name\": \"n\", \"extra\": [1, 2]}, \"tags\": [\"a\", {\"b\": 2}]}"), keep);
+        assert(success(document));
+        const value& root = document.get_root();
+        CHECK_EQUAL(3u, root.get_length());
+        CHECK_EQUAL(1, root.get_value_of_key(literal("id")).get_integer_value());
+        CHECK_EQUAL(root.get_length(), root.find_object_key(literal("skip")));
+        CHECK_EQUAL(root.get_length(), root.find_object_key(literal("name")));
+
+        const value& user = root.get_value_of_key(literal("user"));
+        CHECK_EQUAL(1u, user.get_length());
+        CHECK_EQUAL("n", user.get_value_of_key(literal("name")).as_string());
+
+        const value& tags = root.get_value_of_key(literal("tags"));
+        CHECK_EQUAL(2u, tags.get_length());
+        CHECK_EQUAL(2, tags.get_array_element(1).get_value_of_key(literal("b")).get_integer_value());
+    }
+
+    TEST(arrays_are_passed_through) {
+        const sajson::json_pointer paths[] = {
+            sajson::json_pointer(literal("/events/id")),
+        };
+        sajson::projection keep(paths, 1);
+        const sajson::document& document = sajson::parse(literal(
+            "[{\"events\": [{\"id\": 1, \"x\": 2}, [{\"id\": 3, \"y\": [4]}]], \"other\": 5}]"), keep);
+        assert(success(document));
+        const value& events = document.get_root().get_array_element(0).get_value_of_key(literal("events"));
+        CHECK_EQUAL(2u, events.get_length());
+        CHECK_EQUAL(1u, events.get_array_element(0).get_length());
+        CHECK_EQUAL(1, events.get_array_element(0).get_value_of_key(literal("id")).get_integer_value());
+        const value& nested = events.get_array_element(1).get_array_element(0);
+        CHECK_EQUAL(1u, nested.get_length());
+        CHECK_EQUAL(3, nested.get_value_of_key(literal("id")).get_integer_value());
+        CHECK_EQUAL(1u, document.get_root().get_array_element(0).get_length());
+    }
+
+    TEST(shorter_path_keeps_whole_member) {
+        const sajson::json_pointer paths[] = {
+            sajson::json_pointer(literal("/a/b")),
+            sajson::json_pointer(literal("/a")),
+            sajson::json_pointer(literal("/c/d/e")),
+        };
+        sajson::projection keep(paths, 3);
+        const sajson::document& document = sajson::parse(literal(
+            "{\"a\": {\"b\": 1, \"z\": 2}, \"c\": {\"d\": {\"e\": 3, \"f\": 4}, \"g\": 5}}"), keep);
+        assert(success(document));
+        const value& root = document.get_root();
+        CHECK_EQUAL(2u, root.get_value_of_key(literal("a")).get_length());
+        const value& c = root.get_value_of_key(literal("c"));
+        CHECK_EQUAL(1u, c.get_length());
+        CHECK_EQUAL(1u, c.get_value_of_key(literal("d")).get_length());
+    }
+
+    TEST(empty_path_keeps_everything) {
+        const sajson::json_pointer paths[] = {
+            sajson::json_pointer(literal("/x")),
+            sajson::json_pointer(literal("")),
+        };
+        sajson::projection keep(paths, 2);
+        const sajson::document& document = sajson::parse(literal("{\"a\": 1, \"b\": [2]}"), keep);
+        assert(success(document));
+        CHECK_EQUAL(2u, document.get_root().get_length());
+    }
+
+    TEST(escaped_keys_match) {
+        const sajson::json_pointer paths[] = {
+            sajson::json_pointer(literal("/ab")),
+        };
+        sajson::projection keep(paths, 1);
+        const sajson::document& document = sajson::parse(literal("{\"a\\u0062\": 1, \"ac\": 2}"), keep);
+        assert(success(document));
+        CHECK_EQUAL(1u, document.get_root().get_length());
+        CHECK_EQUAL(1, document.get_root().get_value_of_key(literal("ab")).get_integer_value());
+    }
+
+    TEST(invalid_projection) {
+        const sajson::json_pointer paths[] = {
+            sajson::json_pointer(literal("/a")),
+            sajson::json_pointer(literal("a")),
+        };
+        sajson::projection keep(paths, 2);
+        CHECK(!keep.is_valid());
+        const sajson::document& document = sajson::parse(literal("[]"), keep);
+        CHECK(!document.is_valid());
+        CHECK_EQUAL(sajson::ERROR_INVALID_PROJECTION, document._internal_get_error_code());
+    }
+
+    TEST(skipped_members_are_checked) {
+        const sajson::json_pointer paths[] = {
+            sajson::json_pointer(literal("/a")),
+        };
+        sajson::projection keep(paths, 1);
+        const char* inputs[] = {
+            "{\"b\": [1,]}",
+            "{\"b\": {\"c\" 1}, \"a\": 2}",
+            "{\"b\": \"\\x\"}",
+            "{\"b\": tru}",
+            "{\"b\": 1e}",
+            "{\"b\": }",
+            "{\"b\":",
+            "{\"b\": [[[",
+            "{\"b\": 1 \"a\": 2}",
+            "{\"a\": 1, \"b\": [\n\n  nul]}",
+        };
+        for (size_t i = 0; i < sizeof(inputs) / sizeof(*inputs); ++i) {
+            const sajson::document& full = sajson::parse(literal(inputs[i]));
+            const sajson::document& projected = sajson::parse(literal(inputs[i]), keep);
+            CHECK(!projected.is_valid());
+            CHECK_EQUAL(full._internal_get_error_code(), projected._internal_get_error_code());
+            CHECK_EQUAL(full.get_error_line(), projected.get_error_line());
+            CHECK_EQUAL(full.get_error_column(), projected.get_error_column());
+        }
+    }
+
+    TEST(ast_holds_only_kept_members) {
+        std::string text = "{";
+        for (int i = 0; i < 200; ++i) {
+            text += "\"field" + std::to_string(i) + "\": [" + std::to_string(i) + ", \"v\"], ";
+        }
+        text += "\"last\": 0}";
+
+        const sajson::json_pointer paths[] = {
+            sajson::json_pointer(literal("/field7")),
+            sajson::json_pointer(literal("/last")),
+        };
+        sajson::projection keep(paths, 2);
+        sajson::document projected = sajson::parse(sajson::string(text.data(), text.size()), keep);
+        assert(success(projected));
+        CHECK(projected.compact());
+        CHECK_EQUAL(2u, projected.get_root().get_length());
+        // root: length + 2 keys; field7: length + 2 elements, an integer,
+        // and a string; last: an integer
+        CHECK_EQUAL((7u + 6u + 1u) * sizeof(size_t), projected.get_structure_size());
+    }
+}
+
+SUITE(writer) {
+    std::string write_double(double d) {
+        char buffer[32];
+        return std::string(buffer, sajson::internal::format_double(d, buffer));
+    }
+
+    std::string output_of(const sajson::writer& w) {
+        return w.get_output().as_string();
+    }
+
+    TEST(integers) {
+        const int values[] = {0, 7, -7, 10, 99, 100, -100, 12345, 1000000000, INT_MAX, INT_MIN};
+        for (size_t i = 0; i < sizeof(values) / sizeof(*values); ++i) {
+            char buffer[16];
+            const std::string formatted(buffer, sajson::internal::format_integer(values[i], buffer));
+            CHECK_EQUAL(std::to_string(values[i]), formatted);
+        }
+    }
+
+    TEST(double_layout) {
+        CHECK_EQUAL("0.0", write_double(0.0));
+        CHECK_EQUAL("-0.0", write_double(-0.0));
+        CHECK_EQUAL("1.0", write_double(1.0));
+        CHECK_EQUAL("-2.5", write_double(-2.5));
+        CHECK_EQUAL("0.1", write_double(0.1));
+        CHECK_EQUAL("0.3", write_double(0.3));
+        CHECK_EQUAL("0.30000000000000004", write_double(0.1 + 0.2));
+        CHECK_EQUAL("123456.789", write_double(123456.789));
+        CHECK_EQUAL("0.001234", write_double(0.001234));
+        CHECK_EQUAL("1.5e-7", write_double(1.5e-7));
+        CHECK_EQUAL("1e30", write_double(1e30));
+        CHECK_EQUAL("1.234e33", write_double(1.234e33));
+        CHECK_EQUAL("100000000000000000000.0", write_double(1e20));
+        CHECK_EQUAL("5e-324", write_double(5e-324));
+        CHECK_EQUAL("1.7976931348623157e308", write_double(1.7976931348623157e308));
+        CHECK_EQUAL("2.2250738585072014e-308", write_double(2.2250738585072014e-308));
+    }
+
+    TEST(doubles_round_trip) {
+        std::mt19937_64 random(12345);
+        for (int i = 0; i < 200000; ++i) {
+            const uint64_t bits = random();
+            double d;
+            memcpy(&d, &bits, sizeof(d));
+            if (!std::isfinite(d)) {
+                continue;
+            }
+            const std::string formatted = write_double(d);
+            CHECK(formatted.size() <= 25);
+            const double parsed = strtod(formatted.c_str(), 0);
+            if (memcmp(&parsed, &d, sizeof(d)) != 0) {
+                CHECK_EQUAL(d, parsed);
+                break;
+            }
+        }
+    }
+
+    TEST(doubles_are_short) {
+        // Grisu2 is not always shortest, but it must never need more
+        // digits than printf's shortest round-tripping precision.
+        std::mt19937_64 random(54321);
+        std::uniform_real_distribution<double> distribution(-1e6, 1e6);
+        for (int i = 0; i < 20000; ++i) {
+            const double d = distribution(random);
+            char shortest[32];
+            for (int precision = 1; precision <= 17; ++precision) {
+                snprintf(shortest, sizeof(shortest), "%.*g", precision, d);
+                if (strtod(shortest, 0) == d) {
+                    break;
+                }
+            }
+            const std::string formatted = write_double(d);
+            size_t digits = 0;
+            for (size_t j = 0; j < formatted.size() && formatted[j] != 'e'; ++j) {
+                digits += (formatted[j] >= '0' && formatted[j] <= '9');
+            }
+            size_t shortest_digits = 0;
+            for (const char* c = shortest; *c && *c != 'e'; ++c) {
+                shortest_digits += (*c >= '0' && *c <= '9');
+            }
+            // Leading zeroes like 0.00 are not significant digits.
+            CHECK(digits <= shortest_digits + 2);
+        }
+    }
+
+    TEST(builds_documents) {
+        sajson::writer w;
+        w.start_object();
+        w.key(literal("a"));
+        w.start_array();
+        w.integer_value(1);
+        w.double_value(2.5);
+        w.null_value();
+        w.bool_value(true);
+        w.bool_value(false);
+        w.start_object();
+        w.end_object();
+        w.start_array();
+        w.end_array();
+        w.end_array();
+        w.key(literal("b"));
+        w.string_value(literal("x"));
+        w.end_object();
+        CHECK(w.is_valid());
+        CHECK_EQUAL("{\"a\":[1,2.5,null,true,false,{},[]],\"b\":\"x\"}", output_of(w));
+
+        w.clear();
+        w.start_array();
+        w.double_value(std::numeric_limits<double>::quiet_NaN());
+        w.double_value(-std::numeric_limits<double>::infinity());
+        w.end_array();
+        CHECK_EQUAL("[null,null]", output_of(w));
+    }
+
+    TEST(string_escapes) {
+        sajson::writer w;
+        const char raw[] = "q\" b\\ \b\f\n\r\t \x01\x1f\x7f \xc3\xa9 /";
+        w.string_value(string(raw, sizeof(raw) - 1));
+        CHECK_EQUAL("\"q\\\" b\\\\ \\b\\f\\n\\r\\t \\u0001\\u001f\x7f \xc3\xa9 /\"", output_of(w));
+
+        w.clear();
+        w.string_value(string("a\0b", 3));
+        CHECK_EQUAL("\"a\\u0000b\"", output_of(w));
+    }
+
+    TEST(escapes_at_every_offset) {
+        // Exercises both the vectorized scan and its tail.
+        for (size_t length = 1; length < 40; ++length) {
+            for (size_t position = 0; position < length; ++position) {
+                std::string text(length, 'x');
+                text[position] = '\n';
+                sajson::writer w;
+                w.string_value(string(text.data(), text.size()));
+                std::string expected = "\"" + text.substr(0, position) + "\\n" + text.substr(position + 1) + "\"";
+                CHECK_EQUAL(expected, output_of(w));
+            }
+        }
+    }
+
+    TEST(writes_values) {
+        const char* text =
+            "{\"b\": [1, -2.25, \"s\\u00e9\\t\", null, true, false, [], {}],"
+            " \"a\": {\"y\": 1e300, \"x\": 0}}";
+        const sajson::document& document = sajson::parse(literal(text));
+        assert(success(document));
+        sajson::writer w;
+        w.write(document.get_root());
+        CHECK(w.is_valid());
+        // Keys come out in the AST's sorted order.
+        CHECK_EQUAL(
+            "{\"a\":{\"x\":0,\"y\":1e300},\"b\":[1,-2.25,\"s\xc3\xa9\\t\",null,true,false,[],{}]}",
+            output_of(w));
+
+        // Writing is a fixed point of parsing.
+        const std::string first = output_of(w);
+        const sajson::document& reparsed = sajson::parse(sajson::string(first.data(), first.size()));
+        assert(success(reparsed));
+        sajson::writer again;
+        again.write(reparsed.get_root());
+        CHECK_EQUAL(first, output_of(again));
+    }
+
+    TEST(reserializes_events_in_order) {
+        const char* text = "{\"z\": [1, 2.0, {\"k\": \"v\"}], \"a\": null}";
+        sajson::writer w;
+        CHECK(sajson::parse_events(literal(text), w).is_valid());
+        CHECK_EQUAL("{\"z\":[1,2.0,{\"k\":\"v\"}],\"a\":null}", output_of(w));
+    }
+
+    TEST(grows_and_reports_allocation_failure) {
+        {
+            sajson::writer w;
+            std::string big(100000, 'x');
+            w.start_array();
+            for (int i = 0; i < 3; ++i) {
+                w.string_value(string(big.data(), big.size()));
+            }
+            w.end_array();
+            CHECK(w.is_valid());
+            CHECK_EQUAL(3 * (big.size() + 2) + 4, w.get_output().length());
+        }
+
+        failing_allocator alloc;
+        alloc.remaining = 1;
+        {
+            sajson::writer w(&alloc);
+            w.start_array();
+            w.string_value(literal("short"));
+            CHECK(w.is_valid());
+            std::string big(1000, 'x');
+            w.string_value(string(big.data(), big.size()));
+            w.integer_value(1);
+            CHECK(!w.is_valid());
+            CHECK_EQUAL("[\"short\",", output_of(w));
+        }
+        CHECK_EQUAL(alloc.allocs, alloc.deallocs);
+    }
+}
+
+SUITE(stream_writer) {
+    class recording_sink : public sajson::output_sink {
+    public:
+        bool write(const sajson::output_chunk* chunks, size_t count) override {
+            ++calls;
+            max_chunks = std::max(max_chunks, count);
+            for (size_t i = 0; i < count; ++i) {
+                output.append(chunks[i].data, chunks[i].length);
+            }
+            return calls <= fail_after;
+        }
+        std::string output;
+        size_t calls = 0;
+        size_t max_chunks = 0;
+        size_t fail_after = static_cast<size_t>(-1);
+    };
+
+    // Writes a document of a few hundred kilobytes, with long strings
+    // that need escaping, to any writer.
+    template<typename Writer>
+    void write_large_document(Writer& w) {
+        std::string long_string;
+        for (int i = 0; i < 5000; ++i) {
+            long_string += "line \"" + std::to_string(i) + "\"\n";
+        }
+        w.start_array();
+        for (int i = 0; i < 3000; ++i) {
+            w.start_object();
+            w.key(literal("id"));
+            w.integer_value(i);
+            w.key(literal("score"));
+            w.double_value(i / 7.0);
+            w.key(literal("name"));
+            w.string_value(literal("tab\there"));
+            w.end_object();
+        }
+        w.string_value(string(long_string.data(), long_string.size()));
+        w.end_array();
+    }
+
+    TEST(matches_in_memory_output) {
+        sajson::writer expected;
+        write_large_document(expected);
+
+        recording_sink sink;
+        sajson::stream_writer w(sink, 1, 3);
+        write_large_document(w);
+        CHECK(w.flush());
+        CHECK(w.is_valid());
+        CHECK_EQUAL(expected.get_output().as_string(), sink.output);
+        CHECK_EQUAL(sink.output.size(), w.get_bytes_flushed());
+        CHECK(sink.calls > 10);
+        CHECK_EQUAL(3u, sink.max_chunks);
+    }
+
+    TEST(flush_is_idempotent) {
+        recording_sink sink;
+        sajson::stream_writer w(sink);
+        CHECK(w.flush());
+        CHECK_EQUAL(0u, sink.calls);
+        w.start_array();
+        w.end_array();
+        CHECK(w.flush());
+        CHECK(w.flush());
+        CHECK_EQUAL(1u, sink.calls);
+        CHECK_EQUAL("[]", sink.output);
+    }
+
+    TEST(sink_failure_stops_writer) {
+        recording_sink sink;
+        sink.fail_after = 1;
+        sajson::stream_writer w(sink, 1, 1);
+        write_large_document(w);
+        CHECK(!w.is_valid());
+        CHECK(!w.flush());
+        CHECK_EQUAL(2u, sink.calls);
+    }
+
+    TEST(buffer_allocation_failure) {
+        failing_allocator alloc;
+        recording_sink sink;
+        {
+            sajson::stream_writer w(sink, 4096, 2, &alloc);
+            CHECK(!w.is_valid());
+            w.null_value();
+            CHECK(!w.flush());
+        }
+        CHECK_EQUAL(0u, sink.calls);
+    }
+
+#ifdef SAJSON_HAS_WRITEV
+    TEST(writes_to_file_descriptor) {
+        sajson::writer expected;
+        write_large_document(expected);
+
+        FILE* file = tmpfile();
+        assert(file);
+        sajson::fd_sink sink(fileno(file));
+        sajson::stream_writer w(sink, 4096, 16);
+        write_large_document(w);
+        CHECK(w.flush());
+
+        const std::string& text = expected.get_output().as_string();
+        std::string contents(text.size() + 1, 0);
+        rewind(file);
+        CHECK_EQUAL(text.size(), fread(&contents[0], 1, contents.size(), file));
+        contents.resize(text.size());
+        CHECK_EQUAL(text, contents);
+        fclose(file);
+    }
+
+    TEST(reports_write_errors) {
+        FILE* file = fopen("/dev/null", "r");
+        assert(file);
+        sajson::fd_sink sink(fileno(file));
+        sajson::stream_writer w(sink);
+        w.null_value();
+        CHECK(!w.flush());
+        CHECK_EQUAL(EBADF, sink.get_error_number());
+        fclose(file);
+    }
+#endif
+}
+
+SUITE(minify) {
+    std::string minified(std::string text) {
+        text.resize(sajson::minify(&text[0], text.size()));
+        return text;
+    }
+
+    // The obvious byte-at-a-time definition.
+    std::string reference_minify(const std::string& text) {
+        std::string out;
+        bool in_string = false;
+        bool escaped = false;
+        for (char c : text) {
+            if (in_string) {
+                out += c;
+                if (escaped) {
+                    escaped = false;
+                } else if (c == '\\') {
+                    escaped = true;
+                } else if (c == '"') {
+                    in_string = false;
+                }
+            } else if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+                out += c;
+                in_string = (c == '"');
+            }
+        }
+        return out;
+    }
+
+    TEST(strips_whitespace_outside_strings) {
+        CHECK_EQUAL("", minified(""));
+        CHECK_EQUAL("", minified(" \t\r\n "));
+        CHECK_EQUAL(
+            "{\"a b\":[1,\"x\\\" y\",\"\\\\\",\"\\t \"],\"c\":{}}",
+            minified(" {\n  \"a b\" : [ 1 , \"x\\\" y\", \"\\\\\"  , \"\\t \" ],\r\n\t\"c\": { }\n}\n"));
+    }
+
+    TEST(blocks_and_boundaries) {
+        // Long runs of whitespace, strings, and escapes that straddle
+        // sixteen-byte blocks.
+        std::string text = "[";
+        for (int i = 0; i < 50; ++i) {
+            text += std::string(i % 19, ' ') + "\"" + std::string(i % 23, 'v') + "\\\\" + std::string(i % 7, ' ') + "\\\"\"";
+            text += std::string(i % 5, '\n') + ",";
+        }
+        text += "0]";
+        CHECK_EQUAL(reference_minify(text), minified(text));
+    }
+
+    TEST(matches_reference_on_random_input) {
+        const char alphabet[] = " \t\n\r\"\\a[,1";
+        std::mt19937 random(7);
+        for (int i = 0; i < 5000; ++i) {
+            std::string text(random() % 100, ' ');
+            for (char& c : text) {
+                c = alphabet[random() % (sizeof(alphabet) - 1)];
+            }
+            const std::string expected = reference_minify(text);
+            const std::string actual = minified(text);
+            if (expected != actual) {
+                CHECK_EQUAL(expected, actual);
+                break;
+            }
+        }
+    }
+
+    TEST(parses_the_same) {
+        const std::string pretty =
+            "{\n"
+            "    \"vertices\": [\n"
+            "        1.5,    -2,\n"
+            "        3e10,   \"  spaced  out  \"\n"
+            "    ],\n"
+            "    \"empty\"   :   {   },\n"
+            "    \"flags\"   :   [ true, false, null ]\n"
+            "}\n";
+        const std::string compact = minified(pretty);
+        CHECK(compact.size() < pretty.size());
+
+        const sajson::document& a = sajson::parse(sajson::string(pretty.data(), pretty.size()));
+        const sajson::document& b = sajson::parse(sajson::string(compact.data(), compact.size()));
+        assert(success(a));
+        assert(success(b));
+        sajson::writer wa;
+        sajson::writer wb;
+        wa.write(a.get_root());
+        wb.write(b.get_root());
+        CHECK_EQUAL(wa.get_output().as_string(), wb.get_output().as_string());
+        CHECK_EQUAL(
+            "{\"vertices\":[1.5,-2,3e10,\"  spaced  out  \"],\"empty\":{},\"flags\":[true,false,null]}",
+            compact);
+    }
+}
+
+SUITE(builder) {
+    std::string written(const sajson::value& v) {
+        sajson::writer w;
+        w.write(v);
+        return w.get_output().as_string();
+    }
+
+    TEST(builds_queryable_document) {
+        sajson::document_builder builder;
+        builder.start_object();
+        builder.key(literal("zeta"));
+        builder.integer_value(-7);
+        builder.key(literal("alpha"));
+        builder.start_array();
+        builder.double_value(2.5);
+        builder.string_value(literal("two words"));
+        builder.null_value();
+        builder.bool_value(true);
+        builder.bool_value(false);
+        builder.start_object();
+        builder.end_object();
+        builder.end_array();
+        builder.key(literal("mid"));
+        builder.string_value(sajson::string("nul\0inside", 10));
+        builder.end_object();
+        CHECK(builder.is_valid());
+        const sajson::document& document = builder.get_document();
+        assert(success(document));
+
+        const value& root = document.get_root();
+        CHECK_EQUAL(TYPE_OBJECT, root.get_type());
+        CHECK_EQUAL(3u, root.get_length());
+        // Keys are sorted as in parsed documents: by length, then bytes.
+        CHECK_EQUAL("mid", root.get_object_key(0).as_string());
+        CHECK_EQUAL("zeta", root.get_object_key(1).as_string());
+        CHECK_EQUAL("alpha", root.get_object_key(2).as_string());
+        CHECK_EQUAL(-7, root.get_value_of_key(literal("zeta")).get_integer_value());
+        CHECK_EQUAL(10u, root.get_value_of_key(literal("mid")).get_string_length());
+        const value& alpha = root.get_value_of_key(literal("alpha"));
+        CHECK_EQUAL(6u, alpha.get_length());
+        CHECK_EQUAL(2.5, alpha.get_array_element(0).get_double_value());
+        CHECK_EQUAL("two words", alpha.get_array_element(1).as_string());
+        CHECK_EQUAL(TYPE_NULL, alpha.get_array_element(2).get_type());
+        CHECK_EQUAL(TYPE_TRUE, alpha.get_array_element(3).get_type());
+        CHECK_EQUAL(TYPE_FALSE, alpha.get_array_element(4).get_type());
+        CHECK_EQUAL(0u, alpha.get_array_element(5).get_length());
+    }
+
+    TEST(same_ast_as_parser) {
+        const char* text = "[{\"b\": [1, 2.5], \"a\": \"x\", \"cc\": {}}, [[]], null, \"y\"]";
+        const sajson::document& parsed = sajson::parse(literal(text));
+        assert(success(parsed));
+        sajson::document_builder builder;
+        sajson::parse_events(literal(text), builder);
+        sajson::document built = builder.get_document();
+        assert(success(built));
+        CHECK(built.compact());
+
+        // Only the start and end offsets of the three keys and two
+        // strings differ, since the builder's text holds just those.
+        const size_t length = built._internal_get_ast_length();
+        CHECK_EQUAL(parsed._internal_get_ast_length(), length);
+        size_t differing = 0;
+        for (size_t i = 0; i < length; ++i) {
+            differing += parsed._internal_get_root()[i] != built._internal_get_root()[i];
+        }
+        CHECK_EQUAL(10u, differing);
+        CHECK_EQUAL(written(parsed.get_root()), written(built.get_root()));
+    }
+
+    TEST(copies_values_from_other_documents) {
+        const sajson::document& source = sajson::parse(literal("{\"items\": [1, {\"deep\": [true]}, \"s\"], \"skip\": 0}"));
+        assert(success(source));
+        sajson::document_builder builder;
+        builder.start_object();
+        builder.key(literal("copied"));
+        builder.write(source.get_root().get_value_of_key(literal("items")));
+        builder.key(literal("count"));
+        builder.integer_value(3);
+        builder.end_object();
+        const sajson::document& document = builder.get_document();
+        assert(success(document));
+        CHECK_EQUAL("{\"count\":3,\"copied\":[1,{\"deep\":[true]},\"s\"]}", written(document.get_root()));
+    }
+
+    TEST(large_documents_grow_buffers) {
+        std::string text = "[";
+        sajson::document_builder builder;
+        builder.start_array();
+        for (int i = 0; i < 2000; ++i) {
+            const std::string s = std::string(i % 40, 'k') + std::to_string(i);
+            text += (i ? ",{\"" : "{\"") + s + "\":[" + std::to_string(i) + ",\"" + s + "\"]}";
+            builder.start_object();
+            builder.key(sajson::string(s.data(), s.size()));
+            builder.start_array();
+            builder.integer_value(i);
+            builder.string_value(sajson::string(s.data(), s.size()));
+            builder.end_array();
+            builder.end_object();
+        }
+        builder.end_array();
+        text += "]";
+        const sajson::document& built = builder.get_document();
+        const sajson::document& parsed = sajson::parse(sajson::string(text.data(), text.size()));
+        assert(success(built));
+        assert(success(parsed));
+        CHECK_EQUAL(written(parsed.get_root()), written(built.get_root()));
+    }
+
+    TEST(reports_misplaced_roots) {
+        sajson::document_builder builder;
+        CHECK_EQUAL(sajson::ERROR_MISSING_ROOT_ELEMENT, builder.get_document()._internal_get_error_code());
+
+        builder.integer_value(1);
+        CHECK_EQUAL(false, builder.is_valid());
+        CHECK_EQUAL(sajson::ERROR_BAD_ROOT, builder.get_document()._internal_get_error_code());
+
+        builder.start_array();
+        builder.start_object();
+        builder.end_object();
+        CHECK_EQUAL(sajson::ERROR_UNEXPECTED_END, builder.get_document()._internal_get_error_code());
+
+        builder.start_array();
+        builder.end_array();
+        builder.start_array();
+        CHECK_EQUAL(sajson::ERROR_EXPECTED_END_OF_INPUT, builder.get_document()._internal_get_error_code());
+
+        // The builder starts over after each document.
+        builder.start_array();
+        builder.end_array();
+        const sajson::document& document = builder.get_document();
+        assert(success(document));
+        CHECK_EQUAL(0u, document.get_root().get_length());
+    }
+
+    TEST(allocation_failure_is_reported) {
+        for (int i = 0; i < 6; ++i) {
+            failing_allocator alloc;
+            alloc.remaining = i;
+            {
+                sajson::document_builder builder(&alloc);
+                builder.start_array();
+                for (int j = 0; j < 100; ++j) {
+                    builder.string_value(literal("a string long enough to need more text"));
+                }
+                builder.end_array();
+                CHECK_EQUAL(false, builder.is_valid());
+                const sajson::document& document = builder.get_document();
+                CHECK_EQUAL(sajson::ERROR_OUT_OF_MEMORY, document._internal_get_error_code());
+            }
+            CHECK_EQUAL(alloc.allocs, alloc.deallocs);
+        }
+    }
+}
+
+SUITE(overlay) {
+    using sajson::json_pointer;
+
+    const char* overlay_base_text =
+        "{\"user\": {\"name\": \"ann\", \"id\": 7}, \"tags\": [\"a\", \"b\", \"c\"], \"n\": null}";
+
+    std::string written(const sajson::overlay& edits) {
+        sajson::writer w;
+        edits.get_root().replay(w);
+        return w.get_output().as_string();
+    }
+
+    std::string base_written(const sajson::document& document) {
+        sajson::writer w;
+        w.write(document.get_root());
+        return w.get_output().as_string();
+    }
+
+    TEST(reads_base_without_edits) {
+        const sajson::document& base = sajson::parse(literal(overlay_base_text));
+        assert(success(base));
+        sajson::overlay edits(base);
+        CHECK_EQUAL(base_written(base), written(edits));
+        CHECK_EQUAL(7, edits.get_root().get_value_of_key(literal("user")).get_value_of_key(literal("id")).get_integer_value());
+    }
+
+    TEST(set_insert_remove) {
+        const sajson::document& base = sajson::parse(literal(overlay_base_text));
+        const sajson::document& values = sajson::parse(literal("[\"bob\", 8, {\"nested\": [true]}, \"z\"]"));
+        assert(success(base));
+        assert(success(values));
+        const value& v = values.get_root();
+        const std::string original = base_written(base);
+
+        sajson::overlay edits(base);
+        CHECK(edits.set(json_pointer(literal("/user/name")), v.get_array_element(0)));
+        CHECK(edits.set(json_pointer(literal("/user/age")), v.get_array_element(1)));
+        CHECK(edits.remove(json_pointer(literal("/user/id"))));
+        CHECK(edits.insert(json_pointer(literal("/tags/1")), v.get_array_element(2)));
+        CHECK(edits.set(json_pointer(literal("/tags/-")), v.get_array_element(3)));
+        CHECK(edits.remove(json_pointer(literal("/tags/0"))));
+        CHECK(edits.insert(json_pointer(literal("/tags/4")), v.get_array_element(1)));
+        CHECK(edits.set(json_pointer(literal("/tags/0/nested/0")), v.get_array_element(0)));
+        CHECK(edits.is_valid());
+
+        CHECK_EQUAL(
+            "{\"n\":null,\"tags\":[{\"nested\":[\"bob\"]},\"b\",\"c\",\"z\",8],\"user\":{\"age\":8,\"name\":\"bob\"}}",
+            written(edits));
+        const sajson::overlay_value& root = edits.get_root();
+        const sajson::overlay_value& user = root.get_value_of_key(literal("user"));
+        CHECK_EQUAL(2u, user.get_length());
+        CHECK_EQUAL("bob", user.get_value_of_key(literal("name")).as_string());
+        CHECK_EQUAL(user.get_length(), user.find_object_key(literal("id")));
+        CHECK_EQUAL(5u, root.get_value_of_key(literal("tags")).get_length());
+        CHECK_EQUAL(TYPE_NULL, root.get_value_of_key(literal("n")).get_type());
+
+        // The base document is untouched.
+        CHECK_EQUAL(original, base_written(base));
+    }
+
+    TEST(new_values_are_copied) {
+        const sajson::document& base = sajson::parse(literal("[1]"));
+        assert(success(base));
+        sajson::overlay edits(base);
+        {
+            const sajson::document& temporary = sajson::parse(literal("[{\"short\": \"lived\"}]"));
+            assert(success(temporary));
+            CHECK(edits.set(json_pointer(literal("/0")), temporary.get_root().get_array_element(0)));
+        }
+        CHECK_EQUAL("[{\"short\":\"lived\"}]", written(edits));
+    }
+
+    TEST(failed_edits_change_nothing) {
+        const sajson::document& base = sajson::parse(literal(overlay_base_text));
+        const sajson::document& values = sajson::parse(literal("[0]"));
+        assert(success(base));
+        assert(success(values));
+        const value& zero = values.get_root().get_array_element(0);
+        const std::string original = base_written(base);
+
+        sajson::overlay edits(base);
+        CHECK_EQUAL(false, edits.set(json_pointer(literal("/missing/x")), zero));
+        CHECK_EQUAL(false, edits.set(json_pointer(literal("/tags/3")), zero));
+        CHECK_EQUAL(false, edits.set(json_pointer(literal("/tags/x")), zero));
+        CHECK_EQUAL(false, edits.insert(json_pointer(literal("/tags/4")), zero));
+        CHECK_EQUAL(false, edits.remove(json_pointer(literal("/tags/3"))));
+        CHECK_EQUAL(false, edits.remove(json_pointer(literal("/tags/-"))));
+        CHECK_EQUAL(false, edits.remove(json_pointer(literal("/user/missing"))));
+        CHECK_EQUAL(false, edits.set(json_pointer(literal("/n/x")), zero));
+        CHECK_EQUAL(false, edits.set(json_pointer(literal("")), zero));
+        CHECK_EQUAL(false, edits.remove(json_pointer(literal(""))));
+        CHECK_EQUAL(false, edits.set(json_pointer(literal("bad")), zero));
+        CHECK_EQUAL(original, written(edits));
+
+        // The root may be replaced by another array or object.
+        CHECK(edits.set(json_pointer(literal("")), values.get_root()));
+        CHECK_EQUAL("[0]", written(edits));
+    }
+
+    TEST(replay_into_builder) {
+        const sajson::document& base = sajson::parse(literal(overlay_base_text));
+        const sajson::document& values = sajson::parse(literal("[false]"));
+        assert(success(base));
+        assert(success(values));
+        sajson::overlay edits(base);
+        CHECK(edits.set(json_pointer(literal("/n")), values.get_root().get_array_element(0)));
+        sajson::document_builder builder;
+        edits.get_root().replay(builder);
+        const sajson::document& merged = builder.get_document();
+        assert(success(merged));
+        CHECK_EQUAL(TYPE_FALSE, merged.get_root().get_value_of_key(literal("n")).get_type());
+        CHECK_EQUAL(written(edits), base_written(merged));
+    }
+
+    TEST(many_edits_to_one_array) {
+        const sajson::document& base = sajson::parse(literal("[]"));
+        const sajson::document& values = sajson::parse(literal("[0, 1]"));
+        assert(success(base));
+        assert(success(values));
+        sajson::overlay edits(base);
+        std::string expected = "[";
+        for (int i = 0; i < 500; ++i) {
+            CHECK(edits.insert(json_pointer(literal("/0")), values.get_root().get_array_element(i % 2)));
+            expected += (i ? ",": "") + std::to_string((499 - i) % 2);
+        }
+        expected += "]";
+        CHECK_EQUAL(expected, written(edits));
+    }
+
+    TEST(allocation_failure_is_reported) {
+        const sajson::document& base = sajson::parse(literal(overlay_base_text));
+        const sajson::document& values = sajson::parse(literal("[\"x\"]"));
+        assert(success(base));
+        assert(success(values));
+        for (int i = 0; i < 6; ++i) {
+            failing_allocator alloc;
+            alloc.remaining = i;
+            {
+                sajson::overlay edits(base, &alloc);
+                const bool ok = edits.set(json_pointer(literal("/user/new")), values.get_root().get_array_element(0));
+                CHECK_EQUAL(ok, edits.is_valid());
+                if (!ok) {
+                    CHECK_EQUAL(base_written(base), written(edits));
+                }
+            }
+            CHECK_EQUAL(alloc.allocs, alloc.deallocs);
+        }
+    }
+}
+
+SUITE(patch) {
+    // Applies a merge patch or JSON Patch and writes the result, or the
+    // error message.
+    std::string patched(bool merge, const char* target_text, const char* patch_text) {
+        const sajson::document& target = sajson::parse(literal(target_text));
+        const sajson::document& patch = sajson::parse(literal(patch_text));
+        assert(success(target));
+        assert(success(patch));
+        const sajson::document& result = merge
+            ? sajson::apply_merge_patch(target.get_root(), patch.get_root())
+            : sajson::apply_patch(target.get_root(), patch.get_root());
+        if (!result.is_valid()) {
+            return result.get_error_message_as_string();
+        }
+        sajson::writer w;
+        w.write(result.get_root());
+        return w.get_output().as_string();
+    }
+
+    std::string merged(const char* target_text, const char* patch_text) {
+        return patched(true, target_text, patch_text);
+    }
+
+    std::string json_patched(const char* target_text, const char* patch_text) {
+        return patched(false, target_text, patch_text);
+    }
+
+    TEST(merge_patch_rfc_7386_examples) {
+        CHECK_EQUAL("{\"a\":\"c\"}", merged("{\"a\":\"b\"}", "{\"a\":\"c\"}"));
+        CHECK_EQUAL("{\"a\":\"b\",\"b\":\"c\"}", merged("{\"a\":\"b\"}", "{\"b\":\"c\"}"));
+        CHECK_EQUAL("{}", merged("{\"a\":\"b\"}", "{\"a\":null}"));
+        CHECK_EQUAL("{\"b\":\"c\"}", merged("{\"a\":\"b\",\"b\":\"c\"}", "{\"a\":null}"));
+        CHECK_EQUAL("{\"a\":\"c\"}", merged("{\"a\":[\"b\"]}", "{\"a\":\"c\"}"));
+        CHECK_EQUAL("{\"a\":[\"b\"]}", merged("{\"a\":\"c\"}", "{\"a\":[\"b\"]}"));
+        CHECK_EQUAL("{\"a\":{\"b\":\"d\"}}", merged("{\"a\":{\"b\":\"c\"}}", "{\"a\":{\"b\":\"d\",\"c\":null}}"));
+        CHECK_EQUAL("{\"a\":[1]}", merged("{\"a\":[{\"b\":\"c\"}]}", "{\"a\":[1]}"));
+        CHECK_EQUAL("[\"c\"]", merged("[\"a\",\"b\"]", "[\"c\"]"));
+        CHECK_EQUAL("{\"a\":\"foo\"}", merged("[1,2]", "{\"a\":\"foo\",\"b\":null}"));
+        CHECK_EQUAL("{\"a\":1,\"e\":null}", merged("{\"e\":null}", "{\"a\":1}"));
+        CHECK_EQUAL("{\"a\":{\"bb\":{}}}", merged("{}", "{\"a\":{\"bb\":{\"ccc\":null}}}"));
+        // The RFC's larger example.
+        CHECK_EQUAL(
+            "{\"tags\":[\"example\"],\"title\":\"Hello!\",\"author\":{\"givenName\":\"John\"},\"content\":\"This will be unchanged\",\"phoneNumber\":\"+01-123-456-7890\"}",
+            merged(
+                "{\"title\":\"Goodbye!\",\"author\":{\"givenName\":\"John\",\"familyName\":\"Doe\"},"
+                "\"tags\":[\"example\",\"sample\"],\"content\":\"This will be unchanged\"}",
+                "{\"title\":\"Hello!\",\"phoneNumber\":\"+01-123-456-7890\",\"author\":{\"familyName\":null},\"tags\":[\"example\"]}"));
+    }
+
+    TEST(json_patch_rfc_6902_examples) {
+        CHECK_EQUAL("{\"baz\":\"qux\",\"foo\":\"bar\"}",
+            json_patched("{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/baz\",\"value\":\"qux\"}]"));
+        CHECK_EQUAL("{\"foo\":[\"bar\",\"qux\",\"baz\"]}",
+            json_patched("{\"foo\":[\"bar\",\"baz\"]}", "[{\"op\":\"add\",\"path\":\"/foo/1\",\"value\":\"qux\"}]"));
+        CHECK_EQUAL("{\"foo\":\"bar\"}",
+            json_patched("{\"baz\":\"qux\",\"foo\":\"bar\"}", "[{\"op\":\"remove\",\"path\":\"/baz\"}]"));
+        CHECK_EQUAL("{\"foo\":[\"bar\",\"baz\"]}",
+            json_patched("{\"foo\":[\"bar\",\"qux\",\"baz\"]}", "[{\"op\":\"remove\",\"path\":\"/foo/1\"}]"));
+        CHECK_EQUAL("{\"baz\":\"boo\",\"foo\":\"bar\"}",
+            json_patched("{\"baz\":\"qux\",\"foo\":\"bar\"}", "[{\"op\":\"replace\",\"path\":\"/baz\",\"value\":\"boo\"}]"));
+        CHECK_EQUAL("{\"foo\":{\"bar\":\"baz\"},\"qux\":{\"thud\":\"fred\",\"corge\":\"grault\"}}",
+            json_patched(
+                "{\"foo\":{\"bar\":\"baz\",\"waldo\":\"fred\"},\"qux\":{\"corge\":\"grault\"}}",
+                "[{\"op\":\"move\",\"from\":\"/foo/waldo\",\"path\":\"/qux/thud\"}]"));
+        CHECK_EQUAL("{\"foo\":[\"all\",\"cows\",\"eat\",\"grass\"]}",
+            json_patched(
+                "{\"foo\":[\"all\",\"grass\",\"cows\",\"eat\"]}",
+                "[{\"op\":\"move\",\"from\":\"/foo/1\",\"path\":\"/foo/3\"}]"));
+        CHECK_EQUAL("{\"baz\":[{\"qux\":\"hello\"}],\"foo\":1}",
+            json_patched(
+                "{\"baz\":[{\"qux\":\"hello\"}],\"foo\":1}",
+                "[{\"op\":\"test\",\"path\":\"/baz/0/qux\",\"value\":\"hello\"},"
+                "{\"op\":\"test\",\"path\":\"/foo\",\"value\":1.0}]"));
+        CHECK_EQUAL("patch operation failed: 0",
+            json_patched("{\"baz\":\"qux\"}", "[{\"op\":\"test\",\"path\":\"/baz\",\"value\":\"bar\"}]"));
+        CHECK_EQUAL("{\"foo\":\"bar\",\"child\":{\"grandchild\":{}}}",
+            json_patched("{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/child\",\"value\":{\"grandchild\":{}}}]"));
+        CHECK_EQUAL("patch operation failed: 0",
+            json_patched("{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/baz/bat\",\"value\":\"qux\"}]"));
+        CHECK_EQUAL("{\"foo\":[\"bar\",[\"abc\",\"def\"]]}",
+            json_patched("{\"foo\":[\"bar\"]}", "[{\"op\":\"add\",\"path\":\"/foo/-\",\"value\":[\"abc\",\"def\"]}]"));
+        // ~1 escapes a slash and ~0 a tilde.
+        CHECK_EQUAL("{\"/\":9,\"~1\":10}",
+            json_patched("{\"/\":9,\"~1\":10}", "[{\"op\":\"test\",\"path\":\"/~01\",\"value\":10}]"));
+    }
+
+    TEST(json_patch_sequences) {
+        CHECK_EQUAL("{\"a\":{\"b\":[1,2,{\"c\":3}]},\"d\":[1,2,{\"c\":3}]}",
+            json_patched("{\"a\":{\"b\":[1,2]}}",
+                "[{\"op\":\"add\",\"path\":\"/a/b/-\",\"value\":{\"c\":3}},"
+                "{\"op\":\"copy\",\"from\":\"/a/b\",\"path\":\"/d\"},"
+                "{\"op\":\"test\",\"path\":\"/d\",\"value\":[1,2,{\"c\":3}]}]"));
+        // A copy is independent of its source.
+        CHECK_EQUAL("{\"x\":[0],\"y\":[0,1]}",
+            json_patched("{\"x\":[0]}",
+                "[{\"op\":\"copy\",\"from\":\"/x\",\"path\":\"/y\"},"
+                "{\"op\":\"add\",\"path\":\"/y/1\",\"value\":1}]"));
+        // The root can be replaced by an array or object.
+        CHECK_EQUAL("[true]",
+            json_patched("{\"x\":1}", "[{\"op\":\"replace\",\"path\":\"\",\"value\":[true]}]"));
+        CHECK_EQUAL("{\"x\":{\"y\":{}}}",
+            json_patched("{\"x\":{\"y\":{}}}", "[{\"op\":\"move\",\"from\":\"/x\",\"path\":\"/x\"}]"));
+    }
+
+    TEST(json_patch_errors) {
+        CHECK_EQUAL("invalid patch operation: 0", json_patched("{}", "{}"));
+        CHECK_EQUAL("invalid patch operation: 1",
+            json_patched("{}", "[{\"op\":\"add\",\"path\":\"/a\",\"value\":1},{\"op\":\"frob\",\"path\":\"/a\"}]"));
+        CHECK_EQUAL("invalid patch operation: 0", json_patched("{}", "[{\"op\":\"add\",\"path\":\"/a\"}]"));
+        CHECK_EQUAL("invalid patch operation: 0", json_patched("{}", "[{\"op\":\"add\",\"path\":\"a\",\"value\":1}]"));
+        CHECK_EQUAL("invalid patch operation: 0", json_patched("{}", "[{\"op\":\"move\",\"path\":\"/a\"}]"));
+        CHECK_EQUAL("invalid patch operation: 0", json_patched("{}", "[[]]"));
+        CHECK_EQUAL("patch operation failed: 0", json_patched("{}", "[{\"op\":\"remove\",\"path\":\"/a\"}]"));
+        CHECK_EQUAL("patch operation failed: 0", json_patched("{}", "[{\"op\":\"replace\",\"path\":\"/a\",\"value\":1}]"));
+        CHECK_EQUAL("patch operation failed: 0", json_patched("[1]", "[{\"op\":\"add\",\"path\":\"/2\",\"value\":1}]"));
+        CHECK_EQUAL("patch operation failed: 0",
+            json_patched("{\"a\":{\"b\":1}}", "[{\"op\":\"move\",\"from\":\"/a\",\"path\":\"/a/b/c\"}]"));
+        CHECK_EQUAL("patch operation failed: 0", json_patched("{}", "[{\"op\":\"replace\",\"path\":\"\",\"value\":1}]"));
+    }
+
+    TEST(results_are_compact) {
+        const sajson::document& target = sajson::parse(literal("{\"a\": [1, 2, 3], \"b\": {\"c\": \"d\"}}"));
+        const sajson::document& patch = sajson::parse(literal("{\"b\": {\"c\": null}}"));
+        assert(success(target));
+        assert(success(patch));
+        const sajson::document& result = sajson::apply_merge_patch(target.get_root(), patch.get_root());
+        assert(success(result));
+        // Two members, three elements and their integers, and an empty
+        // object.
+        CHECK_EQUAL(((1 + 2 * 3) + (1 + 3) + 3 + 1) * sizeof(size_t), result.get_structure_size());
+    }
+
+    TEST(allocation_failure_is_reported) {
+        const sajson::document& target = sajson::parse(literal("{\"a\": [1, {\"x\": \"y\"}], \"b\": 2}"));
+        const sajson::document& patch = sajson::parse(literal(
+            "[{\"op\": \"copy\", \"from\": \"/a\", \"path\": \"/c\"}, {\"op\": \"remove\", \"path\": \"/a/0\"}]"));
+        assert(success(target));
+        assert(success(patch));
+        for (int i = 0; i < 30; ++i) {
+            failing_allocator alloc;
+            alloc.remaining = i;
+            {
+                const sajson::document& result = sajson::apply_patch(target.get_root(), patch.get_root(), &alloc);
+                if (!result.is_valid()) {
+                    CHECK_EQUAL(sajson::ERROR_OUT_OF_MEMORY, result._internal_get_error_code());
+                }
+            }
+            CHECK_EQUAL(alloc.allocs, alloc.deallocs);
+        }
+    }
+}
+
+struct bind_point {
+    int x;
+    int y;
+};
+
+SAJSON_BIND_BEGIN(bind_point)
+    SAJSON_BIND_FIELD(x)
+    SAJSON_BIND_FIELD(y)
+SAJSON_BIND_END()
+
+struct bind_shape {
+    bind_shape()
+        : id(-1)
+        , scale(1.0)
+        , closed(false)
+    {}
+
+    int id;
+    std::string name;
+    double scale;
+    bool closed;
+    std::vector<bind_point> points;
+    std::vector<std::string> tags;
+    std::vector<bool> flags;
+};
+
+SAJSON_BIND_BEGIN(bind_shape)
+    SAJSON_BIND_FIELD(id)
+    SAJSON_BIND_FIELD(name)
+    SAJSON_BIND_FIELD(scale)
+    SAJSON_BIND_FIELD(closed)
+    SAJSON_BIND_FIELD(points)
+    SAJSON_BIND_FIELD(tags)
+    SAJSON_BIND_FIELD(flags)
+SAJSON_BIND_END()
+
+struct bind_tree {
+    bind_tree()
+        : value(0)
+    {}
+
+    int value;
+    std::vector<bind_tree> children;
+};
+
+SAJSON_BIND_BEGIN(bind_tree)
+    SAJSON_BIND_FIELD(value)
+    SAJSON_BIND_FIELD(children)
+SAJSON_BIND_END()
+
+SUITE(bind) {
+    TEST(reads_fields) {
+        bind_shape shape;
+        auto result = sajson::parse_into(literal(
+            "{\"id\": 7, \"name\": \"tri\\u0061ngle\", \"scale\": 2, \"closed\": true,"
+            " \"points\": [{\"x\": 1, \"y\": 2}, {\"y\": 4, \"x\": 3}],"
+            " \"tags\": [\"a\", \"\"], \"flags\": [true, false, true]}"), shape);
+        CHECK(result.is_valid());
+        CHECK_EQUAL(7, shape.id);
+        CHECK_EQUAL("triangle", shape.name);
+        CHECK_EQUAL(2.0, shape.scale);
+        CHECK(shape.closed);
+        CHECK_EQUAL(2u, shape.points.size());
+        CHECK_EQUAL(1, shape.points[0].x);
+        CHECK_EQUAL(2, shape.points[0].y);
+        CHECK_EQUAL(3, shape.points[1].x);
+        CHECK_EQUAL(4, shape.points[1].y);
+        CHECK_EQUAL(2u, shape.tags.size());
+        CHECK_EQUAL("a", shape.tags[0]);
+        CHECK_EQUAL("", shape.tags[1]);
+        CHECK_EQUAL(3u, shape.flags.size());
+        CHECK(shape.flags[0] && !shape.flags[1] && shape.flags[2]);
+    }
+
+    TEST(missing_fields_keep_their_values) {
+        bind_shape shape;
+        shape.name = "kept";
+        CHECK(sajson::parse_into(literal(" { } "), shape).is_valid());
+        CHECK_EQUAL(-1, shape.id);
+        CHECK_EQUAL("kept", shape.name);
+        CHECK_EQUAL(1.0, shape.scale);
+    }
+
+    TEST(unknown_fields_are_skipped) {
+        bind_point pt = {0, 0};
+        auto result = sajson::parse_into(literal(
+            "{\"z\": {\"x\": [1, {\"y\": null}]}, \"x\": 5, \"xx\": \"\\n\", \"y\": 6, \"\": false}"), pt);
+        CHECK(result.is_valid());
+        CHECK_EQUAL(5, pt.x);
+        CHECK_EQUAL(6, pt.y);
+    }
+
+    TEST(later_duplicates_win) {
+        bind_shape shape;
+        CHECK(sajson::parse_into(literal("{\"tags\": [\"a\", \"b\"], \"id\": 1, \"tags\": [\"c\"], \"id\": 2}"), shape).is_valid());
+        CHECK_EQUAL(2, shape.id);
+        CHECK_EQUAL(1u, shape.tags.size());
+        CHECK_EQUAL("c", shape.tags[0]);
+    }
+
+    TEST(escaped_keys_match) {
+        bind_point pt = {0, 0};
+        CHECK(sajson::parse_into(literal("{\"\\u0078\": 1, \"\\u0079\": 2}"), pt).is_valid());
+        CHECK_EQUAL(1, pt.x);
+        CHECK_EQUAL(2, pt.y);
+    }
+
+    TEST(root_array) {
+        std::vector<bind_point> points;
+        CHECK(sajson::parse_into(literal("[{\"x\": 1}, {\"y\": 2}]"), points).is_valid());
+        CHECK_EQUAL(2u, points.size());
+        CHECK_EQUAL(1, points[0].x);
+        CHECK_EQUAL(2, points[1].y);
+    }
+
+    TEST(type_mismatches) {
+        const char* inputs[] = {
+            "{\"id\": 1.5}",
+            "{\"id\": \"1\"}",
+            "{\"id\": 3000000000}",
+            "{\"name\": null}",
+            "{\"name\": 1}",
+            "{\"scale\": \"2\"}",
+            "{\"closed\": 1}",
+            "{\"points\": {}}",
+            "{\"points\": [1]}",
+            "{\"flags\": [null]}",
+        };
+        for (size_t i = 0; i < sizeof(inputs) / sizeof(*inputs); ++i) {
+            bind_shape shape;
+            auto result = sajson::parse_into(literal(inputs[i]), shape);
+            CHECK_EQUAL(sajson::ERROR_TYPE_MISMATCH, result._internal_get_error_code());
+            CHECK_EQUAL(1u, result.get_error_line());
+        }
+
+        bind_shape shape;
+        auto result = sajson::parse_into(literal("{\n  \"id\": 1,\n  \"name\": []\n}"), shape);
+        CHECK_EQUAL(sajson::ERROR_TYPE_MISMATCH, result._internal_get_error_code());
+        CHECK_EQUAL(3u, result.get_error_line());
+        CHECK_EQUAL(11u, result.get_error_column());
+        CHECK_EQUAL("value does not match the bound type", result.get_error_message_as_string());
+    }
+
+    TEST(syntax_errors_match_parse) {
+        const char* inputs[] = {
+            "",
+            "  ",
+            "1",
+            "{\"x\" 1}",
+            "{1: 2}",
+            "{\"x\": 1,}",
+            "{\"x\": 1 \"y\": 2}",
+            "{\"x\": 1",
+            "{\"x\": 1} x",
+            "{\"x\": }",
+            "{\"x\": tru}",
+            "{\"x\": 01}",
+            "{\"z\": [1,]}",
+            "{\"z\": [}",
+            "{\"z\": \"\\x\"}",
+            "{\"z\": \"\xff\"}",
+            "{\"\\ud800\": 1}",
+        };
+        for (size_t i = 0; i < sizeof(inputs) / sizeof(*inputs); ++i) {
+            const sajson::document& document = sajson::parse(literal(inputs[i]));
+            bind_point pt = {0, 0};
+            auto result = sajson::parse_into(literal(inputs[i]), pt);
+            CHECK(!result.is_valid());
+            CHECK_EQUAL(document._internal_get_error_code(), result._internal_get_error_code());
+            CHECK_EQUAL(document.get_error_line(), result.get_error_line());
+            CHECK_EQUAL(document.get_error_column(), result.get_error_column());
+        }
+    }
+
+    TEST(key_hashes_are_constant) {
+        static_assert(sajson::internal::hash_key("", 0) == 2166136261u, "FNV-1a offset basis");
+        static_assert(sajson::internal::hash_key("points", 6) != sajson::internal::hash_key("point", 5), "");
+        CHECK_EQUAL(sajson::internal::hash_key("points", 6), sajson::internal::hash_runtime_key("points", 6));
+        CHECK_EQUAL(sajson::internal::hash_key("\xff", 1), sajson::internal::hash_runtime_key("\xff", 1));
+    }
+
+    std::string written(const bind_shape& shape) {
+        sajson::writer w;
+        sajson::write_bound(w, shape);
+        CHECK(w.is_valid());
+        return w.get_output().as_string();
+    }
+
+    TEST(writes_fields_in_bound_order) {
+        bind_shape shape;
+        shape.id = 7;
+        shape.name = "tab\there";
+        shape.scale = 0.5;
+        shape.closed = true;
+        shape.points.push_back(bind_point{1, -2});
+        shape.points.push_back(bind_point{2147483647, -2147483647 - 1});
+        shape.tags.push_back("");
+        shape.flags.push_back(false);
+        shape.flags.push_back(true);
+        CHECK_EQUAL(
+            "{\"id\":7,\"name\":\"tab\\there\",\"scale\":0.5,\"closed\":true,"
+            "\"points\":[{\"x\":1,\"y\":-2},{\"x\":2147483647,\"y\":-2147483648}],"
+            "\"tags\":[\"\"],\"flags\":[false,true]}",
+            written(shape));
+    }
+
+    TEST(empty_containers) {
+        bind_shape shape;
+        shape.scale = 100.0;
+        CHECK_EQUAL(
+            "{\"id\":-1,\"name\":\"\",\"scale\":100.0,\"closed\":false,\"points\":[],\"tags\":[],\"flags\":[]}",
+            written(shape));
+    }
+
+    TEST(round_trip) {
+        bind_shape shape;
+        shape.id = 42;
+        shape.name = "\xc3\xa9\n\"";
+        shape.scale = 1e-300;
+        shape.points.push_back(bind_point{3, 4});
+        shape.tags.push_back("x");
+        shape.flags.push_back(true);
+        const std::string text = written(shape);
+
+        bind_shape copy;
+        CHECK(sajson::parse_into(sajson::string(text.data(), text.size()), copy).is_valid());
+        CHECK_EQUAL(text, written(copy));
+        CHECK_EQUAL(shape.scale, copy.scale);
+        CHECK_EQUAL(shape.name, copy.name);
+    }
+
+    TEST(written_inside_other_values) {
+        std::vector<bind_point> points;
+        points.push_back(bind_point{1, 2});
+        sajson::writer w;
+        w.start_object();
+        w.key(literal("a"));
+        sajson::write_bound(w, points);
+        w.key(literal("b"));
+        sajson::write_bound(w, points[0]);
+        w.end_object();
+        CHECK_EQUAL("{\"a\":[{\"x\":1,\"y\":2}],\"b\":{\"x\":1,\"y\":2}}", w.get_output().as_string());
+    }
+
+    class string_sink : public sajson::output_sink {
+    public:
+        bool write(const sajson::output_chunk* chunks, size_t count) override {
+            for (size_t i = 0; i < count; ++i) {
+                output.append(chunks[i].data, chunks[i].length);
+            }
+            return true;
+        }
+        std::string output;
+    };
+
+    TEST(stream_writer) {
+        std::vector<bind_shape> shapes(100);
+        for (size_t i = 0; i < shapes.size(); ++i) {
+            shapes[i].id = static_cast<int>(i);
+            shapes[i].tags.push_back(std::string(i, 'q'));
+        }
+        string_sink sink;
+        sajson::stream_writer w(sink, 0, 1);
+        sajson::write_bound(w, shapes);
+        CHECK(w.flush());
+
+        sajson::writer expected;
+        sajson::write_bound(expected, shapes);
+        CHECK_EQUAL(expected.get_output().as_string(), sink.output);
+    }
+
+    TEST(self_referential_types_have_a_depth_limit) {
+        bind_tree tree;
+        CHECK(sajson::parse_into(literal("{\"value\": 1, \"children\": [{\"children\": [{\"value\": 3}]}, {}]}"), tree).is_valid());
+        CHECK_EQUAL(2u, tree.children.size());
+        CHECK_EQUAL(3, tree.children[0].children[0].value);
+
+        // Each level is an object and an array.
+        const char level[] = "{\"children\": [";
+        auto nest = [&](size_t levels) {
+            std::string text;
+            text.reserve(levels * (sizeof(level) + 1));
+            for (size_t i = 0; i < levels; ++i) {
+                text += level;
+            }
+            for (size_t i = 0; i < levels; ++i) {
+                text += "]}";
+            }
+            return text;
+        };
+        const std::string limit = nest(sajson::internal::bind_reader::MAX_DEPTH / 2);
+        CHECK(sajson::parse_into(sajson::string(limit.data(), limit.size()), tree).is_valid());
+
+        // Far deeper than the stack allows, but the core parser copes.
+        const std::string deep = nest(2000000);
+        CHECK(sajson::parse(sajson::string(deep.data(), deep.size())).is_valid());
+        const sajson::parse_result& result = sajson::parse_into(sajson::string(deep.data(), deep.size()), tree);
+        CHECK_EQUAL(sajson::ERROR_NESTING_TOO_DEEP, result._internal_get_error_code());
+        CHECK_EQUAL(sajson::internal::bind_reader::MAX_DEPTH / 2 * (sizeof(level) - 1) + 1, result.get_error_column());
+    }
+
+    TEST(does_not_leak) {
+        count_allocator alloc;
+        bind_shape shape;
+        CHECK(sajson::parse_into(literal("{\"q\": [[[{}]]], \"id\": 1}"), shape, &alloc).is_valid());
+        CHECK(!sajson::parse_into(literal("{\"q\": [[[{}]]], \"id\": x}"), shape, &alloc).is_valid());
+        CHECK_EQUAL(alloc.allocs, alloc.deallocs);
+    }
+}
+
+SUITE(schema) {
+    // Parses text and validates it against the schema in schema_text.
+    struct schema_check {
+        schema_check(const char* schema_text)
+            : schema_document(sajson::parse(literal(schema_text)))
+            , compiled(sajson::compile_schema(schema_document.get_root()))
+        {
+            assert(schema_document.is_valid());
+        }
+
+        sajson::schema_result validate(const char* text) {
+            documents.push_back(sajson::parse(literal(text)));
+            assert(documents.back().is_valid());
+            return compiled.validate(documents.back().get_root());
+        }
+
+        std::string failure(const char* text) {
+            const sajson::schema_result result = validate(text);
+            if (result.is_valid()) {
+                return "valid";
+            }
+            return std::string(result.get_keyword()) + " at " + result.get_instance_path();
+        }
+
+        sajson::document schema_document;
+        sajson::schema compiled;
+        std::vector<sajson::document> documents;
+    };
+
+    TEST(properties_and_required) {
+        schema_check check(
+            "{\"type\": \"object\","
+            " \"properties\": {\"id\": {\"type\": \"integer\"}, \"name\": {\"type\": \"string\"}, \"tags\": {}},"
+            " \"required\": [\"name\", \"id\", \"zzz_last\"]}");
+        CHECK(check.compiled.is_valid());
+        CHECK_EQUAL("valid", check.failure("{\"id\": 1, \"name\": \"a\", \"zzz_last\": null}"));
+        CHECK_EQUAL("valid", check.failure("{\"zzz_last\": [], \"name\": \"\", \"id\": 2.0, \"extra\": {}}"));
+        CHECK_EQUAL("required at ", check.failure("{\"id\": 1, \"name\": \"a\"}"));
+        CHECK_EQUAL("required at ", check.failure("{\"id\": 1, \"zzz_last\": 0}"));
+        CHECK_EQUAL("type at /id", check.failure("{\"id\": 1.5, \"name\": \"a\", \"zzz_last\": 0}"));
+        CHECK_EQUAL("type at /name", check.failure("{\"id\": 1, \"name\": 7, \"zzz_last\": 0}"));
+        CHECK_EQUAL("type at ", check.failure("[]"));
+    }
+
+    TEST(additional_properties) {
+        schema_check check("{\"properties\": {\"a\": {}, \"b/c\": false}, \"additionalProperties\": false}");
+        CHECK_EQUAL("valid", check.failure("{\"a\": 1}"));
+        CHECK_EQUAL("additionalProperties at /x", check.failure("{\"a\": 1, \"x\": 2}"));
+        CHECK_EQUAL("false at /b~1c", check.failure("{\"b/c\": 1}"));
+
+        // Only in required, so still additional.
+        schema_check required("{\"required\": [\"r\"], \"additionalProperties\": false}");
+        CHECK_EQUAL("additionalProperties at /r", required.failure("{\"r\": 1}"));
+        CHECK_EQUAL("required at ", required.failure("{}"));
+
+        schema_check typed("{\"properties\": {\"a\": {}}, \"additionalProperties\": {\"type\": \"number\"}}");
+        CHECK_EQUAL("valid", typed.failure("{\"a\": \"s\", \"b\": 1, \"cc\": 2.5}"));
+        CHECK_EQUAL("type at /cc", typed.failure("{\"a\": \"s\", \"b\": 1, \"cc\": \"x\"}"));
+    }
+
+    TEST(duplicate_keys_are_all_checked) {
+        schema_check check("{\"properties\": {\"a\": {\"type\": \"integer\"}}}");
+        CHECK_EQUAL("valid", check.failure("{\"a\": 1, \"a\": 2}"));
+        CHECK_EQUAL("type at /a", check.failure("{\"a\": 1, \"a\": \"x\"}"));
+    }
+
+    TEST(numbers) {
+        schema_check check("{\"minimum\": 1, \"exclusiveMaximum\": 10, \"multipleOf\": 0.5}");
+        CHECK_EQUAL("valid", check.failure("[\"not a number\"]"));
+        schema_check items("{\"items\": {\"minimum\": 1, \"exclusiveMaximum\": 10, \"multipleOf\": 0.5}}");
+        CHECK_EQUAL("valid", items.failure("[1, 1.5, 9.5, \"s\"]"));
+        CHECK_EQUAL("minimum at /1", items.failure("[1, 0.5]"));
+        CHECK_EQUAL("exclusiveMaximum at /0", items.failure("[10]"));
+        CHECK_EQUAL("multipleOf at /0", items.failure("[1.25]"));
+
+        schema_check decimal("{\"items\": {\"multipleOf\": 0.1}}");
+        CHECK_EQUAL("valid", decimal.failure("[0.3, 0.7, 1.1, 12.3, -4.4, 0, 5]"));
+        CHECK_EQUAL("multipleOf at /0", decimal.failure("[0.35]"));
+        CHECK_EQUAL("multipleOf at /1", decimal.failure("[0.2, 0.01]"));
+
+        schema_check even("{\"items\": {\"multipleOf\": 2}}");
+        CHECK_EQUAL("valid", even.failure("[0, -4, 1000000000, 10000000000, 1e20]"));
+        CHECK_EQUAL("multipleOf at /0", even.failure("[1000000001]"));
+        CHECK_EQUAL("multipleOf at /0", even.failure("[10000000001]"));
+        CHECK_EQUAL("multipleOf at /0", even.failure("[9007199254740991]"));
+        CHECK_EQUAL("multipleOf at /0", even.failure("[2.5]"));
+
+        schema_check draft4("{\"items\": {\"minimum\": 0, \"exclusiveMinimum\": true, \"maximum\": 5}}");
+        CHECK_EQUAL("valid", draft4.failure("[0.1, 5]"));
+        CHECK_EQUAL("exclusiveMinimum at /0", draft4.failure("[0]"));
+        CHECK_EQUAL("maximum at /0", draft4.failure("[5.5]"));
+
+        schema_check integers("{\"items\": {\"type\": \"integer\"}}");
+        CHECK_EQUAL("valid", integers.failure("[0, -3, 1e3, 1e20]"));
+        CHECK_EQUAL("type at /0", integers.failure("[0.1]"));
+    }
+
+    TEST(strings_count_code_points) {
+        schema_check check("{\"items\": {\"type\": \"string\", \"minLength\": 2, \"maxLength\": 3}}");
+        CHECK_EQUAL("valid", check.failure("[\"ab\", \"\xc3\xa9\xc3\xa9\xc3\xa9\", \"\\ud83d\\ude00\\u00e9\"]"));
+        CHECK_EQUAL("minLength at /0", check.failure("[\"\xf0\x9f\x98\x80\"]"));
+        CHECK_EQUAL("maxLength at /1", check.failure("[\"ab\", \"abcd\"]"));
+    }
+
+    TEST(arrays) {
+        schema_check check(
+            "{\"type\": \"array\", \"minItems\": 1, \"maxItems\": 3, \"uniqueItems\": true,"
+            " \"contains\": {\"const\": \"x\"}}");
+        CHECK_EQUAL("valid", check.failure("[\"x\", 1, {\"a\": 1}]"));
+        CHECK_EQUAL("minItems at ", check.failure("[]"));
+        CHECK_EQUAL("maxItems at ", check.failure("[\"x\", 1, 2, 3]"));
+        CHECK_EQUAL("uniqueItems at ", check.failure("[\"x\", 1, 1.0]"));
+        CHECK_EQUAL("uniqueItems at ", check.failure("[\"x\", {\"a\": 1, \"b\": 2}, {\"b\": 2, \"a\": 1}]"));
+        CHECK_EQUAL("contains at ", check.failure("[\"y\"]"));
+
+        schema_check tuple("{\"items\": [{\"type\": \"string\"}, {\"type\": \"integer\"}], \"additionalItems\": false}");
+        CHECK_EQUAL("valid", tuple.failure("[\"a\", 1]"));
+        CHECK_EQUAL("valid", tuple.failure("[\"a\"]"));
+        CHECK_EQUAL("type at /1", tuple.failure("[\"a\", \"b\"]"));
+        CHECK_EQUAL("additionalItems at /2", tuple.failure("[\"a\", 1, null]"));
+    }
+
+    TEST(enum_and_const) {
+        schema_check check("{\"properties\": {\"e\": {\"enum\": [1, \"two\", [3], null]}, \"c\": {\"const\": {\"k\": [true]}}}}");
+        CHECK_EQUAL("valid", check.failure("{\"e\": 1.0, \"c\": {\"k\": [true]}}"));
+        CHECK_EQUAL("valid", check.failure("{\"e\": [3]}"));
+        CHECK_EQUAL("valid", check.failure("{\"e\": null}"));
+        CHECK_EQUAL("enum at /e", check.failure("{\"e\": \"three\"}"));
+        CHECK_EQUAL("const at /c", check.failure("{\"c\": {\"k\": [false]}}"));
+
+        // Both must hold, whichever comes first.
+        schema_check both("{\"items\": {\"enum\": [1, 2], \"const\": 2}}");
+        CHECK_EQUAL("valid", both.failure("[2]"));
+        CHECK_EQUAL("const at /0", both.failure("[1]"));
+        CHECK_EQUAL("const at /0", both.failure("[3]"));
+        schema_check disjoint("{\"items\": {\"enum\": [1, 2], \"const\": 3}}");
+        CHECK_EQUAL("const at /0", disjoint.failure("[1]"));
+        CHECK_EQUAL("enum at /0", disjoint.failure("[3]"));
+    }
+
+    TEST(combinators) {
+        schema_check check(
+            "{\"items\": {\"anyOf\": [{\"type\": \"string\"}, {\"type\": \"integer\"}],"
+            " \"oneOf\": [{\"type\": \"integer\", \"minimum\": 0}, {\"type\": \"integer\", \"maximum\": 10}],"
+            " \"not\": {\"const\": 20}}}");
+        CHECK_EQUAL("valid", check.failure("[-1, 11]"));
+        CHECK_EQUAL("anyOf at /0", check.failure("[1.5]"));
+        CHECK_EQUAL("oneOf at /0", check.failure("[3]"));
+        CHECK_EQUAL("oneOf at /0", check.failure("[\"s\"]"));
+        CHECK_EQUAL("not at /1", check.failure("[11, 20]"));
+
+        schema_check all("{\"allOf\": [{\"required\": [\"a\"]}, {\"properties\": {\"a\": {\"type\": \"null\"}}}]}");
+        CHECK_EQUAL("valid", all.failure("{\"a\": null}"));
+        CHECK_EQUAL("type at /a", all.failure("{\"a\": 0}"));
+        CHECK_EQUAL("required at ", all.failure("{}"));
+    }
+
+    TEST(conditionals) {
+        schema_check check(
+            "{\"if\": {\"properties\": {\"kind\": {\"const\": \"circle\"}}},"
+            " \"then\": {\"required\": [\"radius\"]},"
+            " \"else\": {\"required\": [\"width\"]}}");
+        CHECK_EQUAL("valid", check.failure("{\"kind\": \"circle\", \"radius\": 1}"));
+        CHECK_EQUAL("valid", check.failure("{\"kind\": \"square\", \"width\": 1}"));
+        CHECK_EQUAL("required at ", check.failure("{\"kind\": \"circle\", \"width\": 1}"));
+        CHECK_EQUAL("required at ", check.failure("{\"kind\": \"square\", \"radius\": 1}"));
+    }
+
+    TEST(recursive_references) {
+        schema_check check(
+            "{\"definitions\": {\"node\": {\"type\": \"object\", \"required\": [\"value\"],"
+            "  \"properties\": {\"value\": {\"type\": \"integer\"},"
+            "   \"children\": {\"type\": \"array\", \"items\": {\"$ref\": \"#/definitions/node\"}}}}},"
+            " \"$ref\": \"#/definitions/node\"}");
+        CHECK(check.compiled.is_valid());
+        CHECK_EQUAL("valid", check.failure("{\"value\": 1, \"children\": [{\"value\": 2, \"children\": [{\"value\": 3}]}]}"));
+        CHECK_EQUAL("type at /children/0/children/0/value",
+            check.failure("{\"value\": 1, \"children\": [{\"value\": 2, \"children\": [{\"value\": \"3\"}]}]}"));
+        CHECK_EQUAL("required at /children/1", check.failure("{\"value\": 1, \"children\": [{\"value\": 2}, {}]}"));
+
+        schema_check root("{\"properties\": {\"next\": {\"$ref\": \"#\"}}, \"required\": [\"v\"]}");
+        CHECK_EQUAL("valid", root.failure("{\"v\": 1, \"next\": {\"v\": 2, \"next\": {\"v\": 3}}}"));
+        CHECK_EQUAL("required at /next/next", root.failure("{\"v\": 1, \"next\": {\"v\": 2, \"next\": {}}}"));
+
+        // The root $ref is reached again, one level down, before its
+        // target has finished compiling.
+        schema_check nested("{\"$ref\": \"#/definitions/a\", \"definitions\": {\"a\": {\"items\": {\"$ref\": \"#\"}}}}");
+        CHECK(nested.compiled.is_valid());
+        CHECK_EQUAL("valid", nested.failure("[[], [[]]]"));
+        CHECK_EQUAL("valid", nested.failure("[1]"));
+        CHECK_EQUAL("valid", nested.failure("{}"));
+
+        schema_check typed("{\"$ref\": \"#/definitions/a\", \"definitions\": {\"a\": {\"type\": \"array\", \"items\": {\"$ref\": \"#\"}}}}");
+        CHECK(typed.compiled.is_valid());
+        CHECK_EQUAL("valid", typed.failure("[[], [[]]]"));
+        CHECK_EQUAL("type at /1/0", typed.failure("[[], [1]]"));
+
+        // A $ref back to the root through allOf is fine below items.
+        schema_check shared(
+            "{\"type\": \"array\", \"items\": {\"$ref\": \"#/definitions/P\"},"
+            " \"definitions\": {\"P\": {\"allOf\": [{\"$ref\": \"#\"}]}}}");
+        CHECK(shared.compiled.is_valid());
+        CHECK_EQUAL("valid", shared.failure("[[], [[]]]"));
+        CHECK_EQUAL("type at /1/0", shared.failure("[[], [{}]]"));
+    }
+
+    TEST(boolean_schemas) {
+        const sajson::document& schemas = sajson::parse(literal("[true, false]"));
+        const sajson::document& instance = sajson::parse(literal("[1]"));
+        assert(schemas.is_valid() && instance.is_valid());
+        const sajson::schema accept = sajson::compile_schema(schemas.get_root().get_array_element(0));
+        CHECK(accept.is_valid());
+        CHECK(accept.validate(instance.get_root()).is_valid());
+        const sajson::schema reject_all = sajson::compile_schema(schemas.get_root().get_array_element(1));
+        CHECK_EQUAL("false", reject_all.validate(instance.get_root()).get_keyword());
+
+        schema_check reject("{\"items\": false}");
+        CHECK_EQUAL("valid", reject.failure("[]"));
+        CHECK_EQUAL("items at /0", reject.failure("[1]"));
+    }
+
+    TEST(invalid_schemas) {
+        const char* cases[][3] = {
+            {"{\"type\": \"float\"}", "unknown type", "/type"},
+            {"{\"properties\": {\"a\": {\"type\": [\"string\", 1]}}}", "unknown type", "/properties/a/type"},
+            {"{\"properties\": {\"a\": {\"pattern\": \"^x\"}}}", "unsupported keyword", "/properties/a/pattern"},
+            {"{\"items\": {\"minLength\": -1}}", "expected a non-negative integer", "/items/minLength"},
+            {"{\"multipleOf\": 0}", "expected a positive number", "/multipleOf"},
+            {"{\"anyOf\": []}", "expected a non-empty array of schemas", "/anyOf"},
+            {"{\"allOf\": [{}, 3]}", "expected a schema", "/allOf/1"},
+            {"{\"$ref\": \"#/definitions/missing\"}", "unresolved reference", "/$ref"},
+            {"{\"$ref\": \"other.json#/a\"}", "only references within the schema are supported", "/$ref"},
+            {"{\"$ref\": \"#\"}", "circular reference", "/$ref"},
+            {"{\"allOf\": [{\"$ref\": \"#\"}]}", "circular reference", "/allOf/0/$ref"},
+            // P is first compiled under items, then reached again from
+            // oneOf, where its $ref back to the root consumes nothing.
+            {"{\"items\": {\"$ref\": \"#/definitions/P\"}, \"oneOf\": [{\"$ref\": \"#/definitions/P\"}],"
+             " \"definitions\": {\"P\": {\"allOf\": [{\"$ref\": \"#\"}]}}}",
+             "circular reference", "/oneOf/0/$ref"},
+            {"{\"properties\": {\"a~b/c\": {\"required\": 1}}}", "expected an array of strings", "/properties/a~0b~1c/required"},
+        };
+        for (const auto& c : cases) {
+            const sajson::document& document = sajson::parse(literal(c[0]));
+            assert(document.is_valid());
+            const sajson::schema compiled = sajson::compile_schema(document.get_root());
+            CHECK(!compiled.is_valid());
+            CHECK_EQUAL(c[1], compiled.get_error_message());
+            CHECK_EQUAL(c[2], compiled.get_error_path());
+        }
+    }
+
+    TEST(accepts_matches_validate) {
+        schema_check check("{\"items\": {\"type\": \"object\", \"required\": [\"a\"], \"additionalProperties\": false}}");
+        const char* inputs[] = {"[]", "[{\"a\": 1}]", "[{\"a\": 1, \"b\": 2}]", "[{}]", "[1]"};
+        for (const char* input : inputs) {
+            const sajson::schema_result result = check.validate(input);
+            CHECK_EQUAL(result.is_valid(), check.compiled.accepts(check.documents.back().get_root()));
+        }
+    }
+}
+
+SUITE(snapshot) {
+    const char* snapshot_text =
+        "{\"name\": \"caf\\u00e9 \\\"quoted\\\"\", \"values\": [1, -2.5, 1e300, true, false, null],"
+        " \"nested\": {\"empty\": [], \"also\": {}}}";
+
+    std::string written(const sajson::document& document) {
+        sajson::writer w;
+        w.write(document.get_root());
+        return w.get_output().as_string();
+    }
+
+    std::vector<size_t> make_snapshot(const sajson::document& document) {
+        std::vector<size_t> buffer((sajson::get_snapshot_size(document) + sizeof(size_t) - 1) / sizeof(size_t));
+        sajson::write_snapshot(document, buffer.data());
+        return buffer;
+    }
+
+    TEST(round_trip_through_memory) {
+        const sajson::document& original = sajson::parse(literal(snapshot_text));
+        assert(success(original));
+        const std::vector<size_t> buffer = make_snapshot(original);
+
+        count_allocator alloc;
+        {
+            const sajson::document& loaded = sajson::load_snapshot(buffer.data(), sajson::get_snapshot_size(original), &alloc);
+            assert(success(loaded));
+            CHECK_EQUAL(2, alloc.allocs);
+            CHECK_EQUAL(written(original), written(loaded));
+            CHECK_EQUAL("caf\xc3\xa9 \"quoted\"", loaded.get_root().get_value_of_key(literal("name")).as_string());
+        }
+        CHECK_EQUAL(alloc.allocs, alloc.deallocs);
+    }
+
+    TEST(snapshot_of_compacted_document) {
+        sajson::document original = sajson::parse(literal("[[1, 2], \"x\"]"));
+        assert(success(original));
+        const size_t before = sajson::get_snapshot_size(original);
+        CHECK(original.compact());
+        // Only the AST is stored, so compacting changes nothing.
+        CHECK_EQUAL(before, sajson::get_snapshot_size(original));
+        const std::vector<size_t> buffer = make_snapshot(original);
+        const sajson::document& loaded = sajson::load_snapshot(buffer.data(), before);
+        assert(success(loaded));
+        CHECK_EQUAL("[[1,2],\"x\"]", written(loaded));
+    }
+
+    TEST(rejects_bad_headers) {
+        const sajson::document& original = sajson::parse(literal("[1]"));
+        assert(success(original));
+        const size_t size = sajson::get_snapshot_size(original);
+        const std::vector<size_t> good = make_snapshot(original);
+
+        const size_t corruptions[] = {
+            0,                                              // magic
+            offsetof(sajson::snapshot_header, version),
+            offsetof(sajson::snapshot_header, word_size),
+            offsetof(sajson::snapshot_header, byte_order),
+            offsetof(sajson::snapshot_header, root_type),
+            offsetof(sajson::snapshot_header, input_length),
+            offsetof(sajson::snapshot_header, ast_offset),
+            offsetof(sajson::snapshot_header, ast_length),
+            offsetof(sajson::snapshot_header, snapshot_size),
+        };
+        for (size_t offset : corruptions) {
+            std::vector<size_t> bad = good;
+            reinterpret_cast<char*>(bad.data())[offset] ^= 0x40;
+            const sajson::document& loaded = sajson::load_snapshot(bad.data(), size);
+            CHECK_EQUAL(false, loaded.is_valid());
+            CHECK_EQUAL(sajson::ERROR_INVALID_SNAPSHOT, loaded._internal_get_error_code());
+        }
+
+        const sajson::document& truncated = sajson::load_snapshot(good.data(), size - 1);
+        CHECK_EQUAL(sajson::ERROR_INVALID_SNAPSHOT, truncated._internal_get_error_code());
+        const sajson::document& tiny = sajson::load_snapshot(good.data(), 4);
+        CHECK_EQUAL(sajson::ERROR_INVALID_SNAPSHOT, tiny._internal_get_error_code());
+    }
+
+    TEST(allocation_failure_is_reported) {
+        const sajson::document& original = sajson::parse(literal("[1]"));
+        assert(success(original));
+        const std::vector<size_t> buffer = make_snapshot(original);
+        for (int i = 0; i < 2; ++i) {
+            failing_allocator alloc;
+            alloc.remaining = i;
+            {
+                const sajson::document& loaded = sajson::load_snapshot(buffer.data(), sajson::get_snapshot_size(original), &alloc);
+                CHECK_EQUAL(sajson::ERROR_OUT_OF_MEMORY, loaded._internal_get_error_code());
+            }
+            CHECK_EQUAL(alloc.allocs, alloc.deallocs);
+        }
+    }
+
+#ifdef SAJSON_HAS_MMAP
+    std::string temporary_path() {
+        return "/tmp/sajson_snapshot_test_" + std::to_string(getpid());
+    }
+
+    TEST(round_trip_through_file) {
+        const std::string path = temporary_path();
+        {
+            const sajson::document& original = sajson::parse(literal(snapshot_text));
+            assert(success(original));
+            CHECK(sajson::save_snapshot(original, path.c_str()));
+
+            sajson::document loaded = sajson::load_snapshot_file(path.c_str());
+            assert(success(loaded));
+            CHECK_EQUAL(written(original), written(loaded));
+            // The mapping is read-only and cannot be reallocated.
+            CHECK_EQUAL(false, loaded.compact());
+            CHECK_EQUAL(written(original), written(loaded));
+        }
+        unlink(path.c_str());
+    }
+
+    TEST(file_errors) {
+        const sajson::document& missing = sajson::load_snapshot_file("/nonexistent/sajson.snapshot");
+        CHECK_EQUAL(sajson::ERROR_IO, missing._internal_get_error_code());
+        CHECK_EQUAL(ENOENT, missing._internal_get_error_argument());
+        CHECK_EQUAL(std::string("I/O error: ") + strerror(ENOENT), missing.get_error_message_as_string());
+
+        CHECK_EQUAL(false, sajson::save_snapshot(sajson::parse(literal("[]")), "/nonexistent/sajson.snapshot"));
+
+        // A file that has been cut short.
+        const std::string path = temporary_path();
+        const sajson::document& original = sajson::parse(literal("[1, 2, 3]"));
+        assert(success(original));
+        const std::vector<size_t> buffer = make_snapshot(original);
+        FILE* file = fopen(path.c_str(), "wb");
+        assert(file);
+        fwrite(buffer.data(), 1, sajson::get_snapshot_size(original) - sizeof(size_t), file);
+        fclose(file);
+        const sajson::document& truncated = sajson::load_snapshot_file(path.c_str());
+        CHECK_EQUAL(sajson::ERROR_INVALID_SNAPSHOT, truncated._internal_get_error_code());
+        unlink(path.c_str());
+    }
+#endif
+}
+
+#ifdef SAJSON_HAS_MMAP
+SUITE(shared) {
+    std::string shared_name() {
+        return "/sajson_test_" + std::to_string(getpid());
+    }
+
+    TEST(publish_and_attach) {
+        const std::string name = shared_name();
+        const sajson::document& original = sajson::parse(literal("{\"hot\": [1, 2.5, \"three\"], \"ok\": true}"));
+        assert(success(original));
+        CHECK(sajson::publish_shared_document(original, name.c_str()));
+        // Names are not overwritten.
+        CHECK_EQUAL(false, sajson::publish_shared_document(original, name.c_str()));
+        CHECK_EQUAL(EEXIST, errno);
+
+        {
+            const sajson::document& a = sajson::attach_shared_document(name.c_str());
+            const sajson::document& b = sajson::attach_shared_document(name.c_str());
+            assert(success(a));
+            assert(success(b));
+            CHECK_EQUAL("three", a.get_root().get_value_of_key(literal("hot")).get_array_element(2).as_string());
+            CHECK_EQUAL(TYPE_TRUE, b.get_root().get_value_of_key(literal("ok")).get_type());
+
+            CHECK(sajson::unpublish_shared_document(name.c_str()));
+            // Attached documents outlive the name.
+            CHECK_EQUAL(2.5, a.get_root().get_value_of_key(literal("hot")).get_array_element(1).get_double_value());
+        }
+
+        const sajson::document& gone = sajson::attach_shared_document(name.c_str());
+        CHECK_EQUAL(sajson::ERROR_IO, gone._internal_get_error_code());
+        CHECK_EQUAL(ENOENT, gone._internal_get_error_argument());
+        CHECK_EQUAL(false, sajson::unpublish_shared_document(name.c_str()));
+    }
+
+    TEST(attach_from_another_process) {
+        const std::string name = shared_name();
+        const sajson::document& original = sajson::parse(literal("[\"from the parent\", 42]"));
+        assert(success(original));
+        CHECK(sajson::publish_shared_document(original, name.c_str()));
+
+        const pid_t child = fork();
+        if (child == 0) {
+            const sajson::document& attached = sajson::attach_shared_document(name.c_str());
+            const bool ok = attached.is_valid()
+                && attached.get_root().get_array_element(0).as_string() == "from the parent"
+                && attached.get_root().get_array_element(1).get_integer_value() == 42;
+            _exit(ok ? 0 : 1);
+        }
+        int status = -1;
+        CHECK_EQUAL(child, waitpid(child, &status, 0));
+        CHECK(WIFEXITED(status));
+        CHECK_EQUAL(0, WEXITSTATUS(status));
+        sajson::unpublish_shared_document(name.c_str());
+    }
+
+    TEST(partially_written_objects_are_rejected) {
+        const std::string name = shared_name();
+        const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        assert(fd >= 0);
+        // Created but not yet sized.
+        const sajson::document& empty = sajson::attach_shared_document(name.c_str());
+        CHECK_EQUAL(sajson::ERROR_INVALID_SNAPSHOT, empty._internal_get_error_code());
+        // Sized but the magic number is not yet written.
+        CHECK_EQUAL(0, ftruncate(fd, 4096));
+        const sajson::document& zeroed = sajson::attach_shared_document(name.c_str());
+        CHECK_EQUAL(sajson::ERROR_INVALID_SNAPSHOT, zeroed._internal_get_error_code());
+
+        const sajson::document& original = sajson::parse(literal("[[]]"));
+        assert(success(original));
+        CHECK(sajson::write_snapshot_fd(original, fd));
+        close(fd);
+        const sajson::document& attached = sajson::attach_shared_document(name.c_str());
+        assert(success(attached));
+        CHECK_EQUAL(TYPE_ARRAY, attached.get_root().get_array_element(0).get_type());
+        sajson::unpublish_shared_document(name.c_str());
+    }
+}
+#endif
 
 int main() {
     return UnitTest::RunAllTests();
@@ -0,0 +1,58 @@
+// Prints the table of cached powers of ten used by the Grisu2 double
+// formatter in sajson_writer.h: 10^k for k = -348, -340, ..., 340, each
+// as a 64-bit significand f and binary exponent e with f * 2^e rounded
+// to the nearest representable value and the top bit of f set.
+
+function bitLength(n) {
+    return n.toString(2).length;
+}
+
+// Returns [f, e] with num / den ~= f * 2^e and 2^63 <= f < 2^64.
+function normalize(num, den) {
+    var e = bitLength(num) - bitLength(den) - 64;
+    for (;;) {
+        var n = e < 0 ? num << BigInt(-e) : num;
+        var d = e > 0 ? den << BigInt(e) : den;
+        var f = n / d;
+        if (f >= (1n << 64n)) {
+            ++e;
+        } else if (f < (1n << 63n)) {
+            --e;
+        } else {
+            if (2n * (n % d) >= d) {
+                ++f;
+            }
+            if (f === (1n << 64n)) {
+                f >>= 1n;
+                ++e;
+            }
+            return [f, e];
+        }
+    }
+}
+
+var significands = [];
+var exponents = [];
+for (var k = -348; k <= 340; k += 8) {
+    var ten = 10n ** BigInt(Math.abs(k));
+    var r = k < 0 ? normalize(1n, ten) : normalize(ten, 1n);
+    significands.push("0x" + r[0].toString(16).padStart(16, "0"));
+    exponents.push(String(r[1]));
+}
+
+function printList(items, perLine) {
+    for (var i = 0; i < items.length; i += perLine) {
+        var line = items.slice(i, i + perLine).join(", ");
+        if (i + perLine < items.length) {
+            line += ",";
+        }
+        process.stdout.write("                " + line + "\n");
+    }
+}
+
+process.stdout.write("            static const uint64_t significands[] = {\n");
+printList(significands, 3);
+process.stdout.write("            };\n");
+process.stdout.write("            static const int16_t exponents[] = {\n");
+printList(exponents, 10);
+process.stdout.write("            };\n");